@@ -456,6 +456,16 @@ using System.Runtime.InteropServices;
 %ignore Monitor;
 %ignore MemoryBuffer;
 %ignore ScopeLock;
+%ignore NonRecursiveScopeLock;
+%ignore ScopeReadLock;
+%ignore ScopeWriteLock;
+%ignore ProfiledMutex;
+%ignore RecursiveMutex;
+%ignore NonRecursiveMutex;
+%ignore RWMutex;
+%ignore LockProfiler;
+%ignore LockStats;
+%ignore LockSite;
 
 //******************************
 // Make some C++ classes package local
@@ -129,6 +129,16 @@ using namespace umundo;
 %ignore Monitor;
 %ignore MemoryBuffer;
 %ignore ScopeLock;
+%ignore NonRecursiveScopeLock;
+%ignore ScopeReadLock;
+%ignore ScopeWriteLock;
+%ignore ProfiledMutex;
+%ignore RecursiveMutex;
+%ignore NonRecursiveMutex;
+%ignore RWMutex;
+%ignore LockProfiler;
+%ignore LockStats;
+%ignore LockSite;
 
 //******************************
 // Ignore PIMPL Constructors
@@ -312,14 +312,14 @@ void Debug::stackTraceSigHandler(int sig) {
 
 #endif
 
-Mutex Traceable::_mutex;
+NonRecursiveMutex Traceable::_mutex("trace");
 std::map<std::string, boost::weak_ptr<std::ofstream> > Traceable::_files;
 
 Traceable::Traceable() {
 }
 
 Traceable::~Traceable() {
-	ScopeLock lock(_mutex);
+	NonRecursiveScopeLock lock(_mutex);
 	if (_traceFile) {
 		_traceFile->flush();
 	}
@@ -327,7 +327,7 @@ Traceable::~Traceable() {
 
 bool Traceable::setTraceFile(const std::string& filename) {
 	_traceFileName = filename;
-	ScopeLock lock(_mutex);
+	NonRecursiveScopeLock lock(_mutex);
 	if (_files.find(_traceFileName) == _files.end() || _files[_traceFileName].lock() == NULL) {
 		_traceFile = boost::shared_ptr<std::ofstream>(new std::ofstream(_traceFileName.c_str()));
 		if (!_traceFile)
@@ -341,7 +341,7 @@ bool Traceable::setTraceFile(const std::string& filename) {
 
 void Traceable::trace(const std::string& traceMsg, std::map<std::string, std::string> info) {
 	if (_traceFile) {
-		ScopeLock lock(_mutex);
+		NonRecursiveScopeLock lock(_mutex);
 
 		info["threadId"] = toStr(Thread::getThreadId());
 		info["this"] = toStr(this);
@@ -408,7 +408,7 @@ void Traceable::replay(const std::string& filename) {
 		}
 
 		// wait until we are in sync with the trace event
-		now = Thread::getTimeStampMs();
+		now = Thread::getMonotonicMs();
 		if (fileOffset == 0)
 			fileOffset = now - linetime;
 
@@ -100,7 +100,7 @@ protected:
 	std::string _traceFileName;
 	boost::shared_ptr<std::ofstream> _traceFile;
 
-	static Mutex _mutex;
+	static NonRecursiveMutex _mutex; ///< only guards the trace files, never held while calling out
 	static std::map<std::string, boost::weak_ptr<std::ofstream> > _files;
 };
 
@@ -91,6 +91,13 @@ public:
 	virtual void updateLastSeen() {
 		_lastSeen = Thread::getTimeStampMs();
 	}
+	/// Summary of the endpoint's publishers from discovery, empty if unknown
+	virtual const std::string getPubSummary() const {
+		return _pubSummary;
+	}
+	virtual void setPubSummary(const std::string& pubSummary) {
+		_pubSummary = pubSummary;
+	}
 
 	uint16_t implType; // this ought to be in the Implementation class. but class hierarchy won't fit
 
@@ -102,7 +109,8 @@ protected:
 	bool _isInProcess;
 	std::string _host;
 	std::string _domain;
-	long _lastSeen;
+	long _lastSeen; ///< wall clock in ms, discovery and the peer cache share it across processes
+	std::string _pubSummary;
 
 };
 
@@ -199,6 +207,9 @@ public:
 	virtual void updateLastSeen() {
 		return _impl->updateLastSeen();
 	}
+	virtual const std::string getPubSummary() const {
+		return _impl->getPubSummary();
+	}
 
 	boost::shared_ptr<EndPointImpl> getImpl() const {
 		return _impl;
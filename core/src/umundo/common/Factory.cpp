@@ -38,6 +38,12 @@
 #include "umundo/discovery/BroadcastDiscovery.h"
 #endif
 
+#ifdef DISC_GOSSIP
+#include "umundo/discovery/GossipDiscovery.h"
+#endif
+
+#include "umundo/discovery/StaticDiscovery.h"
+
 #if (defined DISC_AVAHI || defined DISC_BONJOUR)
 #include "umundo/discovery/MDNSDiscovery.h"
 #endif
@@ -81,7 +87,7 @@ Factory* Factory::getInstance() {
 	return Factory::_instance;
 }
 
-Factory::Factory() {
+Factory::Factory() : _mutex("factory") {
 	_prototypes["pub.zmq"] = new ZeroMQPublisher();
 	_prototypes["sub.zmq"] = new ZeroMQSubscriber();
 	_prototypes["node.zmq"] = new ZeroMQNode();
@@ -97,6 +103,10 @@ Factory::Factory() {
 #ifdef DISC_BROADCAST
 	_prototypes["discovery.broadcast"] = new BroadcastDiscovery();
 #endif
+#ifdef DISC_GOSSIP
+	_prototypes["discovery.gossip"] = new GossipDiscovery();
+#endif
+	_prototypes["discovery.static"] = new StaticDiscovery();
 #ifdef NET_RTP
 	_prototypes["pub.rtp"] = new RTPPublisher();
 	_prototypes["sub.rtp"] = new RTPSubscriber();
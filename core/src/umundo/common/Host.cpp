@@ -271,4 +271,22 @@ const std::string Host::getHostId() {
 	return hostId;
 }
 
+bool Host::isLocalAddress(const std::string& ip) {
+	if (ip.compare(0, 4, "127.") == 0 || ip == "::1" || ip == "localhost")
+		return true;
+
+	std::vector<Interface> interfaces = getInterfaces();
+	for (size_t i = 0; i < interfaces.size(); i++) {
+		for (size_t j = 0; j < interfaces[i].ipv4.size(); j++) {
+			if (interfaces[i].ipv4[j] == ip)
+				return true;
+		}
+		for (size_t j = 0; j < interfaces[i].ipv6.size(); j++) {
+			if (interfaces[i].ipv6[j] == ip)
+				return true;
+		}
+	}
+	return false;
+}
+
 }
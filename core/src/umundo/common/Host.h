@@ -45,6 +45,7 @@ public:
 	static const std::string getHostname();  ///< hostname
 	static const std::vector<Interface> getInterfaces();  ///< get a list of all the hosts network interfaces
 	static const std::string getHostId();    ///< 36 byte string unique to the host
+	static bool isLocalAddress(const std::string& ip); ///< whether the address belongs to this host
 };
 
 }
@@ -34,7 +34,7 @@ class Type;
 class DLLEXPORT Message {
 public:
 	enum Type {
-		VERSION       = 0xF004, // version 0.4 of the message format
+		VERSION       = 0xF009, // version 0.9 of the message format
 		CONNECT_REQ   = 0x0001, // sent to a remote node when it was added
 		CONNECT_REP   = 0x0002, // reply from a remote node
 		NODE_INFO     = 0x0003, // information about a node and its publishers
@@ -46,6 +46,8 @@ public:
 		UNSUBSCRIBE   = 0x0007, // unsusbscribing from a publisher
 		DISCONNECT    = 0x0008, // node was removed
 		DEBUG         = 0x0009, // request debug info
+		PUB_SYNC      = 0x000A, // ask for publisher table changes since a version
+		HEARTBEAT     = 0x000B, // sign of life when there was no other traffic
 		SHUTDOWN      = 0x000C, // node is shutting down
 	};
 
@@ -68,6 +70,8 @@ public:
 		if (type == UNSUBSCRIBE) return "UNSUBSCRIBE";
 		if (type == DISCONNECT)  return "DISCONNECT";
 		if (type == DEBUG)       return "DEBUG";
+		if (type == PUB_SYNC)    return "PUB_SYNC";
+		if (type == HEARTBEAT)   return "HEARTBEAT";
 		if (type == SHUTDOWN)    return "SHUTDOWN";
 		return "UNKNOWN";
 	}
@@ -0,0 +1,114 @@
+/**
+ *  @file
+ *  @brief      Hashed timer wheel for many coarse timeouts.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef TIMERWHEEL_H_M3Q7XKRE
+#define TIMERWHEEL_H_M3Q7XKRE
+
+#include "umundo/common/Common.h"
+
+#include <list>
+#include <vector>
+
+namespace umundo {
+
+/**
+ * Timeouts hashed into slots of a fixed duration, scheduling is O(1).
+ *
+ * There is no way to cancel a timer, owners are expected to check whether an
+ * expired item is still of interest and reschedule it when its deadline moved.
+ */
+template<class T>
+class TimerWheel {
+public:
+	TimerWheel() : _resolution(1000), _current(0), _size(0) {
+		_slots.resize(64);
+	}
+
+	TimerWheel(uint32_t resolutionMs, size_t nrSlots, uint64_t now) : _resolution(resolutionMs), _size(0) {
+		if (_resolution == 0)
+			_resolution = 1;
+		_current = now / _resolution;
+		_slots.resize(nrSlots > 0 ? nrSlots : 1);
+	}
+
+	/// Have item expire at the given timestamp in ms
+	void schedule(uint64_t at, const T& item) {
+		uint64_t tick = at / _resolution;
+		if (tick <= _current)
+			tick = _current + 1;
+
+		Timer timer;
+		timer.at = at;
+		timer.item = item;
+		_slots[tick % _slots.size()].push_back(timer);
+		_size++;
+	}
+
+	/// Move the wheel to now and append all expired items
+	void advance(uint64_t now, std::list<T>& expired) {
+		uint64_t tick = now / _resolution;
+		if (tick <= _current)
+			return;
+
+		// after a long pause every slot is visited once
+		uint64_t ticks = tick - _current;
+		if (ticks > _slots.size())
+			ticks = _slots.size();
+
+		for (uint64_t i = 1; i <= ticks; i++) {
+			std::list<Timer>& slot = _slots[(_current + i) % _slots.size()];
+			typename std::list<Timer>::iterator timerIter = slot.begin();
+			while(timerIter != slot.end()) {
+				if (timerIter->at <= now) {
+					expired.push_back(timerIter->item);
+					slot.erase(timerIter++);
+					_size--;
+				} else {
+					// due in a later round
+					timerIter++;
+				}
+			}
+		}
+		_current = tick;
+	}
+
+	uint32_t getResolution() {
+		return _resolution;
+	}
+
+	size_t size() {
+		return _size;
+	}
+
+protected:
+	struct Timer {
+		uint64_t at;
+		T item;
+	};
+
+	uint32_t _resolution; ///< duration of a slot in ms
+	uint64_t _current; ///< last tick we advanced to
+	size_t _size;
+	std::vector<std::list<Timer> > _slots;
+};
+
+}
+
+#endif /* end of include guard: TIMERWHEEL_H_M3Q7XKRE */
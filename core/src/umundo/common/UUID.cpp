@@ -23,6 +23,8 @@
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/lexical_cast.hpp>
+#include <stdlib.h> // strtol
+#include <ctype.h> // isxdigit
 
 namespace umundo {
 
@@ -67,4 +69,30 @@ bool UUID::isUUID(const std::string& uuid) {
 	return true;
 }
 
+bool UUID::toBytes(const std::string& uuid, char* bytes) {
+	size_t nrBytes = 0;
+	for (size_t i = 0; i + 1 < uuid.length() && nrBytes < 16; i++) {
+		if (uuid[i] == '-')
+			continue;
+		char hex[3] = { uuid[i], uuid[i + 1], 0 };
+		if (!isxdigit(hex[0]) || !isxdigit(hex[1]))
+			return false;
+		bytes[nrBytes++] = (char)strtol(hex, NULL, 16);
+		i++;
+	}
+	return nrBytes == 16;
+}
+
+const std::string UUID::fromBytes(const char* bytes) {
+	static const char* hexDigits = "0123456789abcdef";
+	std::string uuid;
+	for (int i = 0; i < 16; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			uuid += '-';
+		uuid += hexDigits[(bytes[i] >> 4) & 0x0f];
+		uuid += hexDigits[bytes[i] & 0x0f];
+	}
+	return uuid;
+}
+
 }
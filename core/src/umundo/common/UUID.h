@@ -33,6 +33,8 @@ class DLLEXPORT UUID {
 public:
 	static const std::string getUUID();
 	static bool isUUID(const std::string& uuid);
+	static bool toBytes(const std::string& uuid, char* bytes); ///< write the 16 raw bytes of a uuid
+	static const std::string fromBytes(const char* bytes); ///< read a uuid from 16 raw bytes
 
 private:
 	UUID() {}
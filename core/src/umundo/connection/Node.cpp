@@ -24,12 +24,13 @@
 #include "umundo/discovery/Discovery.h"
 #include "umundo/connection/Subscriber.h"
 #include "umundo/connection/Publisher.h"
+#include "umundo/connection/PubSummary.h"
 
 namespace umundo {
 
 int NodeImpl::instances = -1;
 
-NodeImpl::NodeImpl() {
+NodeImpl::NodeImpl() : _advertisersMutex("node.advertisers") {
 	_uuid = UUID::getUUID();
 	instances++;
 }
@@ -38,6 +39,32 @@ NodeImpl::~NodeImpl() {
 	instances--;
 }
 
+const std::string NodeImpl::getPubSummary() const {
+	PubSummary summary;
+	for (std::map<std::string, Publisher>::const_iterator pubIter = _pubs.begin(); pubIter != _pubs.end(); pubIter++) {
+		summary.addChannel(pubIter->second.getChannelName());
+	}
+	return summary.getBytes();
+}
+
+void NodeImpl::addAdvertiser(DiscoveryImpl* discovery) {
+	ScopeWriteLock lock(_advertisersMutex);
+	_advertisers.insert(discovery);
+}
+
+void NodeImpl::removeAdvertiser(DiscoveryImpl* discovery) {
+	ScopeWriteLock lock(_advertisersMutex);
+	_advertisers.erase(discovery);
+}
+
+void NodeImpl::publishersChanged() {
+	// announcing changes only reads the advertisers, they need not wait for each other
+	ScopeReadLock lock(_advertisersMutex);
+	for (std::set<DiscoveryImpl*>::iterator discIter = _advertisers.begin(); discIter != _advertisers.end(); discIter++) {
+		(*discIter)->publishersChanged(this);
+	}
+}
+
 Node::Node() {
 	_impl = boost::static_pointer_cast<NodeImpl>(Factory::create("node.zmq"));
 	NodeStubBase::_impl = _impl;
@@ -54,6 +81,13 @@ Node::Node(uint16_t nodePort, uint16_t pubPort) {
 	_impl->init(&options);
 }
 
+Node::Node(NodeOptions& options) {
+	_impl = boost::static_pointer_cast<NodeImpl>(Factory::create("node.zmq"));
+	NodeStubBase::_impl = _impl;
+	EndPoint::_impl = _impl;
+	_impl->init(&options);
+}
+
 Node::~Node() {
 }
 
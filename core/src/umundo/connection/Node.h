@@ -32,11 +32,14 @@
 #include <boost/enable_shared_from_this.hpp>
 
 #define SHORT_UUID(uuid) uuid.substr(0, 8)
+#define UMUNDO_NODE_COALESCE_DELAY_US 200 ///< default time a batch of small publications waits for more
 
 namespace umundo {
 
 class Connectable;
 class Discovery;
+class DiscoveryImpl;
+class NodeOptions;
 
 /**
  * The local umundo node implementor basis class (bridge pattern).
@@ -76,11 +79,23 @@ public:
 		return nullPub;
 	}
 
+	/// Summary of our publishers' channels for discovery records, see PubSummary
+	virtual const std::string getPubSummary() const;
+
+	/** @name Discovery implementors advertising us */
+	//@{
+	void addAdvertiser(DiscoveryImpl* discovery);
+	void removeAdvertiser(DiscoveryImpl* discovery);
+	void publishersChanged(); ///< Let the advertisers know that our summary changed
+	//@}
 
 protected:
 	std::map<std::string, Publisher> _pubs;
 	std::map<std::string, Subscriber> _subs;
 
+	std::set<DiscoveryImpl*> _advertisers;
+	RWMutex _advertisersMutex;
+
 private:
 	Publisher nullPub;
 	Subscriber nullSub;
@@ -94,6 +109,7 @@ public:
 
 	Node();
 	Node(uint16_t nodePort, uint16_t pubPort);
+	Node(NodeOptions& options);
 	Node(boost::shared_ptr<NodeImpl> const impl) : NodeStubBase(impl), _impl(impl) { }
 	Node(const Node& other) : NodeStubBase(other._impl), _impl(other._impl) { }
 	virtual ~Node();
@@ -128,10 +144,12 @@ public:
 		return _impl->removeSubscriber(sub);
 	}
 	void addPublisher(Publisher pub) {
-		return _impl->addPublisher(pub);
+		_impl->addPublisher(pub);
+		_impl->publishersChanged();
 	}
 	void removePublisher(Publisher pub) {
-		return _impl->removePublisher(pub);
+		_impl->removePublisher(pub);
+		_impl->publishersChanged();
 	}
 
 	std::map<std::string, NodeStub> connectedTo() {
@@ -184,7 +202,7 @@ public:
 		return _impl->removed(endPoint);
 	}
 	virtual void changed(EndPoint endPoint) {
-		return _impl->removed(endPoint);
+		return _impl->changed(endPoint);
 	}
 
 	//@}
@@ -233,6 +251,8 @@ public:
 	}
 
 	NodeOptions() {
+		setNodePort(0);
+		setPubPort(0);
 		options["node.allowLocal"] = toStr(false);
 	}
 
@@ -251,6 +271,101 @@ public:
 	void allowLocalConnections(bool allow) {
 		options["node.allowLocal"] = toStr(allow);
 	}
+
+	/**
+	 * Whether nodes on this host may subscribe via a unix domain socket, enabled by default.
+	 */
+	void allowIPC(bool allow) {
+		options["node.ipc"] = toStr(allow);
+	}
+
+	/**
+	 * Time in ms without any sign of life before we consider a remote node gone.
+	 */
+	void setFailoverTime(uint32_t ms) {
+		options["node.failoverMs"] = toStr(ms);
+	}
+
+	/**
+	 * Number of connection handshakes we have in flight at most, others wait in a queue.
+	 *
+	 * Handshakes without a reply are retried with a jittered, exponentially growing timeout.
+	 */
+	void setMaxPendingConnections(uint32_t nrConnections) {
+		options["node.connect.maxPending"] = toStr(nrConnections);
+	}
+
+	/**
+	 * Remember the nodes we were connected to in the given file.
+	 *
+	 * When the node is started again, it connects to them right away alongside discovery
+	 * and forgets those that did not answer within the failover time.
+	 */
+	void setPeerCache(const std::string& filename) {
+		options["node.peerCache"] = filename;
+	}
+
+	/**
+	 * Size in bytes of the shared memory ring for subscribers on this host, 0 disables it.
+	 *
+	 * A ring has to hold at least the largest message, subscribers that fall behind by more
+	 * than the ring's size lose messages.
+	 */
+	void setSharedMemorySize(size_t bytes) {
+		options["node.shm.size"] = toStr(bytes);
+	}
+
+	/**
+	 * Pack small publications per channel into batches of up to the given size in bytes, 0 disables it.
+	 *
+	 * A batch is sent once it is full or its first publication waited for delayUs. Our poll
+	 * loop sleeps in whole ms, so on an otherwise idle node any delay below 1ms is effectively
+	 * 1ms and others are rounded up to the next ms.
+	 */
+	void setCoalescing(size_t bytes, uint32_t delayUs = UMUNDO_NODE_COALESCE_DELAY_US) {
+		options["node.coalesce.size"] = toStr(bytes);
+		options["node.coalesce.delayUs"] = toStr(delayUs);
+	}
+
+	/**
+	 * Number of 0MQ I/O threads for the process-wide context.
+	 *
+	 * Only effective for the first node initialized before any publisher or
+	 * subscriber created a socket, later nodes will log a warning when they differ.
+	 */
+	void setIOThreads(int nrThreads) {
+		options["node.zmq.ioThreads"] = toStr(nrThreads);
+	}
+
+	/**
+	 * Maximum number of sockets in the process-wide context, 0MQ defaults to 1024.
+	 *
+	 * Every node uses a socket per connected node and per publisher and subscriber,
+	 * same restrictions as with setIOThreads.
+	 */
+	void setMaxSockets(int nrSockets) {
+		options["node.zmq.maxSockets"] = toStr(nrSockets);
+	}
+
+	/**
+	 * Bitmask of I/O threads that handle this node's network sockets.
+	 *
+	 * Give nodes with heavy publishers an I/O thread of their own.
+	 */
+	void setIOThreadAffinity(uint64_t mask) {
+		options["node.zmq.affinity"] = toStr(mask);
+	}
+
+	/**
+	 * Pin the context's I/O threads to the given CPU, call repeatedly for more CPUs.
+	 *
+	 * Same restrictions as with setIOThreads and requires libzmq 4.3.
+	 */
+	void pinIOThreadsToCPU(int cpu) {
+		if (options["node.zmq.cpus"].length() > 0)
+			options["node.zmq.cpus"] += ",";
+		options["node.zmq.cpus"] += toStr(cpu);
+	}
 };
 
 
@@ -0,0 +1,93 @@
+/**
+ *  @file
+ *  @brief      Compact summary of a node's publishers for discovery records.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/connection/PubSummary.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+#define SUMMARY_BITS (UMUNDO_PUB_SUMMARY_BYTES * 8)
+
+namespace umundo {
+
+PubSummary::PubSummary() : _bits(UMUNDO_PUB_SUMMARY_BYTES, (char)0) {
+}
+
+PubSummary::PubSummary(const std::string& bytes) : _bits(bytes) {
+}
+
+/**
+ * Derive the positions from one FNV-1a hash by double hashing.
+ */
+void PubSummary::setBits(uint32_t hash) {
+	uint32_t second = (hash >> 16) | (hash << 16) | 1;
+	for (int i = 0; i < UMUNDO_PUB_SUMMARY_HASHES; i++) {
+		uint32_t pos = (hash + i * second) % SUMMARY_BITS;
+		_bits[pos / 8] |= (char)(1 << (pos % 8));
+	}
+}
+
+bool PubSummary::hasBits(uint32_t hash) const {
+	uint32_t second = (hash >> 16) | (hash << 16) | 1;
+	for (int i = 0; i < UMUNDO_PUB_SUMMARY_HASHES; i++) {
+		uint32_t pos = (hash + i * second) % SUMMARY_BITS;
+		if (!(_bits[pos / 8] & (1 << (pos % 8))))
+			return false;
+	}
+	return true;
+}
+
+void PubSummary::addChannel(const std::string& channelName) {
+	if (_bits.size() != UMUNDO_PUB_SUMMARY_BYTES)
+		return;
+
+	// the hash of every prefix falls out on the way
+	uint32_t hash = FNV_OFFSET;
+	setBits(hash);
+	for (size_t i = 0; i < channelName.length(); i++) {
+		hash = (hash ^ (uint8_t)channelName[i]) * FNV_PRIME;
+		setBits(hash);
+	}
+}
+
+bool PubSummary::mayMatch(const std::string& subChannelName) const {
+	if (_bits.size() != UMUNDO_PUB_SUMMARY_BYTES)
+		return true;
+
+	uint32_t hash = FNV_OFFSET;
+	for (size_t i = 0; i < subChannelName.length(); i++) {
+		hash = (hash ^ (uint8_t)subChannelName[i]) * FNV_PRIME;
+	}
+	return hasBits(hash);
+}
+
+bool PubSummary::covers(const PubSummary& other) const {
+	if (_bits.size() != UMUNDO_PUB_SUMMARY_BYTES)
+		return true;
+	if (other._bits.size() != UMUNDO_PUB_SUMMARY_BYTES)
+		return false;
+
+	for (size_t i = 0; i < UMUNDO_PUB_SUMMARY_BYTES; i++) {
+		if ((_bits[i] & other._bits[i]) != other._bits[i])
+			return false;
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,62 @@
+/**
+ *  @file
+ *  @brief      Compact summary of a node's publishers for discovery records.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef PUBSUMMARY_H_7RM2KQ4D
+#define PUBSUMMARY_H_7RM2KQ4D
+
+#include "umundo/common/Common.h"
+
+/// size of the bloom filter, small enough for a TXT record entry
+#define UMUNDO_PUB_SUMMARY_BYTES 128
+#define UMUNDO_PUB_SUMMARY_HASHES 3
+
+namespace umundo {
+
+/**
+ * Bloom filter over the channel names of a node's publishers.
+ *
+ * Subscribers match every channel their name is a prefix of, so all prefixes of a channel
+ * name are added. A subscriber that does not match the summary will not receive anything
+ * from the node, one that matches may or may not. Summaries we cannot make sense of match
+ * everything.
+ */
+class DLLEXPORT PubSummary {
+public:
+	PubSummary();
+	PubSummary(const std::string& bytes);
+
+	void addChannel(const std::string& channelName);
+	bool mayMatch(const std::string& subChannelName) const;
+	bool covers(const PubSummary& other) const; ///< whether every channel in other matches us as well
+
+	const std::string& getBytes() const {
+		return _bits;
+	}
+
+protected:
+	void setBits(uint32_t hash);
+	bool hasBits(uint32_t hash) const;
+
+	std::string _bits;
+};
+
+}
+
+#endif /* end of include guard: PUBSUMMARY_H_7RM2KQ4D */
@@ -61,6 +61,10 @@ void Publisher::init(PublisherType type, const std::string& channelName, Greeter
 		_impl = boost::static_pointer_cast<PublisherImpl>(Factory::create("pub.rtp"));
 		_impl->implType = RTP;
 		break;
+	case RTP_MULTICAST:
+		_impl = boost::static_pointer_cast<PublisherImpl>(Factory::create("pub.rtp"));
+		_impl->implType = RTP_MULTICAST;
+		break;
 
 	default:
 		break;
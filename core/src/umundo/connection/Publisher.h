@@ -85,6 +85,9 @@ public:
 	bool isPublishingTo(const std::string& subUUID) {
 		return _subs.find(subUUID) != _subs.end();
 	}
+	virtual size_t getSuppressedMessages() { ///< messages not sent for lack of subscribers
+		return 0;
+	}
 
 	//@}
 
@@ -95,6 +98,7 @@ protected:
 	//@{
 	virtual void added(const SubscriberStub& sub, const NodeStub& node) = 0;
 	virtual void removed(const SubscriberStub& sub, const NodeStub& node) = 0;
+	virtual void setInterest(const std::string& nodeUUID, bool hasInterest) {} ///< whether the node saw a matching subscription
 	//@}
 
 	std::map<std::string, std::string> _mandatoryMeta;
@@ -114,8 +118,10 @@ class DLLEXPORT Publisher : public PublisherStub {
 public:
 	enum PublisherType {
 	    // these have to fit the subscriber types!
-	    ZEROMQ = 0x0001,
-	    RTP    = 0x0002
+	    ZEROMQ    = 0x0001,
+	    RTP       = 0x0002,
+	    MULTICAST = 0x0004, ///< flag, data goes to a multicast group instead of every subscriber
+	    RTP_MULTICAST = RTP | MULTICAST
 	};
 
 	Publisher() : _impl() {}
@@ -172,6 +178,10 @@ public:
 		return _impl->getSubscribers();
 	}
 
+	size_t getSuppressedMessages() {
+		return _impl->getSuppressedMessages();
+	}
+
 	void suspend() {
 		return _impl->suspend();
 	}
@@ -185,6 +195,9 @@ public:
 	void removed(const SubscriberStub& sub, const NodeStub& node) {
 		_impl->removed(sub, node);
 	}
+	void setInterest(const std::string& nodeUUID, bool hasInterest) {
+		_impl->setInterest(nodeUUID, hasInterest);
+	}
 
 protected:
 	void init(PublisherType type, const std::string& channelName, Greeter* greeter);
@@ -49,9 +49,18 @@ public:
 		_uuid = uuid;
 	}
 
+	/// ipc endpoint of the node's publisher socket, empty if it has none
+	virtual std::string getIPCEndpoint() const            {
+		return _ipcEndpoint;
+	}
+	virtual void setIPCEndpoint(const std::string& ipcEndpoint) {
+		_ipcEndpoint = ipcEndpoint;
+	}
+
 protected:
 	std::string _channelName;
 	std::string _uuid;
+	std::string _ipcEndpoint;
 };
 
 /**
@@ -94,6 +103,9 @@ public:
 	virtual const std::string getUUID() const             {
 		return _impl->getUUID();
 	}
+	virtual const std::string getIPCEndpoint() const      {
+		return _impl->getIPCEndpoint();
+	}
 	//@}
 
 protected:
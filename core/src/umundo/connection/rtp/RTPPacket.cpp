@@ -0,0 +1,248 @@
+/**
+ *  @file
+ *  @author     2013 Thilo Molitor (thilo@eightysoft.de)
+ *  @author     2013 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/connection/rtp/RTPPacket.h"
+#include "umundo/common/Message.h"
+
+#ifdef WIN32
+#include <Winsock2.h>
+#else
+#include <arpa/inet.h> // htonl
+#endif
+
+#include <string.h> // memcpy, strnlen
+
+#define RTP_VERSION 2
+#define RTCP_FMT_NACK 1
+
+namespace umundo {
+
+bool RTPPacket::read(const char* buffer, size_t size) {
+	if (size < UMUNDO_RTP_HEADER_SIZE)
+		return false;
+
+	// no padding, extension or contributing sources
+	if ((uint8_t)buffer[0] != (RTP_VERSION << 6))
+		return false;
+
+	marker = ((uint8_t)buffer[1] & 0x80) != 0;
+	payloadType = (uint8_t)buffer[1] & 0x7F;
+
+	memcpy(&seq, buffer + 2, 2);
+	memcpy(&timestamp, buffer + 4, 4);
+	memcpy(&ssrc, buffer + 8, 4);
+	seq = ntohs(seq);
+	timestamp = ntohl(timestamp);
+	ssrc = ntohl(ssrc);
+
+	if (payloadType == UMUNDO_RTP_PARITY_PAYLOAD_TYPE) {
+		if (size < UMUNDO_RTP_PARITY_HEADER_SIZE)
+			return false;
+		memcpy(&baseSeq, buffer + 12, 2);
+		nrProtected = (uint8_t)buffer[14];
+		memcpy(&lengthRecovery, buffer + 16, 2);
+		baseSeq = ntohs(baseSeq);
+		lengthRecovery = ntohs(lengthRecovery);
+
+		if (nrProtected == 0)
+			return false;
+
+		payload = buffer + UMUNDO_RTP_PARITY_HEADER_SIZE;
+		payloadSize = size - UMUNDO_RTP_PARITY_HEADER_SIZE;
+		return true;
+	}
+
+	if (payloadType != UMUNDO_RTP_PAYLOAD_TYPE)
+		return false;
+
+	memcpy(&fragment, buffer + 12, 2);
+	memcpy(&nrFragments, buffer + 14, 2);
+	fragment = ntohs(fragment);
+	nrFragments = ntohs(nrFragments);
+
+	if (nrFragments == 0 || fragment >= nrFragments)
+		return false;
+
+	payload = buffer + UMUNDO_RTP_HEADER_SIZE;
+	payloadSize = size - UMUNDO_RTP_HEADER_SIZE;
+	return true;
+}
+
+char* RTPPacket::write(char* buffer) const {
+	uint16_t netSeq = htons(seq);
+	uint32_t netTimestamp = htonl(timestamp);
+	uint32_t netSSRC = htonl(ssrc);
+
+	buffer[0] = (char)(RTP_VERSION << 6);
+	buffer[1] = (char)((marker ? 0x80 : 0x00) | (payloadType & 0x7F));
+	memcpy(buffer + 2, &netSeq, 2);
+	memcpy(buffer + 4, &netTimestamp, 4);
+	memcpy(buffer + 8, &netSSRC, 4);
+
+	if (payloadType == UMUNDO_RTP_PARITY_PAYLOAD_TYPE) {
+		uint16_t netBaseSeq = htons(baseSeq);
+		uint16_t netLengthRecovery = htons(lengthRecovery);
+		memcpy(buffer + 12, &netBaseSeq, 2);
+		buffer[14] = (char)nrProtected;
+		buffer[15] = 0;
+		memcpy(buffer + 16, &netLengthRecovery, 2);
+		return buffer + UMUNDO_RTP_PARITY_HEADER_SIZE;
+	}
+
+	uint16_t netFragment = htons(fragment);
+	uint16_t netNrFragments = htons(nrFragments);
+	memcpy(buffer + 12, &netFragment, 2);
+	memcpy(buffer + 14, &netNrFragments, 2);
+	return buffer + UMUNDO_RTP_HEADER_SIZE;
+}
+
+void RTPPacket::serialize(Message* msg, std::string& buffer) {
+	const std::map<std::string, std::string>& meta = msg->getMeta();
+
+	size_t size = 2 + msg->size();
+	std::map<std::string, std::string>::const_iterator metaIter;
+	for (metaIter = meta.begin(); metaIter != meta.end(); metaIter++)
+		size += metaIter->first.length() + 1 + metaIter->second.length() + 1;
+
+	buffer.clear();
+	buffer.reserve(size);
+
+	uint16_t nrMeta = htons((uint16_t)meta.size());
+	buffer.append((const char*)&nrMeta, 2);
+	for (metaIter = meta.begin(); metaIter != meta.end(); metaIter++) {
+		buffer.append(metaIter->first.c_str(), metaIter->first.length() + 1);
+		buffer.append(metaIter->second.c_str(), metaIter->second.length() + 1);
+	}
+	if (msg->size() > 0)
+		buffer.append(msg->data(), msg->size());
+}
+
+Message* RTPPacket::deserialize(const char* buffer, size_t size) {
+	if (size < 2)
+		return NULL;
+
+	const char* readPtr = buffer;
+	const char* end = buffer + size;
+
+	uint16_t nrMeta;
+	memcpy(&nrMeta, readPtr, 2);
+	nrMeta = ntohs(nrMeta);
+	readPtr += 2;
+
+	Message* msg = new Message();
+	for (uint16_t i = 0; i < nrMeta; i++) {
+		size_t keyLength = strnlen(readPtr, end - readPtr);
+		if (readPtr + keyLength >= end) {
+			delete msg;
+			return NULL;
+		}
+		const char* value = readPtr + keyLength + 1;
+		size_t valueLength = strnlen(value, end - value);
+		if (value + valueLength >= end) {
+			delete msg;
+			return NULL;
+		}
+		msg->putMeta(readPtr, value);
+		readPtr = value + valueLength + 1;
+	}
+
+	if (readPtr < end)
+		msg->setData(readPtr, end - readPtr);
+	return msg;
+}
+
+uint32_t RTPPacket::ssrcFor(const std::string& pubUUID) {
+	// RFC 3550 wants random identifiers, our uuids are random enough
+	uint32_t hash = 0;
+	for (size_t i = 0; i < pubUUID.length(); i++)
+		hash = hash * 31 + pubUUID[i];
+	return hash;
+}
+
+std::string RTPPacket::multicastGroupFor(const std::string& pubUUID) {
+	uint32_t hash = ssrcFor(pubUUID);
+	std::stringstream group;
+	group << "239.255." << ((hash >> 16) & 0xFF) << "." << ((hash >> 24) & 0xFF);
+	return group.str();
+}
+
+size_t RTPPacket::writeNack(char* buffer, uint32_t senderSSRC, uint32_t mediaSSRC, const std::set<uint16_t>& seqs) {
+	uint32_t netSenderSSRC = htonl(senderSSRC);
+	uint32_t netMediaSSRC = htonl(mediaSSRC);
+
+	buffer[0] = (char)((RTP_VERSION << 6) | RTCP_FMT_NACK);
+	buffer[1] = (char)UMUNDO_RTCP_FEEDBACK_TYPE;
+	memcpy(buffer + 4, &netSenderSSRC, 4);
+	memcpy(buffer + 8, &netMediaSSRC, 4);
+
+	size_t size = 12;
+	std::set<uint16_t>::const_iterator seqIter = seqs.begin();
+	while(seqIter != seqs.end() && size + 4 <= UMUNDO_RTP_MTU) {
+		uint16_t pid = *seqIter++;
+		uint16_t blp = 0;
+		while(seqIter != seqs.end() && (uint16_t)(*seqIter - pid) <= 16) {
+			blp |= 1 << ((uint16_t)(*seqIter - pid) - 1);
+			seqIter++;
+		}
+		uint16_t netPid = htons(pid);
+		uint16_t netBlp = htons(blp);
+		memcpy(buffer + size, &netPid, 2);
+		memcpy(buffer + size + 2, &netBlp, 2);
+		size += 4;
+	}
+
+	// length in 32 bit words minus one
+	uint16_t netLength = htons((uint16_t)(size / 4 - 1));
+	memcpy(buffer + 2, &netLength, 2);
+	return size;
+}
+
+bool RTPPacket::readNack(const char* buffer, size_t size, uint32_t& mediaSSRC, std::set<uint16_t>& seqs) {
+	if (size < 16)
+		return false;
+	if ((uint8_t)buffer[0] != ((RTP_VERSION << 6) | RTCP_FMT_NACK) || (uint8_t)buffer[1] != UMUNDO_RTCP_FEEDBACK_TYPE)
+		return false;
+
+	uint16_t length;
+	memcpy(&length, buffer + 2, 2);
+	length = ntohs(length);
+	if ((size_t)(length + 1) * 4 > size)
+		return false;
+
+	memcpy(&mediaSSRC, buffer + 8, 4);
+	mediaSSRC = ntohl(mediaSSRC);
+
+	for (size_t offset = 12; offset < (size_t)(length + 1) * 4; offset += 4) {
+		uint16_t pid;
+		uint16_t blp;
+		memcpy(&pid, buffer + offset, 2);
+		memcpy(&blp, buffer + offset + 2, 2);
+		pid = ntohs(pid);
+		blp = ntohs(blp);
+		seqs.insert(pid);
+		for (int i = 0; i < 16; i++) {
+			if (blp & (1 << i))
+				seqs.insert((uint16_t)(pid + i + 1));
+		}
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,96 @@
+/**
+ *  @file
+ *  @brief      RTP datagrams carrying fragments of umundo messages.
+ *  @author     2013 Thilo Molitor (thilo@eightysoft.de)
+ *  @author     2013 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef RTPPACKET_H_T7W2MZQD
+#define RTPPACKET_H_T7W2MZQD
+
+#include "umundo/common/Common.h"
+
+#define UMUNDO_RTP_MTU 1400 ///< largest datagram we send, leaves room for ip and udp headers in an ethernet frame
+#define UMUNDO_RTP_HEADER_SIZE 16 ///< fixed rtp header and our fragment header
+#define UMUNDO_RTP_PARITY_HEADER_SIZE 18 ///< fixed rtp header and our parity header
+#define UMUNDO_RTP_PAYLOAD_TYPE 96 ///< first dynamic payload type, we carry serialized messages
+#define UMUNDO_RTP_PARITY_PAYLOAD_TYPE 97 ///< forward error correction for the messages
+#define UMUNDO_RTP_CLOCK_RATE 90000 ///< timestamp units per second, as for video
+#define UMUNDO_RTP_REASSEMBLY_MS 500 ///< we give up on a fragmented message after this long
+#define UMUNDO_RTP_MAX_ASSEMBLIES 64 ///< messages per publisher we reassemble at the same time
+#define UMUNDO_RTP_MULTICAST_PORT 42142 ///< port of the groups multicast publishers send to
+#define UMUNDO_RTCP_FEEDBACK_TYPE 205 ///< transport layer feedback from RFC 4585, we only send generic NACKs
+
+namespace umundo {
+
+class Message;
+
+/**
+ * A single datagram of the RTP transport.
+ *
+ * Every datagram starts with the fixed RTP header from RFC 3550 without contributing sources
+ * or extensions, followed by the index of the fragment and the number of fragments of the
+ * message as 16 bit numbers in network byte order. All fragments of a message share the
+ * timestamp and the marker bit is set on the last one.
+ *
+ * Messages are serialized as the number of meta fields as a 16 bit number, the zero terminated
+ * key and value of every field and the data.
+ *
+ * Parity datagrams have their own payload type and sequence numbers. The fixed header is
+ * followed by the sequence number of the first datagram they protect, the number of
+ * consecutive datagrams protected, a reserved byte and the xor of their lengths. The payload
+ * is the xor of the protected datagrams, padded with zeros to the longest. With all but one
+ * of them the missing datagram is the xor of the others and the parity.
+ *
+ * Subscribers to multicast publishers ask for lost datagrams with the generic NACK from
+ * RFC 4585, a RTCP feedback packet listing the missing sequence numbers as pairs of a
+ * sequence number and a bitmask of the 16 following ones.
+ */
+class DLLEXPORT RTPPacket {
+public:
+	RTPPacket() : marker(false), payloadType(UMUNDO_RTP_PAYLOAD_TYPE), seq(0), timestamp(0), ssrc(0), fragment(0), nrFragments(1), baseSeq(0), nrProtected(0), lengthRecovery(0), payload(NULL), payloadSize(0) {}
+
+	bool read(const char* buffer, size_t size); ///< false if the datagram is not one of ours
+	char* write(char* buffer) const; ///< the headers only, returns where the payload goes
+
+	static void serialize(Message* msg, std::string& buffer);
+	static Message* deserialize(const char* buffer, size_t size); ///< NULL if malformed
+
+	/// As many of the sequence numbers as fit into a datagram, returns its size
+	static size_t writeNack(char* buffer, uint32_t senderSSRC, uint32_t mediaSSRC, const std::set<uint16_t>& seqs);
+	static bool readNack(const char* buffer, size_t size, uint32_t& mediaSSRC, std::set<uint16_t>& seqs);
+
+	static uint32_t ssrcFor(const std::string& pubUUID);
+	static std::string multicastGroupFor(const std::string& pubUUID); ///< within the organization-local scope
+
+	bool marker;
+	uint8_t payloadType;
+	uint16_t seq;
+	uint32_t timestamp;
+	uint32_t ssrc;
+	uint16_t fragment;
+	uint16_t nrFragments;
+	uint16_t baseSeq; ///< first datagram a parity datagram protects
+	uint8_t nrProtected;
+	uint16_t lengthRecovery;
+	const char* payload; ///< points into the buffer we read from
+	size_t payloadSize;
+};
+
+}
+
+#endif /* end of include guard: RTPPACKET_H_T7W2MZQD */
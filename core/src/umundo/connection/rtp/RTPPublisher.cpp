@@ -19,15 +19,100 @@
  */
 
 #include "umundo/connection/rtp/RTPPublisher.h"
+#include "umundo/connection/rtp/RTPPacket.h"
+#include "umundo/common/Message.h"
+#include "umundo/common/UUID.h"
+
+#ifdef WIN32
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+#define close(socket) closesocket(socket)
+typedef int socklen_t;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+#include <string.h> // strerror
+#include <errno.h> // errno
+#include <stdlib.h> // getenv
+
+#define RTP_POLL_MS 100
 
 namespace umundo {
 
-RTPPublisher::RTPPublisher() {}
+RTPPublisher::RTPPublisher() :
+	_socket(-1),
+	_isMulticast(false),
+	_lastSeq(0),
+	_lastSentAt(0),
+	_packetsRetransmitted(0),
+	_repairer(NULL),
+	_seq(0),
+	_ssrc(0),
+	_explicitSSRC(0),
+	_timestampOffset(0),
+	_packetsSent(0),
+	_bytesSent(0),
+	_fecGroupSize(0),
+	_paritySeq(0),
+	_parityBaseSeq(0),
+	_parityCount(0),
+	_parityLength(0),
+	_suppressedMsgs(0),
+	_mutex("pub.rtp") {}
 
 void RTPPublisher::init(Options* config) {
+	ScopeLock lock(_mutex);
+
+	_transport = "udp";
+
+	uint32_t hash = RTPPacket::ssrcFor(_uuid);
+	_ssrc = hash;
+	_explicitSSRC = ~hash;
+	_seq = (uint16_t)(hash >> 7);
+	_paritySeq = (uint16_t)(hash >> 13);
+	_timestampOffset = hash * 2654435761u;
+
+	_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (_socket < 0) {
+		UM_LOG_ERR("socket: %s", strerror(errno));
+		return;
+	}
+
+	if (implType & Publisher::MULTICAST) {
+		_isMulticast = true;
+		_group.ip = RTPPacket::multicastGroupFor(_uuid);
+		_group.port = UMUNDO_RTP_MULTICAST_PORT;
+		_ip = _group.ip;
+		_port = _group.port;
+		_history.resize(UMUNDO_RTP_REPAIR_HISTORY);
+
+		const char* ifIP = getenv("UMUNDO_MULTICAST_INTERFACE");
+		if (ifIP != NULL) {
+			struct in_addr ifAddr;
+			ifAddr.s_addr = inet_addr(ifIP);
+			if (setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_IF, (char*)&ifAddr, sizeof(ifAddr)) < 0)
+				UM_LOG_WARN("setsockopt IP_MULTICAST_IF %s: %s", ifIP, strerror(errno));
+		}
+
+		_repairer = new Repairer(this);
+		_repairer->start();
+		UM_LOG_INFO("RTP publisher for %s sends to %s:%d", _channelName.c_str(), _group.ip.c_str(), _group.port);
+	}
+
+	UM_LOG_INFO("creating RTP publisher for %s with ssrc %u", _channelName.c_str(), _ssrc);
 }
 
 RTPPublisher::~RTPPublisher() {
+	UM_LOG_INFO("deleting RTP publisher for %s", _channelName.c_str());
+	if (_repairer != NULL)
+		delete _repairer;
+	if (_socket >= 0)
+		close(_socket);
 }
 
 boost::shared_ptr<Implementation> RTPPublisher::create() {
@@ -35,24 +120,336 @@ boost::shared_ptr<Implementation> RTPPublisher::create() {
 }
 
 void RTPPublisher::suspend() {
+	ScopeLock lock(_mutex);
+	if (_isSuspended)
+		return;
+	_isSuspended = true;
 };
 
 void RTPPublisher::resume() {
+	ScopeLock lock(_mutex);
+	if (!_isSuspended)
+		return;
+	_isSuspended = false;
 };
 
 int RTPPublisher::waitForSubscribers(int count, int timeoutMs) {
-	return 0;
+	ScopeLock lock(_mutex);
+	uint64_t deadline = Thread::getTimeStampUs() + (uint64_t)timeoutMs * 1000;
+	while (_destinations.size() < (unsigned int)count) {
+		if (timeoutMs <= 0) {
+			_pubLock.wait(_mutex);
+		} else if (!_pubLock.waitUntilUs(_mutex, deadline)) {
+			break;
+		}
+	}
+	return _destinations.size();
 }
 
+/**
+ * The node of the subscriber told us its port with the subscription, the address is
+ * the one we know its node by.
+ */
 void RTPPublisher::added(const SubscriberStub& sub, const NodeStub& node) {
-	UM_LOG_DEBUG("%s: received a new subscriber", SHORT_UUID(_uuid).c_str());
+	ScopeLock lock(_mutex);
+
+	std::string ip = sub.getImpl()->getIP();
+	if (ip.length() == 0)
+		ip = node.getIP();
+	if (ip.length() == 0 || sub.getImpl()->getPort() == 0) {
+		UM_LOG_WARN("%s: no address for RTP subscriber %s on node %s - ignoring", SHORT_UUID(_uuid).c_str(), SHORT_UUID(sub.getUUID()).c_str(), SHORT_UUID(node.getUUID()).c_str());
+		return;
+	}
+
+	bool isNew = (_destinations.find(sub.getUUID()) == _destinations.end());
+	Destination& dest = _destinations[sub.getUUID()];
+	dest.ip = ip;
+	dest.port = sub.getImpl()->getPort();
+	dest.nodes.insert(node.getUUID());
+
+	if (!isNew)
+		return;
+
+	_subs[sub.getUUID()] = sub;
+
+	UM_LOG_INFO("Publisher %s received RTP subscriber %s at %s:%d for channel %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(sub.getUUID()).c_str(), ip.c_str(), dest.port, _channelName.c_str());
+
+	if (_greeter != NULL)
+		_greeter->welcome(Publisher(boost::static_pointer_cast<PublisherImpl>(shared_from_this())), sub);
+
+	UMUNDO_SIGNAL(_pubLock);
 }
 
 void RTPPublisher::removed(const SubscriberStub& sub, const NodeStub& node) {
-	UM_LOG_DEBUG("%s: lost a subscriber", SHORT_UUID(_uuid).c_str());
+	ScopeLock lock(_mutex);
+
+	std::map<std::string, Destination>::iterator destIter = _destinations.find(sub.getUUID());
+	if (destIter == _destinations.end())
+		return;
+
+	destIter->second.nodes.erase(node.getUUID());
+	if (destIter->second.nodes.size() > 0)
+		return;
+
+	UM_LOG_INFO("Publisher %s lost RTP subscriber %s for channel %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(sub.getUUID()).c_str(), _channelName.c_str());
+
+	_destinations.erase(destIter);
+	if (_greeter != NULL)
+		_greeter->farewell(Publisher(boost::static_pointer_cast<PublisherImpl>(shared_from_this())), sub);
+	_subs.erase(sub.getUUID());
+
+	UMUNDO_SIGNAL(_pubLock);
+}
+
+uint64_t RTPPublisher::getPacketsSent() {
+	ScopeLock lock(_mutex);
+	return _packetsSent;
+}
+
+uint64_t RTPPublisher::getBytesSent() {
+	ScopeLock lock(_mutex);
+	return _bytesSent;
+}
+
+uint64_t RTPPublisher::getPacketsRetransmitted() {
+	ScopeLock lock(_mutex);
+	return _packetsRetransmitted;
+}
+
+void RTPPublisher::setFEC(uint8_t groupSize) {
+	ScopeLock lock(_mutex);
+	_fecGroupSize = groupSize;
+	_parityCount = 0; // start a new group
 }
 
 void RTPPublisher::send(Message* msg) {
+	if (_isSuspended) {
+		UM_LOG_WARN("Not sending message on suspended publisher");
+		return;
+	}
+
+	ScopeLock lock(_mutex);
+	if (_socket < 0)
+		return;
+
+	// explicitly addressed messages only go to the one subscriber, we do not queue for late ones
+	Destination* explicitDest = NULL;
+	bool isExplicit = (msg->getMeta().find("um.sub") != msg->getMeta().end());
+	if (isExplicit) {
+		std::map<std::string, Destination>::iterator destIter = _destinations.find(msg->getMeta("um.sub"));
+		if (destIter != _destinations.end())
+			explicitDest = &destIter->second;
+	}
+
+	if (isExplicit ? explicitDest == NULL : _destinations.empty()) {
+		Atomic::add(&_suppressedMsgs, 1);
+		return;
+	}
+
+	// mandatory meta fields
+	msg->putMeta("um.pub", _uuid);
+	msg->putMeta("um.proc", procUUID);
+	msg->putMeta("um.host", hostUUID);
+	msg->putMeta("um.channel", _channelName);
+
+	std::map<std::string, std::string>::const_iterator metaIter = _mandatoryMeta.begin();
+	while(metaIter != _mandatoryMeta.end()) {
+		if (metaIter->second.length() > 0)
+			msg->putMeta(metaIter->first, metaIter->second);
+		metaIter++;
+	}
+
+	std::string payload;
+	RTPPacket::serialize(msg, payload);
+
+	// parity datagrams are as large as the largest datagram they protect plus their header
+	size_t fragmentSize = UMUNDO_RTP_MTU - UMUNDO_RTP_HEADER_SIZE - (_fecGroupSize > 0 ? UMUNDO_RTP_PARITY_HEADER_SIZE : 0);
+	size_t nrFragments = (payload.size() + fragmentSize - 1) / fragmentSize;
+	if (nrFragments > 0xFFFF) {
+		UM_LOG_ERR("Message of %lu bytes is too large for RTP on %s - dropping", (unsigned long)payload.size(), _channelName.c_str());
+		return;
+	}
+
+	// the other subscribers would see gaps if explicit datagrams took numbers from our sequence
+	RTPPacket packet;
+	packet.ssrc = (isExplicit ? _explicitSSRC : _ssrc);
+	packet.timestamp = _timestampOffset + (uint32_t)(Thread::getTimeStampUs() * (UMUNDO_RTP_CLOCK_RATE / 1000) / 1000);
+	packet.nrFragments = nrFragments;
+
+	char buffer[UMUNDO_RTP_MTU];
+	for (size_t i = 0; i < nrFragments; i++) {
+		size_t offset = i * fragmentSize;
+		size_t size = (payload.size() - offset < fragmentSize ? payload.size() - offset : fragmentSize);
+
+		packet.seq = (isExplicit ? explicitDest->explicitSeq++ : _seq++);
+		packet.fragment = i;
+		packet.marker = (i + 1 == nrFragments);
+		char* writePtr = packet.write(buffer);
+		memcpy(writePtr, payload.data() + offset, size);
+
+		if (isExplicit) {
+			transmit(buffer, UMUNDO_RTP_HEADER_SIZE + size, *explicitDest);
+			continue;
+		}
+
+		distribute(buffer, UMUNDO_RTP_HEADER_SIZE + size, _destinations);
+		if (_isMulticast) {
+			_history[packet.seq % UMUNDO_RTP_REPAIR_HISTORY].assign(buffer, UMUNDO_RTP_HEADER_SIZE + size);
+			_lastSeq = packet.seq;
+			_lastSentAt = Thread::getMonotonicMs();
+		}
+		protect(packet, buffer, UMUNDO_RTP_HEADER_SIZE + size);
+	}
+}
+
+/**
+ * Add a datagram to the current parity group and send the parity once the group is full.
+ */
+void RTPPublisher::protect(const RTPPacket& packet, const char* buffer, size_t size) {
+	if (_fecGroupSize == 0)
+		return;
+
+	if (_parityCount == 0) {
+		_parityBaseSeq = packet.seq;
+		_parityLength = 0;
+		_parity.clear();
+	}
+
+	if (_parity.size() < size)
+		_parity.resize(size, 0);
+	for (size_t i = 0; i < size; i++)
+		_parity[i] ^= buffer[i];
+	_parityLength ^= size;
+	_parityCount++;
+
+	if (_parityCount >= _fecGroupSize)
+		flushParity(packet.timestamp);
+}
+
+void RTPPublisher::flushParity(uint32_t timestamp) {
+	if (_parityCount == 0)
+		return;
+
+	RTPPacket parity;
+	parity.payloadType = UMUNDO_RTP_PARITY_PAYLOAD_TYPE;
+	parity.seq = _paritySeq++;
+	parity.timestamp = timestamp;
+	parity.ssrc = _ssrc;
+	parity.baseSeq = _parityBaseSeq;
+	parity.nrProtected = _parityCount;
+	parity.lengthRecovery = _parityLength;
+	_parityCount = 0;
+
+	assert(UMUNDO_RTP_PARITY_HEADER_SIZE + _parity.size() <= UMUNDO_RTP_MTU);
+	char buffer[UMUNDO_RTP_MTU];
+	char* writePtr = parity.write(buffer);
+	memcpy(writePtr, _parity.data(), _parity.size());
+
+	distribute(buffer, UMUNDO_RTP_PARITY_HEADER_SIZE + _parity.size(), _destinations);
+}
+
+/**
+ * Send a datagram to every subscriber or once to our group.
+ */
+void RTPPublisher::distribute(const char* buffer, size_t size, const std::map<std::string, Destination>& dests) {
+	if (_isMulticast) {
+		transmit(buffer, size, _group);
+		return;
+	}
+
+	std::map<std::string, Destination>::const_iterator destIter = dests.begin();
+	while(destIter != dests.end()) {
+		transmit(buffer, size, destIter->second);
+		destIter++;
+	}
+}
+
+/**
+ * Retransmit what a subscriber asked for if we still have it.
+ */
+void RTPPublisher::repair() {
+	char buffer[UMUNDO_RTP_MTU];
+	struct sockaddr_in fromAddr;
+	socklen_t fromAddrLen = sizeof(fromAddr);
+	int size = recvfrom(_socket, buffer, UMUNDO_RTP_MTU, 0, (struct sockaddr*)&fromAddr, &fromAddrLen);
+	if (size < 0)
+		return;
+
+	uint32_t ssrc;
+	std::set<uint16_t> seqs;
+	if (!RTPPacket::readNack(buffer, size, ssrc, seqs) || ssrc != _ssrc)
+		return;
+
+	Destination dest;
+	dest.ip = inet_ntoa(fromAddr.sin_addr);
+	dest.port = ntohs(fromAddr.sin_port);
+
+	ScopeLock lock(_mutex);
+	for (std::set<uint16_t>::iterator seqIter = seqs.begin(); seqIter != seqs.end(); seqIter++) {
+		const std::string& datagram = _history[*seqIter % UMUNDO_RTP_REPAIR_HISTORY];
+		RTPPacket packet;
+		if (!packet.read(datagram.data(), datagram.size()) || packet.seq != *seqIter)
+			continue; // too old
+		transmit(datagram.data(), datagram.size(), dest);
+		_packetsRetransmitted++;
+	}
+}
+
+/**
+ * Subscribers only notice a loss with the next datagram, send the last one again when we were silent.
+ */
+void RTPPublisher::resendTail() {
+	ScopeLock lock(_mutex);
+	if (_lastSentAt == 0 || Thread::getMonotonicMs() - _lastSentAt < RTP_POLL_MS)
+		return;
+	_lastSentAt = 0;
+
+	const std::string& datagram = _history[_lastSeq % UMUNDO_RTP_REPAIR_HISTORY];
+	transmit(datagram.data(), datagram.size(), _group);
+	_packetsRetransmitted++;
+}
+
+RTPPublisher::Repairer::~Repairer() {
+	stop();
+	join();
+}
+
+void RTPPublisher::Repairer::run() {
+	while(isStarted()) {
+		// wake up now and then to notice when we are stopped
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = RTP_POLL_MS * 1000;
+
+		fd_set readFds;
+		FD_ZERO(&readFds);
+		FD_SET(_pub->_socket, &readFds);
+		int ready = select(_pub->_socket + 1, &readFds, NULL, NULL, &timeout);
+		if (ready < 0 && errno != EINTR) {
+			UM_LOG_ERR("select: %s", strerror(errno));
+			Thread::sleepMs(RTP_POLL_MS);
+		}
+		if (ready > 0) {
+			_pub->repair();
+		} else {
+			_pub->resendTail();
+		}
+	}
+}
+
+void RTPPublisher::transmit(const char* buffer, size_t size, const Destination& dest) {
+	struct sockaddr_in toAddr;
+	memset(&toAddr, 0, sizeof(toAddr));
+	toAddr.sin_family = AF_INET;
+	toAddr.sin_port = htons(dest.port);
+	toAddr.sin_addr.s_addr = inet_addr(dest.ip.c_str());
+
+	if (sendto(_socket, buffer, size, 0, (struct sockaddr*)&toAddr, sizeof(toAddr)) < 0) {
+		UM_LOG_WARN("sendto %s:%d: %s", dest.ip.c_str(), dest.port, strerror(errno));
+		return;
+	}
+	_packetsSent++;
+	_bytesSent += size;
 }
 
 }
@@ -21,16 +21,34 @@
 #ifndef RTPPUBLISHER_H_H9LXV94P
 #define RTPPUBLISHER_H_H9LXV94P
 
+#include <boost/enable_shared_from_this.hpp>
+
 #include "umundo/common/Common.h"
 #include "umundo/connection/Publisher.h"
 #include "umundo/thread/Thread.h"
 
+#define UMUNDO_RTP_REPAIR_HISTORY 1024 ///< datagrams a multicast publisher keeps for retransmission
+
 namespace umundo {
 
+class RTPPacket;
+
 /**
- * Concrete publisher implementor for 0MQ (bridge pattern).
+ * Concrete publisher implementor for RTP over UDP (bridge pattern).
+ *
+ * Every message is split into datagrams of at most UMUNDO_RTP_MTU bytes and sent to every
+ * subscriber as soon as its node subscribed with the port of the subscriber's socket. There
+ * are no retransmissions, a lost fragment loses the message unless we send parity datagrams
+ * the subscribers can recover it from.
+ *
+ * As a Publisher::RTP_MULTICAST we send every datagram only once to a multicast group derived
+ * from our uuid and the subscribers join it, so our bandwidth does not grow with the number of
+ * subscribers. Subscribers ask for lost datagrams with a NACK and we retransmit the ones we
+ * still have to them alone. When we fall silent, we send the last datagram again for them to
+ * notice the loss of the datagrams before it. Set UMUNDO_MULTICAST_INTERFACE to the address of the interface to
+ * send from if the default route is not the one.
  */
-class DLLEXPORT RTPPublisher : public PublisherImpl {
+class DLLEXPORT RTPPublisher : public PublisherImpl, public boost::enable_shared_from_this<RTPPublisher> {
 public:
 	virtual ~RTPPublisher();
 
@@ -41,6 +59,20 @@ public:
 
 	void send(Message* msg);
 	int waitForSubscribers(int count, int timeoutMs);
+	size_t getSuppressedMessages() {
+		return Atomic::load(&_suppressedMsgs);
+	}
+
+	uint64_t getPacketsSent(); ///< datagrams summed over all subscribers
+	uint64_t getBytesSent();
+	uint64_t getPacketsRetransmitted(); ///< in response to NACKs as a multicast publisher
+
+	/**
+	 * Send a parity datagram after every groupSize datagrams, subscribers recover a single lost
+	 * datagram per group from it. Groups span messages, so the overhead is 1 / groupSize but
+	 * the recovery of a message may have to wait for the next ones. 0 disables parity.
+	 */
+	void setFEC(uint8_t groupSize);
 
 protected:
 	/**
@@ -51,9 +83,60 @@ protected:
 	void added(const SubscriberStub& sub, const NodeStub& node);
 	void removed(const SubscriberStub& sub, const NodeStub& node);
 
-private:
-	void run();
+	/// Where a subscriber receives and the nodes that told us about it
+	class Destination {
+	public:
+		Destination() : port(0), explicitSeq(0) {}
+		std::string ip;
+		uint16_t port;
+		std::set<std::string> nodes;
+		uint16_t explicitSeq; ///< messages explicitly addressed to this subscriber are numbered on their own
+	};
+
+	/**
+	 * Reads NACKs from our subscribers while we multicast.
+	 */
+	class Repairer : public Thread {
+	public:
+		Repairer(RTPPublisher* pub) : _pub(pub) {}
+		virtual ~Repairer();
+		void run();
+	protected:
+		RTPPublisher* _pub;
+	};
+
+	virtual void transmit(const char* buffer, size_t size, const Destination& dest);
+	void distribute(const char* buffer, size_t size, const std::map<std::string, Destination>& dests);
+	void protect(const RTPPacket& packet, const char* buffer, size_t size);
+	void flushParity(uint32_t timestamp);
+	void repair();
+	void resendTail();
+
+	int _socket;
+	std::map<std::string, Destination> _destinations; ///< by subscriber uuid
+	bool _isMulticast;
+	Destination _group;
+	std::vector<std::string> _history; ///< recently multicast datagrams by sequence number modulo its size
+	uint16_t _lastSeq; ///< last datagram we multicast
+	uint64_t _lastSentAt; ///< 0 once we resent the last datagram
+	uint64_t _packetsRetransmitted;
+	Repairer* _repairer;
+	uint16_t _seq;
+	uint32_t _ssrc;
+	uint32_t _explicitSSRC; ///< explicitly addressed messages are a stream of their own
+	uint32_t _timestampOffset;
+	uint64_t _packetsSent;
+	uint64_t _bytesSent;
+
+	uint8_t _fecGroupSize;
+	uint16_t _paritySeq;
+	uint16_t _parityBaseSeq; ///< first datagram in the current group
+	uint8_t _parityCount; ///< datagrams in the current group
+	uint16_t _parityLength; ///< xor of their lengths
+	std::string _parity; ///< xor of their contents
+	volatile size_t _suppressedMsgs;
 
+	Monitor _pubLock;
 	Mutex _mutex;
 
 	friend class Factory;
@@ -19,15 +19,106 @@
  */
 
 #include "umundo/connection/rtp/RTPSubscriber.h"
+#include "umundo/common/Message.h"
+
+#ifdef WIN32
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+#define close(socket) closesocket(socket)
+typedef int socklen_t;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include <string.h> // strerror
+#include <errno.h> // errno
+#include <math.h> // fabs
+#include <stdlib.h> // getenv
+
+#define RTP_MAX_DROPOUT 3000 ///< larger jumps ahead restart the sequence as in RFC 3550
+#define RTP_MAX_MISORDER 100
+#define RTP_POLL_MS 100
 
 namespace umundo {
 
-RTPSubscriber::RTPSubscriber() {}
+RTPSubscriber::RTPSubscriber() : _socket(-1), _mcastSocket(-1), _targetDelayMs(0), _isAdaptive(true), _mutex("sub.rtp"), _receiveMutex("sub.rtp.receive") {}
 
 void RTPSubscriber::init(Options* config) {
+	ScopeLock lock(_mutex);
+
+	_transport = "udp";
+
+	_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (_socket < 0) {
+		UM_LOG_ERR("socket: %s", strerror(errno));
+		return;
+	}
+
+	int rcvBuf = UMUNDO_RTP_RCVBUF;
+	setsockopt(_socket, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvBuf, sizeof(rcvBuf)) && UM_LOG_WARN("setsockopt: %s", strerror(errno));
+
+	struct sockaddr_in bindAddr;
+	memset(&bindAddr, 0, sizeof(bindAddr));
+	bindAddr.sin_family = AF_INET;
+	bindAddr.sin_port = 0;
+	bindAddr.sin_addr.s_addr = INADDR_ANY;
+	if (bind(_socket, (struct sockaddr*)&bindAddr, sizeof(bindAddr)) != 0) {
+		UM_LOG_ERR("bind: %s", strerror(errno));
+		close(_socket);
+		_socket = -1;
+		return;
+	}
+
+	socklen_t bindAddrLength = sizeof(bindAddr);
+	getsockname(_socket, (struct sockaddr*)&bindAddr, &bindAddrLength) && UM_LOG_ERR("getsockname: %s", strerror(errno));
+	setPort(ntohs(bindAddr.sin_port)); // goes out with our subscriptions
+
+#ifdef WIN32
+	u_long nonBlocking = 1;
+	ioctlsocket(_socket, FIONBIO, &nonBlocking);
+#else
+	fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	UM_LOG_INFO("creating RTP subscriber for %s on port %d", _channelName.c_str(), getPort());
+
+	// we have to read continuously to reassemble messages, with or without a receiver
+	start();
 }
 
 RTPSubscriber::~RTPSubscriber() {
+	UM_LOG_INFO("deleting RTP subscriber for %s", _channelName.c_str());
+	stop();
+	join();
+
+	if (_socket >= 0)
+		close(_socket);
+	if (_mcastSocket >= 0)
+		close(_mcastSocket);
+
+	while(_msgQueue.size() > 0) {
+		delete _msgQueue.front();
+		_msgQueue.pop_front();
+	}
+	while(_ready.size() > 0) {
+		delete _ready.front();
+		_ready.pop_front();
+	}
+
+	std::map<uint32_t, Source>::iterator sourceIter = _sources.begin();
+	while(sourceIter != _sources.end()) {
+		std::map<int64_t, Frame>::iterator frameIter = sourceIter->second.frames.begin();
+		while(frameIter != sourceIter->second.frames.end()) {
+			delete frameIter->second.msg;
+			frameIter++;
+		}
+		sourceIter++;
+	}
 }
 
 boost::shared_ptr<Implementation> RTPSubscriber::create() {
@@ -35,31 +126,676 @@ boost::shared_ptr<Implementation> RTPSubscriber::create() {
 }
 
 void RTPSubscriber::suspend() {
+	ScopeLock lock(_mutex);
+	if (_isSuspended)
+		return;
+	_isSuspended = true;
 }
 
 void RTPSubscriber::resume() {
+	ScopeLock lock(_mutex);
+	if (!_isSuspended)
+		return;
+	_isSuspended = false;
 }
 
 void RTPSubscriber::added(const PublisherStub& pub, const NodeStub& node) {
-	UM_LOG_DEBUG("%s: received a new publisher", SHORT_UUID(_uuid).c_str());
+	ScopeLock lock(_mutex);
+	UM_LOG_INFO("%s receiving %s via RTP from publisher %s", SHORT_UUID(_uuid).c_str(), pub.getChannelName().c_str(), SHORT_UUID(pub.getUUID()).c_str());
+	if (_pubs.find(pub.getUUID()) == _pubs.end() && (pub.getImpl()->implType & Publisher::MULTICAST))
+		joinGroup(pub);
+	_pubs[pub.getUUID()] = pub;
 }
 
 void RTPSubscriber::removed(const PublisherStub& pub, const NodeStub& node) {
-	UM_LOG_DEBUG("%s: lost a publisher", SHORT_UUID(_uuid).c_str());
+	ScopeLock lock(_mutex);
+	UM_LOG_INFO("%s lost publisher %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(pub.getUUID()).c_str());
+	if (_pubs.find(pub.getUUID()) != _pubs.end() && (pub.getImpl()->implType & Publisher::MULTICAST))
+		leaveGroup(pub);
+	_pubs.erase(pub.getUUID());
+}
+
+/**
+ * All multicast publishers send to the same port, we open a socket for it with the first.
+ */
+void RTPSubscriber::joinGroup(const PublisherStub& pub) {
+	if (_mcastSocket < 0) {
+		_mcastSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (_mcastSocket < 0) {
+			UM_LOG_ERR("socket: %s", strerror(errno));
+			return;
+		}
+
+		// every subscriber on this host binds the port
+		int reuse = 1;
+		setsockopt(_mcastSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) && UM_LOG_WARN("setsockopt: %s", strerror(errno));
+#ifdef SO_REUSEPORT
+		setsockopt(_mcastSocket, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) && UM_LOG_WARN("setsockopt: %s", strerror(errno));
+#endif
+		int rcvBuf = UMUNDO_RTP_RCVBUF;
+		setsockopt(_mcastSocket, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvBuf, sizeof(rcvBuf)) && UM_LOG_WARN("setsockopt: %s", strerror(errno));
+
+		struct sockaddr_in bindAddr;
+		memset(&bindAddr, 0, sizeof(bindAddr));
+		bindAddr.sin_family = AF_INET;
+		bindAddr.sin_port = htons(UMUNDO_RTP_MULTICAST_PORT);
+		bindAddr.sin_addr.s_addr = INADDR_ANY;
+		if (bind(_mcastSocket, (struct sockaddr*)&bindAddr, sizeof(bindAddr)) != 0) {
+			UM_LOG_ERR("bind: %s", strerror(errno));
+			close(_mcastSocket);
+			_mcastSocket = -1;
+			return;
+		}
+
+#ifdef WIN32
+		u_long nonBlocking = 1;
+		ioctlsocket(_mcastSocket, FIONBIO, &nonBlocking);
+#else
+		fcntl(_mcastSocket, F_SETFL, fcntl(_mcastSocket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+	}
+
+	std::string group = RTPPacket::multicastGroupFor(pub.getUUID());
+	_mcastSSRCs.insert(RTPPacket::ssrcFor(pub.getUUID()));
+	if (_groups[group]++ > 0)
+		return;
+
+	const char* ifIP = getenv("UMUNDO_MULTICAST_INTERFACE");
+	struct ip_mreq mreq;
+	mreq.imr_multiaddr.s_addr = inet_addr(group.c_str());
+	mreq.imr_interface.s_addr = (ifIP != NULL ? inet_addr(ifIP) : htonl(INADDR_ANY));
+	if (setsockopt(_mcastSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&mreq, sizeof(mreq)) < 0) {
+		UM_LOG_ERR("setsockopt IP_ADD_MEMBERSHIP %s: %s", group.c_str(), strerror(errno));
+		return;
+	}
+	UM_LOG_INFO("%s joined %s for publisher %s", SHORT_UUID(_uuid).c_str(), group.c_str(), SHORT_UUID(pub.getUUID()).c_str());
+}
+
+void RTPSubscriber::leaveGroup(const PublisherStub& pub) {
+	std::string group = RTPPacket::multicastGroupFor(pub.getUUID());
+	_mcastSSRCs.erase(RTPPacket::ssrcFor(pub.getUUID()));
+	if (_mcastSocket < 0 || _groups.find(group) == _groups.end() || --_groups[group] > 0)
+		return;
+	_groups.erase(group);
+
+	const char* ifIP = getenv("UMUNDO_MULTICAST_INTERFACE");
+	struct ip_mreq mreq;
+	mreq.imr_multiaddr.s_addr = inet_addr(group.c_str());
+	mreq.imr_interface.s_addr = (ifIP != NULL ? inet_addr(ifIP) : htonl(INADDR_ANY));
+	setsockopt(_mcastSocket, IPPROTO_IP, IP_DROP_MEMBERSHIP, (const char*)&mreq, sizeof(mreq)) && UM_LOG_WARN("setsockopt IP_DROP_MEMBERSHIP %s: %s", group.c_str(), strerror(errno));
 }
 
 void RTPSubscriber::setReceiver(Receiver* receiver) {
+	ScopeLock lock(_receiveMutex);
+	_receiver = receiver;
+}
+
+void RTPSubscriber::setPlayoutDelay(uint32_t targetDelayMs, bool isAdaptive) {
+	ScopeLock lock(_mutex);
+	_targetDelayMs = targetDelayMs;
+	_isAdaptive = isAdaptive;
+}
+
+RTPStats RTPSubscriber::getStats() {
+	ScopeLock lock(_mutex);
+	RTPStats stats;
+	std::map<uint32_t, Source>::iterator sourceIter = _sources.begin();
+	while(sourceIter != _sources.end()) {
+		Source& source = sourceIter->second;
+		uint64_t expected = (uint64_t)source.cycles + source.maxSeq - source.baseSeq + 1;
+		stats.packetsReceived += source.received;
+		stats.packetsRecovered += source.packetsRecovered;
+		stats.packetsRepaired += source.packetsRepaired;
+		stats.nacksSent += source.nacksSent;
+		if (expected > source.received)
+			stats.packetsLost += expected - source.received;
+		stats.messagesReceived += source.messagesReceived;
+		stats.messagesDropped += source.messagesDropped;
+		stats.messagesLate += source.messagesLate;
+		stats.messagesBuffered += source.frames.size();
+		if (source.reorderDepth > stats.reorderDepth)
+			stats.reorderDepth = source.reorderDepth;
+		if (source.jitter / (UMUNDO_RTP_CLOCK_RATE / 1000) > stats.jitterMs)
+			stats.jitterMs = source.jitter / (UMUNDO_RTP_CLOCK_RATE / 1000);
+		if (playoutDelay(source) > stats.playoutDelayMs)
+			stats.playoutDelayMs = playoutDelay(source);
+		sourceIter++;
+	}
+	return stats;
 }
 
 void RTPSubscriber::run() {
+	while(isStarted()) {
+		if (_socket < 0)
+			return;
+
+		uint64_t now = Thread::getMonotonicMs();
+		uint64_t timeoutMs = RTP_POLL_MS;
+		int mcastSocket;
+		{
+			ScopeLock lock(_mutex);
+			uint64_t nextPlayout = playout(now);
+			if (nextPlayout > 0 && nextPlayout - now < timeoutMs)
+				timeoutMs = nextPlayout - now;
+			uint64_t nextRepair = requestRepair(now);
+			if (nextRepair > 0 && nextRepair - now < timeoutMs)
+				timeoutMs = nextRepair - now;
+			mcastSocket = _mcastSocket;
+		}
+		dispatch();
+
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = timeoutMs * 1000;
+
+		fd_set readFds;
+		FD_ZERO(&readFds);
+		FD_SET(_socket, &readFds);
+		if (mcastSocket >= 0)
+			FD_SET(mcastSocket, &readFds);
+		int ready = select((mcastSocket > _socket ? mcastSocket : _socket) + 1, &readFds, NULL, NULL, &timeout);
+		if (ready < 0 && errno != EINTR) {
+			UM_LOG_ERR("select: %s", strerror(errno));
+			Thread::sleepMs(RTP_POLL_MS);
+		}
+
+		now = Thread::getMonotonicMs();
+		if (ready > 0 && FD_ISSET(_socket, &readFds))
+			receive(_socket, now);
+		if (ready > 0 && mcastSocket >= 0 && FD_ISSET(mcastSocket, &readFds))
+			receive(mcastSocket, now);
+		expire(now);
+		dispatch();
+	}
+}
+
+/**
+ * Read all pending datagrams from one of our sockets.
+ */
+void RTPSubscriber::receive(int socket, uint64_t now) {
+	char buffer[UMUNDO_RTP_MTU];
+	struct sockaddr_in fromAddr;
+
+	for(;;) {
+		socklen_t fromAddrLen = sizeof(fromAddr);
+		int size = recvfrom(socket, buffer, UMUNDO_RTP_MTU, 0, (struct sockaddr*)&fromAddr, &fromAddrLen);
+		if (size < 0)
+			return;
+
+		ScopeLock lock(_mutex);
+		if (socket == _mcastSocket) {
+			RTPPacket packet;
+			if (!packet.read(buffer, size) || _mcastSSRCs.find(packet.ssrc) == _mcastSSRCs.end())
+				continue;
+
+			// we send NACKs to where the datagrams come from
+			Source& source = _sources[packet.ssrc];
+			source.isMulticast = true;
+			source.repairIP = inet_ntoa(fromAddr.sin_addr);
+			source.repairPort = ntohs(fromAddr.sin_port);
+		}
+		received(buffer, size, now);
+	}
+}
+
+void RTPSubscriber::received(const char* buffer, size_t size, uint64_t now) {
+	RTPPacket packet;
+	if (!packet.read(buffer, size))
+		return;
+
+	Source& source = _sources[packet.ssrc];
+
+	if (packet.payloadType == UMUNDO_RTP_PARITY_PAYLOAD_TYPE) {
+		source.isProtected = true;
+		if (source.parities.find(packet.baseSeq) != source.parities.end())
+			return; // duplicate
+		Parity& parity = source.parities[packet.baseSeq];
+		parity.nrProtected = packet.nrProtected;
+		parity.lengthRecovery = packet.lengthRecovery;
+		parity.receivedAt = now;
+		parity.data.assign(packet.payload, packet.payloadSize);
+		recover(source, packet.baseSeq, now);
+		return;
+	}
+
+	if (source.isProtected || source.isMulticast) {
+		if (source.history.find(packet.seq) != source.history.end())
+			return; // duplicate or already recovered
+		source.history[packet.seq] = std::make_pair(now, std::string(buffer, size));
+	}
+
+	if (source.isMulticast)
+		detectGaps(source, packet, now);
+	process(packet, now);
+
+	// this might have been the last but one datagram of a group
+	std::list<uint16_t> groups;
+	std::map<uint16_t, Parity>::iterator parityIter = source.parities.begin();
+	while(parityIter != source.parities.end()) {
+		if ((uint16_t)(packet.seq - parityIter->first) < parityIter->second.nrProtected)
+			groups.push_back(parityIter->first);
+		parityIter++;
+	}
+	for (std::list<uint16_t>::iterator groupIter = groups.begin(); groupIter != groups.end(); groupIter++)
+		recover(source, *groupIter, now);
+}
+
+/**
+ * Remember what we skipped to ask for it, before updateSource moves the highest sequence number.
+ */
+void RTPSubscriber::detectGaps(Source& source, const RTPPacket& packet, uint64_t now) {
+	std::map<uint16_t, Gap>::iterator gapIter = source.gaps.find(packet.seq);
+	if (gapIter != source.gaps.end()) {
+		if (gapIter->second.askedAt > 0)
+			source.packetsRepaired++;
+		source.gaps.erase(gapIter);
+		return;
+	}
+
+	if (source.received == 0) {
+		// we might have missed the start of the first message
+		for (uint16_t i = 1; i <= packet.fragment; i++)
+			source.gaps[(uint16_t)(packet.seq - i)].detectedAt = now;
+		return;
+	}
+
+	uint16_t delta = packet.seq - source.maxSeq;
+	if (delta < 2 || delta > UMUNDO_RTP_MAX_NACK_GAP)
+		return; // in order, reordered or too much to ask for
+
+	for (uint16_t seq = source.maxSeq + 1; seq != packet.seq; seq++) {
+		if (source.history.find(seq) != source.history.end())
+			continue; // recovered from parity
+		source.gaps[seq].detectedAt = now;
+	}
+}
+
+/**
+ * Send NACKs for what is still missing, returns when we will ask again or 0 if there is nothing.
+ */
+uint64_t RTPSubscriber::requestRepair(uint64_t now) {
+	uint64_t nextRepair = 0;
+	std::map<uint32_t, Source>::iterator sourceIter = _sources.begin();
+	while(sourceIter != _sources.end()) {
+		Source& source = sourceIter->second;
+		std::set<uint16_t> seqs;
+		std::map<uint16_t, Gap>::iterator gapIter = source.gaps.begin();
+		while(gapIter != source.gaps.end()) {
+			if (gapIter->second.askedAt + UMUNDO_RTP_NACK_INTERVAL_MS <= now || gapIter->second.askedAt == 0) {
+				seqs.insert(gapIter->first);
+				gapIter->second.askedAt = now;
+			}
+			if (nextRepair == 0 || gapIter->second.askedAt + UMUNDO_RTP_NACK_INTERVAL_MS < nextRepair)
+				nextRepair = gapIter->second.askedAt + UMUNDO_RTP_NACK_INTERVAL_MS;
+			gapIter++;
+		}
+
+		if (seqs.size() > 0 && source.repairPort > 0) {
+			char buffer[UMUNDO_RTP_MTU];
+			size_t size = RTPPacket::writeNack(buffer, RTPPacket::ssrcFor(_uuid), sourceIter->first, seqs);
+
+			struct sockaddr_in toAddr;
+			memset(&toAddr, 0, sizeof(toAddr));
+			toAddr.sin_family = AF_INET;
+			toAddr.sin_port = htons(source.repairPort);
+			toAddr.sin_addr.s_addr = inet_addr(source.repairIP.c_str());
+			if (sendto(_socket, buffer, size, 0, (struct sockaddr*)&toAddr, sizeof(toAddr)) < 0) {
+				UM_LOG_WARN("sendto %s:%d: %s", source.repairIP.c_str(), source.repairPort, strerror(errno));
+			} else {
+				source.nacksSent++;
+			}
+		}
+		sourceIter++;
+	}
+	return nextRepair;
+}
+
+/**
+ * Restore the one datagram of a group we are missing, if we have all the others.
+ */
+void RTPSubscriber::recover(Source& source, uint16_t baseSeq, uint64_t now) {
+	std::map<uint16_t, Parity>::iterator parityIter = source.parities.find(baseSeq);
+	if (parityIter == source.parities.end())
+		return;
+	Parity& parity = parityIter->second;
+
+	size_t nrMissing = 0;
+	for (uint16_t i = 0; i < parity.nrProtected; i++) {
+		if (source.history.find((uint16_t)(baseSeq + i)) == source.history.end())
+			nrMissing++;
+	}
+	if (nrMissing > 1)
+		return; // maybe later
+	if (nrMissing == 0) {
+		source.parities.erase(parityIter);
+		return;
+	}
+
+	std::string datagram = parity.data;
+	uint16_t length = parity.lengthRecovery;
+	for (uint16_t i = 0; i < parity.nrProtected; i++) {
+		std::map<uint16_t, std::pair<uint64_t, std::string> >::iterator historyIter = source.history.find((uint16_t)(baseSeq + i));
+		if (historyIter == source.history.end())
+			continue;
+		const std::string& protectedDatagram = historyIter->second.second;
+		if (datagram.size() < protectedDatagram.size())
+			datagram.resize(protectedDatagram.size(), 0);
+		for (size_t j = 0; j < protectedDatagram.size(); j++)
+			datagram[j] ^= protectedDatagram[j];
+		length ^= protectedDatagram.size();
+	}
+	source.parities.erase(parityIter);
+
+	if (length > datagram.size()) {
+		UM_LOG_WARN("%s: inconsistent parity for %u", SHORT_UUID(_uuid).c_str(), baseSeq);
+		return;
+	}
+
+	source.packetsRecovered++;
+	received(datagram.data(), length, now);
+}
+
+void RTPSubscriber::process(const RTPPacket& packet, uint64_t now) {
+	Source& source = _sources[packet.ssrc];
+
+	uint32_t lateMs;
+	int64_t firstSeq = updateSource(source, packet, now, lateMs) - packet.fragment;
+
+	// the playout time is relative to the fastest packet, later ones had less time in the buffer
+	uint64_t playoutAt = now + playoutDelay(source);
+	playoutAt = (playoutAt > lateMs ? playoutAt - lateMs : 0);
+
+	if (packet.nrFragments == 1) {
+		Message* msg = RTPPacket::deserialize(packet.payload, packet.payloadSize);
+		if (msg == NULL) {
+			UM_LOG_WARN("%s: malformed RTP message from %u", SHORT_UUID(_uuid).c_str(), packet.ssrc);
+			source.messagesDropped++;
+			return;
+		}
+		source.messagesReceived++;
+		enqueue(source, firstSeq, 1, msg, playoutAt);
+		return;
+	}
+
+	// fragments of the same message are numbered consecutively
+	std::map<int64_t, Assembly>::iterator assemblyIter = source.assemblies.find(firstSeq);
+	if (assemblyIter != source.assemblies.end() &&
+	        (assemblyIter->second.timestamp != packet.timestamp || assemblyIter->second.fragments.size() != packet.nrFragments)) {
+		// stale leftovers from before the publisher restarted
+		source.messagesDropped++;
+		source.assemblies.erase(assemblyIter);
+		assemblyIter = source.assemblies.end();
+	}
+
+	if (assemblyIter == source.assemblies.end()) {
+		if (source.assemblies.size() >= UMUNDO_RTP_MAX_ASSEMBLIES) {
+			// make room by giving up on the oldest message
+			std::map<int64_t, Assembly>::iterator oldestIter = source.assemblies.begin();
+			for (assemblyIter = source.assemblies.begin(); assemblyIter != source.assemblies.end(); assemblyIter++) {
+				if (assemblyIter->second.startedAt < oldestIter->second.startedAt)
+					oldestIter = assemblyIter;
+			}
+			source.messagesDropped++;
+			source.assemblies.erase(oldestIter);
+		}
+		assemblyIter = source.assemblies.insert(std::make_pair(firstSeq, Assembly())).first;
+		assemblyIter->second.timestamp = packet.timestamp;
+		assemblyIter->second.startedAt = now;
+		assemblyIter->second.playoutAt = playoutAt;
+		assemblyIter->second.fragments.resize(packet.nrFragments);
+	}
+
+	Assembly& assembly = assemblyIter->second;
+	std::string& fragment = assembly.fragments[packet.fragment];
+	if (fragment.size() > 0 || packet.payloadSize == 0)
+		return; // duplicate
+	fragment.assign(packet.payload, packet.payloadSize);
+	assembly.nrReceived++;
+
+	if (assembly.nrReceived < assembly.fragments.size())
+		return;
+
+	std::string payload;
+	for (size_t i = 0; i < assembly.fragments.size(); i++)
+		payload += assembly.fragments[i];
+	playoutAt = assembly.playoutAt;
+	source.assemblies.erase(assemblyIter);
+
+	Message* msg = RTPPacket::deserialize(payload.data(), payload.size());
+	if (msg == NULL) {
+		UM_LOG_WARN("%s: malformed RTP message from %u", SHORT_UUID(_uuid).c_str(), packet.ssrc);
+		source.messagesDropped++;
+		return;
+	}
+	source.messagesReceived++;
+	enqueue(source, firstSeq, packet.nrFragments, msg, playoutAt);
+}
+
+/**
+ * Extended highest sequence number and interarrival jitter as in RFC 3550 A.1 and A.8.
+ * Returns the extended sequence number of the packet and how much later it arrived than
+ * the fastest packet so far.
+ */
+int64_t RTPSubscriber::updateSource(Source& source, const RTPPacket& packet, uint64_t now, uint32_t& lateMs) {
+	int32_t arrival = (int32_t)(now * (UMUNDO_RTP_CLOCK_RATE / 1000));
+	int32_t transit = arrival - (int32_t)packet.timestamp;
+
+	if (source.received == 0) {
+		source.maxSeq = packet.seq;
+		source.baseSeq = packet.seq;
+		source.cycles = 0;
+		source.transit = transit;
+		source.minTransit = transit;
+	}
+
+	uint16_t delta = packet.seq - source.maxSeq;
+	if (delta < RTP_MAX_DROPOUT) {
+		// in order, with permissible gap
+		if (packet.seq < source.maxSeq)
+			source.cycles += 65536;
+		source.maxSeq = packet.seq;
+	} else if (delta <= 65536 - RTP_MAX_MISORDER) {
+		// the publisher restarted or we lost a lot, start counting anew
+		UM_LOG_INFO("%s: sequence of %u jumped from %u to %u", SHORT_UUID(_uuid).c_str(), packet.ssrc, source.maxSeq, packet.seq);
+		source.maxSeq = packet.seq;
+		source.baseSeq = packet.seq;
+		source.cycles = 0;
+		source.received = 0;
+		source.transit = transit;
+		source.minTransit = transit;
+		source.isPlaying = false;
+	} else {
+		// duplicate or reordered
+	}
+	source.received++;
+
+	int64_t highestSeq = (int64_t)source.cycles + source.maxSeq;
+	int64_t extSeq = highestSeq + (int16_t)(packet.seq - source.maxSeq);
+	if (highestSeq - extSeq > source.reorderDepth)
+		source.reorderDepth = highestSeq - extSeq;
+
+	// all fragments of a message share their timestamp, only the first one tells about the network
+	if (packet.fragment == 0) {
+		double d = transit - source.transit;
+		source.transit = transit;
+		source.jitter += (fabs(d) - source.jitter) / 16.0;
+	}
+
+	if (transit - source.minTransit < 0)
+		source.minTransit = transit;
+	lateMs = (uint32_t)(transit - source.minTransit) / (UMUNDO_RTP_CLOCK_RATE / 1000);
+
+	return extSeq;
+}
+
+/**
+ * Hand a complete message to the jitter buffer or deliver it right away without one.
+ */
+void RTPSubscriber::enqueue(Source& source, int64_t firstSeq, uint16_t nrFragments, Message* msg, uint64_t playoutAt) {
+	if (_targetDelayMs == 0 && source.frames.empty()) {
+		source.isPlaying = false;
+		deliver(msg);
+		return;
+	}
+
+	// we will not deliver out of order
+	if (source.isPlaying && firstSeq < source.nextSeq) {
+		UM_LOG_DEBUG("%s: dropping late message from %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(msg->getMeta("um.pub")).c_str());
+		source.messagesLate++;
+		delete msg;
+		return;
+	}
+
+	Frame& frame = source.frames[firstSeq];
+	if (frame.msg != NULL) {
+		delete msg; // duplicate
+		return;
+	}
+	frame.msg = msg;
+	frame.nrFragments = nrFragments;
+	frame.playoutAt = playoutAt;
+}
+
+/**
+ * Deliver the messages that are due, returns when the next one is due or 0 if there is none.
+ */
+uint64_t RTPSubscriber::playout(uint64_t now) {
+	uint64_t nextPlayout = 0;
+	std::map<uint32_t, Source>::iterator sourceIter = _sources.begin();
+	while(sourceIter != _sources.end()) {
+		Source& source = sourceIter->second;
+		while(source.frames.size() > 0) {
+			std::map<int64_t, Frame>::iterator frameIter = source.frames.begin();
+			if (frameIter->second.playoutAt > now) {
+				if (nextPlayout == 0 || frameIter->second.playoutAt < nextPlayout)
+					nextPlayout = frameIter->second.playoutAt;
+				break;
+			}
+
+			// whatever is still incomplete before this one is lost
+			std::map<int64_t, Assembly>::iterator assemblyIter = source.assemblies.begin();
+			while(assemblyIter != source.assemblies.end() && assemblyIter->first < frameIter->first) {
+				source.messagesDropped++;
+				source.assemblies.erase(assemblyIter++);
+			}
+
+			source.nextSeq = frameIter->first + frameIter->second.nrFragments;
+			source.isPlaying = true;
+			deliver(frameIter->second.msg);
+			source.frames.erase(frameIter);
+		}
+		sourceIter++;
+	}
+	return nextPlayout;
+}
+
+uint32_t RTPSubscriber::playoutDelay(const Source& source) {
+	if (_targetDelayMs == 0)
+		return 0;
+	if (!_isAdaptive)
+		return _targetDelayMs;
+
+	double jitterDelayMs = UMUNDO_RTP_JITTER_MULTIPLIER * source.jitter / (UMUNDO_RTP_CLOCK_RATE / 1000);
+	if (jitterDelayMs > UMUNDO_RTP_MAX_PLAYOUT_DELAY_MS)
+		jitterDelayMs = UMUNDO_RTP_MAX_PLAYOUT_DELAY_MS;
+	return (jitterDelayMs > _targetDelayMs ? (uint32_t)jitterDelayMs : _targetDelayMs);
+}
+
+/**
+ * Give up on messages we did not receive all fragments of in time.
+ */
+void RTPSubscriber::expire(uint64_t now) {
+	ScopeLock lock(_mutex);
+	std::map<uint32_t, Source>::iterator sourceIter = _sources.begin();
+	while(sourceIter != _sources.end()) {
+		std::map<uint16_t, std::pair<uint64_t, std::string> >& history = sourceIter->second.history;
+		std::map<uint16_t, std::pair<uint64_t, std::string> >::iterator historyIter = history.begin();
+		while(historyIter != history.end()) {
+			if (historyIter->second.first + UMUNDO_RTP_REASSEMBLY_MS < now) {
+				history.erase(historyIter++);
+			} else {
+				historyIter++;
+			}
+		}
+
+		std::map<uint16_t, Gap>& gaps = sourceIter->second.gaps;
+		std::map<uint16_t, Gap>::iterator gapIter = gaps.begin();
+		while(gapIter != gaps.end()) {
+			if (gapIter->second.detectedAt + UMUNDO_RTP_REASSEMBLY_MS < now) {
+				gaps.erase(gapIter++);
+			} else {
+				gapIter++;
+			}
+		}
+
+		std::map<uint16_t, Parity>& parities = sourceIter->second.parities;
+		std::map<uint16_t, Parity>::iterator parityIter = parities.begin();
+		while(parityIter != parities.end()) {
+			if (parityIter->second.receivedAt + UMUNDO_RTP_REASSEMBLY_MS < now) {
+				parities.erase(parityIter++);
+			} else {
+				parityIter++;
+			}
+		}
+
+		std::map<int64_t, Assembly>& assemblies = sourceIter->second.assemblies;
+		std::map<int64_t, Assembly>::iterator assemblyIter = assemblies.begin();
+		while(assemblyIter != assemblies.end()) {
+			if (assemblyIter->second.startedAt + UMUNDO_RTP_REASSEMBLY_MS < now) {
+				sourceIter->second.messagesDropped++;
+				assemblies.erase(assemblyIter++);
+			} else {
+				assemblyIter++;
+			}
+		}
+		sourceIter++;
+	}
+}
+
+void RTPSubscriber::deliver(Message* msg) {
+	if (_isSuspended) {
+		delete msg;
+		return;
+	}
+	_ready.push_back(msg);
+}
+
+/**
+ * Hand what deliver collected to the receiver, receivers may call into the node and must not find _mutex held.
+ */
+void RTPSubscriber::dispatch() {
+	ScopeLock lock(_receiveMutex);
+	std::list<Message*> ready;
+	{
+		ScopeLock lock(_mutex);
+		ready.swap(_ready);
+	}
+
+	while(ready.size() > 0) {
+		Message* msg = ready.front();
+		ready.pop_front();
+		if (_receiver != NULL) {
+			_receiver->receive(msg);
+			delete msg;
+		} else {
+			ScopeLock lock(_mutex);
+			_msgQueue.push_back(msg);
+		}
+	}
 }
 
 Message* RTPSubscriber::getNextMsg() {
-	return NULL;
+	ScopeLock lock(_mutex);
+	if (_msgQueue.size() == 0)
+		return NULL;
+	Message* msg = _msgQueue.front();
+	_msgQueue.pop_front();
+	return msg;
 }
 
 bool RTPSubscriber::hasNextMsg() {
-	return false;
+	ScopeLock lock(_mutex);
+	return _msgQueue.size() > 0;
 }
 
-}
\ No newline at end of file
+}
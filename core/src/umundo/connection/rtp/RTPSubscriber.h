@@ -24,12 +24,55 @@
 #include "umundo/config.h"
 #include "umundo/common/Common.h"
 #include "umundo/connection/Subscriber.h"
+#include "umundo/connection/rtp/RTPPacket.h"
+
+#define UMUNDO_RTP_RCVBUF 1048576 ///< socket receive buffer, bursts of fragments must not overflow it
+#define UMUNDO_RTP_JITTER_MULTIPLIER 3 ///< an adaptive playout delay covers this many times the jitter
+#define UMUNDO_RTP_MAX_PLAYOUT_DELAY_MS 2000 ///< an adaptive playout delay never grows beyond
+#define UMUNDO_RTP_NACK_INTERVAL_MS 20 ///< we ask a multicast publisher again for what is still missing after this long
+#define UMUNDO_RTP_MAX_NACK_GAP 256 ///< we do not ask for larger gaps, we lost too much for repair to make sense
 
 namespace umundo {
 
 class PublisherStub;
 class NodeStub;
 
+/**
+ * Reception statistics of an RTP subscriber summed over all publishers.
+ */
+class DLLEXPORT RTPStats {
+public:
+	RTPStats() : packetsReceived(0), packetsLost(0), packetsRecovered(0), packetsRepaired(0), nacksSent(0), messagesReceived(0), messagesDropped(0), messagesLate(0), messagesBuffered(0), reorderDepth(0), jitterMs(0), playoutDelayMs(0) {}
+	uint64_t packetsReceived;
+	uint64_t packetsLost; ///< expected minus received as in RFC 3550, duplicates offset losses
+	uint64_t packetsRecovered; ///< from parity datagrams, these count as received
+	uint64_t packetsRepaired; ///< retransmitted by a multicast publisher after we asked
+	uint64_t nacksSent;
+	uint64_t messagesReceived; ///< complete, including the late ones
+	uint64_t messagesDropped; ///< incomplete when we gave up on them
+	uint64_t messagesLate; ///< complete only after a later message was played out
+	uint64_t messagesBuffered; ///< waiting for their playout time in the jitter buffer
+	uint32_t reorderDepth; ///< the most packets any packet arrived behind a later one
+	double jitterMs; ///< interarrival jitter, the largest of any publisher
+	double playoutDelayMs; ///< current delay of the jitter buffer, the largest of any publisher
+};
+
+/**
+ * Concrete subscriber implementor for RTP over UDP (bridge pattern).
+ *
+ * We bind a socket to any free port when initialized, our node sends the port along with the
+ * subscription and publishers will send their datagrams there. Fragmented messages are
+ * reassembled in any order and delivered as soon as they are complete. If the publisher sends
+ * parity datagrams, we remember the recent datagrams to recover a lost one from them.
+ *
+ * For multicast publishers we join their group on a second socket shared by all of them and
+ * ask them for lost datagrams with NACKs from our own socket.
+ *
+ * With a playout delay, complete messages wait in a jitter buffer per publisher and are
+ * delivered in order of their sequence numbers once the delay after their timestamp passed.
+ * A message still missing when a later one is due is given up, a message completed after a
+ * later one was delivered is dropped as late.
+ */
 class DLLEXPORT RTPSubscriber : public SubscriberImpl, public Thread {
 public:
 	boost::shared_ptr<Implementation> create();
@@ -45,12 +88,117 @@ public:
 	void added(const PublisherStub& pub, const NodeStub& node);
 	void removed(const PublisherStub& pub, const NodeStub& node);
 
+	RTPStats getStats();
+
+	/**
+	 * Delay messages for smooth, ordered playout, 0 delivers them as soon as they are complete.
+	 * An adaptive delay grows with the jitter we measure but never shrinks below the target.
+	 */
+	void setPlayoutDelay(uint32_t targetDelayMs, bool isAdaptive = true);
+
 	// Thread
 	void run();
 
 protected:
 	RTPSubscriber();
 
+	/// The fragments of a message we received so far
+	class Assembly {
+	public:
+		Assembly() : timestamp(0), nrReceived(0), startedAt(0), playoutAt(0) {}
+		uint32_t timestamp;
+		uint16_t nrReceived;
+		uint64_t startedAt;
+		uint64_t playoutAt;
+		std::vector<std::string> fragments;
+	};
+
+	/// A complete message in the jitter buffer
+	class Frame {
+	public:
+		Frame() : msg(NULL), nrFragments(0), playoutAt(0) {}
+		Message* msg;
+		uint16_t nrFragments;
+		uint64_t playoutAt;
+	};
+
+	/// A parity datagram waiting for all but one of the datagrams it protects
+	class Parity {
+	public:
+		Parity() : nrProtected(0), lengthRecovery(0), receivedAt(0) {}
+		uint8_t nrProtected;
+		uint16_t lengthRecovery;
+		uint64_t receivedAt;
+		std::string data;
+	};
+
+	/// Datagrams of a multicast publisher we did not receive
+	class Gap {
+	public:
+		Gap() : detectedAt(0), askedAt(0) {}
+		uint64_t detectedAt;
+		uint64_t askedAt; ///< 0 if we did not ask yet
+	};
+
+	/// Sequence number and jitter bookkeeping per synchronization source as in RFC 3550 A.1 and A.8
+	class Source {
+	public:
+		Source() : maxSeq(0), cycles(0), baseSeq(0), received(0), transit(0), minTransit(0), jitter(0), messagesReceived(0), messagesDropped(0), messagesLate(0), reorderDepth(0), nextSeq(0), isPlaying(false), isProtected(false), packetsRecovered(0), isMulticast(false), repairPort(0), packetsRepaired(0), nacksSent(0) {}
+		uint16_t maxSeq;
+		uint32_t cycles; ///< shifted count of sequence number wrap arounds
+		uint32_t baseSeq;
+		uint64_t received;
+		int32_t transit; ///< relative transit time of the previous packet
+		int32_t minTransit; ///< of the fastest packet, the others are late by the difference
+		double jitter; ///< in timestamp units
+		uint64_t messagesReceived;
+		uint64_t messagesDropped;
+		uint64_t messagesLate;
+		uint32_t reorderDepth;
+		int64_t nextSeq; ///< extended sequence number of the message we play out next
+		bool isPlaying;
+		std::map<int64_t, Assembly> assemblies; ///< by extended sequence number of the first fragment
+		std::map<int64_t, Frame> frames; ///< the jitter buffer, by extended sequence number of the first fragment
+		bool isProtected; ///< whether the publisher sends parity
+		uint64_t packetsRecovered;
+		std::map<uint16_t, std::pair<uint64_t, std::string> > history; ///< recent datagrams with their arrival while protected or repaired
+		std::map<uint16_t, Parity> parities; ///< by sequence number of the first datagram they protect
+		bool isMulticast;
+		std::string repairIP; ///< where the publisher sends from and takes NACKs
+		uint16_t repairPort;
+		std::map<uint16_t, Gap> gaps; ///< by sequence number
+		uint64_t packetsRepaired;
+		uint64_t nacksSent;
+	};
+
+	void receive(int socket, uint64_t now);
+	void received(const char* buffer, size_t size, uint64_t now);
+	void recover(Source& source, uint16_t baseSeq, uint64_t now);
+	void process(const RTPPacket& packet, uint64_t now);
+	void detectGaps(Source& source, const RTPPacket& packet, uint64_t now);
+	uint64_t requestRepair(uint64_t now);
+	void joinGroup(const PublisherStub& pub);
+	void leaveGroup(const PublisherStub& pub);
+	int64_t updateSource(Source& source, const RTPPacket& packet, uint64_t now, uint32_t& lateMs);
+	void enqueue(Source& source, int64_t firstSeq, uint16_t nrFragments, Message* msg, uint64_t playoutAt);
+	uint64_t playout(uint64_t now);
+	void expire(uint64_t now);
+	void deliver(Message* msg);
+	void dispatch();
+	uint32_t playoutDelay(const Source& source);
+
+	int _socket;
+	int _mcastSocket; ///< for all multicast publishers, opened with the first
+	std::map<std::string, size_t> _groups; ///< publishers per multicast group we joined
+	std::set<uint32_t> _mcastSSRCs; ///< others may send to the same groups and port
+	uint32_t _targetDelayMs;
+	bool _isAdaptive;
+	std::map<uint32_t, Source> _sources; ///< by ssrc
+	std::list<Message*> _msgQueue; ///< for getNextMsg without a receiver
+	std::list<Message*> _ready; ///< complete and due, not yet handed to the receiver
+	Mutex _mutex;
+	Mutex _receiveMutex; ///< held while the receiver runs, never while we hold _mutex
+
 private:
 
 	friend class Factory;
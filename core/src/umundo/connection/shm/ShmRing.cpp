@@ -0,0 +1,438 @@
+/**
+ *  @file
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/connection/shm/ShmRing.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+#define SHM_RING_MAGIC 0x756d5348 // "umSH"
+#define SHM_RING_VERSION 2
+#define SHM_RING_HEADER_SIZE 384 // keep the data on its own cache lines
+#define SHM_RING_ALIGN(pos) (((pos) + 7) & ~((size_t)7))
+
+namespace umundo {
+
+ShmRing::ShmRing(const std::string& name, bool isWriter) :
+	_name(name),
+	_isWriter(isWriter),
+	_fd(-1),
+	_header(NULL),
+	_data(NULL),
+	_capacity(0),
+	_mappedSize(0),
+	_pendingStart(0),
+	_pendingPos(0),
+	_pendingFrames(0),
+	_pendingFailed(false),
+	_slot(-1),
+	_readPos(0),
+	_buffer(NULL),
+	_bufferSize(0),
+	_bufferCapacity(0),
+	_nrFrames(0),
+	_overruns(0),
+	_messagesRead(0) {
+}
+
+ShmRing::~ShmRing() {
+	if (_header != NULL) {
+		if (_slot >= 0)
+			__sync_bool_compare_and_swap(&_header->readers[_slot].pid, (size_t)getpid(), (size_t)0);
+		munmap(_header, _mappedSize) && UM_LOG_WARN("munmap %s: %s", _name.c_str(), strerror(errno));
+	}
+	if (_isWriter) {
+		shm_unlink(_name.c_str());
+		if (_fd >= 0)
+			close(_fd);
+	}
+	if (_buffer != NULL)
+		free(_buffer);
+}
+
+std::string ShmRing::nameFor(const std::string& uuid) {
+	// some systems allow no more than 31 characters
+	std::string name("/um.");
+	for (size_t i = 0; i < uuid.length() && name.length() < 30; i++) {
+		if (uuid[i] != '-')
+			name += uuid[i];
+	}
+	return name;
+}
+
+/**
+ * Unlink rings nobody holds the lock for, their writer crashed or was killed.
+ */
+void ShmRing::removeStale() {
+#ifdef __linux__
+	// only linux lists the segments as files
+	DIR* dir = opendir("/dev/shm");
+	if (dir == NULL)
+		return;
+
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "um.", 3) != 0)
+			continue;
+
+		std::string name = std::string("/") + entry->d_name;
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if (fd < 0)
+			continue;
+		if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+			UM_LOG_INFO("removing stale shared memory ring %s", name.c_str());
+			shm_unlink(name.c_str());
+		}
+		close(fd);
+	}
+	closedir(dir);
+#endif
+}
+
+ShmRing* ShmRing::create(const std::string& name, size_t capacity) {
+	assert(sizeof(Header) <= SHM_RING_HEADER_SIZE);
+
+	static bool hasRemovedStale = false;
+	if (!hasRemovedStale) {
+		hasRemovedStale = true;
+		removeStale();
+	}
+
+	// positions wrap around with the machine word, capacity has to divide it
+	size_t powerOfTwo = 4096;
+	while (powerOfTwo < capacity)
+		powerOfTwo <<= 1;
+
+	int fd = shm_open(name.c_str(), O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		UM_LOG_WARN("shm_open %s: %s", name.c_str(), strerror(errno));
+		return NULL;
+	}
+
+	// held until we unlink the ring, the system releases it should we crash
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+		UM_LOG_INFO("flock %s: %s - ring will not be removed if we crash", name.c_str(), strerror(errno));
+
+	size_t mappedSize = SHM_RING_HEADER_SIZE + powerOfTwo;
+	if (ftruncate(fd, mappedSize) != 0) {
+		UM_LOG_WARN("ftruncate %s: %s", name.c_str(), strerror(errno));
+		close(fd);
+		shm_unlink(name.c_str());
+		return NULL;
+	}
+
+	void* mapped = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED) {
+		UM_LOG_WARN("mmap %s: %s", name.c_str(), strerror(errno));
+		close(fd);
+		shm_unlink(name.c_str());
+		return NULL;
+	}
+
+	ShmRing* ring = new ShmRing(name, true);
+	ring->_fd = fd;
+	ring->_header = (Header*)mapped;
+	ring->_data = (char*)mapped + SHM_RING_HEADER_SIZE;
+	ring->_capacity = powerOfTwo;
+	ring->_mappedSize = mappedSize;
+
+	ring->_header->version = SHM_RING_VERSION;
+	ring->_header->capacity = powerOfTwo;
+	ring->_header->writePos = 0;
+	ring->_header->reservedPos = 0;
+	ring->_header->messagesWritten = 0;
+	ring->_header->framesWritten = 0;
+	ring->_header->seq = 0;
+	ring->_header->waiters = 0;
+	memset((void*)ring->_header->readers, 0, sizeof(ring->_header->readers));
+	Atomic::barrier();
+	ring->_header->magic = SHM_RING_MAGIC; // readers check this last
+
+	return ring;
+}
+
+ShmRing* ShmRing::attach(const std::string& name) {
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd < 0)
+		return NULL;
+
+	struct stat fdStat;
+	if (fstat(fd, &fdStat) != 0 || (size_t)fdStat.st_size <= SHM_RING_HEADER_SIZE) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t mappedSize = fdStat.st_size;
+	void* mapped = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		UM_LOG_WARN("mmap %s: %s", name.c_str(), strerror(errno));
+		return NULL;
+	}
+
+	Header* header = (Header*)mapped;
+	if (header->magic != SHM_RING_MAGIC ||
+	        header->version != SHM_RING_VERSION ||
+	        header->capacity + SHM_RING_HEADER_SIZE != mappedSize) {
+		UM_LOG_WARN("%s is not a compatible shared memory ring", name.c_str());
+		munmap(mapped, mappedSize);
+		return NULL;
+	}
+	Atomic::barrier();
+
+	ShmRing* ring = new ShmRing(name, false);
+	ring->_header = header;
+	ring->_data = (char*)mapped + SHM_RING_HEADER_SIZE;
+	ring->_capacity = header->capacity;
+	ring->_mappedSize = mappedSize;
+
+	// take a free slot or the one of a reader that is gone
+	size_t now = Thread::getMonotonicMs();
+	for (int i = 0; i < UMUNDO_SHM_RING_MAX_READERS && ring->_slot < 0; i++) {
+		size_t pid = Atomic::load(&header->readers[i].pid);
+		if (pid != 0 && !ring->isGone(header->readers[i], now))
+			continue;
+		header->readers[i].aliveMs = now;
+		if (__sync_bool_compare_and_swap(&header->readers[i].pid, pid, (size_t)getpid()))
+			ring->_slot = i;
+	}
+	if (ring->_slot < 0) {
+		UM_LOG_INFO("%s has %d readers already", name.c_str(), UMUNDO_SHM_RING_MAX_READERS);
+		delete ring;
+		return NULL;
+	}
+
+	// start with the next message
+	ring->_readPos = Atomic::load(&header->writePos);
+	return ring;
+}
+
+/**
+ * Let the writer know we are still there.
+ */
+void ShmRing::heartbeat() {
+	if (_slot >= 0)
+		_header->readers[_slot].aliveMs = Thread::getMonotonicMs();
+}
+
+/**
+ * Whether the reader in the slot did not show up for a while and its process is gone.
+ */
+bool ShmRing::isGone(ReaderSlot& slot, size_t now) {
+	if (now - Atomic::load(&slot.aliveMs) < UMUNDO_SHM_RING_READER_TIMEOUT_MS)
+		return false;
+
+	pid_t pid = Atomic::load(&slot.pid);
+	if (kill(pid, 0) == 0 || errno != ESRCH) {
+		// blocked in a receiver, do not ask again for a while
+		slot.aliveMs = now;
+		return false;
+	}
+	return true;
+}
+
+void ShmRing::copyIn(size_t pos, const void* data, size_t size) {
+	size_t offset = pos & (_capacity - 1);
+	size_t first = (size < _capacity - offset ? size : _capacity - offset);
+	memcpy(_data + offset, data, first);
+	if (first < size)
+		memcpy(_data, (const char*)data + first, size - first);
+}
+
+void ShmRing::copyOut(size_t pos, void* data, size_t size) {
+	size_t offset = pos & (_capacity - 1);
+	size_t first = (size < _capacity - offset ? size : _capacity - offset);
+	memcpy(data, _data + offset, first);
+	if (first < size)
+		memcpy((char*)data + first, _data, size - first);
+}
+
+/**
+ * Announce that we are about to overwrite everything up to pos - capacity.
+ */
+void ShmRing::reserve(size_t pos) {
+	if ((ssize_t)(pos - _header->reservedPos) > 0)
+		Atomic::store(&_header->reservedPos, pos);
+}
+
+bool ShmRing::hasReaders() {
+	size_t now = Thread::getMonotonicMs();
+	bool hasReaders = false;
+	for (int i = 0; i < UMUNDO_SHM_RING_MAX_READERS; i++) {
+		size_t pid = Atomic::load(&_header->readers[i].pid);
+		if (pid == 0)
+			continue;
+		if (isGone(_header->readers[i], now)) {
+			UM_LOG_INFO("%s: reader in process %lu is gone", _name.c_str(), (unsigned long)pid);
+			__sync_bool_compare_and_swap(&_header->readers[i].pid, pid, (size_t)0);
+			continue;
+		}
+		hasReaders = true;
+	}
+	return hasReaders;
+}
+
+void ShmRing::beginWrite() {
+	assert(_isWriter);
+	_pendingStart = _header->writePos;
+	_pendingPos = _pendingStart + 8; // message size and number of frames
+	_pendingFrames = 0;
+	_pendingFailed = false;
+}
+
+bool ShmRing::writeFrame(const void* data, size_t size) {
+	if (_pendingFailed)
+		return false;
+
+	// a message must never overwrite its own beginning
+	if (_pendingPos - _pendingStart + 4 + size > _capacity) {
+		UM_LOG_WARN("message exceeds shared memory ring %s of %lu bytes - dropping", _name.c_str(), _capacity);
+		_pendingFailed = true;
+		return false;
+	}
+
+	uint32_t frameSize = size;
+	reserve(_pendingPos + 4 + size);
+	copyIn(_pendingPos, &frameSize, 4);
+	copyIn(_pendingPos + 4, data, size);
+	_pendingPos += 4 + size;
+	_pendingFrames++;
+	return true;
+}
+
+void ShmRing::commit() {
+	if (_pendingFailed)
+		return;
+
+	uint32_t messageHeader[2];
+	messageHeader[0] = _pendingPos - _pendingStart - 8;
+	messageHeader[1] = _pendingFrames;
+	reserve(SHM_RING_ALIGN(_pendingPos));
+	copyIn(_pendingStart, messageHeader, 8);
+
+	Atomic::store(&_header->writePos, SHM_RING_ALIGN(_pendingPos));
+	Atomic::add(&_header->messagesWritten, 1);
+	Atomic::add(&_header->framesWritten, _pendingFrames);
+
+#ifdef __linux__
+	__sync_add_and_fetch(&_header->seq, 1);
+	if (_header->waiters > 0)
+		syscall(SYS_futex, &_header->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+	_header->seq++;
+#endif
+}
+
+bool ShmRing::read() {
+	heartbeat();
+
+	size_t writePos = Atomic::load(&_header->writePos);
+	if (writePos == _readPos)
+		return false;
+
+	if (writePos - _readPos > _capacity) {
+		// we have been lapped
+		_overruns++;
+		_readPos = writePos;
+		return false;
+	}
+
+	uint32_t messageHeader[2];
+	copyOut(_readPos, messageHeader, 8);
+	size_t size = messageHeader[0];
+
+	if (size + 8 <= _capacity) {
+		if (_bufferCapacity < size) {
+			_buffer = (char*)realloc(_buffer, size);
+			_bufferCapacity = size;
+		}
+		copyOut(_readPos + 8, _buffer, size);
+		Atomic::barrier();
+	}
+
+	// did the writer overwrite the message while we copied?
+	if (size + 8 > _capacity || Atomic::load(&_header->reservedPos) - _readPos > _capacity) {
+		_overruns++;
+		_readPos = Atomic::load(&_header->writePos);
+		return false;
+	}
+
+	_bufferSize = size;
+	_nrFrames = messageHeader[1];
+	_readPos = SHM_RING_ALIGN(_readPos + 8 + size);
+	_messagesRead++;
+	return true;
+}
+
+bool ShmRing::wait(uint32_t timeoutMs) {
+	heartbeat();
+
+#ifdef __linux__
+	int32_t seq = _header->seq;
+	Atomic::barrier();
+	if (Atomic::load(&_header->writePos) != _readPos)
+		return true;
+
+	struct timespec timeout;
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_nsec = (timeoutMs % 1000) * 1000000;
+
+	// the writer only wakes the futex when someone is waiting
+	__sync_add_and_fetch(&_header->waiters, 1);
+	syscall(SYS_futex, &_header->seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+	__sync_sub_and_fetch(&_header->waiters, 1);
+#else
+	// no futex, poll the write position
+	uint64_t start = Thread::getMonotonicMs();
+	while (Atomic::load(&_header->writePos) == _readPos && Thread::getMonotonicMs() - start < timeoutMs)
+		Thread::sleepMs(1);
+#endif
+	return Atomic::load(&_header->writePos) != _readPos;
+}
+
+const char* ShmRing::nextFrame(const char* ptr, const char* end, const char*& frame, size_t& frameSize) {
+	if (ptr == NULL || ptr + 4 > end)
+		return NULL;
+
+	uint32_t size;
+	memcpy(&size, ptr, 4);
+	if (ptr + 4 + size > end)
+		return NULL;
+
+	frame = ptr + 4;
+	frameSize = size;
+	return ptr + 4 + size;
+}
+
+}
@@ -0,0 +1,157 @@
+/**
+ *  @file
+ *  @brief      Message ring in shared memory for nodes on the same host.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef SHMRING_H_Q8ZK2WDN
+#define SHMRING_H_Q8ZK2WDN
+
+#include "umundo/common/Common.h"
+#include "umundo/thread/Thread.h"
+
+/// default capacity of a node's ring, pages are only backed once written
+#define UMUNDO_SHM_RING_SIZE (32 * 1024 * 1024)
+/// readers attached to a ring at the same time, more fall back to sockets
+#define UMUNDO_SHM_RING_MAX_READERS 16
+/// readers that did not look at the ring for longer are checked for their process
+#define UMUNDO_SHM_RING_READER_TIMEOUT_MS 2000
+
+namespace umundo {
+
+/**
+ * A ring of multi-part messages in POSIX shared memory with one writer and many readers.
+ *
+ * The writer never waits for readers, a reader that falls behind by more than the
+ * capacity loses the overwritten messages and continues with the most recent one.
+ * Readers sleep on a futex in the ring's header where available and poll otherwise.
+ *
+ * Every reader occupies a slot with its pid in the header, the writer frees the slots
+ * of readers that crashed. The writer holds a lock on the segment, so the rings of
+ * writers that crashed can be told apart and are removed by the next one to start.
+ */
+class DLLEXPORT ShmRing {
+public:
+	static ShmRing* create(const std::string& name, size_t capacity); ///< create as writer
+	static ShmRing* attach(const std::string& name); ///< attach as reader, NULL if there is no such ring
+	static std::string nameFor(const std::string& uuid); ///< short enough for all platforms
+	static void removeStale(); ///< unlink the rings of writers that are gone, where we can list them
+	virtual ~ShmRing();
+
+	/** @name Writer */
+	//@{
+	void beginWrite();
+	bool writeFrame(const void* data, size_t size);
+	void commit();
+	bool hasReaders();
+	//@}
+
+	/// messages and frames committed to the ring so far, by whomever writes it
+	size_t getMessagesWritten() {
+		return Atomic::load(&_header->messagesWritten);
+	}
+	size_t getFramesWritten() {
+		return Atomic::load(&_header->framesWritten);
+	}
+
+	/** @name Reader */
+	//@{
+	bool read(); ///< copy the next message, false if there is none
+	bool wait(uint32_t timeoutMs); ///< whether a message became available within the timeout
+	const char* getData() {
+		return _buffer;
+	}
+	size_t getSize() {
+		return _bufferSize;
+	}
+	uint32_t getNrFrames() {
+		return _nrFrames;
+	}
+	size_t getOverruns() {
+		return _overruns;
+	}
+	size_t getMessagesRead() {
+		return _messagesRead;
+	}
+	//@}
+
+	/// Iterate the frames of a message, returns NULL past the last one
+	static const char* nextFrame(const char* ptr, const char* end, const char*& frame, size_t& frameSize);
+
+	const std::string& getName() {
+		return _name;
+	}
+	size_t getCapacity() {
+		return _capacity;
+	}
+
+protected:
+	struct ReaderSlot {
+		volatile size_t pid; ///< process of the reader, 0 if the slot is free
+		volatile size_t aliveMs; ///< monotonic time the reader was last known to be alive
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t capacity;
+		volatile size_t writePos; ///< end of the last committed message
+		volatile size_t reservedPos; ///< end of the region the writer may be overwriting right now
+		volatile size_t messagesWritten;
+		volatile size_t framesWritten;
+		volatile int32_t seq; ///< futex word, incremented with every commit
+		volatile int32_t waiters;
+		ReaderSlot readers[UMUNDO_SHM_RING_MAX_READERS];
+	};
+
+	ShmRing(const std::string& name, bool isWriter);
+
+	void heartbeat();
+	bool isGone(ReaderSlot& slot, size_t now);
+
+	void copyIn(size_t pos, const void* data, size_t size);
+	void copyOut(size_t pos, void* data, size_t size);
+	void reserve(size_t pos);
+
+	std::string _name;
+	bool _isWriter;
+	int _fd; ///< the writer keeps the segment open and locked
+	Header* _header;
+	char* _data;
+	size_t _capacity;
+	size_t _mappedSize;
+
+	// writer state
+	size_t _pendingStart;
+	size_t _pendingPos;
+	uint32_t _pendingFrames;
+	bool _pendingFailed;
+
+	// reader state
+	int _slot;
+	size_t _readPos;
+	char* _buffer;
+	size_t _bufferSize;
+	size_t _bufferCapacity;
+	uint32_t _nrFrames;
+	size_t _overruns;
+	size_t _messagesRead;
+};
+
+}
+
+#endif /* end of include guard: SHMRING_H_Q8ZK2WDN */
@@ -17,8 +17,19 @@
  *  @endcond
  */
 
-#define UMUNDO_PERF_WINDOW_LENGTH_MS 5000
-#define UMUNDO_PERF_BUCKET_LENGTH_MS 200.0
+#define UMUNDO_NODE_MSGS_PER_ROUND 64 ///< maximum number of messages we read from a single socket per poll
+#define UMUNDO_NODE_PUB_HISTORY 1024 ///< changes to our publisher table we remember to send deltas
+#define UMUNDO_NODE_IDLE_PUB_TABLES 64 ///< publisher tables of disconnected nodes we keep to receive deltas when they return
+#define UMUNDO_NODE_FAILOVER_MS 30000 ///< default time without a sign of life before we remove a remote node
+#define UMUNDO_NODE_TIMER_SLOTS 64 ///< slots in the timer wheel for liveness
+#define UMUNDO_NODE_IPC_DIR "/tmp" ///< where we create ipc socket files
+#define UMUNDO_NODE_BATCH_META "um.batch" ///< meta field with the number of publications in a batch
+#define UMUNDO_NODE_SUBSCRIBE_BATCH 16384 ///< send queued subscriptions for a node once they are this large
+#define UMUNDO_NODE_MAX_HANDSHAKES 32 ///< default number of CONNECT_REQs we have in flight at most
+#define UMUNDO_NODE_HANDSHAKE_MS 2000 ///< time we wait for the first CONNECT_REP, doubled with every attempt
+#define UMUNDO_NODE_HANDSHAKE_MAX_MS 32000 ///< upper bound for the time we wait for a CONNECT_REP
+#define UMUNDO_NODE_ADMISSION_MS 100 ///< how often we look at handshakes while some are pending
+#define UMUNDO_NODE_PEER_CACHE_SAVE_MS 1000 ///< how often we write a changed peer cache at most
 
 #include "umundo/connection/zeromq/ZeroMQNode.h"
 
@@ -30,13 +41,26 @@
 #include <stdio.h> // snprintf
 #endif
 
+#ifndef WIN32
+#include <dirent.h> // opendir
+#include <fcntl.h> // open
+#include <sys/file.h> // flock
+#include <unistd.h> // unlink, close
+#endif
+
 #include <boost/lexical_cast.hpp>
 
 #include "umundo/common/Message.h"
+#include "umundo/common/Host.h"
 #include "umundo/common/Regex.h"
 #include "umundo/common/UUID.h"
 #include "umundo/connection/zeromq/ZeroMQPublisher.h"
 #include "umundo/connection/zeromq/ZeroMQSubscriber.h"
+#include "umundo/connection/PubSummary.h"
+
+#ifdef NET_SHM
+#include "umundo/connection/shm/ShmRing.h"
+#endif
 
 #define DRAIN_SOCKET(socket) \
 for(;;) { \
@@ -79,7 +103,11 @@ readPtr = recvBuffer;
 pub.getChannelName().length() + 1 + pub.getUUID().length() + 1 + 2 + 2
 
 #define SUB_INFO_SIZE(sub) \
-sub.getChannelName().length() + 1 + sub.getUUID().length() + 1 + 2
+sub.getChannelName().length() + 1 + sub.getUUID().length() + 1 + 2 + (sub.getImpl()->implType == Subscriber::RTP ? 2 : 0)
+
+// RTP subscribers receive from unicast and multicast RTP publishers alike
+#define TYPES_MATCH(subType, pubType) \
+(subType == (pubType & ~Publisher::MULTICAST))
 
 #define PREPARE_MSG(msg, size) \
 zmq_msg_t msg; \
@@ -97,11 +125,10 @@ while (nodeIter_ != _connFrom.end()) {\
 		zmq_msg_copy(&broadCastMsgCopy_, &msg) && UM_LOG_ERR("zmq_msg_copy: %s", zmq_strerror(errno));\
 		UM_LOG_DEBUG("%s: Broadcasting to %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(nodeIter_->first).c_str()); \
 		zmq_send(_nodeSocket, nodeIter_->first.c_str(), nodeIter_->first.length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));\
-		_buckets.back().nrMetaMsgSent++;\
-		_buckets.back().sizeMetaMsgSent += nodeIter_->first.length();\
+		nodeIter_->second->lastSent = Thread::getMonotonicMs();\
+		_stats.recordMetaMsgSent(nodeIter_->first.length());\
 		zmq_msg_send(&broadCastMsgCopy_, _nodeSocket, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));\
-		_buckets.back().nrMetaMsgSent++;\
-		_buckets.back().sizeMetaMsgSent += zmq_msg_size(&broadCastMsgCopy_);\
+		_stats.recordMetaMsgSent(zmq_msg_size(&broadCastMsgCopy_));\
 		zmq_msg_close(&broadCastMsgCopy_) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));\
 	}\
 	nodeIter_++;\
@@ -119,7 +146,51 @@ void* ZeroMQNode::getZeroMQContext() {
 }
 void* ZeroMQNode::_zmqContext = NULL;
 
-ZeroMQNode::ZeroMQNode() {
+/**
+ * Apply I/O thread and socket limit options to the process-wide context.
+ *
+ * 0MQ starts its I/O threads with the first socket, so this has to happen before.
+ */
+void ZeroMQNode::configureZeroMQContext(std::map<std::string, std::string>& options) {
+	bool isPristine = (_zmqContext == NULL);
+	void* context = getZeroMQContext();
+
+	if (options["node.zmq.ioThreads"].length() > 0) {
+		int ioThreads = strTo<int>(options["node.zmq.ioThreads"]);
+		if (isPristine) {
+			zmq_ctx_set(context, ZMQ_IO_THREADS, ioThreads) && UM_LOG_ERR("zmq_ctx_set: %s", zmq_strerror(errno));
+		} else if (zmq_ctx_get(context, ZMQ_IO_THREADS) != ioThreads) {
+			UM_LOG_WARN("0MQ context already created with %d I/O threads, ignoring request for %d", zmq_ctx_get(context, ZMQ_IO_THREADS), ioThreads);
+		}
+	}
+
+	if (options["node.zmq.maxSockets"].length() > 0) {
+		int maxSockets = strTo<int>(options["node.zmq.maxSockets"]);
+		if (isPristine) {
+			zmq_ctx_set(context, ZMQ_MAX_SOCKETS, maxSockets) && UM_LOG_ERR("zmq_ctx_set: %s", zmq_strerror(errno));
+		} else if (zmq_ctx_get(context, ZMQ_MAX_SOCKETS) < maxSockets) {
+			UM_LOG_WARN("0MQ context already created for %d sockets, ignoring request for %d", zmq_ctx_get(context, ZMQ_MAX_SOCKETS), maxSockets);
+		}
+	}
+
+	if (options["node.zmq.cpus"].length() > 0) {
+		if (!isPristine) {
+			UM_LOG_WARN("0MQ context already created, not pinning I/O threads to cpus %s", options["node.zmq.cpus"].c_str());
+			return;
+		}
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+		std::stringstream cpus(options["node.zmq.cpus"]);
+		std::string cpu;
+		while (std::getline(cpus, cpu, ',')) {
+			zmq_ctx_set(context, ZMQ_THREAD_AFFINITY_CPU_ADD, strTo<int>(cpu)) && UM_LOG_ERR("zmq_ctx_set: %s", zmq_strerror(errno));
+		}
+#else
+		UM_LOG_WARN("libzmq too old to pin I/O threads to cpus %s", options["node.zmq.cpus"].c_str());
+#endif
+	}
+}
+
+ZeroMQNode::ZeroMQNode() : _mutex("node.zmq"), _shmRing(NULL), _ipcLockFd(-1) {
 }
 
 ZeroMQNode::~ZeroMQNode() {
@@ -135,6 +206,17 @@ ZeroMQNode::~ZeroMQNode() {
 	COMMON_VARS;
 	ScopeLock lock(_mutex);
 
+	// remember who we were connected to for the next start, the cache keeps wall clock times
+	uint64_t wallNow = Thread::getTimeStampMs();
+	uint64_t now = Thread::getMonotonicMs();
+	std::map<std::string, boost::shared_ptr<NodeConnection> >::iterator connIter = _connTo.begin();
+	while(connIter != _connTo.end()) {
+		if (connIter->first == connIter->second->address && connIter->second->connectedTo && connIter->second->node)
+			_peerCache.seen(connIter->first, connIter->second->node.getUUID(), wallNow - (now - connIter->second->lastSeen));
+		connIter++;
+	}
+	_peerCache.save();
+
 	PREPARE_MSG(shutdownMsg, 4 + 37);
 	writePtr = writeVersionAndType(writePtr, Message::SHUTDOWN);
 	assert(writePtr - writeBuffer == 4);
@@ -165,6 +247,20 @@ ZeroMQNode::~ZeroMQNode() {
 	zmq_close(_subSocket)     && UM_LOG_ERR("zmq_close: %s",zmq_strerror(errno));
 	zmq_close(_readOpSocket)  && UM_LOG_ERR("zmq_close: %s", zmq_strerror(errno));
 	zmq_close(_writeOpSocket) && UM_LOG_ERR("zmq_close: %s", zmq_strerror(errno));
+
+#ifndef WIN32
+	if (_ipcEndpoint.length() > 0)
+		unlink(_ipcEndpoint.substr(6).c_str()); // 0MQ does not remove the file on every version
+	if (_ipcLockFd >= 0) {
+		unlink((_ipcEndpoint.substr(6) + ".lock").c_str());
+		close(_ipcLockFd);
+	}
+#endif
+
+#ifdef NET_SHM
+	if (_shmRing != NULL)
+		delete _shmRing;
+#endif
 	UM_LOG_INFO("%s: node gone", SHORT_UUID(_uuid).c_str());
 
 }
@@ -177,7 +273,36 @@ void ZeroMQNode::init(Options* options) {
 
 	_transport = "tcp";
 	_ip = "127.0.0.1";
-	_lastNodeInfoBroadCast = Thread::getTimeStampMs();
+	_pubVersion = 0;
+
+	_failoverMs = UMUNDO_NODE_FAILOVER_MS;
+	if (_options["node.failoverMs"].length() > 0)
+		_failoverMs = strTo<uint32_t>(_options["node.failoverMs"]);
+	_heartbeatMs = _failoverMs / 3;
+	_timers = TimerWheel<boost::weak_ptr<NodeConnection> >(_heartbeatMs / 4, UMUNDO_NODE_TIMER_SLOTS, Thread::getMonotonicMs());
+
+	_maxHandshakes = UMUNDO_NODE_MAX_HANDSHAKES;
+	if (_options["node.connect.maxPending"].length() > 0)
+		_maxHandshakes = strTo<uint32_t>(_options["node.connect.maxPending"]);
+	_lastAdmission = 0;
+	_maxHandshakesInFlight = 0;
+	_subscribesSent = 0;
+	_subscribeMsgsSent = 0;
+	_jitterState = 0;
+	for (size_t i = 0; i < _uuid.length(); i++)
+		_jitterState = _jitterState * 31 + _uuid[i];
+
+	_coalesceSize = 0;
+	if (_options["node.coalesce.size"].length() > 0)
+		_coalesceSize = strTo<size_t>(_options["node.coalesce.size"]);
+	_coalesceDelayUs = UMUNDO_NODE_COALESCE_DELAY_US;
+	if (_options["node.coalesce.delayUs"].length() > 0)
+		_coalesceDelayUs = strTo<uint32_t>(_options["node.coalesce.delayUs"]);
+	_batchedMsgsSent = 0;
+	_batchesSent = 0;
+
+	_peerCache = PeerCache(_options["node.peerCache"]);
+	_lastPeerCacheSave = 0;
 
 	int routMand = 1;
 	int routProbe = 0;
@@ -185,12 +310,21 @@ void ZeroMQNode::init(Options* options) {
 	int sndhwm = NET_ZEROMQ_SND_HWM;
 	int rcvhwm = NET_ZEROMQ_RCV_HWM;
 
+	configureZeroMQContext(_options);
+
 	(_nodeSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_ROUTER))  || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_pubSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_XPUB))     || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_subSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_SUB))      || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_readOpSocket  = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR)) || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_writeOpSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR)) || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 
+	// have a subset of I/O threads handle our network traffic
+	if (_options["node.zmq.affinity"].length() > 0) {
+		uint64_t affinity = strTo<uint64_t>(_options["node.zmq.affinity"]);
+		zmq_setsockopt(_nodeSocket, ZMQ_AFFINITY, &affinity, sizeof(affinity)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+		zmq_setsockopt(_pubSocket, ZMQ_AFFINITY, &affinity, sizeof(affinity))  && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+	}
+
 	// connect read and write op sockets
 	std::string readOpId("inproc://um.node.readop." + _uuid);
 	zmq_bind(_readOpSocket, readOpId.c_str())  && UM_LOG_ERR("zmq_bind: %s", zmq_strerror(errno))
@@ -218,7 +352,7 @@ void ZeroMQNode::init(Options* options) {
 	}
 	std::string pubId("um.pub." + _uuid);
 	zmq_bind(_pubSocket,  std::string("inproc://" + pubId).c_str())  && UM_LOG_ERR("zmq_bind: %s", zmq_strerror(errno))
-	//  zmq_bind(_pubSocket,  std::string("ipc://" + pubId).c_str())     && UM_LOG_WARN("zmq_bind: %s %s", std::string("ipc://" + pubId).c_str(), zmq_strerror(errno))
+	bindIPC();
 
 	zmq_setsockopt(_pubSocket, ZMQ_SNDHWM, &sndhwm, sizeof(sndhwm))         && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
 	zmq_setsockopt(_pubSocket, ZMQ_XPUB_VERBOSE, &vbsSub, sizeof(vbsSub))   && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno)); // receive all subscriptions
@@ -230,6 +364,15 @@ void ZeroMQNode::init(Options* options) {
 	zmq_setsockopt(_nodeSocket, ZMQ_ROUTER_MANDATORY, &routMand, sizeof(routMand))  && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
 	zmq_setsockopt(_nodeSocket, ZMQ_PROBE_ROUTER, &routProbe, sizeof(routProbe))    && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
 
+#ifdef NET_SHM
+	// subscribers on this host read our publications from shared memory
+	size_t shmSize = UMUNDO_SHM_RING_SIZE;
+	if (_options["node.shm.size"].length() > 0)
+		shmSize = strTo<size_t>(_options["node.shm.size"]);
+	if (shmSize > 0)
+		_shmRing = ShmRing::create(ShmRing::nameFor(_uuid), shmSize);
+#endif
+
 	sockets[0].socket = _nodeSocket;
 	sockets[1].socket = _pubSocket;
 	sockets[2].socket = _readOpSocket;
@@ -237,9 +380,88 @@ void ZeroMQNode::init(Options* options) {
 	sockets[0].fd = sockets[1].fd = sockets[2].fd = sockets[3].fd = 0;
 	sockets[0].events = sockets[1].events = sockets[2].events = sockets[3].events = ZMQ_POLLIN;
 
+	// connect to the nodes we knew last time while discovery is still looking
+	if (_options["node.peerCache"].length() > 0 && _peerCache.load()) {
+		std::vector<EndPoint> cached = _peerCache.getEndPoints();
+		uint64_t giveUpAt = Thread::getMonotonicMs() + _failoverMs;
+		for (std::vector<EndPoint>::iterator epIter = cached.begin(); epIter != cached.end(); epIter++) {
+			added(*epIter);
+			_cachedPeers[epIter->getAddress()] = giveUpAt;
+		}
+		UM_LOG_INFO("%s: Connecting to %d cached peers", SHORT_UUID(_uuid).c_str(), (int)cached.size());
+	}
+
 	start();
 }
 
+/**
+ * Bind our publisher socket for nodes on this host, they will connect here instead of tcp.
+ */
+void ZeroMQNode::bindIPC() {
+#ifndef WIN32
+	if (_options["node.ipc"].length() > 0 && !strTo<bool>(_options["node.ipc"]))
+		return;
+
+	removeStaleIPCFiles();
+
+	// we hold a lock on a file next to the socket for as long as we live, the system releases it when we crash
+	std::string path = std::string(UMUNDO_NODE_IPC_DIR) + "/um.pub." + _uuid;
+	_ipcLockFd = open((path + ".lock").c_str(), O_RDWR | O_CREAT, 0600);
+	if (_ipcLockFd < 0 || flock(_ipcLockFd, LOCK_EX | LOCK_NB) != 0) {
+		UM_LOG_WARN("cannot lock %s.lock: %s - nodes on this host will use tcp", path.c_str(), strerror(errno));
+		if (_ipcLockFd >= 0)
+			close(_ipcLockFd);
+		_ipcLockFd = -1;
+		return;
+	}
+
+	if (zmq_bind(_pubSocket, ("ipc://" + path).c_str()) == 0) {
+		_ipcEndpoint = "ipc://" + path;
+	} else {
+		UM_LOG_WARN("zmq_bind ipc://%s: %s - nodes on this host will use tcp", path.c_str(), zmq_strerror(errno));
+		unlink((path + ".lock").c_str());
+		close(_ipcLockFd);
+		_ipcLockFd = -1;
+	}
+#endif
+}
+
+/**
+ * Remove socket files of nodes whose process is gone, nobody holds the lock on their lock file.
+ */
+void ZeroMQNode::removeStaleIPCFiles() {
+#ifndef WIN32
+	static bool hasRun = false;
+	if (hasRun)
+		return;
+	hasRun = true;
+
+	DIR* dir = opendir(UMUNDO_NODE_IPC_DIR);
+	if (dir == NULL)
+		return;
+
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL) {
+		std::string name(entry->d_name);
+		if (name.compare(0, 7, "um.pub.") != 0 || name.length() < 5 || name.compare(name.length() - 5, 5, ".lock") != 0)
+			continue;
+
+		std::string lockPath = std::string(UMUNDO_NODE_IPC_DIR) + "/" + name;
+		int lockFd = open(lockPath.c_str(), O_RDWR);
+		if (lockFd < 0)
+			continue;
+		if (flock(lockFd, LOCK_EX | LOCK_NB) == 0) {
+			std::string path = lockPath.substr(0, lockPath.length() - 5);
+			UM_LOG_INFO("removing stale socket file %s", path.c_str());
+			unlink(path.c_str());
+			unlink(lockPath.c_str());
+		}
+		close(lockFd);
+	}
+	closedir(dir);
+#endif
+}
+
 boost::shared_ptr<Implementation> ZeroMQNode::create() {
 	return boost::shared_ptr<ZeroMQNode>(new ZeroMQNode());
 }
@@ -318,7 +540,7 @@ void ZeroMQNode::addSubscriber(Subscriber& sub) {
 
 			// iterate all remote publishers and remove from sub
 			while (pubIter != pubs.end()) {
-				if(sub.matches(pubIter->second.getChannelName())) {
+				if(TYPES_MATCH(sub.getImpl()->implType, pubIter->second.getImpl()->implType) && sub.matches(pubIter->second.getChannelName())) {
 					sub.added(pubIter->second, nodeIter->second->node);
 					sendSubAdded(nodeIter->first.c_str(), sub, pubIter->second);
 				}
@@ -327,6 +549,19 @@ void ZeroMQNode::addSubscriber(Subscriber& sub) {
 		}
 		nodeIter++;
 	}
+	flushSubscribes();
+
+	// nodes we skipped might publish something for the new subscriber
+	std::list<EndPoint> interesting;
+	std::map<std::string, EndPoint>::iterator skippedIter = _skippedEndPoints.begin();
+	while(skippedIter != _skippedEndPoints.end()) {
+		if (PubSummary(skippedIter->second.getPubSummary()).mayMatch(sub.getChannelName()))
+			interesting.push_back(skippedIter->second);
+		skippedIter++;
+	}
+	for (std::list<EndPoint>::iterator epIter = interesting.begin(); epIter != interesting.end(); epIter++) {
+		added(*epIter);
+	}
 }
 
 void ZeroMQNode::removeSubscriber(Subscriber& sub) {
@@ -344,7 +579,7 @@ void ZeroMQNode::removeSubscriber(Subscriber& sub) {
 
 		// iterate all remote publishers and remove from sub
 		while (pubIter != pubs.end()) {
-			if(sub.matches(pubIter->second.getChannelName())) {
+			if(TYPES_MATCH(sub.getImpl()->implType, pubIter->second.getImpl()->implType) && sub.matches(pubIter->second.getChannelName())) {
 				sub.removed(pubIter->second, nodeIter->second->node);
 				sendSubRemoved(nodeIter->first.c_str(), sub, pubIter->second);
 			}
@@ -362,21 +597,24 @@ void ZeroMQNode::addPublisher(Publisher& pub) {
 	if (_pubs.find(pub.getUUID()) != _pubs.end())
 		return;
 
-	size_t bufferSize = 4 + _uuid.length() + 1 + PUB_INFO_SIZE(pub);
+	recordPubChange(Message::PUB_ADDED, pub);
+
+	size_t bufferSize = 4 + _uuid.length() + 1 + 4 + PUB_INFO_SIZE(pub);
 	PREPARE_MSG(pubAddedMsg, bufferSize);
 
 	UM_LOG_INFO("%s added publisher %s on %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(pub.getUUID()).c_str(), pub.getChannelName().c_str());
 
 	writePtr = writeVersionAndType(writePtr, Message::PUB_ADDED);
 	writePtr = writeString(writePtr, _uuid.c_str(), _uuid.length());
+	writePtr = writeUInt32(writePtr, _pubVersion);
 	writePtr = writePubInfo(writePtr, pub);
 	assert(writePtr - writeBuffer == bufferSize);
 
 	zmq_msg_send(&pubAddedMsg, _writeOpSocket, 0) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
-	_buckets.back().nrMetaMsgSent++;
-	_buckets.back().sizeMetaMsgSent += bufferSize;
+	_stats.recordMetaMsgSent(bufferSize);
 
 	_pubs[pub.getUUID()] = pub;
+	updatePubInterest(pub);
 	zmq_msg_close(&pubAddedMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 
 }
@@ -388,21 +626,24 @@ void ZeroMQNode::removePublisher(Publisher& pub) {
 	if (_pubs.find(pub.getUUID()) == _pubs.end())
 		return;
 
-	size_t bufferSize = 4 + _uuid.length() + 1 + PUB_INFO_SIZE(pub);
+	recordPubChange(Message::PUB_REMOVED, pub);
+
+	size_t bufferSize = 4 + _uuid.length() + 1 + 4 + PUB_INFO_SIZE(pub);
 	PREPARE_MSG(pubRemovedMsg, bufferSize);
 
 	UM_LOG_INFO("%s removed publisher %s on %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(pub.getUUID()).c_str(), pub.getChannelName().c_str());
 
 	writePtr = writeVersionAndType(writePtr, Message::PUB_REMOVED);
 	writePtr = writeString(writePtr, _uuid.c_str(), _uuid.length());
+	writePtr = writeUInt32(writePtr, _pubVersion);
 	writePtr = writePubInfo(writePtr, pub);
 	assert(writePtr - writeBuffer == bufferSize);
 
 	zmq_msg_send(&pubRemovedMsg, _writeOpSocket, 0) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
-	_buckets.back().nrMetaMsgSent++;
-	_buckets.back().sizeMetaMsgSent += bufferSize;
+	_stats.recordMetaMsgSent(bufferSize);
 
 	zmq_msg_close(&pubRemovedMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+	pub.setInterest(_uuid, false);
 	_pubs.erase(pub.getUUID());
 
 }
@@ -435,6 +676,18 @@ void ZeroMQNode::added(EndPoint endPoint) {
 	std::stringstream otherAddress;
 	otherAddress << endPoint.getTransport() << "://" << endPoint.getIP() << ":" << endPoint.getPort();
 
+	// discovery found it, it is no longer up to the peer cache to give up on it
+	_cachedPeers.erase(otherAddress.str());
+
+	// do not bother with nodes that have nothing for us
+	if (!isInteresting(endPoint)) {
+		UM_LOG_INFO("%s: Not connecting to %s, it publishes nothing we subscribe to",
+		            SHORT_UUID(_uuid).c_str(), otherAddress.str().c_str());
+		_skippedEndPoints[otherAddress.str()] = endPoint;
+		return;
+	}
+	_skippedEndPoints.erase(otherAddress.str());
+
 	// write connection request to operation socket
 	PREPARE_MSG(addEndPointMsg, 4 + otherAddress.str().length() + 1);
 
@@ -460,6 +713,9 @@ void ZeroMQNode::removed(EndPoint endPoint) {
 	std::stringstream otherAddress;
 	otherAddress << endPoint.getTransport() << "://" << endPoint.getIP() << ":" << endPoint.getPort();
 
+	if (_skippedEndPoints.erase(otherAddress.str()) > 0)
+		return; // we never connected
+
 	PREPARE_MSG(removeEndPointMsg, 4 + otherAddress.str().length() + 1);
 	writePtr = writeVersionAndType(writePtr, Message::DISCONNECT);
 	assert(writePtr - writeBuffer == 4);
@@ -472,6 +728,36 @@ void ZeroMQNode::removed(EndPoint endPoint) {
 }
 
 void ZeroMQNode::changed(EndPoint endPoint) {
+	ScopeLock lock(_mutex);
+
+	std::stringstream otherAddress;
+	otherAddress << endPoint.getTransport() << "://" << endPoint.getIP() << ":" << endPoint.getPort();
+
+	// we only care for nodes we skipped, the others tell us about their publishers themselves
+	if (_skippedEndPoints.find(otherAddress.str()) != _skippedEndPoints.end())
+		added(endPoint);
+}
+
+/**
+ * Whether the summary of an endpoint's publishers matches any of our subscribers.
+ */
+bool ZeroMQNode::isInteresting(const EndPoint& endPoint) {
+	if (endPoint.getPubSummary().length() == 0)
+		return true; // no summary, we have to ask
+
+	PubSummary summary(endPoint.getPubSummary());
+	std::map<std::string, Subscriber>::iterator subIter = _subs.begin();
+	while(subIter != _subs.end()) {
+		if (summary.mayMatch(subIter->second.getChannelName()))
+			return true;
+		subIter++;
+	}
+	return false;
+}
+
+const std::string ZeroMQNode::getPubSummary() const {
+	ScopeLock lock(_mutex);
+	return NodeImpl::getPubSummary();
 }
 
 /**
@@ -491,8 +777,7 @@ void ZeroMQNode::processNodeComm() {
 
 	// read first message
 	RECV_MSG(_nodeSocket, header);
-	_buckets.back().nrMetaMsgRcvd++;
-	_buckets.back().sizeMetaMsgRcvd += msgSize;
+	_stats.recordMetaMsgRcvd(msgSize);
 
 	std::string from(recvBuffer, msgSize);
 	zmq_msg_close(&header) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
@@ -500,8 +785,9 @@ void ZeroMQNode::processNodeComm() {
 	if (from.length() == 36) {
 		RECV_MSG(_nodeSocket, content);
 
-		// remember node and update last seen
-		//touchNeighbor(from);
+		// any message is a sign of life
+		if (_connFrom.find(from) != _connFrom.end())
+			_connFrom[from]->lastSeen = Thread::getMonotonicMs();
 
 		// dealer socket sends no delimiter, but req does
 		if (REMAINING_BYTES_TOREAD == 0) {
@@ -513,8 +799,7 @@ void ZeroMQNode::processNodeComm() {
 			RECV_MSG(_nodeSocket, content);
 		}
 
-		_buckets.back().nrMetaMsgRcvd++;
-		_buckets.back().sizeMetaMsgRcvd += msgSize;
+		_stats.recordMetaMsgRcvd(msgSize);
 
 		// assume the mesage has at least version and type
 		if (REMAINING_BYTES_TOREAD < 4) {
@@ -539,24 +824,41 @@ void ZeroMQNode::processNodeComm() {
 			replyWithDebugInfo(from);
 			break;
 		}
-		case Message::CONNECT_REQ: {
+		case Message::HEARTBEAT: {
+			// nothing to do, we already noted that it is alive
+			break;
+		}
+		case Message::CONNECT_REQ:
+		case Message::PUB_SYNC: {
 
 			// someone is about to connect to us
-			if (from != _uuid || _allowLocalConns)
+			if (type == Message::CONNECT_REQ && (from != _uuid || _allowLocalConns))
 				processConnectedFrom(from);
 
+			// which version of our publisher table does the remote node know already?
+			char* knownUUID = NULL;
+			uint32_t knownVersion = 0;
+			if (REMAINING_BYTES_TOREAD >= 1 + 4) {
+				readPtr = readString(readPtr, knownUUID, 37);
+				if (knownUUID != NULL && REMAINING_BYTES_TOREAD >= 4)
+					readPtr = readUInt32(readPtr, knownVersion);
+			}
+
 			// reply with our uuid and publishers
-			UM_LOG_INFO("%s: Replying with CONNECT_REP and %d pubs on _nodeSocket to %s", SHORT_UUID(_uuid).c_str(), _pubs.size(), SHORT_UUID(from).c_str());
+			UM_LOG_INFO("%s: Replying to %s with publishers since version %d of %d", SHORT_UUID(_uuid).c_str(), SHORT_UUID(from).c_str(), knownVersion, _pubVersion);
 			zmq_send(_nodeSocket, from.c_str(), from.length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno)); // return to sender
-			_buckets.back().nrMetaMsgSent++;
-			_buckets.back().sizeMetaMsgSent += from.length();
+			_stats.recordMetaMsgSent(from.length());
+			if (_connFrom.find(from) != _connFrom.end())
+				_connFrom[from]->lastSent = Thread::getMonotonicMs();
 
 			zmq_msg_t replyNodeInfoMsg;
-			writeNodeInfo(&replyNodeInfoMsg, Message::CONNECT_REP);
+			writeNodeInfo(&replyNodeInfoMsg,
+			              (type == Message::CONNECT_REQ ? Message::CONNECT_REP : Message::NODE_INFO),
+			              (knownUUID != NULL ? knownUUID : ""),
+			              knownVersion);
 
 			zmq_sendmsg(_nodeSocket, &replyNodeInfoMsg, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_sendmsg: %s", zmq_strerror(errno));
-			_buckets.back().nrMetaMsgSent++;
-			_buckets.back().sizeMetaMsgSent += zmq_msg_size(&replyNodeInfoMsg);
+			_stats.recordMetaMsgSent(zmq_msg_size(&replyNodeInfoMsg));
 
 			zmq_msg_close(&replyNodeInfoMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 			break;
@@ -572,43 +874,52 @@ void ZeroMQNode::processNodeComm() {
 			uint16_t pubPort;
 			uint16_t pubType;
 			uint16_t subType;
+			uint16_t subPort;
 
-			readPtr = readSubInfo(readPtr, subType, subChannelName, subUUID);
-			readPtr = readPubInfo(readPtr, pubType, pubPort, pubChannelName, pubUUID);
+			// subscriptions to several of our publishers arrive in a single message
+			while (REMAINING_BYTES_TOREAD > 0) {
+				readPtr = readSubInfo(readPtr, subType, subPort, subChannelName, subUUID);
+				readPtr = readPubInfo(readPtr, pubType, pubPort, pubChannelName, pubUUID);
 
-			assert(REMAINING_BYTES_TOREAD == 0);
-			ScopeLock lock(_mutex);
-
-			if (_pubs.find(pubUUID) == _pubs.end())
-				break;
+				ScopeLock lock(_mutex);
 
-			if (type == Message::SUBSCRIBE) {
-				// confirm subscription
-				if (!_subscriptions[subUUID].subStub) {
-					_subscriptions[subUUID].subStub = SubscriberStub(boost::shared_ptr<SubscriberStubImpl>(new SubscriberStubImpl()));
-					_subscriptions[subUUID].subStub.getImpl()->setChannelName(subChannelName);
-					_subscriptions[subUUID].subStub.getImpl()->setUUID(subUUID);
-					_subscriptions[subUUID].subStub.getImpl()->implType = subType;
-				}
-				_subscriptions[subUUID].nodeUUID = from;
-				_subscriptions[subUUID].pending[pubUUID] = _pubs[pubUUID];
+				if (_pubs.find(pubUUID) == _pubs.end())
+					continue;
+
+				if (type == Message::SUBSCRIBE) {
+					// confirm subscription
+					if (!_subscriptions[subUUID].subStub) {
+						_subscriptions[subUUID].subStub = SubscriberStub(boost::shared_ptr<SubscriberStubImpl>(new SubscriberStubImpl()));
+						_subscriptions[subUUID].subStub.getImpl()->setChannelName(subChannelName);
+						_subscriptions[subUUID].subStub.getImpl()->setUUID(subUUID);
+						_subscriptions[subUUID].subStub.getImpl()->implType = subType;
+					}
+					if (subType == Subscriber::RTP) {
+						// the subscriber's own socket, reachable at the address we know its node by
+						_subscriptions[subUUID].subStub.getImpl()->setPort(subPort);
+						if (_connTo.find(from) != _connTo.end() && _connTo[from]->node)
+							_subscriptions[subUUID].subStub.getImpl()->setIP(_connTo[from]->node.getIP());
+					}
+					_subscriptions[subUUID].nodeUUID = from;
+					_subscriptions[subUUID].pending[pubUUID] = _pubs[pubUUID];
+
+					if (_subscriptions[subUUID].isZMQConfirmed || subType != Subscriber::ZEROMQ)
+						confirmSub(subUUID);
+				} else {
+					// remove a subscription
+					Subscription& confSub = _subscriptions[subUUID];
+					if (_connFrom.find(confSub.nodeUUID) != _connFrom.end() && _connFrom[confSub.nodeUUID]->node)
+						_connFrom[confSub.nodeUUID]->node.removeSubscriber(confSub.subStub);
+
+					// move all pending subscriptions to confirmed
+					std::map<std::string, Publisher>::iterator confPubIter = confSub.confirmed.begin();
+					while(confPubIter != confSub.confirmed.end()) {
+						confPubIter->second.removed(confSub.subStub, _connFrom[confSub.nodeUUID]->node);
+						confPubIter++;
+					}
+					confSub.confirmed.clear();
 
-				if (_subscriptions[subUUID].isZMQConfirmed || subType != Subscriber::ZEROMQ)
-					confirmSub(subUUID);
-			} else {
-				// remove a subscription
-				Subscription& confSub = _subscriptions[subUUID];
-				if (_connFrom.find(confSub.nodeUUID) != _connFrom.end() && _connFrom[confSub.nodeUUID]->node)
-					_connFrom[confSub.nodeUUID]->node.removeSubscriber(confSub.subStub);
-
-				// move all pending subscriptions to confirmed
-				std::map<std::string, Publisher>::iterator confPubIter = confSub.confirmed.begin();
-				while(confPubIter != confSub.confirmed.end()) {
-					confPubIter->second.removed(confSub.subStub, _connFrom[confSub.nodeUUID]->node);
-					confPubIter++;
 				}
-				confSub.confirmed.clear();
-
 			}
 			break;
 		}
@@ -624,6 +935,23 @@ void ZeroMQNode::processNodeComm() {
 	}
 }
 
+/**
+ * Tell the publisher whether any 0MQ subscription at our publisher socket matches its channel.
+ */
+void ZeroMQNode::updatePubInterest(Publisher& pub) {
+	// subscriptions are prefixes of channel names
+	std::string channelName = pub.getChannelName();
+	std::set<std::string>::iterator topicIter = _pubTopics.begin();
+	while(topicIter != _pubTopics.end()) {
+		if (channelName.compare(0, topicIter->length(), *topicIter) == 0) {
+			pub.setInterest(_uuid, true);
+			return;
+		}
+		topicIter++;
+	}
+	pub.setInterest(_uuid, false);
+}
+
 void ZeroMQNode::processPubComm() {
 	COMMON_VARS;
 	/**
@@ -658,6 +986,20 @@ void ZeroMQNode::processPubComm() {
 			UM_LOG_INFO("%s: Got 0MQ unsubscription on %s", _uuid.c_str(), subChannel.c_str());
 		}
 
+		// 0MQ only tells us about the first subscriber and the last unsubscriber of a topic
+		if (subUUID.length() == 0) {
+			if (subscription) {
+				_pubTopics.insert(subChannel);
+			} else {
+				_pubTopics.erase(subChannel);
+			}
+			std::map<std::string, Publisher>::iterator pubIter = _pubs.begin();
+			while(pubIter != _pubs.end()) {
+				updatePubInterest(pubIter->second);
+				pubIter++;
+			}
+		}
+
 		zmq_getsockopt (_pubSocket, ZMQ_RCVMORE, &more, &more_size) && UM_LOG_ERR("zmq_getsockopt: %s", zmq_strerror(errno));
 		zmq_msg_close (&message) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 		assert(!more); // subscriptions are not multipart
@@ -675,6 +1017,7 @@ void ZeroMQNode::processClientComm(boost::shared_ptr<NodeConnection> client) {
 
 	// we have a reply from the server
 	RECV_MSG(client->socket, opMsg);
+	client->lastSeen = Thread::getMonotonicMs();
 
 	if (REMAINING_BYTES_TOREAD < 4) {
 		zmq_msg_close(&opMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
@@ -703,6 +1046,8 @@ void ZeroMQNode::processClientComm(boost::shared_ptr<NodeConnection> client) {
 
 		char* from;
 		readPtr = readString(readPtr, from, 37);
+		uint32_t pubVersion;
+		readPtr = readUInt32(readPtr, pubVersion);
 		uint16_t port;
 		uint16_t pubType;
 		char* channelName;
@@ -713,12 +1058,56 @@ void ZeroMQNode::processClientComm(boost::shared_ptr<NodeConnection> client) {
 
 		ScopeLock lock(_mutex);
 
+		PubTable& table = _remotePubTables[client->address];
+		if (table.nodeUUID != from || pubVersion <= table.version) {
+			// not connected yet or already contained in a node info
+			break;
+		}
+
+		if (pubVersion != table.version + 1) {
+			// we missed a change, have the remote node send us what we missed
+			UM_LOG_INFO("%s: missed publisher changes from %s - have %d got %d", SHORT_UUID(_uuid).c_str(), SHORT_UUID(std::string(from)).c_str(), table.version, pubVersion);
+			sendPubSync(client, Message::PUB_SYNC, false);
+			break;
+		}
+
+		table.version = pubVersion;
 		if (type == Message::PUB_ADDED) {
-			processRemotePubAdded(from, port, pubType, channelName, pubUUID);
+			PublisherStub pubStub(boost::shared_ptr<PublisherStubImpl>(new PublisherStubImpl()));
+			pubStub.getImpl()->setUUID(pubUUID);
+			pubStub.getImpl()->setPort(port);
+			pubStub.getImpl()->setChannelName(channelName);
+			pubStub.getImpl()->implType = pubType;
+			table.pubs[pubUUID] = pubStub;
+			processRemotePubAdded(from, port, pubType, channelName, pubUUID, (char*)table.ipcEndpoint.c_str());
 		} else {
+			table.pubs.erase(pubUUID);
 			processRemotePubRemoved(from, port, pubType, channelName, pubUUID);
 		}
+		break;
+	}
+	case Message::NODE_INFO: {
+		// publisher table changes we asked for
+		ScopeLock lock(_mutex);
+		processNodeInfo(client, recvBuffer + 4, msgSize - 4);
+		break;
+	}
+	case Message::HEARTBEAT: {
+		// remote node is alive, see whether we missed publisher changes
+		if (REMAINING_BYTES_TOREAD < 4)
+			break;
 
+		uint32_t pubVersion;
+		readPtr = readUInt32(readPtr, pubVersion);
+
+		ScopeLock lock(_mutex);
+		if (!client->node || _remotePubTables.find(client->address) == _remotePubTables.end())
+			break;
+
+		PubTable& table = _remotePubTables[client->address];
+		if (table.nodeUUID == client->node.getUUID() && pubVersion > table.version)
+			sendPubSync(client, Message::PUB_SYNC, false);
+		break;
 	}
 	case Message::SHUTDOWN: {
 		// a remote neighbor shut down
@@ -760,7 +1149,7 @@ void ZeroMQNode::processClientComm(boost::shared_ptr<NodeConnection> client) {
 			break;
 
 		processConnectedTo(fromUUID, client);
-		processNodeInfo(recvBuffer + 4, msgSize - 4);
+		processNodeInfo(client, recvBuffer + 4, msgSize - 4);
 
 		break;
 	}
@@ -795,15 +1184,19 @@ void ZeroMQNode::processOpComm() {
 		uint16_t pubType;
 		char* channelName;
 		char* pubUUID;
+		uint32_t pubVersion;
 
 		readPtr = readString(readPtr, uuid, 37);
+		readPtr = readUInt32(readPtr, pubVersion);
 		readPtr = readPubInfo(readPtr, pubType, port, channelName, pubUUID);
 		assert(REMAINING_BYTES_TOREAD == 0);
 
 		std::string internalPubId("inproc://um.pub.intern.");
 		internalPubId += pubUUID;
 
-		if (type == Message::PUB_ADDED) {
+		if (pubType != Publisher::ZEROMQ) {
+			// publishers with other transports have no internal socket
+		} else if (type == Message::PUB_ADDED) {
 			zmq_connect(_subSocket, internalPubId.c_str()) && UM_LOG_ERR("zmq_connect %s: %s", internalPubId.c_str(), zmq_strerror(errno));
 		} else {
 			zmq_disconnect(_subSocket, internalPubId.c_str()) && UM_LOG_ERR("zmq_connect %s: %s", internalPubId.c_str(), zmq_strerror(errno));
@@ -820,8 +1213,18 @@ void ZeroMQNode::processOpComm() {
 		readPtr = readString(readPtr, address, msgSize - (readPtr - recvBuffer));
 
 		ScopeLock lock(_mutex);
-		if (_connTo.find(address) == _connTo.end())
-			return;
+		if (_connTo.find(address) == _connTo.end()) {
+			// maybe we did not even try yet
+			std::list<PendingConnect>::iterator queueIter = _connQueue.begin();
+			while(queueIter != _connQueue.end()) {
+				if (queueIter->address == address) {
+					_connQueue.erase(queueIter);
+					break;
+				}
+				queueIter++;
+			}
+			break;
+		}
 
 		_connTo[address]->refCount--;
 
@@ -829,6 +1232,7 @@ void ZeroMQNode::processOpComm() {
 			NodeStub& nodeStub = _connTo[address]->node;
 			std::string nodeUUID = nodeStub.getUUID();
 			disconnectRemoteNode(nodeStub);
+			retirePubTable(address);
 
 			// disconnect socket and remove as a neighbors
 			zmq_close(_connTo[address]->socket);
@@ -860,33 +1264,25 @@ void ZeroMQNode::processOpComm() {
 
 		ScopeLock lock(_mutex);
 
-		boost::shared_ptr<NodeConnection> clientConn;
 		// we don't know this endpoint
 		if (_connTo.find(address) == _connTo.end()) {
-			// open a new client connection
-			clientConn = boost::shared_ptr<NodeConnection>(new NodeConnection(address, _uuid));
-			if (!clientConn->socket) {
-//				delete clientConn;
+			if (isQueuedForConnect(address))
+				break;
+
+			if (handshakesInFlight() >= _maxHandshakes) {
+				// do not overwhelm the network when discovery reports many nodes at once
+				UM_LOG_INFO("%s: Queuing connection to %s", SHORT_UUID(_uuid).c_str(), address);
+				queueConnect(address, 0, Thread::getMonotonicMs());
 				break;
 			}
-			_connTo[address] = clientConn;
-		} else {
-			clientConn = _connTo[address];
+			connect(address, 0, backoff(0));
+			break;
 		}
 
 		UM_LOG_INFO("%s: Sending CONNECT_REQ to %s", SHORT_UUID(_uuid).c_str(), address);
 
-		// send a CONNECT_REQ message
-		PREPARE_MSG(connReqMsg, 4);
-		writePtr = writeVersionAndType(writePtr, Message::CONNECT_REQ);
-		assert(writePtr - writeBuffer == zmq_msg_size(&connReqMsg));
-
-		zmq_sendmsg(clientConn->socket, &connReqMsg, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_sendmsg: %s", zmq_strerror(errno));
-		_buckets.back().nrMetaMsgSent++;
-		_buckets.back().sizeMetaMsgSent += 4;
-
-		zmq_msg_close(&connReqMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
-
+		// send a CONNECT_REQ message with the publisher table version we know
+		sendPubSync(_connTo[address], Message::CONNECT_REQ, false);
 		break;
 	}
 	case Message::SHUTDOWN: {
@@ -934,146 +1330,511 @@ void ZeroMQNode::run() {
 			sockIter++;
 		}
 		
-		// make sure we have a bucket for performance measuring
-		if (_buckets.size() == 0)
-			_buckets.push_back(StatBucket<size_t>());
-
 		//UM_LOG_DEBUG("%s: polling on %ld sockets", _uuid.c_str(), nrSockets);
+		// discovery changes the queues while we poll, look at them while we still hold the lock
+		long timeout = (_timers.size() > 0 ? _timers.getResolution() : -1);
+		if ((_connQueue.size() > 0 || _cachedPeers.size() > 0) && (timeout < 0 || timeout > UMUNDO_NODE_ADMISSION_MS))
+			timeout = UMUNDO_NODE_ADMISSION_MS;
+		if (_batches.size() > 0) {
+			// wake up in time to send pending batches, 0MQ polls in ms
+			long batchTimeout = (_coalesceDelayUs + 999) / 1000;
+			if (timeout < 0 || batchTimeout < timeout)
+				timeout = batchTimeout;
+		}
 		_mutex.unlock();
-		zmq_poll(items, index, -1);
+		zmq_poll(items, index, timeout);
 		_mutex.lock();
 		// We do have a message to read!
 		
-		// manage performane status buckets
-		uint64_t now = Thread::getTimeStampMs();
-		while (_buckets.size() > 0 && _buckets.front().timeStamp < now - UMUNDO_PERF_WINDOW_LENGTH_MS) {
-			// drop oldest bucket
-			_buckets.pop_front();
-		}
-		if (_buckets.back().timeStamp < now - UMUNDO_PERF_BUCKET_LENGTH_MS) {
-			// we need a new bucket
-			_buckets.push_back(StatBucket<size_t>());
-		}
+		// manage performance status buckets
+		uint64_t now = Thread::getMonotonicMs();
+		_stats.rotate(now);
 		
-		// look through node sockets
-		while(nodeSockets.size() > 0) {
-			if (items[nodeSockets.front().first].revents & ZMQ_POLLIN) {
-				ScopeLock lock(_mutex);
-				if (_connTo.find(nodeSockets.front().second) != _connTo.end()) {
-					processClientComm(_connTo[nodeSockets.front().second]);
-				} else {
-					UM_LOG_WARN("%s: message from vanished node %s", _uuid.c_str(), nodeSockets.front().second.c_str());
+		// look through node sockets, every ready socket gets its share of the budget
+		std::list<std::pair<uint32_t, std::string> >::iterator nodeSockIter = nodeSockets.begin();
+		while(nodeSockIter != nodeSockets.end()) {
+			if (items[nodeSockIter->first].revents & ZMQ_POLLIN) {
+				for (size_t i = 0; i < UMUNDO_NODE_MSGS_PER_ROUND; i++) {
+					if (_connTo.find(nodeSockIter->second) == _connTo.end()) {
+						UM_LOG_WARN("%s: message from vanished node %s", _uuid.c_str(), nodeSockIter->second.c_str());
+						break;
+					}
+					boost::shared_ptr<NodeConnection> client = _connTo[nodeSockIter->second];
+					if (!client->socket)
+						break;
+					processClientComm(client);
+					if (!hasPendingInput(client->socket))
+						break;
 				}
-				break;
 			}
-			nodeSockets.pop_front();
+			nodeSockIter++;
 		}
 		nodeSockets.clear();
-		
 
 		if (items[0].revents & ZMQ_POLLIN) {
-			processNodeComm();
-			DRAIN_SOCKET(_nodeSocket);
+			for (size_t i = 0; i < UMUNDO_NODE_MSGS_PER_ROUND; i++) {
+				processNodeComm();
+				DRAIN_SOCKET(_nodeSocket);
+				if (!hasPendingInput(_nodeSocket))
+					break;
+			}
 		}
 
 		if (items[1].revents & ZMQ_POLLIN) {
-			processPubComm();
-			DRAIN_SOCKET(_pubSocket);
+			for (size_t i = 0; i < UMUNDO_NODE_MSGS_PER_ROUND; i++) {
+				processPubComm();
+				DRAIN_SOCKET(_pubSocket);
+				if (!hasPendingInput(_pubSocket))
+					break;
+			}
 		}
 
 		if (items[2].revents & ZMQ_POLLIN) {
-			processOpComm();
-			DRAIN_SOCKET(_readOpSocket);
+			for (size_t i = 0; i < UMUNDO_NODE_MSGS_PER_ROUND; i++) {
+				processOpComm();
+				DRAIN_SOCKET(_readOpSocket);
+				if (!hasPendingInput(_readOpSocket))
+					break;
+			}
 		}
 
 		// someone is publishing - this is last to
 		if (items[3].revents & ZMQ_POLLIN) {
-			size_t msgSize = 0;
-			zmq_msg_t message;
-			std::string channelName;
-			while (1) {
-				//  Process all parts of the message
-				zmq_msg_init (&message) && UM_LOG_ERR("zmq_msg_init: %s", zmq_strerror(errno));
-				zmq_msg_recv (&message, _subSocket, 0);
-				msgSize = zmq_msg_size(&message);
-				
-				if (channelName.size() == 0)
-					channelName = std::string((char*)zmq_msg_data(&message));
-				
-				_buckets.back().nrChannelMsg[channelName]++;
-				_buckets.back().sizeChannelMsg[channelName] += msgSize;
-
-				zmq_getsockopt (_subSocket, ZMQ_RCVMORE, &more, &more_size) && UM_LOG_ERR("zmq_getsockopt: %s", zmq_strerror(errno));
-				zmq_msg_send(&message, _pubSocket, more ? ZMQ_SNDMORE: 0) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
-				zmq_msg_close (&message) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
-				if (!more)
-					break;      //  Last message part
+			for (size_t i = 0; i < UMUNDO_NODE_MSGS_PER_ROUND; i++) {
+				processSubComm();
+				if (!hasPendingInput(_subSocket))
+					break;
 			}
 		}
-		
-//			if (now - _lastNodeInfoBroadCast > 5000) {
-//				broadCastNodeInfo(now);
-//				_lastNodeInfoBroadCast = now;
-//			}
-//			if (now - _lastDeadNodeRemoval > 15000) {
-//				removeStaleNodes(now);
-//				_lastDeadNodeRemoval = now;
-//			}
+
+		if (_batches.size() > 0)
+			sendDueBatches(Thread::getTimeStampUs());
+
+		// subscriptions we queued while processing the remote nodes' publishers
+		flushSubscribes();
+
+		// time out handshakes and start queued ones
+		if (_connQueue.size() > 0 || now - _lastAdmission >= UMUNDO_NODE_ADMISSION_MS)
+			admitConnections(now);
+
+		// send heartbeats and remove remote nodes that went silent
+		processTimers(now);
+
+		// give up on cached peers that never answered and persist the ones that did
+		if (_cachedPeers.size() > 0)
+			expireCachedPeers(now);
+		if (_peerCache.isDirty() && now - _lastPeerCacheSave >= UMUNDO_NODE_PEER_CACHE_SAVE_MS) {
+			_peerCache.save();
+			_lastPeerCacheSave = now;
+		}
+
 		_mutex.unlock();
 		free(items);
 	}
 }
 
-void ZeroMQNode::broadCastNodeInfo(uint64_t now) {
-	zmq_msg_t infoMsg;
-	writeNodeInfo(&infoMsg, Message::NODE_INFO);
-	NODE_BROADCAST_MSG(infoMsg);
-	zmq_msg_close(&infoMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+/**
+ * Forward a single publication from one of our publishers to the node-global XPUB socket.
+ */
+void ZeroMQNode::processSubComm() {
+	int more;
+	size_t more_size = sizeof(more);
+	size_t msgSize = 0;
+	zmq_msg_t message;
+	size_t channelId = UMUNDO_PERF_MAX_CHANNELS + 1;
+	bool coalesce = false;
+	std::string channel;
+	std::string packed; // frames after the envelope while we still coalesce
+	uint32_t nrFrames = 0;
+#ifdef NET_SHM
+	bool toShm = false;
+#endif
+	while (1) {
+		//  Process all parts of the message
+		zmq_msg_init (&message) && UM_LOG_ERR("zmq_msg_init: %s", zmq_strerror(errno));
+		zmq_msg_recv (&message, _subSocket, 0);
+		msgSize = zmq_msg_size(&message);
+
+		bool isEnvelope = false;
+		if (channelId > UMUNDO_PERF_MAX_CHANNELS) {
+			// first part is the channel envelope, explicitly addressed messages are itemized per subscriber
+			isEnvelope = true;
+			const char* channelName = (const char*)zmq_msg_data(&message);
+			channelId = _stats.internChannel(channelName, strnlen(channelName, msgSize));
+			if (msgSize > 0 && channelName[0] != '~') {
+				// explicitly addressed messages confirm subscriptions, never hold them back
+				coalesce = (_coalesceSize > 0);
+				if (coalesce)
+					channel = std::string(channelName, msgSize);
+			} else {
+				// we cannot tell the channel, send everything held back before it
+				sendBatches();
+			}
+#ifdef NET_SHM
+			// explicitly addressed messages as well, or they would overtake the publications in the ring
+			toShm = (_shmRing != NULL && _shmRing->hasReaders());
+			if (toShm)
+				_shmRing->beginWrite();
+#endif
+		}
+
+		_stats.recordChannelMsg(channelId, msgSize);
+#ifdef NET_SHM
+		if (toShm)
+			_shmRing->writeFrame(zmq_msg_data(&message), msgSize);
+#endif
+
+		zmq_getsockopt (_subSocket, ZMQ_RCVMORE, &more, &more_size) && UM_LOG_ERR("zmq_getsockopt: %s", zmq_strerror(errno));
+
+		if (coalesce && !isEnvelope) {
+			if (4 + packed.size() + 4 + msgSize <= _coalesceSize) {
+				uint32_t frameSize = htonl(msgSize);
+				packed.append((const char*)&frameSize, 4);
+				packed.append((const char*)zmq_msg_data(&message), msgSize);
+				nrFrames++;
+			} else {
+				// too large after all, keep the order within the channel and send what we held back
+				coalesce = false;
+				sendBatch(channel);
+				zmq_send(_pubSocket, channel.data(), channel.size(), ZMQ_SNDMORE) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+				const char* readPtr = packed.data();
+				for (uint32_t i = 0; i < nrFrames; i++) {
+					uint32_t frameSize = ntohl(*(uint32_t*)readPtr);
+					zmq_send(_pubSocket, readPtr + 4, frameSize, ZMQ_SNDMORE) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+					readPtr += 4 + frameSize;
+				}
+			}
+		}
+
+		if (!coalesce)
+			zmq_msg_send(&message, _pubSocket, more ? ZMQ_SNDMORE: 0) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
+		zmq_msg_close (&message) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+		if (!more)
+			break;      //  Last message part
+	}
+#ifdef NET_SHM
+	if (toShm)
+		_shmRing->commit();
+#endif
+
+	if (coalesce) {
+		if (_batches.find(channel) != _batches.end() &&
+		        _batches[channel].data.size() + 4 + packed.size() > _coalesceSize)
+			sendBatch(channel);
+
+		Batch& batch = _batches[channel];
+		if (batch.nrMsgs == 0)
+			batch.startedAt = Thread::getTimeStampUs();
+		uint32_t nrFramesN = htonl(nrFrames);
+		batch.data.append((const char*)&nrFramesN, 4);
+		batch.data.append(packed);
+		batch.nrMsgs++;
+	}
 }
 
-void ZeroMQNode::removeStaleNodes(uint64_t now) {
-	std::map<std::string, boost::shared_ptr<NodeConnection> >::iterator pendingNodeIter = _connTo.begin();
-	while(pendingNodeIter != _connTo.end()) {
-		if (now - pendingNodeIter->second->startedAt > 30000) {
-			// we have been very patient remove pending node
-			UM_LOG_ERR("%s could not connect to node at %s - removing", SHORT_UUID(_uuid).c_str(), pendingNodeIter->first.c_str());
-//			delete pendingNodeIter->second;
-			_connTo.erase(pendingNodeIter++);
-		} else {
-			pendingNodeIter++;
+/**
+ * Send the pending publications of a channel as a single message.
+ */
+void ZeroMQNode::sendBatch(const std::string& channel) {
+	if (_batches.find(channel) == _batches.end())
+		return;
+	Batch& batch = _batches[channel];
+
+	std::string batchMeta(UMUNDO_NODE_BATCH_META);
+	batchMeta += '\0';
+	batchMeta += toStr(batch.nrMsgs);
+	batchMeta += '\0';
+
+	zmq_send(_pubSocket, channel.data(), channel.size(), ZMQ_SNDMORE) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+	zmq_send(_pubSocket, batchMeta.data(), batchMeta.size(), ZMQ_SNDMORE) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+	zmq_send(_pubSocket, batch.data.data(), batch.data.size(), 0) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+
+	_batchedMsgsSent += batch.nrMsgs;
+	_batchesSent++;
+	_batches.erase(channel);
+}
+
+/**
+ * Send all batches whose first publication waited long enough.
+ */
+void ZeroMQNode::sendDueBatches(uint64_t nowUs) {
+	std::map<std::string, Batch>::iterator batchIter = _batches.begin();
+	while(batchIter != _batches.end()) {
+		std::string channel = batchIter->first;
+		bool isDue = (nowUs - batchIter->second.startedAt >= _coalesceDelayUs);
+		batchIter++;
+		if (isDue)
+			sendBatch(channel);
+	}
+}
+
+/**
+ * Send all pending batches, whether due or not.
+ */
+void ZeroMQNode::sendBatches() {
+	while(_batches.size() > 0)
+		sendBatch(_batches.begin()->first);
+}
+
+/**
+ * Whether another message can be read from the given socket without blocking.
+ */
+bool ZeroMQNode::hasPendingInput(void* socket) {
+	int events = 0;
+	size_t events_size = sizeof(events);
+	zmq_getsockopt(socket, ZMQ_EVENTS, &events, &events_size) && UM_LOG_ERR("zmq_getsockopt: %s", zmq_strerror(errno));
+	return (events & ZMQ_POLLIN) != 0;
+}
+
+/**
+ * Open a client connection to a remote node and send a CONNECT_REQ.
+ */
+void ZeroMQNode::connect(const std::string& address, uint32_t attempts, uint32_t timeout) {
+	boost::shared_ptr<NodeConnection> clientConn = boost::shared_ptr<NodeConnection>(new NodeConnection(address, _uuid));
+	if (!clientConn->socket)
+		return;
+
+	clientConn->attempts = attempts;
+	clientConn->handshakeTimeout = timeout;
+	_idlePubTables.remove(address);
+	_connTo[address] = clientConn;
+	watchConnection(clientConn);
+
+	size_t inFlight = handshakesInFlight();
+	if (inFlight > _maxHandshakesInFlight)
+		_maxHandshakesInFlight = inFlight;
+
+	UM_LOG_INFO("%s: Sending CONNECT_REQ to %s", SHORT_UUID(_uuid).c_str(), address.c_str());
+
+	// send a CONNECT_REQ message with the publisher table version we know
+	sendPubSync(clientConn, Message::CONNECT_REQ, false);
+}
+
+/**
+ * Connections we sent a CONNECT_REQ for without a reply yet.
+ */
+size_t ZeroMQNode::handshakesInFlight() {
+	size_t inFlight = 0;
+	std::map<std::string, boost::shared_ptr<NodeConnection> >::iterator connIter = _connTo.begin();
+	while(connIter != _connTo.end()) {
+		if (!connIter->second->connectedTo && connIter->second->socket)
+			inFlight++;
+		connIter++;
+	}
+	return inFlight;
+}
+
+bool ZeroMQNode::isQueuedForConnect(const std::string& address) {
+	std::list<PendingConnect>::iterator queueIter = _connQueue.begin();
+	while(queueIter != _connQueue.end()) {
+		if (queueIter->address == address)
+			return true;
+		queueIter++;
+	}
+	return false;
+}
+
+/**
+ * Time to wait for a CONNECT_REP, doubled with every attempt and jittered so nodes do not retry in lockstep.
+ */
+uint32_t ZeroMQNode::backoff(uint32_t attempts) {
+	uint32_t timeout = UMUNDO_NODE_HANDSHAKE_MS;
+	for (uint32_t i = 0; i < attempts && timeout < UMUNDO_NODE_HANDSHAKE_MAX_MS; i++)
+		timeout *= 2;
+	if (timeout > UMUNDO_NODE_HANDSHAKE_MAX_MS)
+		timeout = UMUNDO_NODE_HANDSHAKE_MAX_MS;
+
+	// somewhere between half and the full timeout
+	_jitterState = _jitterState * 1103515245 + 12345;
+	return timeout / 2 + (_jitterState >> 8) % (timeout / 2 + 1);
+}
+
+/**
+ * Queue a handshake, retries wait as long as they will wait for the CONNECT_REP.
+ */
+void ZeroMQNode::queueConnect(const std::string& address, uint32_t attempts, uint64_t now) {
+	PendingConnect pending;
+	pending.address = address;
+	pending.attempts = attempts;
+	pending.timeout = backoff(attempts);
+	if (attempts > 0)
+		pending.notBefore = now + pending.timeout;
+	_connQueue.push_back(pending);
+}
+
+/**
+ * Give up on handshakes that took too long and start queued ones while we have slots.
+ */
+void ZeroMQNode::admitConnections(uint64_t now) {
+	_lastAdmission = now;
+
+	std::map<std::string, boost::shared_ptr<NodeConnection> >::iterator connIter = _connTo.begin();
+	while(connIter != _connTo.end()) {
+		boost::shared_ptr<NodeConnection> conn = connIter->second;
+		connIter++;
+
+		if (conn->connectedTo || !conn->socket || conn->startedAt + conn->handshakeTimeout > now)
+			continue;
+
+		// retry later, 0MQ keeps the socket reconnecting in the meantime otherwise
+		UM_LOG_INFO("%s: No CONNECT_REP from %s after %dms - retrying later", SHORT_UUID(_uuid).c_str(), conn->address.c_str(), conn->handshakeTimeout);
+		queueConnect(conn->address, conn->attempts + 1, now);
+		_connTo.erase(conn->address);
+	}
+
+	size_t inFlight = handshakesInFlight();
+	std::list<PendingConnect>::iterator queueIter = _connQueue.begin();
+	while(queueIter != _connQueue.end() && inFlight < _maxHandshakes) {
+		if (queueIter->notBefore > now || _connTo.find(queueIter->address) != _connTo.end()) {
+			queueIter++;
+			continue;
 		}
+		connect(queueIter->address, queueIter->attempts, queueIter->timeout);
+		queueIter = _connQueue.erase(queueIter);
+		inFlight++;
 	}
+}
 
-	std::map<std::string, boost::shared_ptr<NodeConnection> >::iterator connIter = _connFrom.begin();
-	while(connIter != _connFrom.end()) {
-		if (!UUID::isUUID(connIter->first)) {
-			connIter++;
+/**
+ * Remove the cached peers we connected to at startup that did not answer in time.
+ *
+ * Peers discovery reported meanwhile are not ours to remove, added() took them off the list.
+ */
+void ZeroMQNode::expireCachedPeers(uint64_t now) {
+	std::map<std::string, uint64_t>::iterator cachedIter = _cachedPeers.begin();
+	while(cachedIter != _cachedPeers.end()) {
+		if (cachedIter->second > now) {
+			cachedIter++;
 			continue;
 		}
-		if (now - connIter->second->node.getLastSeen() > 30000) {
-			// we have been very patient remove pending node
-			UM_LOG_ERR("%s timeout for %s - removing", SHORT_UUID(_uuid).c_str(), SHORT_UUID(connIter->second->node.getUUID()).c_str());
-			NodeStub nodeStub = connIter->second->node;
-			// Disconnect subscribers
-			std::map<std::string, PublisherStub> pubStubs = nodeStub.getPublishers();
-			std::map<std::string, PublisherStub>::iterator pubStubIter = pubStubs.begin();
-			while(pubStubIter != pubStubs.end()) {
-				std::map<std::string, Subscriber>::iterator subIter = _subs.begin();
-				while(subIter != _subs.end()) {
-					if (subIter->second.matches(pubStubIter->second.getChannelName()))
-						subIter->second.removed(pubStubIter->second, nodeStub);
-					subIter++;
-				}
-				pubStubIter++;
-			}
+		std::string address = cachedIter->first;
+		_cachedPeers.erase(cachedIter++);
+
+		UM_LOG_INFO("%s: Cached peer %s did not answer - forgetting it", SHORT_UUID(_uuid).c_str(), address.c_str());
+		_peerCache.forget(address);
+		EndPoint endPoint(address);
+		if (endPoint)
+			removed(endPoint);
+	}
+}
 
-			if (connIter->second->address.length())
-				_connFrom.erase(connIter->second->address);
-//			delete connIter->second;
-			_connFrom.erase(connIter++);
-		} else {
-			connIter++;
+/**
+ * Start the liveness timer for a connection unless it has one already.
+ */
+void ZeroMQNode::watchConnection(boost::shared_ptr<NodeConnection> conn) {
+	if (conn->isWatched)
+		return;
+	conn->isWatched = true;
+	_timers.schedule(Thread::getMonotonicMs() + _heartbeatMs, conn);
+}
+
+/**
+ * Handle expired liveness timers.
+ *
+ * Received and sent messages only touch a timestamp in the connection, the
+ * timer is moved when it expires early, so traffic doubles as heartbeats.
+ */
+void ZeroMQNode::processTimers(uint64_t now) {
+	std::list<boost::weak_ptr<NodeConnection> > expired;
+	_timers.advance(now, expired);
+
+	std::list<boost::weak_ptr<NodeConnection> >::iterator timerIter = expired.begin();
+	while(timerIter != expired.end()) {
+		boost::shared_ptr<NodeConnection> conn = timerIter->lock();
+		timerIter++;
+
+		if (!conn)
+			continue; // connection was already removed
+
+		std::string nodeUUID = (conn->node ? conn->node.getUUID() : "");
+		bool isCurrent = (_connTo.find(conn->address) != _connTo.end() && _connTo[conn->address] == conn) ||
+		                 (_connFrom.find(nodeUUID) != _connFrom.end() && _connFrom[nodeUUID] == conn);
+		if (!isCurrent) {
+			conn->isWatched = false;
+			continue;
+		}
+
+		if (conn->lastSeen + _failoverMs <= now) {
+			conn->isWatched = false;
+			evictNode(conn);
+			continue;
 		}
+
+		if (conn->lastSent + _heartbeatMs <= now)
+			sendHeartbeat(conn);
+
+		uint64_t nextDeadline = conn->lastSeen + _failoverMs;
+		if (conn->lastSent + _heartbeatMs < nextDeadline)
+			nextDeadline = conn->lastSent + _heartbeatMs;
+		_timers.schedule(nextDeadline, conn);
+	}
+}
+
+/**
+ * Tell the remote node that we are still alive and which publisher table version we have.
+ */
+void ZeroMQNode::sendHeartbeat(boost::shared_ptr<NodeConnection> conn) {
+	COMMON_VARS;
+
+	if (conn->connectedFrom && conn->node) {
+		// remote node is connected to our node socket
+		std::string nodeUUID = conn->node.getUUID();
+		PREPARE_MSG(routerHeartbeatMsg, 4 + 4);
+		writePtr = writeVersionAndType(writePtr, Message::HEARTBEAT);
+		writePtr = writeUInt32(writePtr, _pubVersion);
+
+		zmq_send(_nodeSocket, nodeUUID.c_str(), nodeUUID.length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+		_stats.recordMetaMsgSent(nodeUUID.length());
+		zmq_msg_send(&routerHeartbeatMsg, _nodeSocket, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
+		_stats.recordMetaMsgSent(4 + 4);
+		zmq_msg_close(&routerHeartbeatMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+	}
+
+	if (conn->connectedTo && conn->socket) {
+		// we are connected to the remote node socket
+		PREPARE_MSG(clientHeartbeatMsg, 4 + 4);
+		writePtr = writeVersionAndType(writePtr, Message::HEARTBEAT);
+		writePtr = writeUInt32(writePtr, _pubVersion);
+
+		zmq_msg_send(&clientHeartbeatMsg, conn->socket, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
+		_stats.recordMetaMsgSent(4 + 4);
+		zmq_msg_close(&clientHeartbeatMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+	}
+
+	conn->lastSent = Thread::getMonotonicMs();
+}
+
+/**
+ * Remove a remote node that went silent or never answered.
+ *
+ * Endpoints we connected to are queued for another handshake, they stay ours
+ * until discovery removes them.
+ */
+void ZeroMQNode::evictNode(boost::shared_ptr<NodeConnection> conn) {
+	std::string nodeUUID = (conn->node ? conn->node.getUUID() : "");
+	UM_LOG_WARN("%s: no sign of life from %s for %dms - removing",
+	            SHORT_UUID(_uuid).c_str(),
+	            (nodeUUID.length() > 0 ? SHORT_UUID(nodeUUID).c_str() : conn->address.c_str()),
+	            _failoverMs);
+
+	disconnectRemoteNode(conn->node);
+	forgetPubTable(conn->address);
+
+	if (_connTo.find(conn->address) != _connTo.end() && _connTo[conn->address] == conn) {
+		if (conn->socket) {
+			zmq_close(conn->socket);
+			conn->socket = NULL;
+		}
+		_connTo.erase(conn->address);
+
+		// discovery still knows the endpoint and will not add it again, keep trying until it is removed
+		queueConnect(conn->address, 1, Thread::getMonotonicMs());
+	}
+	if (nodeUUID.length() > 0) {
+		if (_connTo.find(nodeUUID) != _connTo.end() && _connTo[nodeUUID] == conn)
+			_connTo.erase(nodeUUID);
+		if (_connFrom.find(nodeUUID) != _connFrom.end() && _connFrom[nodeUUID] == conn)
+			_connFrom.erase(nodeUUID);
 	}
 }
 
@@ -1084,12 +1845,13 @@ void ZeroMQNode::disconnectRemoteNode(NodeStub& nodeStub) {
 	std::string nodeUUID = nodeStub.getUUID();
 	std::map<std::string, PublisherStub> remotePubs = nodeStub.getPublishers();
 	std::map<std::string, PublisherStub>::iterator remotePubIter = remotePubs.begin();
-	std::map<std::string, Subscriber>::iterator localSubIter = _subs.begin();
 
 	// iterate all remote publishers and remove from local subs
 	while (remotePubIter != remotePubs.end()) {
+		std::map<std::string, Subscriber>::iterator localSubIter = _subs.begin();
 		while (localSubIter != _subs.end()) {
-			if(localSubIter->second.matches(remotePubIter->second.getChannelName())) {
+			if(TYPES_MATCH(localSubIter->second.getImpl()->implType, remotePubIter->second.getImpl()->implType) &&
+			        localSubIter->second.matches(remotePubIter->second.getChannelName())) {
 				localSubIter->second.removed(remotePubIter->second, nodeStub);
 				sendSubRemoved(nodeStub.getUUID().c_str(), localSubIter->second, remotePubIter->second);
 			}
@@ -1133,6 +1895,8 @@ void ZeroMQNode::processConnectedFrom(const std::string& uuid) {
 	// in any case, mark as connected from and update last seen
 	_connFrom[uuid]->connectedFrom = true;
 	_connFrom[uuid]->node.updateLastSeen();
+	_connFrom[uuid]->lastSeen = Thread::getMonotonicMs();
+	watchConnection(_connFrom[uuid]);
 }
 
 void ZeroMQNode::processConnectedTo(const std::string& uuid, boost::shared_ptr<NodeConnection> client) {
@@ -1156,6 +1920,7 @@ void ZeroMQNode::processConnectedTo(const std::string& uuid, boost::shared_ptr<N
 	if (client->node && uuid != client->node.getUUID()) {
 		// previous and this uuid of remote node differ - assume that it was replaced
 		disconnectRemoteNode(client->node);
+		forgetPubTable(client->address);
 		_connTo.erase(client->node.getUUID());
 		_connFrom.erase(client->node.getUUID());
 		nodeStub = NodeStub(boost::shared_ptr<NodeStubImpl>(new NodeStubImpl()));
@@ -1182,8 +1947,14 @@ void ZeroMQNode::processConnectedTo(const std::string& uuid, boost::shared_ptr<N
 	client->node.getImpl()->setTransport(transport);
 	client->node.getImpl()->setIP(ip);
 	client->node.getImpl()->setPort(strTo<uint16_t>(port));
+	client->node.getImpl()->setRemote(!Host::isLocalAddress(ip));
 	client->node.updateLastSeen();
 	_connTo[uuid] = client;
+	watchConnection(client);
+
+	// cached peers that answered are just peers
+	_cachedPeers.erase(client->address);
+	_peerCache.seen(client->address, uuid, Thread::getTimeStampMs());
 }
 
 void ZeroMQNode::confirmSub(const std::string& subUUID) {
@@ -1213,19 +1984,52 @@ void ZeroMQNode::confirmSub(const std::string& subUUID) {
 	pendSub.pending.clear();
 }
 
-void ZeroMQNode::writeNodeInfo(zmq_msg_t* msg, Message::Type type) {
+/**
+ * Write our publisher table, only the changes if the remote node knows a recent version.
+ */
+void ZeroMQNode::writeNodeInfo(zmq_msg_t* msg, Message::Type type, const std::string& knownUUID, uint32_t knownVersion) {
 	ScopeLock lock(_mutex);
 
 	zmq_msg_init(msg) && UM_LOG_WARN("zmq_msg_init: %s", zmq_strerror(errno));
 
+	// a base version of zero denotes a full snapshot
+	uint32_t baseVersion = 0;
+	std::list<PubChange>::iterator changeIter = _pubChanges.end();
+
+	if (knownUUID == _uuid && knownVersion > 0 && knownVersion <= _pubVersion) {
+		bool haveHistory = (_pubChanges.size() == 0 ? knownVersion == _pubVersion : _pubChanges.front().version <= knownVersion + 1);
+		if (haveHistory) {
+			size_t nrChanges = 0;
+			changeIter = _pubChanges.begin();
+			while(changeIter != _pubChanges.end() && changeIter->version <= knownVersion)
+				changeIter++;
+			std::list<PubChange>::iterator countIter = changeIter;
+			while(countIter != _pubChanges.end()) {
+				nrChanges++;
+				countIter++;
+			}
+			// do not send more changes than we have publishers
+			if (nrChanges <= _pubs.size())
+				baseVersion = knownVersion;
+		}
+	}
+
 	size_t pubInfoSize = 0;
-	std::map<std::string, Publisher>::iterator pubIter =_pubs.begin();
-	while(pubIter != _pubs.end()) {
-		pubInfoSize += PUB_INFO_SIZE(pubIter->second);
-		pubIter++;
+	if (baseVersion > 0) {
+		std::list<PubChange>::iterator sizeIter = changeIter;
+		while(sizeIter != _pubChanges.end()) {
+			pubInfoSize += 2 + PUB_INFO_SIZE(sizeIter->pub);
+			sizeIter++;
+		}
+	} else {
+		std::map<std::string, Publisher>::iterator pubIter =_pubs.begin();
+		while(pubIter != _pubs.end()) {
+			pubInfoSize += 2 + PUB_INFO_SIZE(pubIter->second);
+			pubIter++;
+		}
 	}
 
-	zmq_msg_init_size (msg, 4 + _uuid.length() + 1 + pubInfoSize) && UM_LOG_WARN("zmq_msg_init_size: %s",zmq_strerror(errno));
+	zmq_msg_init_size (msg, 4 + _uuid.length() + 1 + _ipcEndpoint.length() + 1 + 8 + pubInfoSize) && UM_LOG_WARN("zmq_msg_init_size: %s",zmq_strerror(errno));
 	char* writeBuffer = (char*)zmq_msg_data(msg);
 	char* writePtr = writeBuffer;
 
@@ -1237,37 +2041,191 @@ void ZeroMQNode::writeNodeInfo(zmq_msg_t* msg, Message::Type type) {
 	writePtr = writeString(writePtr, _uuid.c_str(), _uuid.length());
 	assert(writePtr - writeBuffer == 4 + _uuid.length() + 1);
 
-	pubIter =_pubs.begin();
-	while(pubIter != _pubs.end()) {
-		writePtr = writePubInfo(writePtr, pubIter->second);
-		pubIter++;
+	// where nodes on this host reach all our publishers
+	writePtr = writeString(writePtr, _ipcEndpoint.c_str(), _ipcEndpoint.length());
+
+	// the publisher table version the changes apply to and the one they result in
+	writePtr = writeUInt32(writePtr, baseVersion);
+	writePtr = writeUInt32(writePtr, _pubVersion);
+
+	if (baseVersion > 0) {
+		while(changeIter != _pubChanges.end()) {
+			writePtr = writeUInt16(writePtr, changeIter->type);
+			writePtr = writePubInfo(writePtr, changeIter->pub);
+			changeIter++;
+		}
+	} else {
+		std::map<std::string, Publisher>::iterator pubIter =_pubs.begin();
+		while(pubIter != _pubs.end()) {
+			writePtr = writeUInt16(writePtr, Message::PUB_ADDED);
+			writePtr = writePubInfo(writePtr, pubIter->second);
+			pubIter++;
+		}
 	}
 
 	assert(writePtr - writeBuffer == zmq_msg_size(msg));
 }
 
-void ZeroMQNode::processNodeInfo(char* recvBuffer, size_t msgSize) {
+void ZeroMQNode::processNodeInfo(boost::shared_ptr<NodeConnection> client, char* recvBuffer, size_t msgSize) {
 	char* readPtr = recvBuffer;
 
-	if(REMAINING_BYTES_TOREAD < 36)
+	if(REMAINING_BYTES_TOREAD < 37 + 1 + 8)
 		return;
 
 	char* from;
 	readPtr = readString(readPtr, from, 37);
+	char* ipcEndpoint;
+	readPtr = readString(readPtr, ipcEndpoint, 4096);
+
+	uint32_t baseVersion;
+	uint32_t pubVersion;
+	readPtr = readUInt32(readPtr, baseVersion);
+	readPtr = readUInt32(readPtr, pubVersion);
 
 	if (_connTo.find(from) == _connTo.end()) {
 		UM_LOG_WARN("%s not caring for nodeinfo from %s - not connected", SHORT_UUID(_uuid).c_str(), from);
 		return;
 	}
 
-	std::set<std::string> pubUUIDs;
-	while(REMAINING_BYTES_TOREAD > 37) {
+	PubTable& table = _remotePubTables[client->address];
+	if (baseVersion == 0) {
+		// full snapshot
+		table.pubs.clear();
+	} else if (table.nodeUUID != from || table.version != baseVersion) {
+		// changes do not apply to what we know, ask for everything
+		UM_LOG_INFO("%s: publisher changes from %s are relative to %d, we have %d", SHORT_UUID(_uuid).c_str(), SHORT_UUID(std::string(from)).c_str(), baseVersion, table.version);
+		sendPubSync(client, Message::PUB_SYNC, true);
+		return;
+	}
+	table.nodeUUID = from;
+	table.version = pubVersion;
+	table.ipcEndpoint = ipcEndpoint;
+
+	while(REMAINING_BYTES_TOREAD > 2 + 37) {
+		uint16_t change;
 		uint16_t port;
 		char* channelName;
 		char* pubUUID;
 		uint16_t type;
+		readPtr = readUInt16(readPtr, change);
 		readPtr = readPubInfo(readPtr, type, port, channelName, pubUUID);
-		processRemotePubAdded(from, port, type, channelName, pubUUID);
+
+		if (change == Message::PUB_ADDED) {
+			PublisherStub pubStub(boost::shared_ptr<PublisherStubImpl>(new PublisherStubImpl()));
+			pubStub.getImpl()->setUUID(pubUUID);
+			pubStub.getImpl()->setPort(port);
+			pubStub.getImpl()->setChannelName(channelName);
+			pubStub.getImpl()->implType = type;
+			table.pubs[pubUUID] = pubStub;
+		} else {
+			table.pubs.erase(pubUUID);
+		}
+	}
+
+	syncRemotePubs(from, table);
+}
+
+/**
+ * Keep the publisher table of a node we disconnected from, but only for the most recent ones.
+ */
+void ZeroMQNode::retirePubTable(const std::string& address) {
+	if (_remotePubTables.find(address) == _remotePubTables.end())
+		return;
+
+	_idlePubTables.remove(address);
+	_idlePubTables.push_back(address);
+	while(_idlePubTables.size() > UMUNDO_NODE_IDLE_PUB_TABLES) {
+		_remotePubTables.erase(_idlePubTables.front());
+		_idlePubTables.pop_front();
+	}
+}
+
+/**
+ * Drop the publisher table of a node that is gone or was replaced.
+ */
+void ZeroMQNode::forgetPubTable(const std::string& address) {
+	_remotePubTables.erase(address);
+	_idlePubTables.remove(address);
+}
+
+/**
+ * Remember a change to our publisher table for remote nodes that are behind.
+ */
+void ZeroMQNode::recordPubChange(Message::Type type, const Publisher& pub) {
+	PubChange change;
+	change.version = ++_pubVersion;
+	change.type = type;
+	change.pub = PublisherStub(boost::shared_ptr<PublisherStubImpl>(new PublisherStubImpl()));
+	change.pub.getImpl()->setUUID(pub.getUUID());
+	change.pub.getImpl()->setChannelName(pub.getChannelName());
+	change.pub.getImpl()->implType = pub.getImpl()->implType;
+
+	_pubChanges.push_back(change);
+	while(_pubChanges.size() > UMUNDO_NODE_PUB_HISTORY)
+		_pubChanges.pop_front();
+}
+
+/**
+ * Ask a remote node for its publishers, sending the version of its table we know.
+ */
+void ZeroMQNode::sendPubSync(boost::shared_ptr<NodeConnection> client, Message::Type type, bool forceFull) {
+	COMMON_VARS;
+
+	std::string knownUUID;
+	uint32_t knownVersion = 0;
+	if (!forceFull && _remotePubTables.find(client->address) != _remotePubTables.end()) {
+		knownUUID = _remotePubTables[client->address].nodeUUID;
+		knownVersion = _remotePubTables[client->address].version;
+	}
+
+	size_t bufferSize = 4 + knownUUID.length() + 1 + 4;
+	PREPARE_MSG(syncReqMsg, bufferSize);
+	writePtr = writeVersionAndType(writePtr, type);
+	writePtr = writeString(writePtr, knownUUID.c_str(), knownUUID.length());
+	writePtr = writeUInt32(writePtr, knownVersion);
+	assert(writePtr - writeBuffer == zmq_msg_size(&syncReqMsg));
+
+	zmq_sendmsg(client->socket, &syncReqMsg, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_sendmsg: %s", zmq_strerror(errno));
+	_stats.recordMetaMsgSent(bufferSize);
+	client->lastSent = Thread::getMonotonicMs();
+
+	zmq_msg_close(&syncReqMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+}
+
+/**
+ * Bring the publishers of a remote node stub in line with its publisher table.
+ */
+void ZeroMQNode::syncRemotePubs(const std::string& nodeUUID, const PubTable& table) {
+	if (_connTo.find(nodeUUID) == _connTo.end())
+		return;
+
+	std::map<std::string, PublisherStub> knownPubs = _connTo[nodeUUID]->node.getPublishers();
+
+	std::map<std::string, PublisherStub>::iterator knownIter = knownPubs.begin();
+	while(knownIter != knownPubs.end()) {
+		if (table.pubs.find(knownIter->first) == table.pubs.end()) {
+			PublisherStub& pub = knownIter->second;
+			processRemotePubRemoved((char*)nodeUUID.c_str(),
+			                        pub.getPort(),
+			                        pub.getImpl()->implType,
+			                        (char*)pub.getChannelName().c_str(),
+			                        (char*)knownIter->first.c_str());
+		}
+		knownIter++;
+	}
+
+	std::map<std::string, PublisherStub>::const_iterator tableIter = table.pubs.begin();
+	while(tableIter != table.pubs.end()) {
+		if (knownPubs.find(tableIter->first) == knownPubs.end()) {
+			const PublisherStub& pub = tableIter->second;
+			processRemotePubAdded((char*)nodeUUID.c_str(),
+			                      pub.getPort(),
+			                      pub.getImpl()->implType,
+			                      (char*)pub.getChannelName().c_str(),
+			                      (char*)tableIter->first.c_str(),
+			                      (char*)table.ipcEndpoint.c_str());
+		}
+		tableIter++;
 	}
 }
 
@@ -1275,7 +2233,8 @@ void ZeroMQNode::processRemotePubAdded(char* nodeUUID,
                                        uint16_t port,
                                        uint16_t type,
                                        char* channelName,
-                                       char* pubUUID) {
+                                       char* pubUUID,
+                                       char* ipcEndpoint) {
 	if (_connTo.find(nodeUUID) == _connTo.end())
 		return;
 
@@ -1292,13 +2251,14 @@ void ZeroMQNode::processRemotePubAdded(char* nodeUUID,
 	pubStub.getImpl()->setRemote(nodeStub.isRemote());
 	pubStub.getImpl()->setIP(nodeStub.getIP());
 	pubStub.getImpl()->setTransport(nodeStub.getTransport());
+	pubStub.getImpl()->setIPCEndpoint(ipcEndpoint);
 	pubStub.getImpl()->implType = type;
 
 	nodeStub.getImpl()->addPublisher(pubStub);
 
 	std::map<std::string, Subscriber>::iterator subIter = _subs.begin();
 	while(subIter != _subs.end()) {
-		if (subIter->second.getImpl()->implType == type && subIter->second.matches(channelName)) {
+		if (TYPES_MATCH(subIter->second.getImpl()->implType, type) && subIter->second.matches(channelName)) {
 			subIter->second.added(pubStub, nodeStub);
 			sendSubAdded(nodeUUID, subIter->second, pubStub);
 		}
@@ -1322,7 +2282,7 @@ void ZeroMQNode::processRemotePubRemoved(char* nodeUUID,
 
 	std::map<std::string, Subscriber>::iterator subIter = _subs.begin();
 	while(subIter != _subs.end()) {
-		if (subIter->second.getImpl()->implType == type && subIter->second.matches(channelName)) {
+		if (TYPES_MATCH(subIter->second.getImpl()->implType, type) && subIter->second.matches(channelName)) {
 			subIter->second.removed(pubStub, nodeStub);
 			sendSubRemoved(nodeUUID, subIter->second, pubStub);
 		}
@@ -1331,9 +2291,46 @@ void ZeroMQNode::processRemotePubRemoved(char* nodeUUID,
 	nodeStub.removePublisher(pubStub);
 }
 
+/**
+ * Queue a subscription for the remote node, flushSubscribes sends all of them in one message.
+ */
 void ZeroMQNode::sendSubAdded(const char* nodeUUID, const Subscriber& sub, const PublisherStub& pub) {
+	if (_connTo.find(nodeUUID) == _connTo.end())
+		return;
+
+	if (!_connTo[nodeUUID]->socket)
+		return;
+
+	UM_LOG_INFO("Queuing sub added for %s on %s to publisher %s",
+	            sub.getChannelName().c_str(), SHORT_UUID(sub.getUUID()).c_str(), SHORT_UUID(pub.getUUID()).c_str());
+
+	size_t recordSize = SUB_INFO_SIZE(sub) + PUB_INFO_SIZE(pub);
+	std::string& pending = _pendingSubscribes[nodeUUID];
+	size_t offset = pending.size();
+	pending.resize(offset + recordSize);
+
+	char* writePtr = &pending[offset];
+	writePtr = writeSubInfo(writePtr, sub);
+	writePtr = writePubInfo(writePtr, pub);
+	assert(writePtr - &pending[offset] == recordSize);
+	_subscribesSent++;
+
+	if (pending.size() >= UMUNDO_NODE_SUBSCRIBE_BATCH)
+		flushSubscribes(nodeUUID);
+}
+
+/**
+ * Send the queued subscriptions for a remote node as a single SUBSCRIBE message.
+ */
+void ZeroMQNode::flushSubscribes(const std::string& nodeUUID) {
 	COMMON_VARS;
 
+	if (_pendingSubscribes.find(nodeUUID) == _pendingSubscribes.end())
+		return;
+
+	std::string records = _pendingSubscribes[nodeUUID];
+	_pendingSubscribes.erase(nodeUUID);
+
 	if (_connTo.find(nodeUUID) == _connTo.end())
 		return;
 
@@ -1341,27 +2338,31 @@ void ZeroMQNode::sendSubAdded(const char* nodeUUID, const Subscriber& sub, const
 	if (!clientSocket)
 		return;
 
-	UM_LOG_INFO("Sending sub added for %s on %s to publisher %s",
-	            sub.getChannelName().c_str(), SHORT_UUID(sub.getUUID()).c_str(), SHORT_UUID(pub.getUUID()).c_str());
-
-	size_t bufferSize = 4 + SUB_INFO_SIZE(sub) + PUB_INFO_SIZE(pub);
+	size_t bufferSize = 4 + records.size();
 	PREPARE_MSG(subAddedMsg, bufferSize);
 
 	writePtr = writeVersionAndType(writePtr, Message::SUBSCRIBE);
-	writePtr = writeSubInfo(writePtr, sub);
-	writePtr = writePubInfo(writePtr, pub);
-	assert(writePtr - writeBuffer == bufferSize);
+	memcpy(writePtr, records.data(), records.size());
 
 	zmq_msg_send(&subAddedMsg, clientSocket, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
-	_buckets.back().nrMetaMsgSent++;
-	_buckets.back().sizeMetaMsgSent += bufferSize;
+	_stats.recordMetaMsgSent(bufferSize);
+	_subscribeMsgsSent++;
+	_connTo[nodeUUID]->lastSent = Thread::getMonotonicMs();
 
 	zmq_msg_close(&subAddedMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 }
 
+void ZeroMQNode::flushSubscribes() {
+	while(_pendingSubscribes.size() > 0)
+		flushSubscribes(_pendingSubscribes.begin()->first);
+}
+
 void ZeroMQNode::sendSubRemoved(const char* nodeUUID, const Subscriber& sub, const PublisherStub& pub) {
 	COMMON_VARS;
 
+	// do not overtake the subscription
+	flushSubscribes(nodeUUID);
+
 	if (_connTo.find(nodeUUID) == _connTo.end())
 		return;
 
@@ -1381,8 +2382,8 @@ void ZeroMQNode::sendSubRemoved(const char* nodeUUID, const Subscriber& sub, con
 	assert(writePtr - writeBuffer == bufferSize);
 
 	zmq_msg_send(&subRemovedMsg, clientSocket, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
-	_buckets.back().nrMetaMsgSent++;
-	_buckets.back().sizeMetaMsgSent += bufferSize;
+	_stats.recordMetaMsgSent(bufferSize);
+	_connTo[nodeUUID]->lastSent = Thread::getMonotonicMs();
 
 	zmq_msg_close(&subRemovedMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 
@@ -1433,12 +2434,14 @@ char* ZeroMQNode::writeSubInfo(char* buffer, const Subscriber& sub) {
 	buffer = writeString(buffer, channel.c_str(), channel.length());
 	buffer = writeString(buffer, uuid.c_str(), uuid.length());
 	buffer = writeUInt16(buffer, type);
+	if (type == Subscriber::RTP)
+		buffer = writeUInt16(buffer, sub.getImpl()->getPort());
 
 	assert(buffer - start == SUB_INFO_SIZE(sub));
 	return buffer;
 }
 
-char* ZeroMQNode::readSubInfo(char* buffer, uint16_t& type, char*& channelName, char*& uuid) {
+char* ZeroMQNode::readSubInfo(char* buffer, uint16_t& type, uint16_t& port, char*& channelName, char*& uuid) {
 	char* start = buffer;
 	(void)start; // surpress unused warning without assert
 
@@ -1446,6 +2449,11 @@ char* ZeroMQNode::readSubInfo(char* buffer, uint16_t& type, char*& channelName,
 	buffer = readString(buffer, uuid, 37);
 	buffer = readUInt16(buffer, type);
 
+	// only RTP subscribers receive on a socket of their own
+	port = 0;
+	if (type == Subscriber::RTP)
+		buffer = readUInt16(buffer, port);
+
 	return buffer;
 }
 
@@ -1494,16 +2502,135 @@ char* ZeroMQNode::readUInt16(char* buffer, uint16_t& value) {
 	return buffer;
 }
 
+char* ZeroMQNode::writeUInt32(char* buffer, uint32_t value) {
+	*(uint32_t*)(buffer) = htonl(value);
+	buffer += 4;
+	return buffer;
+}
+
+char* ZeroMQNode::readUInt32(char* buffer, uint32_t& value) {
+	value = ntohl(*(uint32_t*)(buffer));
+	buffer += 4;
+	return buffer;
+}
+
+ZeroMQNode::StatRing::StatRing() : _current(0), _totalMetaMsgsSent(0), _totalMetaBytesSent(0) {
+	memset((void*)_ring, 0, sizeof(_ring));
+	memset((void*)_channelHash, 0, sizeof(_channelHash));
+	_ring[0].timeStamp = Thread::getMonotonicMs();
+}
+
+size_t ZeroMQNode::StatRing::internChannel(const char* channelName, size_t length) {
+	// FNV-1a, zero is reserved for empty slots
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)channelName[i];
+		hash *= 16777619u;
+	}
+	if (hash == 0)
+		hash = 1;
+
+	size_t slot = hash % UMUNDO_PERF_MAX_CHANNELS;
+	for (size_t probe = 0; probe < UMUNDO_PERF_MAX_CHANNELS; probe++) {
+		if (_channelHash[slot] == 0) {
+			// first time we see this channel - publish the name before the hash
+			_channelName[slot] = std::string(channelName, length);
+			Atomic::barrier();
+			_channelHash[slot] = hash;
+			return slot;
+		}
+		if (_channelHash[slot] == hash &&
+		        _channelName[slot].length() == length &&
+		        memcmp(_channelName[slot].c_str(), channelName, length) == 0) {
+			return slot;
+		}
+		slot = (slot + 1) % UMUNDO_PERF_MAX_CHANNELS;
+	}
+	return UMUNDO_PERF_MAX_CHANNELS;
+}
+
+void ZeroMQNode::StatRing::rotate(uint64_t now) {
+	size_t current = Atomic::load(&_current);
+	if (_ring[current].timeStamp + UMUNDO_PERF_BUCKET_LENGTH_MS > now)
+		return;
+
+	// recycle the oldest bucket, nobody is recording there
+	size_t next = (current + 1) % UMUNDO_PERF_NR_BUCKETS;
+	RingBucket& bucket = _ring[next];
+
+	Atomic::add(&bucket.sequence, 1);
+	bucket.timeStamp = now;
+	for (size_t i = 0; i <= UMUNDO_PERF_MAX_CHANNELS; i++) {
+		bucket.nrChannelMsg[i] = 0;
+		bucket.sizeChannelMsg[i] = 0;
+	}
+	bucket.nrMetaMsgRcvd = 0;
+	bucket.sizeMetaMsgRcvd = 0;
+	bucket.nrMetaMsgSent = 0;
+	bucket.sizeMetaMsgSent = 0;
+	Atomic::add(&bucket.sequence, 1);
+
+	Atomic::store(&_current, next);
+}
+
+std::list<ZeroMQNode::StatBucket<size_t> > ZeroMQNode::StatRing::snapshot(uint64_t now) {
+	std::list<StatBucket<size_t> > buckets;
+	size_t current = Atomic::load(&_current);
+
+	// walk from the oldest to the current bucket
+	for (size_t i = 1; i <= UMUNDO_PERF_NR_BUCKETS; i++) {
+		RingBucket& bucket = _ring[(current + i) % UMUNDO_PERF_NR_BUCKETS];
+		StatBucket<size_t> copy;
+
+		size_t sequence;
+		do {
+			while((sequence = Atomic::load(&bucket.sequence)) & 1)
+				Thread::yield();
+
+			copy.timeStamp = bucket.timeStamp;
+			copy.nrMetaMsgRcvd = bucket.nrMetaMsgRcvd;
+			copy.sizeMetaMsgRcvd = bucket.sizeMetaMsgRcvd;
+			copy.nrMetaMsgSent = bucket.nrMetaMsgSent;
+			copy.sizeMetaMsgSent = bucket.sizeMetaMsgSent;
+			copy.nrChannelMsg.clear();
+			copy.sizeChannelMsg.clear();
+			for (size_t j = 0; j <= UMUNDO_PERF_MAX_CHANNELS; j++) {
+				if (bucket.nrChannelMsg[j] == 0)
+					continue;
+				if (j == UMUNDO_PERF_MAX_CHANNELS) {
+					// channels that found no slot in the table
+					copy.nrChannelMsg[UMUNDO_PERF_OTHER_CHANNELS] = bucket.nrChannelMsg[j];
+					copy.sizeChannelMsg[UMUNDO_PERF_OTHER_CHANNELS] = bucket.sizeChannelMsg[j];
+					continue;
+				}
+				if (_channelHash[j] == 0)
+					continue;
+				Atomic::barrier();
+				copy.nrChannelMsg[_channelName[j]] = bucket.nrChannelMsg[j];
+				copy.sizeChannelMsg[_channelName[j]] = bucket.sizeChannelMsg[j];
+			}
+		} while(Atomic::load(&bucket.sequence) != sequence);
+
+		if (copy.timeStamp == 0 || copy.timeStamp + UMUNDO_PERF_WINDOW_LENGTH_MS < now)
+			continue;
+		buckets.push_back(copy);
+	}
+	return buckets;
+}
+
 ZeroMQNode::StatBucket<double> ZeroMQNode::accumulateIntoBucket() {
 	StatBucket<double> statBucket;
 	
 	double rollOffFactor = 0.3;
 
-	std::list<StatBucket<size_t> >::iterator buckFrameStart = _buckets.begin();
-	std::list<StatBucket<size_t> >::iterator buckFrameEnd = _buckets.begin();
+	// copy of the recent buckets, the node thread keeps recording meanwhile
+	std::list<StatBucket<size_t> > buckets = _stats.snapshot(Thread::getMonotonicMs());
+
+	std::list<StatBucket<size_t> >::iterator buckFrameStart = buckets.begin();
+	std::list<StatBucket<size_t> >::iterator buckFrameEnd = buckets.begin();
 	std::map<std::string, size_t>::iterator chanIter;
 
-	while(buckFrameEnd != _buckets.end()) {
+	while(buckFrameEnd != buckets.end()) {
 		if (buckFrameEnd->timeStamp - 1000 < buckFrameStart->timeStamp) {
 			// we do not yet have a full second
 			buckFrameEnd++;
@@ -1618,6 +2745,34 @@ void ZeroMQNode::replyWithDebugInfo(const std::string uuid) {
 	zmq_send(_nodeSocket, ss.str().c_str(), ss.str().length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
 	RESETSS(ss);
 
+	// where we serialize, the profiler only knows about locks when built with PROFILE_LOCKS
+	std::list<LockStats> lockStats = LockProfiler::getStats();
+	for (std::list<LockStats>::iterator lockIter = lockStats.begin(); lockIter != lockStats.end(); lockIter++) {
+		ss << "lock:" << lockIter->name << ":acquisitions:" << lockIter->acquisitions;
+		zmq_send(_nodeSocket, ss.str().c_str(), ss.str().length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+		RESETSS(ss);
+
+		ss << "lock:" << lockIter->name << ":contentions:" << lockIter->contentions;
+		zmq_send(_nodeSocket, ss.str().c_str(), ss.str().length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+		RESETSS(ss);
+
+		ss << "lock:" << lockIter->name << ":waitUs:" << lockIter->waitNs / 1000;
+		zmq_send(_nodeSocket, ss.str().c_str(), ss.str().length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+		RESETSS(ss);
+
+		ss << "lock:" << lockIter->name << ":maxWaitUs:" << lockIter->maxWaitNs / 1000;
+		zmq_send(_nodeSocket, ss.str().c_str(), ss.str().length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+		RESETSS(ss);
+
+		ss << "lock:" << lockIter->name << ":holdUs:" << lockIter->holdNs / 1000;
+		zmq_send(_nodeSocket, ss.str().c_str(), ss.str().length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+		RESETSS(ss);
+
+		ss << "lock:" << lockIter->name << ":maxHoldUs:" << lockIter->maxHoldNs / 1000;
+		zmq_send(_nodeSocket, ss.str().c_str(), ss.str().length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+		RESETSS(ss);
+	}
+
 	// send our publishers
 	std::map<std::string, Publisher>::iterator pubIter = _pubs.begin();
 	while (pubIter != _pubs.end()) {
@@ -1644,6 +2799,10 @@ void ZeroMQNode::replyWithDebugInfo(const std::string uuid) {
 		ss << "pub:sent:bytes:" << statBucket.sizeChannelMsg[pubIter->second.getChannelName()];
 		zmq_send(_nodeSocket, ss.str().c_str(), ss.str().length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
 		RESETSS(ss);
+
+		ss << "pub:suppressed:msgs:" << pubIter->second.getSuppressedMessages();
+		zmq_send(_nodeSocket, ss.str().c_str(), ss.str().length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+		RESETSS(ss);
 		
 		std::map<std::string, SubscriberStub> subs = pubIter->second.getSubscribers();
 		std::map<std::string, SubscriberStub>::iterator subIter = subs.begin();
@@ -1816,12 +2975,15 @@ void ZeroMQNode::replyWithDebugInfo(const std::string uuid) {
 }
 
 ZeroMQNode::NodeConnection::NodeConnection()
-	: connectedTo(false), connectedFrom(false), socket(NULL), startedAt(0), refCount(0), isConfirmed(false) {}
+	: connectedTo(false), connectedFrom(false), socket(NULL), startedAt(0), refCount(0), isConfirmed(false), lastSent(0), isWatched(false), attempts(0), handshakeTimeout(0) {
+	lastSeen = Thread::getMonotonicMs();
+}
 
 ZeroMQNode::NodeConnection::NodeConnection(const std::string& _address,
         const std::string& thisUUID)
-	: connectedTo(false), connectedFrom(false), address(_address), refCount(0), isConfirmed(false) {
-	startedAt	= Thread::getTimeStampMs();
+	: connectedTo(false), connectedFrom(false), address(_address), refCount(0), isConfirmed(false), lastSent(0), isWatched(false), attempts(0), handshakeTimeout(0) {
+	startedAt	= Thread::getMonotonicMs();
+	lastSeen = startedAt;
 	socketId = thisUUID;
 	socket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_DEALER);
 	if (!socket) {
@@ -1846,6 +3008,6 @@ ZeroMQNode::NodeConnection::~NodeConnection() {
 
 ZeroMQNode::Subscription::Subscription() :
 	isZMQConfirmed(false),
-	startedAt(Thread::getTimeStampMs()) {}
+	startedAt(Thread::getMonotonicMs()) {}
 
 }
@@ -26,8 +26,10 @@
 #include "umundo/common/Common.h"
 #include "umundo/thread/Thread.h"
 #include "umundo/common/ResultSet.h"
+#include "umundo/common/TimerWheel.h"
 #include "umundo/connection/Node.h"
 #include "umundo/common/Message.h"
+#include "umundo/discovery/PeerCache.h"
 
 /// Send uuid as first message in envelope
 #define ZMQ_SEND_IDENTITY(msg, uuid, socket) \
@@ -65,12 +67,19 @@ ZMQ_PREPARE_STRING(endPointOp, parameter, strlen(parameter)); \
 zmq_sendmsg(_writeOpSocket, &endPointOp, 0) >= 0 || UM_LOG_WARN("zmq_sendmsg: %s",zmq_strerror(errno)); \
 zmq_msg_close(&endPointOp) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
 
+#define UMUNDO_PERF_WINDOW_LENGTH_MS 5000
+#define UMUNDO_PERF_BUCKET_LENGTH_MS 200
+#define UMUNDO_PERF_NR_BUCKETS 32 ///< has to cover the window plus the bucket currently written
+#define UMUNDO_PERF_MAX_CHANNELS 128 ///< channels we keep itemized statistics for
+#define UMUNDO_PERF_OTHER_CHANNELS "*other*" ///< name we report all channels beyond these under
+
 namespace umundo {
 
 class PublisherStub;
 class ZeroMQPublisher;
 class ZeroMQSubscriber;
 class NodeQuery;
+class ShmRing;
 
 /**
  * Concrete node implementor for 0MQ (bridge pattern).
@@ -102,12 +111,40 @@ public:
 	//@{
 	void added(EndPoint);    ///< A node was added, connect to its router socket and list our publishers.
 	void removed(EndPoint);  ///< A node was removed, notify local subscribers and clean up.
-	void changed(EndPoint);  ///< Never happens.
+	void changed(EndPoint);  ///< A node's publisher summary changed, connect if it became interesting.
 	//@}
 
+	const std::string getPubSummary() const;
+
+
+	/** @name Statistics */
+	//@{
+	size_t getMetaMsgsSent() {
+		return _stats.getTotalMetaMsgsSent();
+	} ///< node-to-node control messages since we were created
+	size_t getMetaBytesSent() {
+		return _stats.getTotalMetaBytesSent();
+	}
+	size_t getMaxHandshakesInFlight() {
+		return _maxHandshakesInFlight;
+	} ///< most CONNECT_REQs we had unanswered at the same time
+	size_t getSubscribesSent() {
+		return _subscribesSent;
+	} ///< subscriptions to remote publishers we announced
+	size_t getSubscribeMsgsSent() {
+		return _subscribeMsgsSent;
+	} ///< SUBSCRIBE messages they were batched into
+	size_t getBatchedMsgsSent() {
+		return _batchedMsgsSent;
+	} ///< small publications we coalesced
+	size_t getBatchesSent() {
+		return _batchesSent;
+	} ///< batches they went out in
+	//@}
 
 	static uint16_t bindToFreePort(void* socket, const std::string& transport, const std::string& address);
 	static void* getZeroMQContext();
+	static void configureZeroMQContext(std::map<std::string, std::string>& options);
 
 protected:
 	class NodeConnection {
@@ -126,6 +163,11 @@ protected:
 		NodeStub node; /// always a representation about the remote node
 		int refCount; ///< when connect to, how many times this address was added as an endpoint
 		bool isConfirmed; ///< when connect to, whether we received any node info reply
+		uint64_t lastSeen; ///< monotonic timestamp of the last message we received from the remote node
+		uint64_t lastSent; ///< monotonic timestamp of the last message we sent to the remote node
+		bool isWatched; ///< whether there is a liveness timer for this connection
+		uint32_t attempts; ///< when connect to, handshakes that timed out before this one
+		uint32_t handshakeTimeout; ///< when connect to, how long we wait for the CONNECT_REP
 
 	};
 
@@ -141,11 +183,28 @@ protected:
 		uint64_t startedAt; ///< Timestamp when we noticed this subscription attempt
 	};
 
+	class PubChange {
+	public:
+		uint32_t version; ///< version of our publisher table after this change
+		Message::Type type; ///< PUB_ADDED or PUB_REMOVED
+		PublisherStub pub; ///< detached copy of the publisher's information
+	};
+
+	class PubTable {
+	public:
+		PubTable() : version(0) {}
+
+		std::string nodeUUID; ///< remote node this table belongs to
+		uint32_t version; ///< version of the remote publisher table we are at
+		std::map<std::string, PublisherStub> pubs; ///< remote publishers per uuid
+		std::string ipcEndpoint; ///< where the remote node's publisher socket is bound for its host, empty if it is not
+	};
+
 	template<class T>
 	class StatBucket {
 	public:
 		StatBucket() :
-			timeStamp(Thread::getTimeStampMs()),
+			timeStamp(Thread::getMonotonicMs()),
 			nrMetaMsgRcvd(0),
 			sizeMetaMsgRcvd(0),
 			nrMetaMsgSent(0),
@@ -159,8 +218,69 @@ protected:
 		T nrMetaMsgSent;
 		T sizeMetaMsgSent;
 	};
-	
-	std::list<StatBucket<size_t> > _buckets;
+
+	/**
+	 * Fixed ring of statistic buckets, recording does neither lock nor allocate.
+	 *
+	 * Counters are bumped atomically by whoever sends or receives, only the node thread
+	 * interns channels and rotates buckets. Readers copy buckets under a per-bucket
+	 * sequence number and retry if the bucket was recycled meanwhile.
+	 */
+	class StatRing {
+	public:
+		StatRing();
+
+		size_t internChannel(const char* channelName, size_t length); ///< only from node thread, UMUNDO_PERF_MAX_CHANNELS on overflow
+		void rotate(uint64_t now); ///< only from node thread, start a new bucket if the current one is too old
+
+		void recordChannelMsg(size_t channelId, size_t size) {
+			RingBucket& bucket = _ring[Atomic::load(&_current)];
+			Atomic::add(&bucket.nrChannelMsg[channelId], 1);
+			Atomic::add(&bucket.sizeChannelMsg[channelId], size);
+		}
+		void recordMetaMsgRcvd(size_t size) {
+			RingBucket& bucket = _ring[Atomic::load(&_current)];
+			Atomic::add(&bucket.nrMetaMsgRcvd, 1);
+			Atomic::add(&bucket.sizeMetaMsgRcvd, size);
+		}
+		void recordMetaMsgSent(size_t size) {
+			RingBucket& bucket = _ring[Atomic::load(&_current)];
+			Atomic::add(&bucket.nrMetaMsgSent, 1);
+			Atomic::add(&bucket.sizeMetaMsgSent, size);
+			Atomic::add(&_totalMetaMsgsSent, 1);
+			Atomic::add(&_totalMetaBytesSent, size);
+		}
+		size_t getTotalMetaMsgsSent() {
+			return Atomic::load(&_totalMetaMsgsSent);
+		}
+		size_t getTotalMetaBytesSent() {
+			return Atomic::load(&_totalMetaBytesSent);
+		}
+
+		std::list<StatBucket<size_t> > snapshot(uint64_t now); ///< all buckets within the window, oldest first
+
+	protected:
+		struct RingBucket {
+			volatile size_t sequence; ///< odd while the bucket is recycled
+			uint64_t timeStamp;
+			volatile size_t nrChannelMsg[UMUNDO_PERF_MAX_CHANNELS + 1];
+			volatile size_t sizeChannelMsg[UMUNDO_PERF_MAX_CHANNELS + 1];
+			volatile size_t nrMetaMsgRcvd;
+			volatile size_t sizeMetaMsgRcvd;
+			volatile size_t nrMetaMsgSent;
+			volatile size_t sizeMetaMsgSent;
+		};
+
+		RingBucket _ring[UMUNDO_PERF_NR_BUCKETS];
+		volatile size_t _current; ///< index of the bucket we are recording into
+		volatile size_t _totalMetaMsgsSent; ///< not windowed, since the node was created
+		volatile size_t _totalMetaBytesSent;
+
+		volatile uint32_t _channelHash[UMUNDO_PERF_MAX_CHANNELS]; ///< open addressing table, 0 marks an empty slot
+		std::string _channelName[UMUNDO_PERF_MAX_CHANNELS]; ///< valid once the hash is set
+	};
+
+	StatRing _stats;
 	
 	ZeroMQNode();
 
@@ -172,12 +292,23 @@ protected:
 	std::map<std::string, boost::shared_ptr<NodeConnection> > _connPending;
 
 	std::map<std::string, Subscription> _subscriptions;
+	std::set<std::string> _pubTopics; ///< topics subscribed at our publisher socket
 
-	Mutex _mutex;
-	uint64_t _lastNodeInfoBroadCast;
-	uint64_t _lastDeadNodeRemoval;
+	uint32_t _pubVersion; ///< version of our publisher table, incremented with every change
+	std::list<PubChange> _pubChanges; ///< recent changes to our publisher table to send deltas
+	std::map<std::string, PubTable> _remotePubTables; ///< publisher tables of remote nodes per address
+	std::list<std::string> _idlePubTables; ///< disconnected addresses we keep the table of for a delta on reconnect, oldest first
+
+	mutable Mutex _mutex;
 	bool _allowLocalConns;
 
+	std::map<std::string, EndPoint> _skippedEndPoints; ///< nodes we did not connect to as they publish nothing for us, by address
+	bool isInteresting(const EndPoint& endPoint);
+
+	uint32_t _failoverMs; ///< time without a sign of life before we remove a remote node
+	uint32_t _heartbeatMs; ///< send a heartbeat when we were silent for this long
+	TimerWheel<boost::weak_ptr<NodeConnection> > _timers; ///< liveness timers for connections
+
 	zmq_pollitem_t sockets[4]; // standard sockets to poll for this node
 
 	void* _nodeSocket; ///< global node socket for off-band communication
@@ -187,6 +318,72 @@ protected:
 	void* _subSocket; ///< umundo internal socket to receive publications from publishers
 	void* _monitorSocket;
 
+	ShmRing* _shmRing; ///< publications for subscribers on this host, NULL if disabled
+	std::string _ipcEndpoint; ///< where our publisher socket is bound for processes on this host, empty if it is not
+	int _ipcLockFd; ///< held locked while we live, so others can tell our socket file from a stale one
+
+	void bindIPC();
+	static void removeStaleIPCFiles();
+
+	/** @name Connection admission */
+	//@{
+	class PendingConnect {
+	public:
+		PendingConnect() : attempts(0), timeout(0), notBefore(0) {}
+		std::string address; ///< remote node socket
+		uint32_t attempts; ///< handshakes that timed out so far
+		uint32_t timeout; ///< backoff before and CONNECT_REP timeout of the next attempt
+		uint64_t notBefore; ///< earliest time for the next attempt
+	};
+
+	std::list<PendingConnect> _connQueue; ///< endpoints waiting for a handshake slot or their backoff
+	uint32_t _maxHandshakes; ///< CONNECT_REQs we have in flight at most
+	size_t _maxHandshakesInFlight;
+	size_t _subscribesSent;
+	size_t _subscribeMsgsSent;
+	uint64_t _lastAdmission;
+	uint32_t _jitterState;
+	std::map<std::string, std::string> _pendingSubscribes; ///< SUBSCRIBE records per remote node uuid
+
+	void connect(const std::string& address, uint32_t attempts, uint32_t timeout);
+	size_t handshakesInFlight();
+	bool isQueuedForConnect(const std::string& address);
+	uint32_t backoff(uint32_t attempts);
+	void queueConnect(const std::string& address, uint32_t attempts, uint64_t now);
+	void admitConnections(uint64_t now);
+	void flushSubscribes(const std::string& nodeUUID);
+	void flushSubscribes();
+	//@}
+
+	/** @name Warm start from the peer cache */
+	//@{
+	PeerCache _peerCache; ///< remote nodes we were connected to, written back to disk every now and then
+	std::map<std::string, uint64_t> _cachedPeers; ///< addresses only known from the cache, with the time we give up on them
+	uint64_t _lastPeerCacheSave;
+
+	void expireCachedPeers(uint64_t now);
+	//@}
+
+	/** @name Coalescing small publications */
+	//@{
+	struct Batch {
+		Batch() : nrMsgs(0), startedAt(0) {}
+		std::string data; ///< per publication its number of frames and the size-prefixed frames
+		uint32_t nrMsgs;
+		uint64_t startedAt; ///< timestamp in us of the first publication in the batch
+	};
+
+	size_t _coalesceSize; ///< maximum size of a batch, 0 if we do not coalesce
+	uint32_t _coalesceDelayUs; ///< maximum time a publication waits in a batch
+	std::map<std::string, Batch> _batches; ///< pending batches per channel
+	size_t _batchedMsgsSent;
+	size_t _batchesSent;
+
+	void sendBatch(const std::string& channel);
+	void sendDueBatches(uint64_t nowUs);
+	void sendBatches();
+	//@}
+
 	void run(); ///< see Thread
 
 	/** @name Remote publisher / subscriber maintenance */
@@ -194,7 +391,8 @@ protected:
 	void sendSubRemoved(const char* nodeUUID, const umundo::Subscriber& sub, const umundo::PublisherStub& pub);
 	void sendSubAdded(const char* nodeUUID, const umundo::Subscriber& sub, const umundo::PublisherStub& pub);
 	void confirmSub(const std::string& subUUID);
-	void processRemotePubAdded(char* nodeUUID, uint16_t port, uint16_t type, char* channelName, char* pubUUID);
+	void updatePubInterest(Publisher& pub);
+	void processRemotePubAdded(char* nodeUUID, uint16_t port, uint16_t type, char* channelName, char* pubUUID, char* ipcEndpoint);
 	void processRemotePubRemoved(char* nodeUUID, uint16_t port, uint16_t type, char* channelName, char* pubUUID);
 	//@}
 
@@ -203,28 +401,46 @@ protected:
 	char* writePubInfo(char* buffer, const PublisherStub& pub);
 	char* readPubInfo(char* buffer, uint16_t& type, uint16_t& port, char*& channelName, char*& uuid);
 	char* writeSubInfo(char* buffer, const Subscriber& sub);
-	char* readSubInfo(char* buffer, uint16_t& type, char*& channelName, char*& uuid);
+	char* readSubInfo(char* buffer, uint16_t& type, uint16_t& port, char*& channelName, char*& uuid);
 	char* writeVersionAndType(char* buffer, Message::Type type);
 	char* readVersionAndType(char* buffer, uint16_t& version, umundo::Message::Type& type);
 	char* writeString(char* buffer, const char* content, size_t length);
 	char* readString(char* buffer, char*& content, size_t maxLength);
 	char* writeUInt16(char* buffer, uint16_t value);
 	char* readUInt16(char* buffer, uint16_t& value);
+	char* writeUInt32(char* buffer, uint32_t value);
+	char* readUInt32(char* buffer, uint32_t& value);
 	//@}
 
 	void disconnectRemoteNode(NodeStub& stub);
 	void processNodeComm();
 	void processPubComm();
 	void processOpComm();
+	void processSubComm();
+	bool hasPendingInput(void* socket);
 	void processClientComm(boost::shared_ptr<NodeConnection> client);
-	void processNodeInfo(char* recvBuffer, size_t msgSize);
-	void writeNodeInfo(zmq_msg_t* msg, Message::Type type);
+	void processNodeInfo(boost::shared_ptr<NodeConnection> client, char* recvBuffer, size_t msgSize);
+	void writeNodeInfo(zmq_msg_t* msg, Message::Type type, const std::string& knownUUID = "", uint32_t knownVersion = 0);
+
+	/** @name Versioned publisher tables */
+	//@{
+	void recordPubChange(Message::Type type, const Publisher& pub);
+	void sendPubSync(boost::shared_ptr<NodeConnection> client, Message::Type type, bool forceFull);
+	void syncRemotePubs(const std::string& nodeUUID, const PubTable& table);
+	void retirePubTable(const std::string& address);
+	void forgetPubTable(const std::string& address);
+	//@}
 
 	void processConnectedFrom(const std::string& uuid);
 	void processConnectedTo(const std::string& uuid, boost::shared_ptr<NodeConnection> client);
 
-	void broadCastNodeInfo(uint64_t now);
-	void removeStaleNodes(uint64_t now);
+	/** @name Liveness */
+	//@{
+	void watchConnection(boost::shared_ptr<NodeConnection> conn);
+	void processTimers(uint64_t now);
+	void sendHeartbeat(boost::shared_ptr<NodeConnection> conn);
+	void evictNode(boost::shared_ptr<NodeConnection> conn);
+	//@}
 
 	void replyWithDebugInfo(const std::string uuid);
 	StatBucket<double> accumulateIntoBucket();
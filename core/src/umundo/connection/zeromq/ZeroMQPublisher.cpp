@@ -38,7 +38,7 @@
 
 namespace umundo {
 
-ZeroMQPublisher::ZeroMQPublisher() {}
+ZeroMQPublisher::ZeroMQPublisher() : _nrInterestedNodes(0), _nrDomainSubs(0), _suppressedMsgs(0), _mutex("pub.zmq") {}
 
 void ZeroMQPublisher::init(Options* config) {
 	ScopeLock lock(_mutex);
@@ -96,11 +96,13 @@ void ZeroMQPublisher::resume() {
 
 int ZeroMQPublisher::waitForSubscribers(int count, int timeoutMs) {
 	ScopeLock lock(_mutex);
-	uint64_t now = Thread::getTimeStampMs();
+	uint64_t deadline = Thread::getTimeStampUs() + (uint64_t)timeoutMs * 1000;
 	while (unique_keys(_domainSubs) < (unsigned int)count) {
-		_pubLock.wait(_mutex, timeoutMs);
-		if (timeoutMs > 0 && Thread::getTimeStampMs() - timeoutMs > now)
+		if (timeoutMs <= 0) {
+			_pubLock.wait(_mutex);
+		} else if (!_pubLock.waitUntilUs(_mutex, deadline)) {
 			break;
+		}
 	}
 	/**
 	 * TODO: we get notified when the subscribers uuid occurs, that
@@ -127,6 +129,7 @@ void ZeroMQPublisher::added(const SubscriberStub& sub, const NodeStub& node) {
 	}
 
 	_domainSubs.insert(std::make_pair(sub.getUUID(), std::make_pair(node, sub)));
+	Atomic::store(&_nrDomainSubs, _domainSubs.size());
 
 	UM_LOG_INFO("Publisher %s received subscriber %s on node %s for channel %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(sub.getUUID()).c_str(), SHORT_UUID(node.getUUID()).c_str(), _channelName.c_str());
 
@@ -170,15 +173,32 @@ void ZeroMQPublisher::removed(const SubscriberStub& sub, const NodeStub& node) {
 	}
 
 	_domainSubs.erase(subIter.first);
+	Atomic::store(&_nrDomainSubs, _domainSubs.size());
 	UMUNDO_SIGNAL(_pubLock);
 }
 
+void ZeroMQPublisher::setInterest(const std::string& nodeUUID, bool hasInterest) {
+	ScopeLock lock(_mutex);
+	if (hasInterest) {
+		_interestedNodes.insert(nodeUUID);
+	} else {
+		_interestedNodes.erase(nodeUUID);
+	}
+	Atomic::store(&_nrInterestedNodes, _interestedNodes.size());
+}
+
 void ZeroMQPublisher::send(Message* msg) {
 	if (_isSuspended) {
 		UM_LOG_WARN("Not sending message on suspended publisher");
 		return;
 	}
 
+	// nobody would receive it, do not bother serializing - subscribers via shared memory only show up in _domainSubs
+	if (Atomic::load(&_nrInterestedNodes) == 0 && Atomic::load(&_nrDomainSubs) == 0 && msg->getMeta().find("um.sub") == msg->getMeta().end()) {
+		Atomic::add(&_suppressedMsgs, 1);
+		return;
+	}
+
 	// topic name or explicit subscriber id is first message in envelope
 	zmq_msg_t channelEnvlp;
 	if (msg->getMeta().find("um.sub") != msg->getMeta().end()) {
@@ -187,7 +207,7 @@ void ZeroMQPublisher::send(Message* msg) {
 			UM_LOG_INFO("Subscriber %s is not (yet) connected on %s - queuing message", msg->getMeta("um.sub").c_str(), _channelName.c_str());
 			Message* queuedMsg = new Message(*msg); // copy message
 			queuedMsg->setQueued(true);
-			_queuedMessages[msg->getMeta("um.sub")].push_back(std::make_pair(Thread::getTimeStampMs(), queuedMsg));
+			_queuedMessages[msg->getMeta("um.sub")].push_back(std::make_pair(Thread::getMonotonicMs(), queuedMsg));
 			return;
 		}
 		ZMQ_PREPARE_STRING(channelEnvlp, std::string("~" + msg->getMeta("um.sub")).c_str(), msg->getMeta("um.sub").size() + 1);
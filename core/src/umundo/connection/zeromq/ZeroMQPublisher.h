@@ -47,6 +47,9 @@ public:
 
 	void send(Message* msg);
 	int waitForSubscribers(int count, int timeoutMs);
+	size_t getSuppressedMessages() {
+		return Atomic::load(&_suppressedMsgs);
+	}
 
 protected:
 	/**
@@ -56,6 +59,7 @@ protected:
 
 	void added(const SubscriberStub& sub, const NodeStub& node);
 	void removed(const SubscriberStub& sub, const NodeStub& node);
+	void setInterest(const std::string& nodeUUID, bool hasInterest);
 
 private:
 	void run();
@@ -68,6 +72,14 @@ private:
 	/// messages for subscribers we do not know yet
 	std::map<std::string, std::list<std::pair<uint64_t, umundo::Message*> > > _queuedMessages;
 
+	/// nodes with a 0MQ subscription matching our channel
+	std::set<std::string> _interestedNodes;
+
+	/// sizes of the above for send, it must not touch the containers without the lock
+	volatile size_t _nrInterestedNodes;
+	volatile size_t _nrDomainSubs;
+	volatile size_t _suppressedMsgs;
+
 	Monitor _pubLock;
 	Mutex _mutex;
 
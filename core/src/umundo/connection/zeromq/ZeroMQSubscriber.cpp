@@ -31,14 +31,24 @@
 #include <stdio.h> // snprintf
 #endif
 
+#ifndef WIN32
+#include <arpa/inet.h> // ntohl
+#include <sys/stat.h> // stat
+#endif
+
+#ifdef NET_SHM
+#include "umundo/connection/shm/ShmRing.h"
+#endif
+
 namespace umundo {
 
-ZeroMQSubscriber::ZeroMQSubscriber() {}
+ZeroMQSubscriber::ZeroMQSubscriber() : _mutex("sub.zmq"), _receiveMutex("sub.zmq.receive") {}
 
 void ZeroMQSubscriber::init(Options* config) {
 //	_config = boost::static_pointer_cast<SubscriberConfig>(config);
 
 	(_subSocket     = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_SUB))     || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
+	(_shmCtrlSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_SUB))     || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_readOpSocket  = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR))    || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_writeOpSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR))    || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 
@@ -57,6 +67,10 @@ void ZeroMQSubscriber::init(Options* config) {
 	zmq_setsockopt(_subSocket, ZMQ_SUBSCRIBE, _channelName.c_str(), _channelName.length())  && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
 	zmq_setsockopt(_subSocket, ZMQ_SUBSCRIBE, lastSub.c_str(), lastSub.length())  && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
 
+	// publishers on this host learn about our subscription via the socket, their messages come from the ring
+	zmq_setsockopt(_shmCtrlSocket, ZMQ_RCVHWM, &hwm, sizeof(hwm)) && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
+	zmq_setsockopt(_shmCtrlSocket, ZMQ_SUBSCRIBE, lastSub.c_str(), lastSub.length())  && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
+
 	int rcvTimeOut = 30;
 	zmq_setsockopt(_subSocket, ZMQ_RCVTIMEO, &rcvTimeOut, sizeof(rcvTimeOut));
 
@@ -76,7 +90,20 @@ ZeroMQSubscriber::~ZeroMQSubscriber() {
 	stop();
 	join();
 
+#ifdef NET_SHM
+	std::map<std::string, ShmReader*>::iterator readerIter = _shmReaders.begin();
+	while(readerIter != _shmReaders.end()) {
+		delete readerIter->second;
+		readerIter++;
+	}
+#endif
+	while(_msgQueue.size() > 0) {
+		delete _msgQueue.front();
+		_msgQueue.pop_front();
+	}
+
 	zmq_close(_subSocket) && UM_LOG_WARN("zmq_close: %s",zmq_strerror(errno));
+	zmq_close(_shmCtrlSocket) && UM_LOG_WARN("zmq_close: %s",zmq_strerror(errno));
 	zmq_close(_readOpSocket) && UM_LOG_WARN("zmq_close: %s",zmq_strerror(errno));
 	zmq_close(_writeOpSocket) && UM_LOG_WARN("zmq_close: %s",zmq_strerror(errno));
 }
@@ -105,25 +132,33 @@ void ZeroMQSubscriber::added(const PublisherStub& pub, const NodeStub& node) {
 
 	if (_domainPubs.count(pub.getDomain()) == 0) {
 		std::stringstream ss;
+		void* socket = _subSocket;
+		const char* op = "connectPub";
 
 		if (pub.isInProcess()) {
 			// same process, use inproc communication
 			ss << "inproc://um.pub." << pub.getDomain();
-		} else if (!pub.isRemote() && false) { // disabled for now
+		} else if (!pub.isRemote() && attachShm(pub)) {
+			// same host, publications are in the node's shared memory
+			ss << pub.getTransport() << "://" << pub.getIP() << ":" << pub.getPort();
+			socket = _shmCtrlSocket;
+			op = "connectCtrl";
+		} else if (!pub.isRemote() && hasIPCEndpoint(pub)) {
 			// same host, use inter-process communication
-			ss << "ipc://um.pub." << pub.getDomain();
+			ss << pub.getIPCEndpoint();
 		} else {
 			// remote node, use network
 			ss << pub.getTransport() << "://" << pub.getIP() << ":" << pub.getPort();
 		}
 
-		UM_LOG_INFO("%s subscribing to %s on %s", SHORT_UUID(_uuid).c_str(), pub.getChannelName().c_str(), ss.str().c_str());
+		UM_LOG_INFO("%s subscribing to %s on %s%s", SHORT_UUID(_uuid).c_str(), pub.getChannelName().c_str(), ss.str().c_str(), (socket == _shmCtrlSocket ? " via shared memory" : ""));
 
 		if (isStarted()) {
-			ZMQ_INTERNAL_SEND("connectPub", ss.str().c_str());
+			ZMQ_INTERNAL_SEND(op, ss.str().c_str());
 		} else {
-			zmq_connect(_subSocket, ss.str().c_str()) && UM_LOG_ERR("zmq_connect %s: %s", ss.str().c_str(), zmq_strerror(errno));
+			zmq_connect(socket, ss.str().c_str()) && UM_LOG_ERR("zmq_connect %s: %s", ss.str().c_str(), zmq_strerror(errno));
 		}
+		_domainEndPoints[pub.getDomain()] = ss.str();
 	}
 
 	_pubs[pub.getUUID()] = pub;
@@ -151,28 +186,74 @@ void ZeroMQSubscriber::removed(const PublisherStub& pub, const NodeStub& node) {
 	}
 
 	if (_domainPubs.count(pub.getDomain()) == 0) {
-		std::stringstream ss;
-		if (pub.isInProcess()) {
-			// same process, use inproc communication
-			ss << "inproc://um.pub." << pub.getDomain();
-		} else if (!pub.isRemote() && false) { // disabled for now
-			// same host, use inter-process communication
-			ss << "ipc://um.pub." << pub.getDomain();
-		} else {
-			// remote node, use network
-			ss << pub.getTransport() << "://" << pub.getIP() << ":" << pub.getPort();
+		// disconnect from whatever we chose when the first publisher was added
+		std::string endPoint = _domainEndPoints[pub.getDomain()];
+		_domainEndPoints.erase(pub.getDomain());
+		void* socket = _subSocket;
+		const char* op = "disconnectPub";
+
+#ifdef NET_SHM
+		if (_shmReaders.find(pub.getDomain()) != _shmReaders.end()) {
+			delete _shmReaders[pub.getDomain()];
+			_shmReaders.erase(pub.getDomain());
+			socket = _shmCtrlSocket;
+			op = "disconnectCtrl";
 		}
+#endif
 
-		UM_LOG_INFO("%s unsubscribing from %s on %s", SHORT_UUID(_uuid).c_str(), pub.getChannelName().c_str(), ss.str().c_str());
+		UM_LOG_INFO("%s unsubscribing from %s on %s", SHORT_UUID(_uuid).c_str(), pub.getChannelName().c_str(), endPoint.c_str());
 
 		if (isStarted()) {
-			ZMQ_INTERNAL_SEND("disconnectPub", ss.str().c_str());
+			ZMQ_INTERNAL_SEND(op, endPoint.c_str());
 		} else {
-			zmq_disconnect(_subSocket, ss.str().c_str()) && UM_LOG_ERR("zmq_disconnect %s: %s", ss.str().c_str(), zmq_strerror(errno));
+			zmq_disconnect(socket, endPoint.c_str()) && UM_LOG_ERR("zmq_disconnect %s: %s", endPoint.c_str(), zmq_strerror(errno));
 		}
 	}
 }
 
+/**
+ * Start reading the shared memory ring of the publisher's node if it offers one.
+ */
+bool ZeroMQSubscriber::attachShm(const PublisherStub& pub) {
+#ifdef NET_SHM
+	ShmRing* ring = ShmRing::attach(ShmRing::nameFor(pub.getDomain()));
+	if (ring == NULL)
+		return false;
+
+	_shmReaders[pub.getDomain()] = new ShmReader(this, ring);
+	_shmReaders[pub.getDomain()]->start();
+	return true;
+#else
+	return false;
+#endif
+}
+
+std::string ZeroMQSubscriber::getEndPoint(const PublisherStub& pub) {
+	ScopeLock lock(_mutex);
+	if (_domainEndPoints.find(pub.getDomain()) == _domainEndPoints.end())
+		return "";
+	return _domainEndPoints[pub.getDomain()];
+}
+
+/**
+ * Whether the publisher's node bound a socket file we can reach.
+ */
+bool ZeroMQSubscriber::hasIPCEndpoint(const PublisherStub& pub) {
+#ifndef WIN32
+	std::string endPoint = pub.getIPCEndpoint();
+	if (endPoint.compare(0, 6, "ipc://") != 0)
+		return false;
+
+	// the node may run in another container or its file was removed, fall back to tcp
+	struct stat fileStat;
+	if (stat(endPoint.substr(6).c_str(), &fileStat) != 0 || !S_ISSOCK(fileStat.st_mode))
+		return false;
+	return true;
+#else
+	return false;
+#endif
+}
+
 void ZeroMQSubscriber::setReceiver(Receiver* receiver) {
 	stop();
 	ZMQ_INTERNAL_SEND("",""); // just unblock
@@ -185,12 +266,13 @@ void ZeroMQSubscriber::setReceiver(Receiver* receiver) {
 
 void ZeroMQSubscriber::run() {
 	zmq_pollitem_t items [] = {
-		{ _readOpSocket, 0, ZMQ_POLLIN, 0 }, // one of our members wants to manipulate a socket
-		{ _subSocket,    0, ZMQ_POLLIN, 0 }, // publication requests
+		{ _readOpSocket,  0, ZMQ_POLLIN, 0 }, // one of our members wants to manipulate a socket
+		{ _subSocket,     0, ZMQ_POLLIN, 0 }, // publication requests
+		{ _shmCtrlSocket, 0, ZMQ_POLLIN, 0 }, // copies of explicitly addressed messages from nodes on this host
 	};
 
 	while(isStarted()) {
-		int rc = zmq_poll(items, 2, -1);
+		int rc = zmq_poll(items, 3, -1);
 		if (rc < 0) {
 			UM_LOG_ERR("zmq_poll: %s", zmq_strerror(errno));
 		}
@@ -223,6 +305,10 @@ void ZeroMQSubscriber::run() {
 					zmq_connect(_subSocket, endpoint) && UM_LOG_ERR("zmq_connect %s: %s", endpoint, zmq_strerror(errno));
 				} else if (strcmp(op, "disconnectPub") == 0) {
 					zmq_disconnect(_subSocket, endpoint) && UM_LOG_ERR("zmq_disconnect %s: %s", endpoint, zmq_strerror(errno));
+				} else if (strcmp(op, "connectCtrl") == 0) {
+					zmq_connect(_shmCtrlSocket, endpoint) && UM_LOG_ERR("zmq_connect %s: %s", endpoint, zmq_strerror(errno));
+				} else if (strcmp(op, "disconnectCtrl") == 0) {
+					zmq_disconnect(_shmCtrlSocket, endpoint) && UM_LOG_ERR("zmq_disconnect %s: %s", endpoint, zmq_strerror(errno));
 				}
 
 				zmq_getsockopt (_readOpSocket, ZMQ_RCVMORE, &more, &more_size);
@@ -236,14 +322,133 @@ void ZeroMQSubscriber::run() {
 		}
 
 		if (items[1].revents & ZMQ_POLLIN && _receiver != NULL) {
-			Message* msg = getNextMsg();
-			_receiver->receive(msg);
-			delete msg;
+			ScopeLock lock(_receiveMutex);
+			Message* msg = readMsg(_subSocket);
+			if (msg != NULL && msg->getMeta().find("um.batch") != msg->getMeta().end()) {
+				// many small publications coalesced by the remote node
+				std::list<Message*> msgs;
+				unbatch(msg, msgs);
+				delete msg;
+				while(msgs.size() > 0) {
+					_receiver->receive(msgs.front());
+					delete msgs.front();
+					msgs.pop_front();
+				}
+			} else {
+				_receiver->receive(msg);
+				delete msg;
+			}
+		}
+
+		if (items[2].revents & ZMQ_POLLIN) {
+			// we already got it in order from the ring
+			delete readMsg(_shmCtrlSocket);
 		}
 	}
 }
 
 Message* ZeroMQSubscriber::getNextMsg() {
+	{
+		ScopeLock lock(_receiveMutex);
+		if (_msgQueue.size() > 0) {
+			Message* msg = _msgQueue.front();
+			_msgQueue.pop_front();
+			return msg;
+		}
+	}
+
+#ifdef NET_SHM
+	// explicitly addressed messages on the socket are copies of those in the ring
+	zmq_pollitem_t items[1];
+	items[0].socket = _shmCtrlSocket;
+	items[0].events = ZMQ_POLLIN;
+	while (_shmReaders.size() > 0 && zmq_poll(items, 1, 0) > 0)
+		delete readMsg(_shmCtrlSocket);
+#endif
+
+	Message* msg = readMsg(_subSocket);
+	if (msg == NULL || msg->getMeta().find("um.batch") == msg->getMeta().end())
+		return msg;
+
+	// return the first publication of a batch and queue the others
+	std::list<Message*> msgs;
+	unbatch(msg, msgs);
+	delete msg;
+	if (msgs.size() == 0)
+		return NULL;
+
+	Message* first = msgs.front();
+	msgs.pop_front();
+	ScopeLock lock(_receiveMutex);
+	_msgQueue.splice(_msgQueue.end(), msgs);
+	return first;
+}
+
+/**
+ * Split a batch of publications coalesced by a node back into messages.
+ *
+ * Every publication is its number of frames followed by the frames, each prefixed
+ * by its size. All but the last frame are meta fields, the last one is the data.
+ */
+void ZeroMQSubscriber::unbatch(Message* batch, std::list<Message*>& msgs) {
+	const char* readPtr = batch->data();
+	const char* end = readPtr + batch->size();
+
+	while (readPtr + 4 <= end) {
+		uint32_t nrFrames = ntohl(*(uint32_t*)readPtr);
+		readPtr += 4;
+
+		Message* msg = new Message();
+		msg->putMeta("um.channel", batch->getMeta("um.channel"));
+		for (uint32_t i = 0; i < nrFrames; i++) {
+			uint32_t frameSize = 0;
+			if (readPtr + 4 <= end)
+				frameSize = ntohl(*(uint32_t*)readPtr);
+			if (readPtr + 4 > end || readPtr + 4 + frameSize > end) {
+				UM_LOG_ERR("Received truncated batch on %s", _channelName.c_str());
+				delete msg;
+				return;
+			}
+			readPtr += 4;
+
+			if (i + 1 == nrFrames) {
+				// last frame contains actual data
+				msg->setData(readPtr, frameSize);
+			} else {
+				size_t keyLength = strnlen(readPtr, frameSize);
+				size_t valueLength = (keyLength < frameSize ? strnlen(readPtr + keyLength + 1, frameSize - keyLength - 1) : 0);
+				if (keyLength + valueLength + 2 != frameSize) {
+					UM_LOG_ERR("Received malformed meta field %d + %d + 2 != %d", keyLength, valueLength, frameSize);
+				} else {
+					msg->putMeta(readPtr, readPtr + keyLength + 1);
+				}
+			}
+			readPtr += frameSize;
+		}
+		msgs.push_back(msg);
+	}
+}
+
+/**
+ * Hand a message we did not read on the subscriber's thread to the receiver or queue it.
+ */
+void ZeroMQSubscriber::deliver(Message* msg) {
+	ScopeLock lock(_receiveMutex);
+	if (_receiver != NULL) {
+		_receiver->receive(msg);
+		delete msg;
+		return;
+	}
+
+	_msgQueue.push_back(msg);
+	if (_msgQueue.size() > NET_ZEROMQ_RCV_HWM) {
+		// nobody polls, behave like a full socket
+		delete _msgQueue.front();
+		_msgQueue.pop_front();
+	}
+}
+
+Message* ZeroMQSubscriber::readMsg(void* socket) {
 	int32_t more;
 	size_t more_size = sizeof(more);
 
@@ -254,7 +459,7 @@ Message* ZeroMQSubscriber::getNextMsg() {
 		zmq_msg_init(&message) && UM_LOG_WARN("zmq_msg_init: %s",zmq_strerror(errno));
 
 		int rc;
-		rc = zmq_recvmsg(_subSocket, &message, ZMQ_DONTWAIT);
+		rc = zmq_recvmsg(socket, &message, ZMQ_DONTWAIT);
 		if (rc < 0) {
 			UM_LOG_WARN("zmq_recvmsg: %s",zmq_strerror(errno));
 			zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
@@ -263,7 +468,7 @@ Message* ZeroMQSubscriber::getNextMsg() {
 		}
 
 		size_t msgSize = zmq_msg_size(&message);
-		zmq_getsockopt(_subSocket, ZMQ_RCVMORE, &more, &more_size) && UM_LOG_WARN("zmq_getsockopt: %s",zmq_strerror(errno));
+		zmq_getsockopt(socket, ZMQ_RCVMORE, &more, &more_size) && UM_LOG_WARN("zmq_getsockopt: %s",zmq_strerror(errno));
 
 		if (more) {
 			char* key = (char*)zmq_msg_data(&message);
@@ -298,6 +503,12 @@ bool ZeroMQSubscriber::hasNextMsg() {
 	items[0].socket = _subSocket;
 	items[0].events = ZMQ_POLLIN;
 
+	{
+		ScopeLock lock(_receiveMutex);
+		if (_msgQueue.size() > 0)
+			return true;
+	}
+
 	int rc = zmq_poll(items, 1, 0);
 	if (rc < 0) {
 		UM_LOG_ERR("zmq_poll: %s", zmq_strerror(errno));
@@ -309,5 +520,69 @@ bool ZeroMQSubscriber::hasNextMsg() {
 	return false;
 }
 
+#ifdef NET_SHM
+ZeroMQSubscriber::ShmReader::~ShmReader() {
+	stop();
+	join();
+	delete _ring;
+}
+
+void ZeroMQSubscriber::ShmReader::run() {
+	const std::string& channelName = _sub->_channelName;
+	std::string explicitEnvlp("~" + _sub->_uuid);
+
+	while(isStarted()) {
+		// wake up now and then to notice when we are stopped
+		if (!_ring->wait(100))
+			continue;
+
+		while(isStarted() && _ring->read()) {
+			const char* frame = NULL;
+			size_t frameSize = 0;
+			const char* readPtr = _ring->getData();
+			const char* end = readPtr + _ring->getSize();
+
+			// the ring carries all messages of the node, filter by channel like a SUB socket
+			readPtr = ShmRing::nextFrame(readPtr, end, frame, frameSize);
+			if (readPtr == NULL)
+				continue;
+			if (frameSize > 0 && frame[0] == '~') {
+				// explicitly addressed, only ever for a single subscriber
+				if (strnlen(frame, frameSize) != explicitEnvlp.length() ||
+				        memcmp(frame, explicitEnvlp.c_str(), explicitEnvlp.length()) != 0)
+					continue;
+			} else if (frameSize < channelName.length() ||
+			           memcmp(frame, channelName.c_str(), channelName.length()) != 0) {
+				continue;
+			}
+
+			Message* msg = new Message();
+			msg->putMeta("um.channel", std::string(frame, strnlen(frame, frameSize)));
+
+			for (uint32_t i = 1; i < _ring->getNrFrames(); i++) {
+				readPtr = ShmRing::nextFrame(readPtr, end, frame, frameSize);
+				if (readPtr == NULL)
+					break;
+
+				if (i + 1 == _ring->getNrFrames()) {
+					// last frame contains actual data
+					msg->setData(frame, frameSize);
+				} else {
+					size_t keyLength = strnlen(frame, frameSize);
+					size_t valueLength = (keyLength < frameSize ? strnlen(frame + keyLength + 1, frameSize - keyLength - 1) : 0);
+					if (keyLength + valueLength + 2 != frameSize) {
+						UM_LOG_ERR("Received malformed meta field %d + %d + 2 != %d", keyLength, valueLength, frameSize);
+						break;
+					}
+					msg->putMeta(frame, frame + keyLength + 1);
+				}
+			}
+
+			_sub->deliver(msg);
+		}
+	}
+}
+#endif
+
 
 }
\ No newline at end of file
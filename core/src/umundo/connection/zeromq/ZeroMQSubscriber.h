@@ -30,6 +30,7 @@ namespace umundo {
 
 class PublisherStub;
 class NodeStub;
+class ShmRing;
 
 /**
  * Concrete subscriber implementor for 0MQ (bridge pattern).
@@ -49,17 +50,44 @@ public:
 	void added(const PublisherStub& pub, const NodeStub& node);
 	void removed(const PublisherStub& pub, const NodeStub& node);
 
+	/// endpoint we connected to for the publisher's node, empty if we did not
+	std::string getEndPoint(const PublisherStub& pub);
+
 	// Thread
 	void run();
 
 protected:
+	/**
+	 * Delivers the publications of a node on this host from its shared memory ring.
+	 */
+	class ShmReader : public Thread {
+	public:
+		ShmReader(ZeroMQSubscriber* sub, ShmRing* ring) : _sub(sub), _ring(ring) {}
+		virtual ~ShmReader();
+		void run();
+	protected:
+		ZeroMQSubscriber* _sub;
+		ShmRing* _ring;
+	};
+
 	ZeroMQSubscriber();
 
+	Message* readMsg(void* socket);
+	void deliver(Message* msg);
+	void unbatch(Message* batch, std::list<Message*>& msgs);
+	bool attachShm(const PublisherStub& pub);
+	bool hasIPCEndpoint(const PublisherStub& pub);
+
 	void* _subSocket;
+	void* _shmCtrlSocket; ///< announces us to nodes we read via shared memory, what arrives there is in the ring as well
 	void* _readOpSocket;
 	void* _writeOpSocket;
 	std::multimap<std::string, std::string> _domainPubs;
+	std::map<std::string, std::string> _domainEndPoints; ///< where we connected to per domain
+	std::map<std::string, ShmReader*> _shmReaders; ///< readers per domain
+	std::list<Message*> _msgQueue; ///< shared memory and unbatched messages for getNextMsg
 	Mutex _mutex;
+	Mutex _receiveMutex; ///< shared memory readers and the socket thread deliver concurrently
 
 private:
 
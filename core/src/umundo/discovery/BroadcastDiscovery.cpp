@@ -1,90 +1,548 @@
+/**
+ *  @file
+ *  @brief      Discovery of nodes via UDP broadcast or multicast beacons.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
 #include "umundo/discovery/BroadcastDiscovery.h"
-#include <zmq.h>
+#include "umundo/common/UUID.h"
+#include "umundo/connection/PubSummary.h"
+#include "umundo/config.h"
+
+#ifdef WIN32
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+#define close(socket) closesocket(socket)
+typedef int socklen_t;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include <string.h> // strerror
+#include <errno.h> // errno
+
+/**
+ * A beacon is a single datagram, all numbers in network byte order:
+ *
+ *   0  'u' 'm'
+ *   2  version
+ *   3  flags
+ *   4  port of the advertised endpoint
+ *   6  beacon interval of the sender in ms
+ *   8  node uuid as 16 raw bytes
+ *  24  length of the domain
+ *  25  domain without terminating zero
+ *      summary of the node's publishers if flagged, see PubSummary
+ */
+#define BEACON_VERSION 1
+#define BEACON_HEADER_SIZE 25
+#define BEACON_MAX_SIZE (BEACON_HEADER_SIZE + 255 + UMUNDO_PUB_SUMMARY_BYTES)
+#define BEACON_FLAG_LEAVING 0x01 ///< the endpoint is going away
+#define BEACON_FLAG_UDP 0x02 ///< transport is udp rather than tcp
+#define BEACON_FLAG_SUMMARY 0x04 ///< a publisher summary follows the domain
 
 namespace umundo {
 
 /**
  * Have a look at https://github.com/zeromq/czmq/blob/master/src/zbeacon.c#L433 to
  * see how to setup UDP sockets for broadcast.
- *
- * Receiving Broadcast messages: https://github.com/zeromq/czmq/blob/master/src/zbeacon.c#L700
- * Sending Broadcast messages: https://github.com/zeromq/czmq/blob/master/src/zbeacon.c#L751
  */
 
-BroadcastDiscovery::BroadcastDiscovery() {
+BroadcastDiscovery::BroadcastDiscovery() :
+	_socket(-1),
+	_port(UMUNDO_BROADCAST_PORT),
+	_intervalMs(UMUNDO_BROADCAST_INTERVAL_MS),
+	_missedBeacons(UMUNDO_BROADCAST_MISSED_BEACONS),
+	_nextBeacon(0),
+	_withPubSummary(false),
+	_mutex("disc.broadcast") {
 	/**
-	 * This is called twice overall, once for the prototype in the factory and
-	 * once for the instance that is actually used.
+	 * This is called once for the prototype in the factory and once for every
+	 * instance created from it. Only the latter are initialized.
 	 */
 }
 
 BroadcastDiscovery::~BroadcastDiscovery() {
-}
+	std::list<NodeImpl*> nodes;
+	{
+		ScopeLock lock(_mutex);
+		// say goodbye for all our advertisements
+		for (std::map<EndPoint, LocalAd>::iterator adIter = _localAds.begin();
+		        adIter != _localAds.end();
+		        adIter++) {
+			sendBeacon(adIter->second, true);
+			if (adIter->second.node != NULL)
+				nodes.push_back(adIter->second.node);
+		}
+		_localAds.clear();
+	}
+	for (std::list<NodeImpl*>::iterator nodeIter = nodes.begin(); nodeIter != nodes.end(); nodeIter++) {
+		(*nodeIter)->removeAdvertiser(this);
+	}
+
+	stop();
+	join();
+
+	if (_socket >= 0)
+		close(_socket);
 
-boost::shared_ptr<BroadcastDiscovery> BroadcastDiscovery::getInstance() {
-	if (_instance.get() == NULL) {
-		_instance = boost::shared_ptr<BroadcastDiscovery>(new BroadcastDiscovery());
-		_instance->start();
+	// unreport all found nodes from all queries
+	for (std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin();
+	        adIter != _remoteAds.end();
+	        adIter++) {
+		for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+		        queryIter != _queries.end();
+		        queryIter++) {
+			(*queryIter)->removed(adIter->second.endPoint);
+		}
 	}
-	return _instance;
 }
-boost::shared_ptr<BroadcastDiscovery> BroadcastDiscovery::_instance;
 
 boost::shared_ptr<Implementation> BroadcastDiscovery::create() {
-	return getInstance();
+	return boost::shared_ptr<Implementation>(new BroadcastDiscovery());
 }
 
-void BroadcastDiscovery::init(Options*) {
-	/*
-	 * This is where you can setup the non-prototype instance, i.e. not the one
-	 * in the factory, but the one created from the prototype.
-	 *
-	 * The options object is not used and empty.
-	 */
+void BroadcastDiscovery::init(Options* config) {
+	if (config != NULL)
+		_config = config->getKVPs();
+
+	// make sure these are set
+	if (_config["broadcast.domain"].length() == 0)        _config["broadcast.domain"] = "local.";
+	if (_config["broadcast.address"].length() == 0)       _config["broadcast.address"] = UMUNDO_BROADCAST_ADDRESS;
+	if (_config["broadcast.port"].length() == 0)          _config["broadcast.port"] = toStr(UMUNDO_BROADCAST_PORT);
+	if (_config["broadcast.intervalMs"].length() == 0)    _config["broadcast.intervalMs"] = toStr(UMUNDO_BROADCAST_INTERVAL_MS);
+	if (_config["broadcast.missedBeacons"].length() == 0) _config["broadcast.missedBeacons"] = toStr(UMUNDO_BROADCAST_MISSED_BEACONS);
+	if (_config["broadcast.pubSummary"].length() == 0)    _config["broadcast.pubSummary"] = toStr(false);
+
+	if (_config["broadcast.domain"].length() > 255) {
+		UM_LOG_WARN("Broadcast domain '%s' too long - truncating", _config["broadcast.domain"].c_str());
+		_config["broadcast.domain"] = _config["broadcast.domain"].substr(0, 255);
+	}
+
+	_address = _config["broadcast.address"];
+	_port = strTo<uint16_t>(_config["broadcast.port"]);
+	_intervalMs = strTo<uint32_t>(_config["broadcast.intervalMs"]);
+	_missedBeacons = strTo<uint32_t>(_config["broadcast.missedBeacons"]);
+	_withPubSummary = strTo<bool>(_config["broadcast.pubSummary"]);
+
+	// the interval has to fit the beacon
+	if (_intervalMs == 0)
+		_intervalMs = 1;
+	if (_intervalMs > 0xffff)
+		_intervalMs = 0xffff;
+	if (_missedBeacons == 0)
+		_missedBeacons = 1;
+
+	_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (_socket < 0) {
+		UM_LOG_ERR("socket: %s", strerror(errno));
+		return;
+	}
+
+	// every discovery on this host binds the same port
+	int on = 1;
+	setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, (char*)&on, sizeof(on)) && UM_LOG_ERR("setsockopt SO_REUSEADDR: %s", strerror(errno));
+#ifdef SO_REUSEPORT
+	setsockopt(_socket, SOL_SOCKET, SO_REUSEPORT, (char*)&on, sizeof(on)) && UM_LOG_ERR("setsockopt SO_REUSEPORT: %s", strerror(errno));
+#endif
+	setsockopt(_socket, SOL_SOCKET, SO_BROADCAST, (char*)&on, sizeof(on)) && UM_LOG_ERR("setsockopt SO_BROADCAST: %s", strerror(errno));
+
+	struct sockaddr_in bindAddr;
+	memset(&bindAddr, 0, sizeof(bindAddr));
+	bindAddr.sin_family = AF_INET;
+	bindAddr.sin_port = htons(_port);
+	bindAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(_socket, (struct sockaddr*)&bindAddr, sizeof(bindAddr)) != 0) {
+		UM_LOG_ERR("bind to port %d: %s", _port, strerror(errno));
+		close(_socket);
+		_socket = -1;
+		return;
+	}
+
+	struct in_addr groupAddr;
+	groupAddr.s_addr = inet_addr(_address.c_str());
+	if (IN_MULTICAST(ntohl(groupAddr.s_addr))) {
+		struct ip_mreq membership;
+		membership.imr_multiaddr = groupAddr;
+		membership.imr_interface.s_addr = htonl(INADDR_ANY);
+		setsockopt(_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&membership, sizeof(membership)) && UM_LOG_ERR("setsockopt IP_ADD_MEMBERSHIP: %s", strerror(errno));
+		unsigned char loop = 1; // we discover nodes in our own process this way
+		setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_LOOP, (char*)&loop, sizeof(loop)) && UM_LOG_ERR("setsockopt IP_MULTICAST_LOOP: %s", strerror(errno));
+	}
+
+#ifdef WIN32
+	u_long nonBlocking = 1;
+	ioctlsocket(_socket, FIONBIO, &nonBlocking);
+#else
+	fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	start();
 }
 
 void BroadcastDiscovery::suspend() {
+	ScopeLock lock(_mutex);
+	if (_isSuspended)
+		return;
+	_isSuspended = true;
+
+	for (std::map<EndPoint, LocalAd>::iterator adIter = _localAds.begin();
+	        adIter != _localAds.end();
+	        adIter++) {
+		sendBeacon(adIter->second, true);
+	}
 }
 
 void BroadcastDiscovery::resume() {
+	ScopeLock lock(_mutex);
+	if (!_isSuspended)
+		return;
+	_isSuspended = false;
+	_nextBeacon = 0;
 }
 
 void BroadcastDiscovery::advertise(const EndPoint& node) {
-	/**
-	 * umundo.core asks you to make the given node discoverable
-	 */
+	// plain endpoints have no uuid, make one up
+	advertise(node, UUID::getUUID(), NULL);
+}
+
+void BroadcastDiscovery::advertise(const EndPoint& node, const std::string& uuid, NodeImpl* nodeImpl) {
+	ScopeLock lock(_mutex);
+	if (_localAds.find(node) != _localAds.end()) {
+		UM_LOG_WARN("Node already %s://%s:%d advertised",
+		            node.getTransport().c_str(),
+		            node.getIP().c_str(),
+		            node.getPort());
+		return;
+	}
+
+	LocalAd ad;
+	ad.uuid = uuid;
+	ad.port = node.getPort();
+	ad.node = nodeImpl;
+	_localAds[node] = ad;
+
+	// do not wait for the next interval
+	sendBeacon(ad, false);
 }
 
 void BroadcastDiscovery::add(Node& node) {
+	advertise(node, node.getUUID(), node.getImpl().get());
+	if (_withPubSummary)
+		node.getImpl()->addAdvertiser(this);
+	browse(node.getImpl().get());
 }
 
 void BroadcastDiscovery::unadvertise(const EndPoint& node) {
-	/**
-	 * umundo.core asks you to announce the removal of the given node
-	 */
+	ScopeLock lock(_mutex);
+	if (_localAds.find(node) == _localAds.end()) {
+		UM_LOG_WARN("Not unadvertising %s://%s:%d - node unknown",
+		            node.getTransport().c_str(),
+		            node.getIP().c_str(),
+		            node.getPort());
+		return;
+	}
+
+	sendBeacon(_localAds[node], true);
+	_localAds.erase(node);
 }
 
 void BroadcastDiscovery::remove(Node& node) {
+	node.getImpl()->removeAdvertiser(this);
+	unbrowse(node.getImpl().get());
+	unadvertise(node);
+}
+
+/**
+ * Tell everyone about a node's new publishers right away.
+ */
+void BroadcastDiscovery::publishersChanged(NodeImpl* node) {
+	ScopeLock lock(_mutex);
+	for (std::map<EndPoint, LocalAd>::iterator adIter = _localAds.begin();
+	        adIter != _localAds.end();
+	        adIter++) {
+		if (adIter->second.node == node)
+			sendBeacon(adIter->second, false);
+	}
 }
 
 void BroadcastDiscovery::browse(ResultSet<EndPoint>* query) {
-	/**
-	 * Another node wants to browse for nodes
-	 */
+	ScopeLock lock(_mutex);
+
+	if (_queries.find(query) != _queries.end()) {
+		UM_LOG_WARN("Query %p already added for browsing", query);
+		return;
+	}
+	UM_LOG_INFO("Adding %p query", query);
+	_queries.insert(query);
+
+	// report all existing remote endpoints
+	for (std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin();
+	        adIter != _remoteAds.end();
+	        adIter++) {
+		query->added(adIter->second.endPoint);
+	}
 }
 
 void BroadcastDiscovery::unbrowse(ResultSet<EndPoint>* query) {
-	/**
-	 * Another node no longer wants to browse for nodes
-	 */
+	ScopeLock lock(_mutex);
+
+	if (_queries.find(query) == _queries.end()) {
+		UM_LOG_WARN("No such query %p to unbrowse", query);
+		return;
+	}
+
+	UM_LOG_INFO("Removing %p query", query);
+	// unreport all existing remote endpoints
+	for (std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin();
+	        adIter != _remoteAds.end();
+	        adIter++) {
+		query->removed(adIter->second.endPoint);
+	}
+
+	_queries.erase(query);
 }
 
 std::vector<EndPoint> BroadcastDiscovery::list() {
-	return std::vector<EndPoint>();
+	ScopeLock lock(_mutex);
+
+	std::vector<EndPoint> endpoints;
+	for (std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin();
+	        adIter != _remoteAds.end();
+	        adIter++) {
+		endpoints.push_back(adIter->second.endPoint);
+	}
+
+	return endpoints;
+}
+
+void BroadcastDiscovery::sendBeacon(const LocalAd& ad, bool isLeaving) {
+	if (_socket < 0 || (_isSuspended && !isLeaving))
+		return;
+
+	const std::string& domain = _config["broadcast.domain"];
+	char beacon[BEACON_MAX_SIZE];
+	uint16_t port = htons(ad.port);
+	uint16_t intervalMs = htons(_intervalMs);
+
+	beacon[0] = 'u';
+	beacon[1] = 'm';
+	beacon[2] = BEACON_VERSION;
+	beacon[3] = (isLeaving ? BEACON_FLAG_LEAVING : 0);
+	if (_config["broadcast.protocol"] == "udp")
+		beacon[3] |= BEACON_FLAG_UDP;
+	memcpy(beacon + 4, &port, 2);
+	memcpy(beacon + 6, &intervalMs, 2);
+	if (!UUID::toBytes(ad.uuid, beacon + 8)) {
+		UM_LOG_ERR("Cannot advertise node with malformed uuid '%s'", ad.uuid.c_str());
+		return;
+	}
+	beacon[24] = (char)domain.length();
+	memcpy(beacon + BEACON_HEADER_SIZE, domain.data(), domain.length());
+	size_t beaconSize = BEACON_HEADER_SIZE + domain.length();
+
+	if (_withPubSummary && ad.node != NULL) {
+		std::string summary = ad.node->getPubSummary();
+		if (summary.length() == UMUNDO_PUB_SUMMARY_BYTES) {
+			beacon[3] |= BEACON_FLAG_SUMMARY;
+			memcpy(beacon + beaconSize, summary.data(), UMUNDO_PUB_SUMMARY_BYTES);
+			beaconSize += UMUNDO_PUB_SUMMARY_BYTES;
+		}
+	}
+
+	struct sockaddr_in beaconAddr;
+	memset(&beaconAddr, 0, sizeof(beaconAddr));
+	beaconAddr.sin_family = AF_INET;
+	beaconAddr.sin_port = htons(_port);
+	beaconAddr.sin_addr.s_addr = inet_addr(_address.c_str());
+
+	sendto(_socket, beacon, beaconSize, 0, (struct sockaddr*)&beaconAddr, sizeof(beaconAddr)) < 0 &&
+	UM_LOG_WARN("sendto %s:%d: %s", _address.c_str(), _port, strerror(errno));
+}
+
+/**
+ * Read all pending beacons and update the remote endpoints accordingly.
+ */
+void BroadcastDiscovery::receiveBeacons(uint64_t now) {
+	char beacon[BEACON_MAX_SIZE];
+	struct sockaddr_in fromAddr;
+	socklen_t fromAddrLength;
+
+	for(;;) {
+		fromAddrLength = sizeof(fromAddr);
+		int beaconSize = recvfrom(_socket, beacon, BEACON_MAX_SIZE, 0, (struct sockaddr*)&fromAddr, &fromAddrLength);
+		if (beaconSize < 0)
+			return;
+
+		// silently ignore what is not for us
+		if (beaconSize < BEACON_HEADER_SIZE || beacon[0] != 'u' || beacon[1] != 'm' || beacon[2] != BEACON_VERSION)
+			continue;
+		int summarySize = ((beacon[3] & BEACON_FLAG_SUMMARY) ? UMUNDO_PUB_SUMMARY_BYTES : 0);
+		if (beaconSize != BEACON_HEADER_SIZE + (uint8_t)beacon[24] + summarySize ||
+		        _config["broadcast.domain"].compare(0, std::string::npos, beacon + BEACON_HEADER_SIZE, (uint8_t)beacon[24]) != 0)
+			continue;
+
+		uint16_t port;
+		uint16_t intervalMs;
+		memcpy(&port, beacon + 4, 2);
+		memcpy(&intervalMs, beacon + 6, 2);
+		port = ntohs(port);
+		intervalMs = ntohs(intervalMs);
+
+		std::string uuid = UUID::fromBytes(beacon + 8);
+		bool isLeaving = (beacon[3] & BEACON_FLAG_LEAVING);
+		std::string summary(beacon + BEACON_HEADER_SIZE + (uint8_t)beacon[24], summarySize);
+
+		ScopeLock lock(_mutex);
+
+		if (_remoteAds.find(uuid) != _remoteAds.end()) {
+			RemoteAd& remoteAd = _remoteAds[uuid];
+			if (!isLeaving) {
+				// the common case, just a sign of life
+				remoteAd.expiresAt = now + (uint64_t)intervalMs * _missedBeacons;
+				remoteAd.endPoint.getImpl()->setLastSeen(Thread::getTimeStampMs());
+				if (remoteAd.endPoint.getPubSummary() != summary) {
+					remoteAd.endPoint.getImpl()->setPubSummary(summary);
+					for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+					        queryIter != _queries.end();
+					        queryIter++) {
+						(*queryIter)->changed(remoteAd.endPoint);
+					}
+				}
+				continue;
+			}
+
+			UM_LOG_INFO("Broadcast reported vanished node %s in %s", remoteAd.endPoint.getAddress().c_str(), _config["broadcast.domain"].c_str());
+			for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+			        queryIter != _queries.end();
+			        queryIter++) {
+				(*queryIter)->removed(remoteAd.endPoint);
+			}
+			_remoteAds.erase(uuid);
+			continue;
+		}
+
+		if (isLeaving)
+			continue;
+
+		// a new one
+		bool isInProcess = false;
+		for (std::map<EndPoint, LocalAd>::iterator adIter = _localAds.begin();
+		        adIter != _localAds.end();
+		        adIter++) {
+			if (adIter->second.uuid == uuid)
+				isInProcess = true;
+		}
+
+		EndPoint endPoint(boost::shared_ptr<EndPointImpl>(new EndPointImpl()));
+		endPoint.getImpl()->setDomain(_config["broadcast.domain"]);
+		endPoint.getImpl()->setIP(inet_ntoa(fromAddr.sin_addr));
+		endPoint.getImpl()->setPort(port);
+		endPoint.getImpl()->setTransport((beacon[3] & BEACON_FLAG_UDP) ? "udp" : "tcp");
+		endPoint.getImpl()->setInProcess(isInProcess);
+		endPoint.getImpl()->setRemote(!isInProcess);
+		endPoint.getImpl()->setLastSeen(Thread::getTimeStampMs());
+		endPoint.getImpl()->setPubSummary(summary);
+
+		UM_LOG_INFO("Broadcast reported new node %s in %s", endPoint.getAddress().c_str(), _config["broadcast.domain"].c_str());
+
+		RemoteAd& remoteAd = _remoteAds[uuid];
+		remoteAd.endPoint = endPoint;
+		remoteAd.expiresAt = now + (uint64_t)intervalMs * _missedBeacons;
+
+		for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+		        queryIter != _queries.end();
+		        queryIter++) {
+			(*queryIter)->added(endPoint);
+		}
+
+		// let the newcomer know about us right away
+		if (!isInProcess)
+			_nextBeacon = now;
+	}
+}
+
+/**
+ * Remove remote endpoints we did not hear from for too long.
+ */
+void BroadcastDiscovery::expire(uint64_t now) {
+	ScopeLock lock(_mutex);
+
+	std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin();
+	while(adIter != _remoteAds.end()) {
+		if (adIter->second.expiresAt > now) {
+			adIter++;
+			continue;
+		}
+
+		UM_LOG_INFO("Broadcast lost node %s in %s", adIter->second.endPoint.getAddress().c_str(), _config["broadcast.domain"].c_str());
+		for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+		        queryIter != _queries.end();
+		        queryIter++) {
+			(*queryIter)->removed(adIter->second.endPoint);
+		}
+		_remoteAds.erase(adIter++);
+	}
 }
 
 void BroadcastDiscovery::run() {
-	// your very own thread!
+	if (_socket < 0)
+		return;
+
+	while(isStarted()) {
+		uint64_t now = Thread::getMonotonicMs();
+
+		{
+			ScopeLock lock(_mutex);
+			if (_nextBeacon <= now) {
+				for (std::map<EndPoint, LocalAd>::iterator adIter = _localAds.begin();
+				        adIter != _localAds.end();
+				        adIter++) {
+					sendBeacon(adIter->second, false);
+				}
+				_nextBeacon = now + _intervalMs;
+			}
+		}
+
+		// wait for beacons until we are due to send our own
+		uint64_t timeoutMs = (_nextBeacon > now ? _nextBeacon - now : 0);
+		struct timeval timeout;
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+		fd_set readFds;
+		FD_ZERO(&readFds);
+		FD_SET(_socket, &readFds);
+		int ready = select(_socket + 1, &readFds, NULL, NULL, &timeout);
+		if (ready < 0 && errno != EINTR) {
+			UM_LOG_ERR("select: %s", strerror(errno));
+			Thread::sleepMs(_intervalMs);
+		}
+
+		now = Thread::getMonotonicMs();
+		if (ready > 0)
+			receiveBeacons(now);
+		expire(now);
+	}
 }
 
 }
@@ -1,3 +1,23 @@
+/**
+ *  @file
+ *  @brief      Discovery of nodes via UDP broadcast or multicast beacons.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
 #ifndef BROADCASTDISCOVERY_H_ZZW33B2N
 #define BROADCASTDISCOVERY_H_ZZW33B2N
 
@@ -5,6 +25,10 @@
 #include "umundo/thread/Thread.h"
 #include "umundo/discovery/Discovery.h"
 
+#define UMUNDO_BROADCAST_PORT 42151
+#define UMUNDO_BROADCAST_ADDRESS "255.255.255.255"
+#define UMUNDO_BROADCAST_INTERVAL_MS 500
+#define UMUNDO_BROADCAST_MISSED_BEACONS 4 ///< beacons we may miss before a node is gone
 
 namespace umundo {
 
@@ -20,6 +44,11 @@ public:
 		options["broadcast.domain"] = "local.";
 		options["broadcast.protocol"] = "tcp";
 		options["broadcast.serviceType"] = "umundo";
+		options["broadcast.address"] = UMUNDO_BROADCAST_ADDRESS;
+		options["broadcast.port"] = toStr(UMUNDO_BROADCAST_PORT);
+		options["broadcast.intervalMs"] = toStr(UMUNDO_BROADCAST_INTERVAL_MS);
+		options["broadcast.missedBeacons"] = toStr(UMUNDO_BROADCAST_MISSED_BEACONS);
+		options["broadcast.pubSummary"] = toStr(false);
 	}
 
 	std::string getType() {
@@ -48,17 +77,43 @@ public:
 		options["broadcast.serviceType"] = serviceType;
 	}
 
+	/**
+	 * Where to send beacons, a broadcast address such as 127.255.255.255 for loopback
+	 * or a multicast group we will join.
+	 */
+	void setAddress(const std::string& address) {
+		options["broadcast.address"] = address;
+	}
+
+	void setPort(uint16_t port) {
+		options["broadcast.port"] = toStr(port);
+	}
+
+	/// Nodes are considered gone after missedBeacons intervals without a beacon
+	void setInterval(uint32_t intervalMs, uint32_t missedBeacons = UMUNDO_BROADCAST_MISSED_BEACONS) {
+		options["broadcast.intervalMs"] = toStr(intervalMs);
+		options["broadcast.missedBeacons"] = toStr(missedBeacons);
+	}
+
+	/// Have beacons of nodes carry a summary of their publishers, see PubSummary
+	void setPubSummaries(bool enable) {
+		options["broadcast.pubSummary"] = toStr(enable);
+	}
+
 };
 
 /**
  * Concrete discovery implementor for Broadcast (bridge pattern).
  *
  * This class is a concrete implementor (in the bridge pattern sense) for the Discovery subsystem.
+ * Every advertised endpoint is announced with a small UDP beacon per interval and whenever we
+ * learn about a new node. Remote endpoints are removed when they say goodbye or when we did not
+ * hear from them for a number of their beacon intervals.
  */
 class DLLEXPORT BroadcastDiscovery : public DiscoveryImpl, public Thread {
 public:
+	BroadcastDiscovery();
 	virtual ~BroadcastDiscovery();
-	static boost::shared_ptr<BroadcastDiscovery> getInstance();  ///< Return the singleton instance.
 
 	boost::shared_ptr<Implementation> create();
 	void init(Options*);
@@ -75,11 +130,44 @@ public:
 
 	std::vector<EndPoint> list();
 
+	void publishersChanged(NodeImpl* node);
+
 	void run();
 
 protected:
-	BroadcastDiscovery();
-	static boost::shared_ptr<BroadcastDiscovery> _instance;  ///< The singleton instance.
+	class LocalAd {
+	public:
+		LocalAd() : port(0), node(NULL) {}
+		std::string uuid;
+		uint16_t port;
+		NodeImpl* node; ///< NULL for plain endpoints
+	};
+
+	class RemoteAd {
+	public:
+		EndPoint endPoint;
+		uint64_t expiresAt;
+	};
+
+	void advertise(const EndPoint& node, const std::string& uuid, NodeImpl* nodeImpl);
+	void sendBeacon(const LocalAd& ad, bool isLeaving);
+	void receiveBeacons(uint64_t now);
+	void expire(uint64_t now);
+
+	std::map<std::string, std::string> _config;
+	std::map<EndPoint, LocalAd> _localAds;
+	std::map<std::string, RemoteAd> _remoteAds; ///< by node uuid
+	std::set<ResultSet<EndPoint>*> _queries;
+
+	int _socket;
+	std::string _address;
+	uint16_t _port;
+	uint32_t _intervalMs;
+	uint32_t _missedBeacons;
+	uint64_t _nextBeacon;
+	bool _withPubSummary;
+
+	Mutex _mutex;
 
 	friend class Factory;
 };
@@ -20,6 +20,8 @@
 #include "umundo/discovery/Discovery.h"
 #include "umundo/discovery/MDNSDiscovery.h"
 #include "umundo/discovery/BroadcastDiscovery.h"
+#include "umundo/discovery/StaticDiscovery.h"
+#include "umundo/discovery/GossipDiscovery.h"
 
 #include "umundo/common/Factory.h"
 #include "umundo/connection/Node.h"
@@ -34,6 +36,12 @@ Discovery::Discovery(DiscoveryType type, Options* config) {
 	case BROADCAST:
 		_impl = boost::static_pointer_cast<DiscoveryImpl>(Factory::create("discovery.broadcast"));
 		break;
+	case STATIC:
+		_impl = boost::static_pointer_cast<DiscoveryImpl>(Factory::create("discovery.static"));
+		break;
+	case GOSSIP:
+		_impl = boost::static_pointer_cast<DiscoveryImpl>(Factory::create("discovery.gossip"));
+		break;
 	default:
 		break;
 	}
@@ -57,6 +65,13 @@ Discovery::Discovery(DiscoveryType type, const std::string domain) {
 		_impl->init(config);
 		break;
 	}
+	case GOSSIP: {
+		_impl = boost::static_pointer_cast<DiscoveryImpl>(Factory::create("discovery.gossip"));
+		GossipDiscoveryOptions* config = new GossipDiscoveryOptions();
+		config->setDomain(domain);
+		_impl->init(config);
+		break;
+	}
 	default:
 		break;
 	}
@@ -47,6 +47,9 @@ public:
 	virtual void unbrowse(ResultSet<EndPoint>* query) = 0;
 
 	virtual std::vector<EndPoint> list() = 0;
+
+	/// An added node changed its publishers, called by the node if we registered as its advertiser
+	virtual void publishersChanged(NodeImpl* node) {}
 };
 
 /**
@@ -68,7 +71,9 @@ public:
 
 	enum DiscoveryType {
 	    MDNS,
-	    BROADCAST
+	    BROADCAST,
+	    STATIC,
+	    GOSSIP
 	};
 
 	/**
@@ -161,6 +166,7 @@ public:
 		options["mdns.domain"] = "local.";
 		options["mdns.protocol"] = "tcp";
 		options["mdns.serviceType"] = "umundo";
+		options["mdns.pubSummary"] = toStr(false);
 	}
 
 	std::string getType() {
@@ -189,6 +195,11 @@ public:
 		options["mdns.serviceType"] = serviceType;
 	}
 
+	/// Have the TXT records of nodes carry a summary of their publishers, see PubSummary
+	void setPubSummaries(bool enable) {
+		options["mdns.pubSummary"] = toStr(enable);
+	}
+
 };
 
 }
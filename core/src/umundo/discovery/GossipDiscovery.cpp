@@ -0,0 +1,950 @@
+/**
+ *  @file
+ *  @brief      Discovery implementation with SWIM-style gossip.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/discovery/GossipDiscovery.h"
+#include "umundo/common/UUID.h"
+#include "umundo/config.h"
+
+#ifdef WIN32
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+#define close(socket) closesocket(socket)
+typedef int socklen_t;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include <string.h> // strerror
+#include <errno.h> // errno
+#include <algorithm> // sort
+
+/**
+ * Every message is a single datagram, all numbers in network byte order:
+ *
+ *   0  'u' 'g'
+ *   2  version
+ *   3  message type
+ *   4  sequence number
+ *   8  ip of the member to probe with PING_REQ
+ *  12  port of the member to probe with PING_REQ
+ *  14  sender id as 16 raw bytes
+ *  30  length of the domain
+ *  31  domain without terminating zero
+ *      number of member updates
+ *      member updates, the first is always the sender itself
+ *
+ * A member update is:
+ *
+ *   0  member id as 16 raw bytes
+ *  16  ip of the member, 0 for the sender as it might not know its own
+ *  20  port of the member
+ *  22  incarnation
+ *  26  state
+ *  27  number of endpoints
+ *  28  per endpoint its uuid as 16 raw bytes, its port and flags
+ */
+#define GOSSIP_VERSION 1
+#define GOSSIP_HEADER_SIZE 31
+#define GOSSIP_MEMBER_SIZE 28
+#define GOSSIP_ENDPOINT_SIZE 19
+#define GOSSIP_ENDPOINT_UDP 0x01 ///< transport is udp rather than tcp
+
+namespace umundo {
+
+GossipDiscovery::GossipDiscovery() :
+	_probeIndex(0),
+	_socket(-1),
+	_port(UMUNDO_GOSSIP_PORT),
+	_intervalMs(UMUNDO_GOSSIP_INTERVAL_MS),
+	_indirectProbes(UMUNDO_GOSSIP_INDIRECT_PROBES),
+	_suspectMultiplier(UMUNDO_GOSSIP_SUSPECT_MULTIPLIER),
+	_nextProbe(0),
+	_nextSync(0),
+	_seq(0),
+	_randState(0),
+	_bytesSent(0),
+	_mutex("disc.gossip") {
+	/**
+	 * This is called once for the prototype in the factory and once for every
+	 * instance created from it. Only the latter are initialized.
+	 */
+}
+
+GossipDiscovery::~GossipDiscovery() {
+	suspend(); // say goodbye
+
+	stop();
+	join();
+
+	if (_socket >= 0)
+		close(_socket);
+
+	// unreport all endpoints of other members from all queries
+	for (std::map<std::string, Member>::iterator memberIter = _members.begin();
+	        memberIter != _members.end();
+	        memberIter++) {
+		if (memberIter->second.state == DEAD)
+			continue;
+		report(memberIter->second.endPoints, std::map<std::string, EndPoint>());
+	}
+}
+
+boost::shared_ptr<Implementation> GossipDiscovery::create() {
+	return boost::shared_ptr<Implementation>(new GossipDiscovery());
+}
+
+void GossipDiscovery::init(Options* config) {
+	if (config != NULL)
+		_config = config->getKVPs();
+
+	// make sure these are set
+	if (_config["gossip.domain"].length() == 0)            _config["gossip.domain"] = "local.";
+	if (_config["gossip.bindAddress"].length() == 0)       _config["gossip.bindAddress"] = "0.0.0.0";
+	if (_config["gossip.port"].length() == 0)              _config["gossip.port"] = toStr(UMUNDO_GOSSIP_PORT);
+	if (_config["gossip.intervalMs"].length() == 0)        _config["gossip.intervalMs"] = toStr(UMUNDO_GOSSIP_INTERVAL_MS);
+	if (_config["gossip.indirectProbes"].length() == 0)    _config["gossip.indirectProbes"] = toStr(UMUNDO_GOSSIP_INDIRECT_PROBES);
+	if (_config["gossip.suspectMultiplier"].length() == 0) _config["gossip.suspectMultiplier"] = toStr(UMUNDO_GOSSIP_SUSPECT_MULTIPLIER);
+
+	if (_config["gossip.domain"].length() > 255) {
+		UM_LOG_WARN("Gossip domain '%s' too long - truncating", _config["gossip.domain"].c_str());
+		_config["gossip.domain"] = _config["gossip.domain"].substr(0, 255);
+	}
+
+	_port = strTo<uint16_t>(_config["gossip.port"]);
+	_intervalMs = strTo<uint32_t>(_config["gossip.intervalMs"]);
+	_indirectProbes = strTo<uint32_t>(_config["gossip.indirectProbes"]);
+	_suspectMultiplier = strTo<uint32_t>(_config["gossip.suspectMultiplier"]);
+	if (_intervalMs < 3)
+		_intervalMs = 3;
+	if (_suspectMultiplier == 0)
+		_suspectMultiplier = 1;
+
+	std::istringstream seeds(_config["gossip.seeds"]);
+	std::string seed;
+	while(seeds >> seed) {
+		size_t colonPos = seed.find_last_of(":");
+		if (colonPos == std::string::npos) {
+			UM_LOG_WARN("Ignoring gossip seed '%s' without a port", seed.c_str());
+			continue;
+		}
+		_seeds.push_back(std::make_pair((uint32_t)inet_addr(seed.substr(0, colonPos).c_str()),
+		                                strTo<uint16_t>(seed.substr(colonPos + 1))));
+	}
+
+	// a restarted member has to be newer than what the others remember about it
+	_self.id = UUID::getUUID();
+	_self.incarnation = Thread::getTimeStampMs() / 1000;
+	_self.state = ALIVE;
+	for (size_t i = 0; i < _self.id.length(); i++)
+		_randState = _randState * 31 + _self.id[i];
+
+	_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (_socket < 0) {
+		UM_LOG_ERR("socket: %s", strerror(errno));
+		return;
+	}
+
+	struct sockaddr_in bindAddr;
+	memset(&bindAddr, 0, sizeof(bindAddr));
+	bindAddr.sin_family = AF_INET;
+	bindAddr.sin_port = htons(_port);
+	bindAddr.sin_addr.s_addr = inet_addr(_config["gossip.bindAddress"].c_str());
+	if (bind(_socket, (struct sockaddr*)&bindAddr, sizeof(bindAddr)) != 0) {
+		UM_LOG_ERR("bind to %s:%d: %s", _config["gossip.bindAddress"].c_str(), _port, strerror(errno));
+		close(_socket);
+		_socket = -1;
+		return;
+	}
+
+	socklen_t bindAddrLength = sizeof(bindAddr);
+	getsockname(_socket, (struct sockaddr*)&bindAddr, &bindAddrLength) && UM_LOG_ERR("getsockname: %s", strerror(errno));
+	_port = ntohs(bindAddr.sin_port);
+
+#ifdef WIN32
+	u_long nonBlocking = 1;
+	ioctlsocket(_socket, FIONBIO, &nonBlocking);
+#else
+	fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	start();
+}
+
+/**
+ * Leave the group, the members we tell will spread the news.
+ */
+void GossipDiscovery::suspend() {
+	ScopeLock lock(_mutex);
+	if (_isSuspended || _socket < 0)
+		return;
+
+	_self.state = DEAD;
+	std::vector<Member*> alive;
+	for (std::map<std::string, Member>::iterator memberIter = _members.begin();
+	        memberIter != _members.end();
+	        memberIter++) {
+		if (memberIter->second.state != DEAD)
+			alive.push_back(&memberIter->second);
+	}
+	for (uint32_t i = 0; i < _indirectProbes + 1 && alive.size() > 0; i++) {
+		size_t index = nextRandom() % alive.size();
+		send(alive[index]->ip, alive[index]->port, SYNC, 0);
+		alive.erase(alive.begin() + index);
+	}
+	_isSuspended = true;
+}
+
+void GossipDiscovery::resume() {
+	ScopeLock lock(_mutex);
+	if (!_isSuspended)
+		return;
+	_isSuspended = false;
+
+	// everyone considers us dead at our last incarnation
+	_self.state = ALIVE;
+	_self.incarnation++;
+	_nextProbe = 0;
+}
+
+void GossipDiscovery::advertise(const EndPoint& node) {
+	// plain endpoints have no uuid, make one up
+	advertise(node, UUID::getUUID());
+}
+
+void GossipDiscovery::advertise(const EndPoint& node, const std::string& uuid) {
+	ScopeLock lock(_mutex);
+	if (_localAds.find(node) != _localAds.end()) {
+		UM_LOG_WARN("Node already %s://%s:%d advertised",
+		            node.getTransport().c_str(),
+		            node.getIP().c_str(),
+		            node.getPort());
+		return;
+	}
+
+	EndPoint endPoint(boost::shared_ptr<EndPointImpl>(new EndPointImpl()));
+	endPoint.getImpl()->setTransport(node.getTransport());
+	endPoint.getImpl()->setPort(node.getPort());
+	endPoint.getImpl()->setRemote(false);
+
+	_localAds[node] = uuid;
+	_self.endPoints[uuid] = endPoint;
+	_self.incarnation++; // our state changed, we piggyback it on every message anyway
+}
+
+void GossipDiscovery::add(Node& node) {
+	advertise(node, node.getUUID());
+	browse(node.getImpl().get());
+}
+
+void GossipDiscovery::unadvertise(const EndPoint& node) {
+	ScopeLock lock(_mutex);
+	if (_localAds.find(node) == _localAds.end()) {
+		UM_LOG_WARN("Not unadvertising %s://%s:%d - node unknown",
+		            node.getTransport().c_str(),
+		            node.getIP().c_str(),
+		            node.getPort());
+		return;
+	}
+
+	_self.endPoints.erase(_localAds[node]);
+	_localAds.erase(node);
+	_self.incarnation++;
+}
+
+void GossipDiscovery::remove(Node& node) {
+	unbrowse(node.getImpl().get());
+	unadvertise(node);
+}
+
+void GossipDiscovery::browse(ResultSet<EndPoint>* query) {
+	ScopeLock lock(_mutex);
+
+	if (_queries.find(query) != _queries.end()) {
+		UM_LOG_WARN("Query %p already added for browsing", query);
+		return;
+	}
+	UM_LOG_INFO("Adding %p query", query);
+	_queries.insert(query);
+
+	// report all endpoints of other members
+	std::vector<EndPoint> endPoints = list();
+	for (std::vector<EndPoint>::iterator epIter = endPoints.begin(); epIter != endPoints.end(); epIter++) {
+		query->added(*epIter);
+	}
+}
+
+void GossipDiscovery::unbrowse(ResultSet<EndPoint>* query) {
+	ScopeLock lock(_mutex);
+
+	if (_queries.find(query) == _queries.end()) {
+		UM_LOG_WARN("No such query %p to unbrowse", query);
+		return;
+	}
+
+	UM_LOG_INFO("Removing %p query", query);
+	std::vector<EndPoint> endPoints = list();
+	for (std::vector<EndPoint>::iterator epIter = endPoints.begin(); epIter != endPoints.end(); epIter++) {
+		query->removed(*epIter);
+	}
+
+	_queries.erase(query);
+}
+
+std::vector<EndPoint> GossipDiscovery::list() {
+	ScopeLock lock(_mutex);
+
+	std::vector<EndPoint> endPoints;
+	for (std::map<std::string, Member>::iterator memberIter = _members.begin();
+	        memberIter != _members.end();
+	        memberIter++) {
+		if (memberIter->second.state == DEAD)
+			continue;
+		for (std::map<std::string, EndPoint>::iterator epIter = memberIter->second.endPoints.begin();
+		        epIter != memberIter->second.endPoints.end();
+		        epIter++) {
+			endPoints.push_back(epIter->second);
+		}
+	}
+	return endPoints;
+}
+
+size_t GossipDiscovery::getNrMembers() {
+	ScopeLock lock(_mutex);
+
+	size_t nrMembers = 0;
+	for (std::map<std::string, Member>::iterator memberIter = _members.begin();
+	        memberIter != _members.end();
+	        memberIter++) {
+		if (memberIter->second.state != DEAD)
+			nrMembers++;
+	}
+	return nrMembers;
+}
+
+uint64_t GossipDiscovery::getBytesSent() {
+	ScopeLock lock(_mutex);
+	return _bytesSent;
+}
+
+/**
+ * Conclude the last probe and ping the next member in our shuffled round-robin order.
+ */
+void GossipDiscovery::startProbe(uint64_t now) {
+	if (!_probe.isAcked && _members.find(_probe.target) != _members.end()) {
+		Member& member = _members[_probe.target];
+		if (member.state == ALIVE) {
+			UM_LOG_INFO("Gossip member %s did not answer - suspecting it", SHORT_UUID(member.id).c_str());
+			member.state = SUSPECT;
+			member.changedAt = now;
+			member.transmissions = 0;
+		}
+	}
+	_probe = Probe();
+
+	Member* target = NULL;
+	while(target == NULL) {
+		if (_probeIndex >= _probeOrder.size()) {
+			_probeOrder.clear();
+			_probeIndex = 0;
+			for (std::map<std::string, Member>::iterator memberIter = _members.begin();
+			        memberIter != _members.end();
+			        memberIter++) {
+				if (memberIter->second.state != DEAD)
+					_probeOrder.push_back(memberIter->first);
+			}
+			if (_probeOrder.size() == 0)
+				break;
+			for (size_t i = _probeOrder.size() - 1; i > 0; i--) {
+				std::swap(_probeOrder[i], _probeOrder[nextRandom() % (i + 1)]);
+			}
+		}
+
+		std::map<std::string, Member>::iterator memberIter = _members.find(_probeOrder[_probeIndex++]);
+		if (memberIter != _members.end() && memberIter->second.state != DEAD)
+			target = &memberIter->second;
+	}
+
+	if (target == NULL) {
+		// we are on our own, try to join via the seeds
+		for (std::list<std::pair<uint32_t, uint16_t> >::iterator seedIter = _seeds.begin(); seedIter != _seeds.end(); seedIter++) {
+			send(seedIter->first, seedIter->second, PING, 0);
+		}
+		return;
+	}
+
+	_probe.target = target->id;
+	if (++_seq == 0)
+		++_seq; // reserved for syncs
+	_probe.seq = _seq;
+	_probe.sentAt = now;
+	_probe.isAcked = false;
+	send(target->ip, target->port, PING, _probe.seq);
+}
+
+/**
+ * Ask some other members to probe the target of our unacknowledged probe.
+ */
+void GossipDiscovery::probeIndirectly() {
+	_probe.isIndirect = true;
+	if (_members.find(_probe.target) == _members.end())
+		return;
+	Member& target = _members[_probe.target];
+
+	std::vector<Member*> candidates;
+	for (std::map<std::string, Member>::iterator memberIter = _members.begin();
+	        memberIter != _members.end();
+	        memberIter++) {
+		if (memberIter->second.state == ALIVE && memberIter->first != _probe.target)
+			candidates.push_back(&memberIter->second);
+	}
+	for (uint32_t i = 0; i < _indirectProbes && candidates.size() > 0; i++) {
+		size_t index = nextRandom() % candidates.size();
+		send(candidates[index]->ip, candidates[index]->port, PING_REQ, _probe.seq, target.ip, target.port);
+		candidates.erase(candidates.begin() + index);
+	}
+}
+
+/**
+ * Ask a random member for everything it knows.
+ *
+ * Piggybacked updates are only gossiped for a while, members that missed them would
+ * otherwise never learn about each other. The full membership grows with the group, so
+ * we sync less often to keep the bandwidth per member bounded.
+ */
+void GossipDiscovery::startSync(uint64_t now) {
+	std::vector<Member*> alive;
+	for (std::map<std::string, Member>::iterator memberIter = _members.begin();
+	        memberIter != _members.end();
+	        memberIter++) {
+		if (memberIter->second.state == ALIVE)
+			alive.push_back(&memberIter->second);
+	}
+
+	if (alive.size() == 0) {
+		_nextSync = now + _intervalMs;
+		return;
+	}
+	uint64_t periods = UMUNDO_GOSSIP_SYNC_PERIODS * (1 + _members.size() / 32);
+	_nextSync = now + periods * _intervalMs + nextRandom() % _intervalMs;
+
+	Member* member = alive[nextRandom() % alive.size()];
+	send(member->ip, member->port, PING, 0);
+}
+
+/**
+ * Declare suspects that did not refute in time dead and forget about old news.
+ */
+void GossipDiscovery::expire(uint64_t now) {
+	uint64_t timeout = suspicionTimeout();
+	std::map<std::string, Member>::iterator memberIter = _members.begin();
+	while(memberIter != _members.end()) {
+		Member& member = memberIter->second;
+		if (member.state == SUSPECT && member.changedAt + timeout <= now) {
+			UM_LOG_INFO("Gossip member %s is dead", SHORT_UUID(member.id).c_str());
+			report(member.endPoints, std::map<std::string, EndPoint>());
+			member.endPoints.clear();
+			member.state = DEAD;
+			member.changedAt = now;
+			member.transmissions = 0;
+		}
+		if (member.state == DEAD && member.changedAt + UMUNDO_GOSSIP_TOMBSTONE_MS <= now) {
+			_members.erase(memberIter++);
+			continue;
+		}
+		memberIter++;
+	}
+
+	std::map<uint32_t, Relay>::iterator relayIter = _relays.begin();
+	while(relayIter != _relays.end()) {
+		if (relayIter->second.expiresAt <= now) {
+			_relays.erase(relayIter++);
+		} else {
+			relayIter++;
+		}
+	}
+}
+
+/**
+ * Read all pending messages, apply their updates and answer them.
+ */
+void GossipDiscovery::receive(uint64_t now) {
+	char buffer[UMUNDO_GOSSIP_MAX_DATAGRAM];
+	struct sockaddr_in fromAddr;
+	socklen_t fromAddrLength;
+	const std::string& domain = _config["gossip.domain"];
+
+	for(;;) {
+		fromAddrLength = sizeof(fromAddr);
+		int size = recvfrom(_socket, buffer, UMUNDO_GOSSIP_MAX_DATAGRAM, 0, (struct sockaddr*)&fromAddr, &fromAddrLength);
+		if (size < 0)
+			return;
+
+		// silently ignore what is not for us
+		if (size < GOSSIP_HEADER_SIZE + 1 || buffer[0] != 'u' || buffer[1] != 'g' || buffer[2] != GOSSIP_VERSION)
+			continue;
+		size_t offset = GOSSIP_HEADER_SIZE + (uint8_t)buffer[30];
+		if ((size_t)size < offset + 1 || domain.compare(0, std::string::npos, buffer + GOSSIP_HEADER_SIZE, (uint8_t)buffer[30]) != 0)
+			continue;
+
+		MessageType type = (MessageType)buffer[3];
+		uint32_t seq;
+		uint32_t targetIp;
+		uint16_t targetPort;
+		memcpy(&seq, buffer + 4, 4);
+		memcpy(&targetIp, buffer + 8, 4);
+		memcpy(&targetPort, buffer + 12, 2);
+		seq = ntohl(seq);
+		targetPort = ntohs(targetPort);
+		std::string senderId = UUID::fromBytes(buffer + 14);
+		uint32_t senderIp = fromAddr.sin_addr.s_addr;
+		uint16_t senderPort = ntohs(fromAddr.sin_port);
+
+		ScopeLock lock(_mutex);
+		if (_isSuspended || senderId == _self.id)
+			continue;
+
+		uint8_t nrUpdates = buffer[offset++];
+		for (uint8_t i = 0; i < nrUpdates; i++) {
+			Member update;
+			size_t consumed = readMember(buffer + offset, size - offset, update);
+			if (consumed == 0)
+				break;
+			offset += consumed;
+
+			if (update.ip == 0)
+				update.ip = senderIp;
+			struct in_addr memberAddr;
+			memberAddr.s_addr = update.ip;
+			for (std::map<std::string, EndPoint>::iterator epIter = update.endPoints.begin();
+			        epIter != update.endPoints.end();
+			        epIter++) {
+				epIter->second.getImpl()->setIP(inet_ntoa(memberAddr));
+			}
+			apply(update, now);
+		}
+
+		switch (type) {
+		case PING:
+			send(senderIp, senderPort, ACK, seq);
+			// a newcomer joining through us as its seed or a periodic sync
+			if (seq == 0)
+				sendFullState(senderIp, senderPort);
+			break;
+		case ACK:
+			if (!_probe.isAcked && seq == _probe.seq) {
+				_probe.isAcked = true;
+			} else if (_relays.find(seq) != _relays.end()) {
+				send(_relays[seq].ip, _relays[seq].port, ACK, _relays[seq].seq);
+				_relays.erase(seq);
+			}
+			break;
+		case PING_REQ: {
+			Relay relay;
+			relay.ip = senderIp;
+			relay.port = senderPort;
+			relay.seq = seq;
+			relay.expiresAt = now + _intervalMs;
+			if (++_seq == 0)
+				++_seq;
+			_relays[_seq] = relay;
+			send(targetIp, targetPort, PING, _seq);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * Whether an update changes what we know about a member.
+ *
+ * Only the member itself increments its incarnation, news about a higher incarnation
+ * always wins, suspicion beats being alive and death beats everything at the same one.
+ */
+bool GossipDiscovery::isNews(const Member& update) {
+	if (update.id == _self.id)
+		return true; // we might have to refute it
+
+	std::map<std::string, Member>::iterator memberIter = _members.find(update.id);
+	if (memberIter == _members.end())
+		return update.state != DEAD; // nothing to forget
+
+	const Member& member = memberIter->second;
+	switch (update.state) {
+	case ALIVE:
+		return update.incarnation > member.incarnation;
+	case SUSPECT:
+		return update.incarnation > member.incarnation || (update.incarnation == member.incarnation && member.state == ALIVE);
+	case DEAD:
+		return update.incarnation > member.incarnation || (update.incarnation == member.incarnation && member.state != DEAD);
+	}
+	return false;
+}
+
+/**
+ * Merge what we heard about a member with what we know.
+ */
+bool GossipDiscovery::apply(Member& update, uint64_t now) {
+	if (update.id == _self.id) {
+		if (update.state != ALIVE && update.incarnation >= _self.incarnation && _self.state == ALIVE) {
+			// refute by piggybacking a newer incarnation on everything we send
+			UM_LOG_INFO("Gossip member %s refuting suspicion", SHORT_UUID(_self.id).c_str());
+			_self.incarnation = update.incarnation + 1;
+		}
+		return false;
+	}
+
+	if (!isNews(update))
+		return false;
+
+	if (_members.find(update.id) == _members.end()) {
+		UM_LOG_INFO("Gossip reported new member %s", SHORT_UUID(update.id).c_str());
+		update.changedAt = now;
+		update.transmissions = 0;
+		_members[update.id] = update;
+		report(std::map<std::string, EndPoint>(), update.endPoints);
+		return true;
+	}
+
+	Member& member = _members[update.id];
+	std::map<std::string, EndPoint> before;
+	std::map<std::string, EndPoint> after;
+	if (member.state != DEAD)
+		before = member.endPoints;
+	if (update.state != DEAD) {
+		// keep reporting the endpoint objects we already reported
+		for (std::map<std::string, EndPoint>::iterator epIter = update.endPoints.begin();
+		        epIter != update.endPoints.end();
+		        epIter++) {
+			if (before.find(epIter->first) != before.end() && before[epIter->first].getAddress() == epIter->second.getAddress()) {
+				after[epIter->first] = before[epIter->first];
+			} else {
+				after[epIter->first] = epIter->second;
+			}
+		}
+	}
+
+	if (member.state != update.state) {
+		UM_LOG_INFO("Gossip member %s is %s", SHORT_UUID(member.id).c_str(),
+		            (update.state == ALIVE ? "alive" : (update.state == SUSPECT ? "suspect" : "dead")));
+		member.changedAt = now;
+	}
+	member.ip = update.ip;
+	member.port = update.port;
+	member.incarnation = update.incarnation;
+	member.state = update.state;
+	member.transmissions = 0;
+	member.endPoints = after;
+
+	report(before, after);
+	return true;
+}
+
+void GossipDiscovery::report(const std::map<std::string, EndPoint>& before, const std::map<std::string, EndPoint>& after) {
+	for (std::map<std::string, EndPoint>::const_iterator epIter = before.begin(); epIter != before.end(); epIter++) {
+		std::map<std::string, EndPoint>::const_iterator otherIter = after.find(epIter->first);
+		if (otherIter != after.end() && otherIter->second == epIter->second)
+			continue;
+		for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+		        queryIter != _queries.end();
+		        queryIter++) {
+			(*queryIter)->removed(epIter->second);
+		}
+	}
+	for (std::map<std::string, EndPoint>::const_iterator epIter = after.begin(); epIter != after.end(); epIter++) {
+		std::map<std::string, EndPoint>::const_iterator otherIter = before.find(epIter->first);
+		if (otherIter != before.end() && otherIter->second == epIter->second)
+			continue;
+		for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+		        queryIter != _queries.end();
+		        queryIter++) {
+			(*queryIter)->added(epIter->second);
+		}
+	}
+}
+
+/**
+ * Send a message with ourselves and as many of the least gossiped updates as fit.
+ */
+void GossipDiscovery::send(uint32_t ip, uint16_t port, MessageType type, uint32_t seq, uint32_t targetIp, uint16_t targetPort) {
+	char buffer[UMUNDO_GOSSIP_MAX_DATAGRAM];
+	size_t size = writeHeader(buffer, type, seq, targetIp, targetPort);
+	size_t nrUpdatesOffset = size++;
+	uint8_t nrUpdates = 0;
+
+	size_t written = writeMember(buffer + size, UMUNDO_GOSSIP_MAX_DATAGRAM - size, _self, true);
+	if (written > 0) {
+		size += written;
+		nrUpdates++;
+	}
+
+	uint32_t limit = retransmitLimit();
+	std::vector<Member*> pending;
+	for (std::map<std::string, Member>::iterator memberIter = _members.begin();
+	        memberIter != _members.end();
+	        memberIter++) {
+		if (memberIter->second.transmissions < limit)
+			pending.push_back(&memberIter->second);
+	}
+	std::sort(pending.begin(), pending.end(), fewerTransmissions);
+
+	for (std::vector<Member*>::iterator memberIter = pending.begin(); memberIter != pending.end() && nrUpdates < 255; memberIter++) {
+		written = writeMember(buffer + size, UMUNDO_GOSSIP_MAX_DATAGRAM - size, **memberIter, false);
+		if (written == 0)
+			continue;
+		size += written;
+		nrUpdates++;
+		(*memberIter)->transmissions++;
+	}
+	buffer[nrUpdatesOffset] = nrUpdates;
+
+	transmit(buffer, size, ip, port);
+}
+
+/**
+ * Tell a joining member about everyone we know in as many datagrams as it takes.
+ */
+void GossipDiscovery::sendFullState(uint32_t ip, uint16_t port) {
+	char buffer[UMUNDO_GOSSIP_MAX_DATAGRAM];
+	std::map<std::string, Member>::iterator memberIter = _members.begin();
+
+	while(memberIter != _members.end()) {
+		size_t size = writeHeader(buffer, SYNC, 0, 0, 0);
+		size_t nrUpdatesOffset = size++;
+		uint8_t nrUpdates = 0;
+
+		size_t written = writeMember(buffer + size, UMUNDO_GOSSIP_MAX_DATAGRAM - size, _self, true);
+		if (written > 0) {
+			size += written;
+			nrUpdates++;
+		}
+
+		size_t nrMembers = 0;
+		while(memberIter != _members.end() && nrUpdates < 255) {
+			if (memberIter->second.state == DEAD || (memberIter->second.ip == ip && memberIter->second.port == port)) {
+				memberIter++;
+				continue;
+			}
+			written = writeMember(buffer + size, UMUNDO_GOSSIP_MAX_DATAGRAM - size, memberIter->second, false);
+			if (written == 0)
+				break;
+			size += written;
+			nrUpdates++;
+			nrMembers++;
+			memberIter++;
+		}
+		buffer[nrUpdatesOffset] = nrUpdates;
+
+		if (nrMembers == 0) {
+			// a member with too many endpoints for a single datagram
+			if (memberIter != _members.end())
+				memberIter++;
+			continue;
+		}
+		transmit(buffer, size, ip, port);
+	}
+}
+
+void GossipDiscovery::transmit(const char* buffer, size_t size, uint32_t ip, uint16_t port) {
+	if (_socket < 0)
+		return;
+
+	struct sockaddr_in toAddr;
+	memset(&toAddr, 0, sizeof(toAddr));
+	toAddr.sin_family = AF_INET;
+	toAddr.sin_port = htons(port);
+	toAddr.sin_addr.s_addr = ip;
+
+	if (sendto(_socket, buffer, size, 0, (struct sockaddr*)&toAddr, sizeof(toAddr)) < 0) {
+		UM_LOG_WARN("sendto %s:%d: %s", inet_ntoa(toAddr.sin_addr), port, strerror(errno));
+		return;
+	}
+	_bytesSent += size;
+}
+
+size_t GossipDiscovery::writeHeader(char* buffer, MessageType type, uint32_t seq, uint32_t targetIp, uint16_t targetPort) {
+	const std::string& domain = _config["gossip.domain"];
+	seq = htonl(seq);
+	targetPort = htons(targetPort);
+
+	buffer[0] = 'u';
+	buffer[1] = 'g';
+	buffer[2] = GOSSIP_VERSION;
+	buffer[3] = (char)type;
+	memcpy(buffer + 4, &seq, 4);
+	memcpy(buffer + 8, &targetIp, 4);
+	memcpy(buffer + 12, &targetPort, 2);
+	UUID::toBytes(_self.id, buffer + 14);
+	buffer[30] = (char)domain.length();
+	memcpy(buffer + GOSSIP_HEADER_SIZE, domain.data(), domain.length());
+	return GOSSIP_HEADER_SIZE + domain.length();
+}
+
+/**
+ * Write a member update if it fits, returns the number of bytes written.
+ */
+size_t GossipDiscovery::writeMember(char* buffer, size_t space, const Member& member, bool isSelf) {
+	size_t nrEndPoints = member.endPoints.size();
+	if (nrEndPoints > 255 || space < GOSSIP_MEMBER_SIZE + nrEndPoints * GOSSIP_ENDPOINT_SIZE)
+		return 0;
+
+	uint32_t ip = (isSelf ? 0 : member.ip);
+	uint16_t port = htons(isSelf ? _port : member.port);
+	uint32_t incarnation = htonl(member.incarnation);
+
+	UUID::toBytes(member.id, buffer);
+	memcpy(buffer + 16, &ip, 4);
+	memcpy(buffer + 20, &port, 2);
+	memcpy(buffer + 22, &incarnation, 4);
+	buffer[26] = (char)member.state;
+	buffer[27] = (char)nrEndPoints;
+
+	char* epBuffer = buffer + GOSSIP_MEMBER_SIZE;
+	for (std::map<std::string, EndPoint>::const_iterator epIter = member.endPoints.begin();
+	        epIter != member.endPoints.end();
+	        epIter++) {
+		uint16_t epPort = htons(epIter->second.getPort());
+		UUID::toBytes(epIter->first, epBuffer);
+		memcpy(epBuffer + 16, &epPort, 2);
+		epBuffer[18] = (epIter->second.getTransport() == "udp" ? GOSSIP_ENDPOINT_UDP : 0);
+		epBuffer += GOSSIP_ENDPOINT_SIZE;
+	}
+	return epBuffer - buffer;
+}
+
+/**
+ * Read a member update, returns the number of bytes consumed or 0 if it is malformed.
+ *
+ * Most updates we receive are old news, we only bother with their endpoints if not.
+ */
+size_t GossipDiscovery::readMember(const char* buffer, size_t space, Member& member) {
+	if (space < GOSSIP_MEMBER_SIZE || (uint8_t)buffer[26] > DEAD)
+		return 0;
+	size_t nrEndPoints = (uint8_t)buffer[27];
+	if (space < GOSSIP_MEMBER_SIZE + nrEndPoints * GOSSIP_ENDPOINT_SIZE)
+		return 0;
+
+	member.id = UUID::fromBytes(buffer);
+	memcpy(&member.ip, buffer + 16, 4);
+	memcpy(&member.port, buffer + 20, 2);
+	memcpy(&member.incarnation, buffer + 22, 4);
+	member.port = ntohs(member.port);
+	member.incarnation = ntohl(member.incarnation);
+	member.state = (MemberState)buffer[26];
+
+	const char* epBuffer = buffer + GOSSIP_MEMBER_SIZE;
+	if (!isNews(member))
+		return GOSSIP_MEMBER_SIZE + nrEndPoints * GOSSIP_ENDPOINT_SIZE;
+
+	for (size_t i = 0; i < nrEndPoints; i++) {
+		uint16_t epPort;
+		memcpy(&epPort, epBuffer + 16, 2);
+
+		EndPoint endPoint(boost::shared_ptr<EndPointImpl>(new EndPointImpl()));
+		endPoint.getImpl()->setDomain(_config["gossip.domain"]);
+		endPoint.getImpl()->setPort(ntohs(epPort));
+		endPoint.getImpl()->setTransport((epBuffer[18] & GOSSIP_ENDPOINT_UDP) ? "udp" : "tcp");
+		endPoint.getImpl()->setRemote(true);
+		member.endPoints[UUID::fromBytes(epBuffer)] = endPoint;
+		epBuffer += GOSSIP_ENDPOINT_SIZE;
+	}
+	return epBuffer - buffer;
+}
+
+uint32_t GossipDiscovery::nextRandom() {
+	_randState = _randState * 1103515245 + 12345;
+	return _randState >> 8;
+}
+
+uint32_t GossipDiscovery::groupSizeLog2() {
+	uint32_t log2 = 1;
+	while(((size_t)1 << log2) < _members.size() + 1)
+		log2++;
+	return log2;
+}
+
+uint32_t GossipDiscovery::retransmitLimit() {
+	return UMUNDO_GOSSIP_RETRANSMIT_MULTIPLIER * groupSizeLog2();
+}
+
+uint64_t GossipDiscovery::suspicionTimeout() {
+	return (uint64_t)_intervalMs * _suspectMultiplier * groupSizeLog2();
+}
+
+void GossipDiscovery::run() {
+	if (_socket < 0)
+		return;
+
+	uint32_t ackTimeoutMs = _intervalMs / 2; // leaves the other half for indirect probes
+
+	while(isStarted()) {
+		uint64_t now = Thread::getMonotonicMs();
+		uint64_t wakeUpAt;
+
+		{
+			ScopeLock lock(_mutex);
+			if (!_isSuspended) {
+				if (!_probe.isAcked && !_probe.isIndirect && _probe.sentAt + ackTimeoutMs <= now)
+					probeIndirectly();
+				if (_nextProbe <= now) {
+					startProbe(now);
+					_nextProbe = now + _intervalMs;
+				}
+				if (_nextSync <= now)
+					startSync(now);
+			}
+			expire(now);
+
+			wakeUpAt = _nextProbe;
+			if (!_probe.isAcked && !_probe.isIndirect && _probe.sentAt + ackTimeoutMs < wakeUpAt)
+				wakeUpAt = _probe.sentAt + ackTimeoutMs;
+		}
+
+		// wait for messages until we have something to do
+		uint64_t timeoutMs = (wakeUpAt > now ? wakeUpAt - now : 0);
+		struct timeval timeout;
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+		fd_set readFds;
+		FD_ZERO(&readFds);
+		FD_SET(_socket, &readFds);
+		int ready = select(_socket + 1, &readFds, NULL, NULL, &timeout);
+		if (ready < 0 && errno != EINTR) {
+			UM_LOG_ERR("select: %s", strerror(errno));
+			Thread::sleepMs(_intervalMs);
+		}
+
+		if (ready > 0)
+			receive(Thread::getMonotonicMs());
+	}
+}
+
+bool GossipDiscovery::fewerTransmissions(const Member* first, const Member* second) {
+	return first->transmissions < second->transmissions;
+}
+
+}
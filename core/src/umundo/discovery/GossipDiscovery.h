@@ -0,0 +1,242 @@
+/**
+ *  @file
+ *  @brief      Discovery implementation with SWIM-style gossip.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef GOSSIPDISCOVERY_H_Q4WB7NZE
+#define GOSSIPDISCOVERY_H_Q4WB7NZE
+
+#include "umundo/common/Common.h"
+#include "umundo/thread/Thread.h"
+#include "umundo/discovery/Discovery.h"
+
+#define UMUNDO_GOSSIP_PORT 42152
+#define UMUNDO_GOSSIP_INTERVAL_MS 200 ///< protocol period, we probe one member per period
+#define UMUNDO_GOSSIP_INDIRECT_PROBES 3 ///< members we ask to probe for us when there is no direct ack
+#define UMUNDO_GOSSIP_SUSPECT_MULTIPLIER 4 ///< suspicion lasts this many periods times log2 of the group size
+#define UMUNDO_GOSSIP_RETRANSMIT_MULTIPLIER 4 ///< updates are piggybacked this many times log2 of the group size
+#define UMUNDO_GOSSIP_MAX_DATAGRAM 1400 ///< we never send more in one datagram, fits an ethernet frame
+#define UMUNDO_GOSSIP_TOMBSTONE_MS 60000 ///< how long we remember dead members to ignore stale gossip
+#define UMUNDO_GOSSIP_SYNC_PERIODS 50 ///< pull the full membership from a random member this often, scaled with the group size
+
+namespace umundo {
+
+class GossipDiscoveryOptions : public Options {
+public:
+	enum Protocol {
+	    TCP, UDP
+	};
+
+	GossipDiscoveryOptions() {
+		options["gossip.domain"] = "local.";
+		options["gossip.protocol"] = "tcp";
+		options["gossip.bindAddress"] = "0.0.0.0";
+		options["gossip.port"] = toStr(UMUNDO_GOSSIP_PORT);
+		options["gossip.seeds"] = "";
+		options["gossip.intervalMs"] = toStr(UMUNDO_GOSSIP_INTERVAL_MS);
+		options["gossip.indirectProbes"] = toStr(UMUNDO_GOSSIP_INDIRECT_PROBES);
+		options["gossip.suspectMultiplier"] = toStr(UMUNDO_GOSSIP_SUSPECT_MULTIPLIER);
+	}
+
+	std::string getType() {
+		return "gossip";
+	}
+
+	void setDomain(const std::string& domain) {
+		options["gossip.domain"] = domain;
+	}
+
+	void setProtocol(Protocol protocol) {
+		switch (protocol) {
+		case UDP:
+			options["gossip.protocol"] = "udp";
+			break;
+		case TCP:
+			options["gossip.protocol"] = "tcp";
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	/// Where we receive gossip, port 0 picks any free port
+	void setBindAddress(const std::string& address, uint16_t port = UMUNDO_GOSSIP_PORT) {
+		options["gossip.bindAddress"] = address;
+		options["gossip.port"] = toStr(port);
+	}
+
+	/// A member to join the group through, call repeatedly for more
+	void addSeed(const std::string& ip, uint16_t port = UMUNDO_GOSSIP_PORT) {
+		options["gossip.seeds"] += ip + ":" + toStr(port) + " ";
+	}
+
+	/**
+	 * Members are probed once per interval, the failure detection time grows with the
+	 * interval and the logarithm of the group size.
+	 */
+	void setInterval(uint32_t intervalMs, uint32_t suspectMultiplier = UMUNDO_GOSSIP_SUSPECT_MULTIPLIER) {
+		options["gossip.intervalMs"] = toStr(intervalMs);
+		options["gossip.suspectMultiplier"] = toStr(suspectMultiplier);
+	}
+
+	void setIndirectProbes(uint32_t nrMembers) {
+		options["gossip.indirectProbes"] = toStr(nrMembers);
+	}
+
+};
+
+/**
+ * Concrete discovery implementor with a SWIM-style gossip protocol (bridge pattern).
+ *
+ * Every instance is a member of the group for its domain and joins it via one of the seeds.
+ * Once per interval we probe a single member and ask a few others to probe it for us if it
+ * does not answer. Members that did not answer are suspected and declared dead if they do not
+ * refute the suspicion in time. Membership changes and the endpoints advertised by a member
+ * are piggybacked on the probes and their acks, so every member sends a bounded number of
+ * datagrams of bounded size per interval regardless of the group size.
+ */
+class DLLEXPORT GossipDiscovery : public DiscoveryImpl, public Thread {
+public:
+	GossipDiscovery();
+	virtual ~GossipDiscovery();
+
+	boost::shared_ptr<Implementation> create();
+	void init(Options*);
+	void suspend();
+	void resume();
+
+	void advertise(const EndPoint& node);
+	void add(Node& node);
+	void unadvertise(const EndPoint& node);
+	void remove(Node& node);
+
+	void browse(ResultSet<EndPoint>* query);
+	void unbrowse(ResultSet<EndPoint>* query);
+
+	std::vector<EndPoint> list();
+
+	void run();
+
+	uint16_t getPort() {
+		return _port;
+	} ///< where we receive gossip, the actual port if we bound to any
+	size_t getNrMembers(); ///< other members we consider alive or suspect
+	uint64_t getBytesSent(); ///< since we were initialized
+
+protected:
+	enum MessageType {
+	    PING = 1, ///< with sequence number 0 asks for the full membership
+	    ACK = 2,
+	    PING_REQ = 3, ///< probe a member for us
+	    SYNC = 4 ///< just updates, the full membership for joining members or a goodbye
+	};
+
+	enum MemberState {
+	    ALIVE = 0,
+	    SUSPECT = 1,
+	    DEAD = 2
+	};
+
+	class Member {
+	public:
+		Member() : ip(0), port(0), incarnation(0), state(ALIVE), changedAt(0), transmissions(0) {}
+		std::string id;
+		uint32_t ip; ///< network byte order
+		uint16_t port;
+		uint32_t incarnation; ///< only the member itself increments it
+		MemberState state;
+		uint64_t changedAt; ///< when we last changed the state
+		uint32_t transmissions; ///< how often we piggybacked the current state
+		std::map<std::string, EndPoint> endPoints; ///< advertised endpoints by uuid
+	};
+
+	class Probe {
+	public:
+		Probe() : seq(0), sentAt(0), isAcked(true), isIndirect(false) {}
+		std::string target;
+		uint32_t seq;
+		uint64_t sentAt;
+		bool isAcked;
+		bool isIndirect; ///< whether we asked others to probe as well
+	};
+
+	/// A probe we are doing for someone else
+	class Relay {
+	public:
+		uint32_t ip;
+		uint16_t port;
+		uint32_t seq; ///< the requester's sequence number
+		uint64_t expiresAt;
+	};
+
+	void advertise(const EndPoint& node, const std::string& uuid);
+
+	void startProbe(uint64_t now);
+	void probeIndirectly();
+	void startSync(uint64_t now);
+	void expire(uint64_t now);
+	void receive(uint64_t now);
+	bool isNews(const Member& update);
+	bool apply(Member& update, uint64_t now);
+	void report(const std::map<std::string, EndPoint>& before, const std::map<std::string, EndPoint>& after);
+
+	void send(uint32_t ip, uint16_t port, MessageType type, uint32_t seq, uint32_t targetIp = 0, uint16_t targetPort = 0);
+	void sendFullState(uint32_t ip, uint16_t port);
+	void transmit(const char* buffer, size_t size, uint32_t ip, uint16_t port);
+	size_t writeHeader(char* buffer, MessageType type, uint32_t seq, uint32_t targetIp, uint16_t targetPort);
+	size_t writeMember(char* buffer, size_t space, const Member& member, bool isSelf);
+	size_t readMember(const char* buffer, size_t space, Member& member);
+
+	uint32_t nextRandom();
+	uint32_t groupSizeLog2();
+	uint32_t retransmitLimit();
+	uint64_t suspicionTimeout();
+	static bool fewerTransmissions(const Member* first, const Member* second);
+
+	std::map<std::string, std::string> _config;
+	std::map<EndPoint, std::string> _localAds; ///< uuids of the endpoints we advertise
+	std::set<ResultSet<EndPoint>*> _queries;
+
+	Member _self;
+	std::map<std::string, Member> _members; ///< everyone else by id, including dead ones for a while
+	std::vector<std::string> _probeOrder; ///< shuffled members, we probe them round-robin
+	size_t _probeIndex;
+	Probe _probe;
+	std::map<uint32_t, Relay> _relays; ///< by the sequence number of our probe
+	std::list<std::pair<uint32_t, uint16_t> > _seeds;
+
+	int _socket;
+	uint16_t _port;
+	uint32_t _intervalMs;
+	uint32_t _indirectProbes;
+	uint32_t _suspectMultiplier;
+	uint64_t _nextProbe;
+	uint64_t _nextSync;
+	uint32_t _seq;
+	uint32_t _randState;
+	uint64_t _bytesSent;
+
+	Mutex _mutex;
+
+	friend class Factory;
+};
+
+}
+
+#endif /* end of include guard: GOSSIPDISCOVERY_H_Q4WB7NZE */
@@ -20,9 +20,17 @@
 
 #include "MDNSDiscovery.h"
 #include "umundo/common/Factory.h"
+#include "umundo/common/Host.h"
+#include "umundo/connection/PubSummary.h"
+
+#define MDNS_TXT_PUBS "pubs="
 
 namespace umundo {
 
+std::map<std::string, std::map<std::string, EndPoint> > MDNSDiscovery::_inProcNodes;
+std::map<std::string, std::set<ResultSet<EndPoint>*> > MDNSDiscovery::_inProcQueries;
+Mutex MDNSDiscovery::_inProcMutex("disc.mdns.inProc");
+
 boost::shared_ptr<Implementation> MDNSDiscovery::create() {
 	boost::shared_ptr<Implementation> impl = boost::shared_ptr<Implementation>(new MDNSDiscovery());
 	return impl;
@@ -36,6 +44,8 @@ void MDNSDiscovery::init(Options* config) {
 	if (_config["mdns.domain"].length() == 0)       _config["mdns.domain"] = "local.";
 	if (_config["mdns.protocol"].length() == 0)     _config["mdns.protocol"] = "tcp";
 	if (_config["mdns.serviceType"].length() == 0)  _config["mdns.serviceType"] = "umundo";
+	if (_config["mdns.pubSummary"].length() == 0)   _config["mdns.pubSummary"] = toStr(false);
+	_withPubSummary = strTo<bool>(_config["mdns.pubSummary"]);
 
 	_mdnsImpl = boost::static_pointer_cast<MDNSDiscoveryImpl>(Factory::create("discovery.mdns.impl"));
 	_query = new MDNSQuery();
@@ -45,7 +55,7 @@ void MDNSDiscovery::init(Options* config) {
 	_mdnsImpl->browse(_query);
 }
 
-MDNSDiscovery::MDNSDiscovery() : _query(NULL) {
+MDNSDiscovery::MDNSDiscovery() : _query(NULL), _withPubSummary(false), _mutex("disc.mdns") {
 }
 
 MDNSDiscovery::~MDNSDiscovery() {
@@ -54,6 +64,9 @@ MDNSDiscovery::~MDNSDiscovery() {
 	        adIter != _localAds.end();
 	        adIter++) {
 		_mdnsImpl->unadvertise(adIter->second);
+		boost::shared_ptr<NodeImpl> nodeImpl = boost::dynamic_pointer_cast<NodeImpl>(adIter->first.getImpl());
+		if (nodeImpl)
+			nodeImpl->removeAdvertiser(this);
 	}
 	if (_mdnsImpl && _query) {
 		_mdnsImpl->unbrowse(_query);
@@ -70,6 +83,19 @@ MDNSDiscovery::~MDNSDiscovery() {
 		}
 	}
 
+	// same for the nodes in this process
+	for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+	        queryIter != _queries.end();
+	        queryIter++) {
+		unbrowseInProcess(*queryIter);
+	}
+	for (std::map<EndPoint, MDNSAd*>::iterator adIter = _localAds.begin();
+	        adIter != _localAds.end();
+	        adIter++) {
+		if (adIter->second->isInProcess)
+			removeInProcess(adIter->second->name);
+	}
+
 	delete _query;
 }
 
@@ -118,10 +144,16 @@ void MDNSDiscovery::add(Node& node) {
 		mdnsAd->domain = _config["mdns.domain"];
 		mdnsAd->name = node.getUUID();
 		mdnsAd->isInProcess = true; // this allows for local nodes to use inproc sockets, not actually advertised
+		if (_withPubSummary)
+			mdnsAd->txtRecord.insert(MDNS_TXT_PUBS + node.getImpl()->getPubSummary());
 
 		_localAds[node] = mdnsAd;
 	}
+	// nodes in this process learn about us right away, mDNS is for everyone else
+	addInProcess(node);
 	_mdnsImpl->advertise(mdnsAd);
+	if (_withPubSummary)
+		node.getImpl()->addAdvertiser(this);
 	browse(node.getImpl().get());
 }
 
@@ -145,45 +177,193 @@ void MDNSDiscovery::unadvertise(const EndPoint& node) {
 }
 
 void MDNSDiscovery::remove(Node& node) {
+	node.getImpl()->removeAdvertiser(this);
 	unbrowse(node.getImpl().get());
 	unadvertise(node);
+	removeInProcess(node.getUUID());
 }
 
 void MDNSDiscovery::browse(ResultSet<EndPoint>* query) {
-	ScopeLock lock(_mutex);
+	{
+		ScopeLock lock(_mutex);
+
+		if (_queries.find(query) != _queries.end()) {
+			UM_LOG_WARN("Query %p already added for browsing", query);
+			return;
+		}
+		UM_LOG_INFO("Adding %p query", query);
+		_queries.insert(query);
+
+		// report all existing remote endpoints
+		for (std::map<MDNSAd*, EndPoint>::iterator adIter = _remoteAds.begin();
+		        adIter != _remoteAds.end();
+		        adIter++) {
+			query->added(adIter->second);
+		}
+	}
+	browseInProcess(query);
+}
+
+void MDNSDiscovery::unbrowse(ResultSet<EndPoint>* query) {
+	{
+		ScopeLock lock(_mutex);
+
+		if (_queries.find(query) == _queries.end()) {
+			UM_LOG_WARN("No such query %p to unbrowse", query);
+			return;
+		}
+
+		UM_LOG_INFO("Removing %p query", query);
+		// unreport all existing remote endpoints
+		for (std::map<MDNSAd*, EndPoint>::iterator adIter = _remoteAds.begin();
+		        adIter != _remoteAds.end();
+		        adIter++) {
+			query->removed(adIter->second);
+		}
+
+		_queries.erase(query);
+	}
+	unbrowseInProcess(query);
+}
 
-	if (_queries.find(query) != _queries.end()) {
-		UM_LOG_WARN("Query %p already added for browsing", query);
+/**
+ * Report a node to all queries for our domain in this process, without an mDNS round trip.
+ */
+void MDNSDiscovery::addInProcess(Node& node) {
+	ScopeLock lock(_inProcMutex);
+
+	std::map<std::string, EndPoint>& nodes = _inProcNodes[_config["mdns.domain"]];
+	if (nodes.find(node.getUUID()) != nodes.end())
 		return;
+
+	EndPoint endPoint(boost::shared_ptr<EndPointImpl>(new EndPointImpl()));
+	endPoint.getImpl()->setDomain(_config["mdns.domain"]);
+	endPoint.getImpl()->setHost(Host::getHostname());
+	endPoint.getImpl()->setIP("127.0.0.1");
+	endPoint.getImpl()->setPort(node.getPort());
+	endPoint.getImpl()->setTransport(node.getTransport());
+	endPoint.getImpl()->setInProcess(true);
+	endPoint.getImpl()->setRemote(false);
+	endPoint.getImpl()->setLastSeen(Thread::getTimeStampMs());
+	if (_withPubSummary)
+		endPoint.getImpl()->setPubSummary(node.getImpl()->getPubSummary());
+
+	UM_LOG_INFO("Adding in-process node %s in %s", endPoint.getAddress().c_str(), _config["mdns.domain"].c_str());
+	nodes[node.getUUID()] = endPoint;
+
+	std::set<ResultSet<EndPoint>*>& queries = _inProcQueries[_config["mdns.domain"]];
+	for (std::set<ResultSet<EndPoint>*>::iterator queryIter = queries.begin();
+	        queryIter != queries.end();
+	        queryIter++) {
+		(*queryIter)->added(endPoint);
 	}
-	UM_LOG_INFO("Adding %p query", query);
-	_queries.insert(query);
+}
 
-	// report all existing remote endpoints
-	for (std::map<MDNSAd*, EndPoint>::iterator adIter = _remoteAds.begin();
-	        adIter != _remoteAds.end();
-	        adIter++) {
-		query->added(adIter->second);
+void MDNSDiscovery::removeInProcess(const std::string& uuid) {
+	ScopeLock lock(_inProcMutex);
+
+	std::map<std::string, EndPoint>& nodes = _inProcNodes[_config["mdns.domain"]];
+	if (nodes.find(uuid) == nodes.end())
+		return;
+
+	UM_LOG_INFO("Removing in-process node %s in %s", nodes[uuid].getAddress().c_str(), _config["mdns.domain"].c_str());
+
+	std::set<ResultSet<EndPoint>*>& queries = _inProcQueries[_config["mdns.domain"]];
+	for (std::set<ResultSet<EndPoint>*>::iterator queryIter = queries.begin();
+	        queryIter != queries.end();
+	        queryIter++) {
+		(*queryIter)->removed(nodes[uuid]);
 	}
+	nodes.erase(uuid);
 }
 
-void MDNSDiscovery::unbrowse(ResultSet<EndPoint>* query) {
-	ScopeLock lock(_mutex);
+void MDNSDiscovery::browseInProcess(ResultSet<EndPoint>* query) {
+	ScopeLock lock(_inProcMutex);
+
+	_inProcQueries[_config["mdns.domain"]].insert(query);
+
+	std::map<std::string, EndPoint>& nodes = _inProcNodes[_config["mdns.domain"]];
+	for (std::map<std::string, EndPoint>::iterator nodeIter = nodes.begin();
+	        nodeIter != nodes.end();
+	        nodeIter++) {
+		query->added(nodeIter->second);
+	}
+}
+
+void MDNSDiscovery::unbrowseInProcess(ResultSet<EndPoint>* query) {
+	ScopeLock lock(_inProcMutex);
 
-	if (_queries.find(query) == _queries.end()) {
-		UM_LOG_WARN("No such query %p to unbrowse", query);
+	if (_inProcQueries[_config["mdns.domain"]].erase(query) == 0)
 		return;
+
+	std::map<std::string, EndPoint>& nodes = _inProcNodes[_config["mdns.domain"]];
+	for (std::map<std::string, EndPoint>::iterator nodeIter = nodes.begin();
+	        nodeIter != nodes.end();
+	        nodeIter++) {
+		query->removed(nodeIter->second);
 	}
+}
 
-	UM_LOG_INFO("Removing %p query", query);
-	// unreport all existing remote endpoints
-	for (std::map<MDNSAd*, EndPoint>::iterator adIter = _remoteAds.begin();
-	        adIter != _remoteAds.end();
-	        adIter++) {
-		query->removed(adIter->second);
+/**
+ * A node we advertise changed its publishers, update its summary.
+ *
+ * Nodes in this process are told right away. The TXT record is only published anew if the
+ * node gained channels, a summary with stale bits just makes for some extra connections.
+ */
+void MDNSDiscovery::publishersChanged(NodeImpl* node) {
+	std::string summary = node->getPubSummary();
+
+	{
+		ScopeLock lock(_inProcMutex);
+		std::map<std::string, EndPoint>& nodes = _inProcNodes[_config["mdns.domain"]];
+		if (nodes.find(node->getUUID()) != nodes.end() && nodes[node->getUUID()].getPubSummary() != summary) {
+			nodes[node->getUUID()].getImpl()->setPubSummary(summary);
+			std::set<ResultSet<EndPoint>*>& queries = _inProcQueries[_config["mdns.domain"]];
+			for (std::set<ResultSet<EndPoint>*>::iterator queryIter = queries.begin();
+			        queryIter != queries.end();
+			        queryIter++) {
+				(*queryIter)->changed(nodes[node->getUUID()]);
+			}
+		}
+	}
+
+	MDNSAd* mdnsAd = NULL;
+	{
+		ScopeLock lock(_mutex);
+		for (std::map<EndPoint, MDNSAd*>::iterator adIter = _localAds.begin();
+		        adIter != _localAds.end();
+		        adIter++) {
+			if (adIter->first.getImpl().get() != node)
+				continue;
+
+			std::string advertised;
+			std::set<std::string>::iterator txtIter = adIter->second->txtRecord.begin();
+			while(txtIter != adIter->second->txtRecord.end()) {
+				if (txtIter->compare(0, strlen(MDNS_TXT_PUBS), MDNS_TXT_PUBS) == 0) {
+					advertised = txtIter->substr(strlen(MDNS_TXT_PUBS));
+					adIter->second->txtRecord.erase(txtIter++);
+				} else {
+					txtIter++;
+				}
+			}
+			adIter->second->txtRecord.insert(MDNS_TXT_PUBS + summary);
+
+			if (!PubSummary(advertised).covers(PubSummary(summary)))
+				mdnsAd = adIter->second;
+			break;
+		}
 	}
 
-	_queries.erase(query);
+	if (mdnsAd != NULL) {
+		_mdnsImpl->unadvertise(mdnsAd);
+		_mdnsImpl->advertise(mdnsAd);
+	}
+}
+
+bool MDNSDiscovery::isInProcess(const std::string& uuid) {
+	ScopeLock lock(_inProcMutex);
+	std::map<std::string, EndPoint>& nodes = _inProcNodes[_config["mdns.domain"]];
+	return nodes.find(uuid) != nodes.end();
 }
 
 /**
@@ -192,6 +372,12 @@ void MDNSDiscovery::unbrowse(ResultSet<EndPoint>* query) {
 void MDNSDiscovery::added(MDNSAd* remoteAd) {
 	ScopeLock lock(_mutex);
 
+	if (_inProcAds.find(remoteAd) != _inProcAds.end() || isInProcess(remoteAd->name)) {
+		// we already reported this one
+		_inProcAds.insert(remoteAd);
+		return;
+	}
+
 	if(_remoteAds.find(remoteAd) != _remoteAds.end()) {
 		UM_LOG_WARN("MDNS reported existing node %s in %s as new", _remoteAds[remoteAd].getAddress().c_str(), _config["mdns.domain"].c_str());
 
@@ -218,6 +404,13 @@ void MDNSDiscovery::added(MDNSAd* remoteAd) {
 
 		endPoint.getImpl()->setTransport(remoteAd->getTransport());
 
+		for (std::set<std::string>::iterator txtIter = remoteAd->txtRecord.begin();
+		        txtIter != remoteAd->txtRecord.end();
+		        txtIter++) {
+			if (txtIter->compare(0, strlen(MDNS_TXT_PUBS), MDNS_TXT_PUBS) == 0)
+				endPoint.getImpl()->setPubSummary(txtIter->substr(strlen(MDNS_TXT_PUBS)));
+		}
+
 		UM_LOG_INFO("MDNS reported new node %s in %s", endPoint.getAddress().c_str(), _config["mdns.domain"].c_str());
 
 		_remoteAds[remoteAd] = endPoint;
@@ -233,6 +426,11 @@ void MDNSDiscovery::added(MDNSAd* remoteAd) {
 void MDNSDiscovery::removed(MDNSAd* remoteAd) {
 	ScopeLock lock(_mutex);
 
+	if (_inProcAds.find(remoteAd) != _inProcAds.end()) {
+		_inProcAds.erase(remoteAd);
+		return;
+	}
+
 	if(_remoteAds.find(remoteAd) == _remoteAds.end()) {
 		UM_LOG_WARN("MDNS reported vanishing of unknown node %s in %s", remoteAd->host.c_str(), _config["mdns.domain"].c_str());
 		return;
@@ -251,6 +449,9 @@ void MDNSDiscovery::removed(MDNSAd* remoteAd) {
 void MDNSDiscovery::changed(MDNSAd* remoteAd) {
 	ScopeLock lock(_mutex);
 
+	if (_inProcAds.find(remoteAd) != _inProcAds.end())
+		return;
+
 	assert(_remoteAds.find(remoteAd) != _remoteAds.end());
 
 	UM_LOG_INFO("MDNS reported changed node %s in %s", _remoteAds[remoteAd].getAddress().c_str(), _config["mdns.domain"].c_str());
@@ -272,6 +473,14 @@ std::vector<EndPoint> MDNSDiscovery::list() {
 		endpoints.push_back(adIter->second);
 	}
 
+	ScopeLock inProcLock(_inProcMutex);
+	std::map<std::string, EndPoint>& nodes = _inProcNodes[_config["mdns.domain"]];
+	for (std::map<std::string, EndPoint>::iterator nodeIter = nodes.begin();
+	        nodeIter != nodes.end();
+	        nodeIter++) {
+		endpoints.push_back(nodeIter->second);
+	}
+
 	return endpoints;
 }
 
@@ -107,14 +107,33 @@ public:
 
 	std::vector<EndPoint> list();
 
+	void publishersChanged(NodeImpl* node);
+
 protected:
 	void init(Options*);
 
+	/** @name Nodes in this process
+	 * Reported to each other right away, their mDNS advertisements are only for remote peers.
+	 */
+	//@{
+	void addInProcess(Node& node);
+	void removeInProcess(const std::string& uuid);
+	void browseInProcess(ResultSet<EndPoint>* query);
+	void unbrowseInProcess(ResultSet<EndPoint>* query);
+	bool isInProcess(const std::string& uuid);
+
+	static std::map<std::string, std::map<std::string, EndPoint> > _inProcNodes; ///< per domain by uuid
+	static std::map<std::string, std::set<ResultSet<EndPoint>*> > _inProcQueries; ///< per domain
+	static Mutex _inProcMutex;
+	//@}
+
 	std::map<std::string, std::string> _config;
 	MDNSQuery* _query;
 	std::map<EndPoint, MDNSAd*> _localAds;
 	std::map<MDNSAd*, EndPoint> _remoteAds;
+	std::set<MDNSAd*> _inProcAds; ///< mDNS reports of our in-process nodes we ignore
 	std::set<ResultSet<EndPoint>*> _queries;
+	bool _withPubSummary;
 
 	Mutex _mutex;
 	boost::shared_ptr<MDNSDiscoveryImpl> _mdnsImpl;
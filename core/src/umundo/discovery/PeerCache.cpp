@@ -0,0 +1,117 @@
+/**
+ *  @file
+ *  @brief      Remember the nodes we were connected to across restarts.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/discovery/PeerCache.h"
+#include "umundo/thread/Thread.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+
+namespace umundo {
+
+PeerCache::PeerCache(const std::string& filename, uint64_t maxAgeMs) :
+	_filename(filename),
+	_maxAgeMs(maxAgeMs),
+	_isDirty(false) {
+}
+
+bool PeerCache::load() {
+	_entries.clear();
+	_isDirty = false;
+
+	std::ifstream file(_filename.c_str());
+	if (!file)
+		return false;
+
+	uint64_t now = Thread::getTimeStampMs();
+	std::string line;
+	while(std::getline(file, line)) {
+		Entry entry;
+		std::istringstream words(line);
+		if (!(words >> entry.address >> entry.uuid >> entry.lastSeen))
+			continue;
+		if (entry.lastSeen + _maxAgeMs < now) {
+			_isDirty = true;
+			continue;
+		}
+		_entries[entry.address] = entry;
+	}
+	return true;
+}
+
+/**
+ * Write to a temporary file first, a crash must not leave us with half a cache.
+ */
+bool PeerCache::save() {
+	if (_filename.length() == 0)
+		_isDirty = false; // nowhere to write to
+	if (!_isDirty)
+		return true;
+
+	std::string tmpName = _filename + ".tmp";
+	{
+		std::ofstream file(tmpName.c_str(), std::ios::trunc);
+		if (!file) {
+			UM_LOG_WARN("Cannot write peer cache to '%s'", tmpName.c_str());
+			return false;
+		}
+		for (std::map<std::string, Entry>::iterator entryIter = _entries.begin(); entryIter != _entries.end(); entryIter++) {
+			file << entryIter->second.address << " " << entryIter->second.uuid << " " << entryIter->second.lastSeen << std::endl;
+		}
+	}
+#ifdef WIN32
+	remove(_filename.c_str());
+#endif
+	if (rename(tmpName.c_str(), _filename.c_str()) != 0) {
+		UM_LOG_WARN("Cannot replace peer cache '%s'", _filename.c_str());
+		return false;
+	}
+	_isDirty = false;
+	return true;
+}
+
+void PeerCache::seen(const std::string& address, const std::string& uuid, uint64_t lastSeen) {
+	Entry& entry = _entries[address];
+	entry.address = address;
+	entry.uuid = uuid;
+	entry.lastSeen = lastSeen;
+	_isDirty = true;
+}
+
+void PeerCache::forget(const std::string& address) {
+	if (_entries.erase(address) > 0)
+		_isDirty = true;
+}
+
+std::vector<EndPoint> PeerCache::getEndPoints() {
+	std::vector<EndPoint> endPoints;
+	for (std::map<std::string, Entry>::iterator entryIter = _entries.begin(); entryIter != _entries.end(); entryIter++) {
+		EndPoint endPoint(entryIter->first);
+		if (!endPoint)
+			continue;
+		endPoint.getImpl()->setRemote(true);
+		endPoint.getImpl()->setLastSeen(entryIter->second.lastSeen);
+		endPoints.push_back(endPoint);
+	}
+	return endPoints;
+}
+
+}
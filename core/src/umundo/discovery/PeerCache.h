@@ -0,0 +1,73 @@
+/**
+ *  @file
+ *  @brief      Remember the nodes we were connected to across restarts.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef PEERCACHE_H_8SJ3VN2T
+#define PEERCACHE_H_8SJ3VN2T
+
+#include "umundo/common/Common.h"
+#include "umundo/common/EndPoint.h"
+
+#define UMUNDO_PEER_CACHE_MAX_AGE_MS 86400000 ///< default age after which we do not bother with a cached peer anymore
+
+namespace umundo {
+
+/**
+ * Small on-disk cache of the last known remote nodes.
+ *
+ * The file has one peer per line as "tcp://ip:port uuid lastSeen" with lastSeen in ms since
+ * the epoch. A node will optimistically connect to all cached peers while discovery is still
+ * looking and forget the ones that do not answer.
+ */
+class DLLEXPORT PeerCache {
+public:
+	class Entry {
+	public:
+		Entry() : lastSeen(0) {}
+		std::string address; ///< tcp://ip:port of the node socket
+		std::string uuid;
+		uint64_t lastSeen;
+	};
+
+	PeerCache(const std::string& filename = "", uint64_t maxAgeMs = UMUNDO_PEER_CACHE_MAX_AGE_MS);
+
+	bool load(); ///< read the file, entries older than the maximum age are dropped
+	bool save(); ///< write the file if we changed since the last load or save
+
+	void seen(const std::string& address, const std::string& uuid, uint64_t lastSeen);
+	void forget(const std::string& address);
+
+	std::vector<EndPoint> getEndPoints();
+	const std::map<std::string, Entry>& getEntries() const {
+		return _entries;
+	}
+	bool isDirty() const {
+		return _isDirty;
+	}
+
+protected:
+	std::string _filename;
+	uint64_t _maxAgeMs;
+	std::map<std::string, Entry> _entries; ///< by address
+	bool _isDirty;
+};
+
+}
+
+#endif /* end of include guard: PEERCACHE_H_8SJ3VN2T */
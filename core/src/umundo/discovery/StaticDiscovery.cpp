@@ -0,0 +1,232 @@
+/**
+ *  @file
+ *  @brief      Discovery of nodes from a fixed list of endpoints.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/discovery/StaticDiscovery.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace umundo {
+
+StaticDiscovery::StaticDiscovery() : _pollMs(UMUNDO_STATIC_POLL_MS), _mutex("disc.static") {
+}
+
+StaticDiscovery::~StaticDiscovery() {
+	stop();
+	join();
+
+	// unreport all endpoints from all queries
+	for (std::map<std::string, EndPoint>::iterator epIter = _endPoints.begin();
+	        epIter != _endPoints.end();
+	        epIter++) {
+		for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+		        queryIter != _queries.end();
+		        queryIter++) {
+			(*queryIter)->removed(epIter->second);
+		}
+	}
+}
+
+boost::shared_ptr<Implementation> StaticDiscovery::create() {
+	return boost::shared_ptr<Implementation>(new StaticDiscovery());
+}
+
+void StaticDiscovery::init(Options* config) {
+	if (config != NULL)
+		_config = config->getKVPs();
+
+	if (_config["static.pollMs"].length() > 0)
+		_pollMs = strTo<uint32_t>(_config["static.pollMs"]);
+	if (_pollMs == 0)
+		_pollMs = 1;
+
+	std::string addresses = _config["static.endpoints"];
+
+	// read the file right away, there is nothing to wait for
+	if (_config["static.file"].length() > 0) {
+		if (!readFile(_fileContent))
+			UM_LOG_WARN("Cannot read endpoints from '%s', will keep trying", _config["static.file"].c_str());
+		start();
+	}
+
+	update(addresses + "\n" + _fileContent);
+}
+
+void StaticDiscovery::suspend() {
+}
+
+void StaticDiscovery::resume() {
+}
+
+void StaticDiscovery::advertise(const EndPoint& node) {
+	// everyone already knows about everyone else
+}
+
+void StaticDiscovery::add(Node& node) {
+	browse(node.getImpl().get());
+}
+
+void StaticDiscovery::unadvertise(const EndPoint& node) {
+}
+
+void StaticDiscovery::remove(Node& node) {
+	unbrowse(node.getImpl().get());
+}
+
+void StaticDiscovery::browse(ResultSet<EndPoint>* query) {
+	ScopeLock lock(_mutex);
+
+	if (_queries.find(query) != _queries.end()) {
+		UM_LOG_WARN("Query %p already added for browsing", query);
+		return;
+	}
+	UM_LOG_INFO("Adding %p query", query);
+	_queries.insert(query);
+
+	// report all endpoints
+	for (std::map<std::string, EndPoint>::iterator epIter = _endPoints.begin();
+	        epIter != _endPoints.end();
+	        epIter++) {
+		query->added(epIter->second);
+	}
+}
+
+void StaticDiscovery::unbrowse(ResultSet<EndPoint>* query) {
+	ScopeLock lock(_mutex);
+
+	if (_queries.find(query) == _queries.end()) {
+		UM_LOG_WARN("No such query %p to unbrowse", query);
+		return;
+	}
+
+	UM_LOG_INFO("Removing %p query", query);
+	// unreport all endpoints
+	for (std::map<std::string, EndPoint>::iterator epIter = _endPoints.begin();
+	        epIter != _endPoints.end();
+	        epIter++) {
+		query->removed(epIter->second);
+	}
+
+	_queries.erase(query);
+}
+
+std::vector<EndPoint> StaticDiscovery::list() {
+	ScopeLock lock(_mutex);
+
+	std::vector<EndPoint> endpoints;
+	for (std::map<std::string, EndPoint>::iterator epIter = _endPoints.begin();
+	        epIter != _endPoints.end();
+	        epIter++) {
+		endpoints.push_back(epIter->second);
+	}
+
+	return endpoints;
+}
+
+bool StaticDiscovery::readFile(std::string& content) {
+	std::ifstream file(_config["static.file"].c_str());
+	if (!file)
+		return false;
+
+	std::stringstream ss;
+	ss << file.rdbuf();
+	content = ss.str();
+	return true;
+}
+
+/**
+ * Report the difference between the given addresses and the ones we know.
+ */
+void StaticDiscovery::update(const std::string& addresses) {
+	ScopeLock lock(_mutex);
+
+	std::set<std::string> current;
+	std::istringstream lines(addresses);
+	std::string line;
+	while(std::getline(lines, line)) {
+		// strip comments
+		if (line.find("#") != std::string::npos)
+			line = line.substr(0, line.find("#"));
+
+		std::istringstream words(line);
+		std::string address;
+		while(words >> address) {
+			if (address[address.length() - 1] == ',')
+				address = address.substr(0, address.length() - 1);
+			if (address.length() > 0)
+				current.insert(address);
+		}
+	}
+
+	std::map<std::string, EndPoint>::iterator epIter = _endPoints.begin();
+	while(epIter != _endPoints.end()) {
+		if (current.find(epIter->first) != current.end()) {
+			epIter++;
+			continue;
+		}
+
+		UM_LOG_INFO("Static endpoint %s removed", epIter->first.c_str());
+		for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+		        queryIter != _queries.end();
+		        queryIter++) {
+			(*queryIter)->removed(epIter->second);
+		}
+		_endPoints.erase(epIter++);
+	}
+
+	for (std::set<std::string>::iterator addrIter = current.begin(); addrIter != current.end(); addrIter++) {
+		if (_endPoints.find(*addrIter) != _endPoints.end())
+			continue;
+
+		EndPoint endPoint(*addrIter);
+		if (!endPoint) {
+			UM_LOG_WARN("Ignoring static endpoint '%s'", addrIter->c_str());
+			continue;
+		}
+		endPoint.getImpl()->setRemote(true);
+		endPoint.getImpl()->setLastSeen(Thread::getTimeStampMs());
+
+		UM_LOG_INFO("Static endpoint %s added", addrIter->c_str());
+		_endPoints[*addrIter] = endPoint;
+		for (std::set<ResultSet<EndPoint>*>::iterator queryIter = _queries.begin();
+		        queryIter != _queries.end();
+		        queryIter++) {
+			(*queryIter)->added(endPoint);
+		}
+	}
+}
+
+/**
+ * Watch the file for changes.
+ */
+void StaticDiscovery::run() {
+	while(isStarted()) {
+		Thread::sleepMs(_pollMs);
+
+		std::string content;
+		if (!readFile(content) || content == _fileContent)
+			continue;
+
+		_fileContent = content;
+		update(_config["static.endpoints"] + "\n" + _fileContent);
+	}
+}
+
+}
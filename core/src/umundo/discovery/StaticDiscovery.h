@@ -0,0 +1,110 @@
+/**
+ *  @file
+ *  @brief      Discovery of nodes from a fixed list of endpoints.
+ *  @author     2012 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef STATICDISCOVERY_H_4HQ7C2VX
+#define STATICDISCOVERY_H_4HQ7C2VX
+
+#include "umundo/common/Common.h"
+#include "umundo/thread/Thread.h"
+#include "umundo/discovery/Discovery.h"
+
+#define UMUNDO_STATIC_POLL_MS 500
+
+namespace umundo {
+
+class StaticDiscoveryOptions : public Options {
+public:
+	StaticDiscoveryOptions() {
+		options["static.file"] = "";
+		options["static.endpoints"] = "";
+		options["static.pollMs"] = toStr(UMUNDO_STATIC_POLL_MS);
+	}
+
+	std::string getType() {
+		return "static";
+	}
+
+	/**
+	 * Read endpoints from a file with one tcp://ip:port address per line, lines
+	 * starting with # are ignored. The file is watched for changes.
+	 */
+	void setFile(const std::string& filename, uint32_t pollMs = UMUNDO_STATIC_POLL_MS) {
+		options["static.file"] = filename;
+		options["static.pollMs"] = toStr(pollMs);
+	}
+
+	void addEndPoint(const std::string& address) {
+		options["static.endpoints"] += address + " ";
+	}
+
+	void addEndPoint(const EndPoint& endPoint) {
+		addEndPoint(endPoint.getTransport() + "://" + endPoint.getIP() + ":" + toStr(endPoint.getPort()));
+	}
+
+};
+
+/**
+ * Concrete discovery implementor for a fixed set of endpoints (bridge pattern).
+ *
+ * All endpoints are known once we are initialized and reported to queries as soon as they
+ * browse, there are no advertisements. If a file is given, it is polled and changed entries
+ * are reported as added or removed.
+ */
+class DLLEXPORT StaticDiscovery : public DiscoveryImpl, public Thread {
+public:
+	StaticDiscovery();
+	virtual ~StaticDiscovery();
+
+	boost::shared_ptr<Implementation> create();
+	void init(Options*);
+	void suspend();
+	void resume();
+
+	void advertise(const EndPoint& node);
+	void add(Node& node);
+	void unadvertise(const EndPoint& node);
+	void remove(Node& node);
+
+	void browse(ResultSet<EndPoint>* query);
+	void unbrowse(ResultSet<EndPoint>* query);
+
+	std::vector<EndPoint> list();
+
+	void run();
+
+protected:
+	bool readFile(std::string& content);
+	void update(const std::string& addresses);
+
+	std::map<std::string, std::string> _config;
+	std::map<std::string, EndPoint> _endPoints; ///< by address
+	std::set<ResultSet<EndPoint>*> _queries;
+
+	std::string _fileContent;
+	uint32_t _pollMs;
+
+	Mutex _mutex;
+
+	friend class Factory;
+};
+
+}
+
+#endif /* end of include guard: STATICDISCOVERY_H_4HQ7C2VX */
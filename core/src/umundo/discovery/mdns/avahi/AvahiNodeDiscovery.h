@@ -28,45 +28,84 @@
 
 #include "umundo/common/Common.h"
 #include "umundo/thread/Thread.h"
-#include "umundo/discovery/Discovery.h"
+#include "umundo/discovery/MDNSDiscovery.h"
 
-namespace umundo {
+struct pollfd;
 
-class AvahiNodeStub;
+namespace umundo {
 
 /**
  * Concrete discovery implementor for avahi (bridge pattern).
+ *
+ * All calls into avahi happen on our own thread, which blocks in the avahi poll loop until
+ * either avahi has something for us or we are woken up via a pipe. Advertisements and
+ * queries are only recorded and queued as operations by the public methods, every wakeup
+ * processes all operations queued so far in one batch.
  */
-class DLLEXPORT AvahiNodeDiscovery : public DiscoveryImpl, public Thread {
+class DLLEXPORT AvahiNodeDiscovery : public MDNSDiscoveryImpl, public Thread {
 public:
+	AvahiNodeDiscovery();
 	virtual ~AvahiNodeDiscovery();
-	static shared_ptr<AvahiNodeDiscovery> getInstance();
+	static boost::shared_ptr<AvahiNodeDiscovery> getInstance();  ///< Return the singleton instance.
 
-	shared_ptr<Implementation> create();
-	void init(shared_ptr<Options>);
+	boost::shared_ptr<Implementation> create();
+	void init(Options*);
 	void suspend();
 	void resume();
 
-	void add(NodeImpl* node);
-	void remove(NodeImpl* node);
+	void advertise(MDNSAd* node);
+	void unadvertise(MDNSAd* node);
 
-	void browse(shared_ptr<NodeQuery> discovery);
-	void unbrowse(shared_ptr<NodeQuery> discovery);
+	void browse(MDNSQuery* query);
+	void unbrowse(MDNSQuery* query);
 
 	void run();
 
-private:
-	AvahiNodeDiscovery();
-
-	AvahiSimplePoll *_simplePoll;
-	Mutex _mutex;
-	Monitor _monitor;
-
-	bool validateState();
-
-	static void entryGroupCallback(AvahiEntryGroup*, AvahiEntryGroupState, void*);
+protected:
+	enum OperationType {
+	    ADVERTISE,
+	    UNADVERTISE,
+	    BROWSE,
+	    UNBROWSE
+	};
+
+	/// Something to do on the avahi thread, never refers to objects owned by the caller
+	class Operation {
+	public:
+		Operation() : type(ADVERTISE), ad(NULL), group(NULL) {}
+		OperationType type;
+		MDNSAd* ad;             ///< only valid as long as it is in _localAds
+		AvahiEntryGroup* group; ///< group to free when unadvertising
+		std::string domain;
+		std::string regType;
+	};
+
+	/// All queries for a service type in a domain share a browser
+	class AvahiQuery {
+	public:
+		AvahiQuery() : browser(NULL) {}
+		AvahiServiceBrowser* browser;
+		std::string domain;
+		std::string regType;
+		std::set<MDNSQuery*> queries;
+		std::map<std::string, MDNSAd*> remoteAds; ///< by service name
+		std::map<std::string, std::map<AvahiIfIndex, AvahiServiceResolver*> > resolvers;
+	};
+
+	void enqueue(const Operation& op);
+	void processOperations();
+	void publish(MDNSAd* ad);
+	void startBrowsing(AvahiQuery& query);
+	void stopBrowsing(AvahiQuery& query);
+	void forgetAvahiObjects();
+
+	static std::string avahiName(const std::string& name);
+
+	/** @name Avahi callbacks */
+	//@{
+	static int pollFunc(struct pollfd *ufds, unsigned int nfds, int timeout, void *userdata);
 	static void clientCallback(AvahiClient*, AvahiClientState, void*);
-	static void browseClientCallback(AvahiClient*, AvahiClientState, void*);
+	static void entryGroupCallback(AvahiEntryGroup*, AvahiEntryGroupState, void*);
 
 	static void browseCallback(
 	    AvahiServiceBrowser *b,
@@ -95,22 +134,23 @@ private:
 	    AvahiLookupResultFlags flags,
 	    void* userdata
 	);
+	//@}
+
+	AvahiSimplePoll* _simplePoll;
+	AvahiClient* _client;
+	AvahiClientState _clientState;
+	int _wakeupPipe[2]; ///< written to whenever there are new operations
 
-	map<intptr_t, shared_ptr<NodeQuery> > _browsers;       ///< memory addresses of queries for static callbacks
-	map<intptr_t, NodeImpl* > _nodes;	         ///< memory addresses of local nodes for static callbacks
-	map<intptr_t, NodeImpl* > _suspendedNodes;	 ///< memory addresses of suspended local nodes
-	map<intptr_t, AvahiClient* > _avahiClients;            ///< memory addresses of local nodes to avahi clients
-	map<intptr_t, AvahiEntryGroup* > _avahiGroups;         ///< memory addresses of local nodes to avahi groups
-	map<intptr_t, AvahiServiceBrowser* > _avahiBrowsers;   ///< memory addresses of local nodes to avahi service browsers
+	std::list<Operation> _operations;
+	std::map<MDNSAd*, AvahiEntryGroup*> _localAds; ///< NULL until published
 
-	map<shared_ptr<NodeQuery>, map<string, shared_ptr<AvahiNodeStub> > > _queryNodes;
+	/// domain to type to browser with set of queries
+	std::map<std::string, std::map<std::string, AvahiQuery> > _queryClients;
 
-	uint64_t lastOperation;
-	void delayOperation();
+	Mutex _mutex;
 
-	static shared_ptr<AvahiNodeDiscovery> _instance;
+	static boost::shared_ptr<AvahiNodeDiscovery> _instance;  ///< The singleton instance.
 
-	friend class AvahiNodeStub;
 	friend class Factory;
 };
 
@@ -35,6 +35,11 @@
 #include <string.h>
 #endif
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
 #include "umundo/connection/Node.h"
 
 #ifdef DISC_BONJOUR_EMBED
@@ -43,6 +48,10 @@ extern "C" {
 	int embedded_mDNSInit();
 	void embedded_mDNSExit();
 	int embedded_mDNSmainLoop(timeval);
+#ifndef WIN32
+	void embedded_mDNSGetFDSet(int* nfds, fd_set* readfds, timeval* timeout);
+	void embedded_mDNSProcessFDSet(fd_set* readfds);
+#endif
 }
 #endif
 
@@ -59,6 +68,14 @@ void BonjourDiscovery::init(Options*) {
 boost::shared_ptr<BonjourDiscovery> BonjourDiscovery::getInstance() {
 	if (_instance.get() == NULL) {
 		_instance = boost::shared_ptr<BonjourDiscovery>(new BonjourDiscovery());
+#ifndef WIN32
+		if (pipe(_instance->_wakeupPipe) != 0) {
+			UM_LOG_ERR("pipe: %s", strerror(errno));
+		} else {
+			fcntl(_instance->_wakeupPipe[0], F_SETFL, O_NONBLOCK);
+			fcntl(_instance->_wakeupPipe[1], F_SETFL, O_NONBLOCK);
+		}
+#endif
 #ifdef DISC_BONJOUR_EMBED
 		UM_LOG_DEBUG("Initializing embedded mDNS server");
 		int err = embedded_mDNSInit();
@@ -72,7 +89,7 @@ boost::shared_ptr<BonjourDiscovery> BonjourDiscovery::getInstance() {
 		if (error) {
 			UM_LOG_WARN("DNSServiceCreateConnection returned error: %s", errCodeToString(error).c_str());
 		} else {
-			_instance->_activeFDs[DNSServiceRefSockFD(_instance->_mainDNSHandle)] = _instance->_mainDNSHandle;
+			_instance->addActiveFD(DNSServiceRefSockFD(_instance->_mainDNSHandle), _instance->_mainDNSHandle);
 			_instance->start();
 		}
 #endif
@@ -85,6 +102,8 @@ BonjourDiscovery::BonjourDiscovery() {
 	_mainDNSHandle = NULL;
 	_nodes = 0;
 	_ads = 0;
+	_activeFDsChanged = true;
+	_wakeupPipe[0] = _wakeupPipe[1] = -1;
 }
 
 BonjourDiscovery::~BonjourDiscovery() {
@@ -100,11 +119,18 @@ BonjourDiscovery::~BonjourDiscovery() {
 	}
 #endif
 	stop();
+	wakeup();
 	join(); // we have deadlock in embedded?
 
 #ifdef DISC_BONJOUR_EMBED
 	// notify every other host that we are about to vanish
 	embedded_mDNSExit();
+#endif
+#ifndef WIN32
+	if (_wakeupPipe[0] >= 0)
+		close(_wakeupPipe[0]);
+	if (_wakeupPipe[1] >= 0)
+		close(_wakeupPipe[1]);
 #endif
 	if (_mainDNSHandle) {
 		DNSServiceRefDeallocate(_mainDNSHandle);
@@ -162,9 +188,8 @@ void BonjourDiscovery::resume() {
 }
 
 void BonjourDiscovery::run() {
+#if (defined DISC_BONJOUR_EMBED && defined WIN32)
 	struct timeval tv;
-
-#ifdef DISC_BONJOUR_EMBED
 	while(isStarted()) {
 		UMUNDO_LOCK(_mutex);
 		tv.tv_sec  = BONJOUR_REPOLL_SEC;
@@ -173,14 +198,46 @@ void BonjourDiscovery::run() {
 		_monitor.signal();
 		UMUNDO_UNLOCK(_mutex);
 		// give other threads a chance to react before locking again
-//#ifdef WIN32
 		Thread::sleepMs(100);
-//#else
-//		Thread::yield();
-//#endif
 	}
-#else
 
+#elif defined DISC_BONJOUR_EMBED
+	struct timeval tv;
+	fd_set readfds;
+	int nfds;
+
+	while(isStarted()) {
+		// the mDNS core tells us its sockets and when it wants to run next
+		nfds = 0;
+		FD_ZERO(&readfds);
+		tv.tv_sec  = BONJOUR_IDLE_SEC;
+		tv.tv_usec = 0;
+		{
+			ScopeLock lock(_mutex);
+			embedded_mDNSGetFDSet(&nfds, &readfds, &tv);
+		}
+		FD_SET(_wakeupPipe[0], &readfds);
+		if (_wakeupPipe[0] + 1 > nfds)
+			nfds = _wakeupPipe[0] + 1;
+
+		int result = select(nfds, &readfds, (fd_set*)NULL, (fd_set*)NULL, &tv);
+		if (result < 0) {
+			if (errno != EINTR)
+				UM_LOG_WARN("select failed %s", strerror(errno));
+			continue;
+		}
+		if (FD_ISSET(_wakeupPipe[0], &readfds)) {
+			drainWakeupPipe();
+			FD_CLR(_wakeupPipe[0], &readfds);
+		}
+
+		ScopeLock lock(_mutex);
+		embedded_mDNSProcessFDSet(&readfds);
+		_monitor.signal();
+	}
+
+#elif defined WIN32
+	struct timeval tv;
 	fd_set readfds;
 	int nfds = -1;
 
@@ -225,7 +282,6 @@ void BonjourDiscovery::run() {
 					it = _activeFDs.begin();
 				}
 			}
-//      _monitor.signal();
 
 		} else if (result == 0) {
 			// timeout as no socket is selectable, just retry
@@ -234,13 +290,90 @@ void BonjourDiscovery::run() {
 				UM_LOG_WARN("select failed %s", strerror(errno));
 			if (nfds > FD_SETSIZE)
 				UM_LOG_WARN("number of file descriptors too large: %d of %d", nfds, FD_SETSIZE);
-//			Thread::sleepMs(300);
 		}
+	}
+
+#else
+	// the wakeup pipe comes first, the rest is only rebuilt when descriptors come or go
+	std::vector<struct pollfd> fds;
 
+	while(isStarted()) {
+		{
+			ScopeLock lock(_mutex);
+			if (_activeFDsChanged) {
+				fds.clear();
+				struct pollfd pfd;
+				pfd.fd = _wakeupPipe[0];
+				pfd.events = POLLIN;
+				fds.push_back(pfd);
+				for (std::map<int, DNSServiceRef>::iterator fdIter = _activeFDs.begin(); fdIter != _activeFDs.end(); fdIter++) {
+					if (fdIter->first == -1)
+						continue; // subordinate refs on the shared connection
+					pfd.fd = fdIter->first;
+					fds.push_back(pfd);
+				}
+				_activeFDsChanged = false;
+			}
+		}
+		for (std::vector<struct pollfd>::iterator fdIter = fds.begin(); fdIter != fds.end(); fdIter++)
+			fdIter->revents = 0;
+
+		// no lock held while we wait, registering and browsing go straight to the daemon
+		int result = poll(&fds[0], fds.size(), -1);
+		if (result < 0) {
+			if (errno != EINTR)
+				UM_LOG_WARN("poll failed %s", strerror(errno));
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN)
+			drainWakeupPipe();
+
+		// process every readable descriptor in one go
+		ScopeLock lock(_mutex);
+		for (size_t i = 1; i < fds.size(); i++) {
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			// the descriptor might have gone away with an earlier result
+			std::map<int, DNSServiceRef>::iterator fdIter = _activeFDs.find(fds[i].fd);
+			if (fdIter == _activeFDs.end())
+				continue;
+			DNSServiceErrorType err = DNSServiceProcessResult(fdIter->second);
+			if (err != kDNSServiceErr_NoError)
+				UM_LOG_WARN("DNSServiceProcessResult: %s", errCodeToString(err).c_str());
+		}
 	}
 #endif
 }
 
+void BonjourDiscovery::wakeup() {
+#ifndef WIN32
+	char c = 0;
+	if (_wakeupPipe[1] >= 0)
+		write(_wakeupPipe[1], &c, 1);
+#endif
+}
+
+#ifndef WIN32
+void BonjourDiscovery::drainWakeupPipe() {
+	char buffer[64];
+	while(read(_wakeupPipe[0], buffer, sizeof(buffer)) > 0) {}
+}
+#endif
+
+void BonjourDiscovery::addActiveFD(int fd, DNSServiceRef sdRef) {
+	_activeFDs[fd] = sdRef;
+	_activeFDsChanged = true;
+	wakeup();
+}
+
+void BonjourDiscovery::removeActiveFD(int fd) {
+	if (_activeFDs.erase(fd) > 0) {
+		_activeFDsChanged = true;
+		wakeup();
+	}
+}
+
 /**
  * Add a node to be discoverable by other nodes.
  */
@@ -268,21 +401,23 @@ void BonjourDiscovery::advertise(MDNSAd* node) {
 	        txtIter != node->txtRecord.end();
 	        txtIter++) {
 		if (txtIter->length() > 255) {
-			if (txtLen + 255 > 0xffff)
+			if (txtLen + 256 > 0xffff)
 				break;
-			txtLen += 255;
+			txtLen += 256;
 			txtSS << (char)255;
 			txtSS << txtIter->substr(0,255);
 		} else {
-			if (txtLen + txtIter->length() > 0xffff)
+			if (txtLen + txtIter->length() + 1 > 0xffff)
 				break;
-			txtLen += txtIter->length();
+			txtLen += txtIter->length() + 1;
 			txtSS << (char)txtIter->length();
 			txtSS << *txtIter;
 		}
 	}
 
-	const char* txtRData = (txtSS.str().size() > 0 ? txtSS.str().data() : NULL);
+	// keep the rdata alive until registered
+	std::string txtString = txtSS.str();
+	const char* txtRData = (txtString.size() > 0 ? txtString.data() : NULL);
 
 	err = DNSServiceRegister(&registerClient,                 // uninitialized DNSServiceRef
 	                         kDNSServiceFlagsShareConnection, // renaming behavior on name conflict (kDNSServiceFlagsNoAutoRename)
@@ -301,7 +436,9 @@ void BonjourDiscovery::advertise(MDNSAd* node) {
 		_localAds[node].serviceRegister = registerClient;
 		_ads++;
 #ifndef DISC_BONJOUR_EMBED
-		_activeFDs[DNSServiceRefSockFD(registerClient)] = registerClient;
+		addActiveFD(DNSServiceRefSockFD(registerClient), registerClient);
+#else
+		wakeup(); // have the mDNS core send our probes right away
 #endif
 	}	else {
 		UM_LOG_ERR("Cannot advertise node: %s", errCodeToString(err).c_str());
@@ -317,13 +454,13 @@ void BonjourDiscovery::unadvertise(MDNSAd* node) {
 		return;
 	}
 
-	_activeFDs.erase(DNSServiceRefSockFD(_localAds[node].serviceRegister)); // noop in embedded
+	removeActiveFD(DNSServiceRefSockFD(_localAds[node].serviceRegister)); // noop in embedded
 	assert(_localAds[node].serviceRegister != NULL);
 	DNSServiceRefDeallocate(_localAds[node].serviceRegister);
 	_localAds.erase(node);
-	// this is required for browsereply to report vanished nodes?
-	DNSServiceProcessResult(_mainDNSHandle);
 	_ads--;
+	// the goodbye is processed by our thread
+	wakeup();
 }
 
 
@@ -367,7 +504,9 @@ void BonjourDiscovery::browse(MDNSQuery* query) {
 
 		if(queryClient && err == 0) {
 #ifndef DISC_BONJOUR_EMBED
-			_activeFDs[DNSServiceRefSockFD(queryClient)] = queryClient;
+			addActiveFD(DNSServiceRefSockFD(queryClient), queryClient);
+#else
+			wakeup();
 #endif
 		} else {
 			UM_LOG_ERR("Cannot browse for given query: %s", errCodeToString(err).c_str());
@@ -403,7 +542,7 @@ void BonjourDiscovery::unbrowse(MDNSQuery* query) {
 		DNSServiceRef queryClient = _queryClients[query->domain][query->regType].mdnsClient;
 		if (queryClient) {
 #ifndef DISC_BONJOUR_EMBED
-			_activeFDs.erase(DNSServiceRefSockFD(queryClient));
+			removeActiveFD(DNSServiceRefSockFD(queryClient));
 #endif
 			DNSServiceRefDeallocate(queryClient);
 		}
@@ -750,11 +889,12 @@ void DNSSD_API BonjourDiscovery::serviceResolveReply(
 		return;
 	}
 
+	ad->txtRecord.clear();
 	size_t txtOffset = 0;
 	while (txtOffset < txtLen) {
 		uint8_t length = txtRecord[txtOffset++];
-		if (length > 0) {
-			ad->txtRecord.insert(std::string(txtRecord[txtOffset], length));
+		if (length > 0 && txtOffset + length <= txtLen) {
+			ad->txtRecord.insert(std::string((const char*)txtRecord + txtOffset, length));
 			txtOffset += length;
 		}
 	}
@@ -36,6 +36,7 @@ extern "C" {
 
 #define BONJOUR_REPOLL_USEC 20000
 #define BONJOUR_REPOLL_SEC 0
+#define BONJOUR_IDLE_SEC 5 ///< longest wait for the embedded mDNS core when it has nothing scheduled
 
 namespace umundo {
 
@@ -162,8 +163,15 @@ protected:
 
 	void dumpQueries();
 
+	void addActiveFD(int fd, DNSServiceRef sdRef);
+	void removeActiveFD(int fd);
+	void wakeup();          ///< Have our thread pick up changes right away
+	void drainWakeupPipe();
+
 	DNSServiceRef _mainDNSHandle;
 	std::map<int, DNSServiceRef> _activeFDs;                       ///< Socket file descriptors to bonjour handle.
+	bool _activeFDsChanged;                                         ///< Our thread has to rebuild its poll set
+	int _wakeupPipe[2];
 
 	/// domain to type to client with set of queries
 	std::map<std::string, std::map<std::string, BonjourQuery> > _queryClients;
@@ -43,6 +43,10 @@ extern mDNSexport void mDNSPosixProcessFDSet(mDNS *const m, fd_set *readfds);
 
 // promise compiler that these will be there
 mDNSexport int embedded_mDNSmainLoop(struct timeval timeout);
+#ifndef WIN32
+mDNSexport void embedded_mDNSGetFDSet(int* nfds, fd_set* readfds, struct timeval* timeout);
+mDNSexport void embedded_mDNSProcessFDSet(fd_set* readfds);
+#endif
 
 #if WIN32
 mStatus mDNSPoll(DWORD msec);
@@ -144,4 +148,13 @@ mDNSexport int embedded_mDNSmainLoop(struct timeval timeout) {
 	}
 	return result;
 }
+
+/// Let the caller wait on the sockets of the mDNS core along with its own descriptors
+mDNSexport void embedded_mDNSGetFDSet(int* nfds, fd_set* readfds, struct timeval* timeout) {
+	mDNSPosixGetFDSet(&mDNSStorage, nfds, readfds, timeout);
+}
+
+mDNSexport void embedded_mDNSProcessFDSet(fd_set* readfds) {
+	mDNSPosixProcessFDSet(&mDNSStorage, readfds);
+}
 #endif
@@ -27,6 +27,11 @@
 
 #if defined(UNIX) || defined(IOS)
 #include <sys/time.h> // gettimeofday
+#include <time.h> // clock_gettime
+#endif
+
+#if defined(APPLE) || defined(IOS)
+#include <mach/mach_time.h> // mach_absolute_time
 #endif
 
 namespace umundo {
@@ -103,6 +108,37 @@ uint64_t Thread::getTimeStampMs() {
 	return time;
 }
 
+uint64_t Thread::getTimeStampUs() {
+	return getTimeStampNs() / 1000;
+}
+
+uint64_t Thread::getTimeStampNs() {
+	uint64_t time = 0;
+#if defined(WIN32)
+	static LARGE_INTEGER frequency;
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	// split to not overflow for counters of a few days
+	time = (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000;
+	time += (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#elif defined(APPLE) || defined(IOS)
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	uint64_t ticks = mach_absolute_time();
+	time = (ticks / timebase.denom) * timebase.numer;
+	time += (ticks % timebase.denom) * timebase.numer / timebase.denom;
+#elif defined(UNIX)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	time += (uint64_t)ts.tv_sec * 1000000000;
+	time += ts.tv_nsec;
+#endif
+	return time;
+}
+
 //Monitor::Monitor(const Monitor& other) {
 //	UM_LOG_ERR("CopyConstructor!");
 //}
@@ -127,11 +163,213 @@ void Monitor::signal(int nrThreads) {
 }
 
 void Monitor::wait(Mutex& mutex, uint32_t ms) {
-	if (ms <= 0) {
-		_cond.wait(mutex);
+	waitUs(mutex, (uint64_t)ms * 1000);
+}
+
+void Monitor::waitUs(Mutex& mutex, uint64_t us) {
+	// wait on the plain mutex, the time we wait does not count as holding it
+	tthread::recursive_mutex& handle = mutex;
+	int depth = mutex.suspend();
+	if (us <= 0) {
+		_cond.wait(handle);
 	} else {
-		_cond.wait_for(mutex, ms);
+		_cond.wait_for_us(handle, us);
 	}
+	mutex.resume(depth);
+}
+
+bool Monitor::waitUntilUs(Mutex& mutex, uint64_t deadline) {
+	uint64_t now = Thread::getTimeStampUs();
+	if (now >= deadline)
+		return false;
+	waitUs(mutex, deadline - now);
+	return Thread::getTimeStampUs() < deadline;
+}
+
+/**
+ * Statistics of all locks sharing a name, updated by whoever releases one of them.
+ */
+class LockSite {
+public:
+	LockStats stats;
+	tthread::mutex mutex; ///< a plain mutex, we are not profiling ourselves
+};
+
+// never destroyed, locks in static objects may outlive any other static
+static std::map<std::string, LockSite*>& lockSites() {
+	static std::map<std::string, LockSite*>* sites = new std::map<std::string, LockSite*>();
+	return *sites;
+}
+
+static tthread::mutex& lockSitesMutex() {
+	static tthread::mutex* mutex = new tthread::mutex();
+	return *mutex;
+}
+
+bool LockProfiler::isEnabled() {
+#ifdef PROFILE_LOCKS
+	return true;
+#else
+	return false;
+#endif
+}
+
+LockSite* LockProfiler::getSite(const char* name) {
+	tthread::lock_guard<tthread::mutex> lock(lockSitesMutex());
+	std::map<std::string, LockSite*>& sites = lockSites();
+	if (sites.find(name) == sites.end()) {
+		sites[name] = new LockSite();
+		sites[name]->stats.name = name;
+	}
+	return sites[name];
+}
+
+std::list<LockStats> LockProfiler::getStats() {
+	std::list<LockStats> stats;
+	tthread::lock_guard<tthread::mutex> lock(lockSitesMutex());
+	std::map<std::string, LockSite*>& sites = lockSites();
+	for (std::map<std::string, LockSite*>::iterator siteIter = sites.begin(); siteIter != sites.end(); siteIter++) {
+		tthread::lock_guard<tthread::mutex> siteLock(siteIter->second->mutex);
+		stats.push_back(siteIter->second->stats);
+	}
+	return stats;
+}
+
+void LockProfiler::reset() {
+	tthread::lock_guard<tthread::mutex> lock(lockSitesMutex());
+	std::map<std::string, LockSite*>& sites = lockSites();
+	for (std::map<std::string, LockSite*>::iterator siteIter = sites.begin(); siteIter != sites.end(); siteIter++) {
+		tthread::lock_guard<tthread::mutex> siteLock(siteIter->second->mutex);
+		siteIter->second->stats = LockStats();
+		siteIter->second->stats.name = siteIter->first;
+	}
+}
+
+void LockProfiler::acquired(LockSite* site, bool contended, uint64_t waitNs) {
+	tthread::lock_guard<tthread::mutex> lock(site->mutex);
+	site->stats.acquisitions++;
+	if (!contended)
+		return;
+	site->stats.contentions++;
+	site->stats.waitNs += waitNs;
+	if (waitNs > site->stats.maxWaitNs)
+		site->stats.maxWaitNs = waitNs;
+}
+
+void LockProfiler::released(LockSite* site, uint64_t holdNs) {
+	tthread::lock_guard<tthread::mutex> lock(site->mutex);
+	site->stats.holdNs += holdNs;
+	if (holdNs > site->stats.maxHoldNs)
+		site->stats.maxHoldNs = holdNs;
+}
+
+RWMutex::RWMutex(const char* name) : _site(NULL), _writeLockedAt(0) {
+#ifdef PROFILE_LOCKS
+	if (name != NULL)
+		_site = LockProfiler::getSite(name);
+#endif
+	init();
+}
+
+RWMutex::RWMutex(const RWMutex& other) : _site(other._site), _writeLockedAt(0) {
+	init();
+}
+
+RWMutex& RWMutex::operator=(const RWMutex& other) {
+	// keep our own handle, it might be locked
+	_site = other._site;
+	return *this;
+}
+
+RWMutex::~RWMutex() {
+#ifdef THREAD_PTHREAD
+	pthread_rwlock_destroy(&_handle);
+#endif
+}
+
+void RWMutex::init() {
+#ifdef THREAD_WIN32
+	InitializeSRWLock(&_handle);
+#else
+	pthread_rwlock_init(&_handle, NULL);
+#endif
+}
+
+bool RWMutex::tryLockRead() {
+#ifdef THREAD_WIN32
+	return TryAcquireSRWLockShared(&_handle) != 0;
+#else
+	return pthread_rwlock_tryrdlock(&_handle) == 0;
+#endif
+}
+
+bool RWMutex::tryLockWrite() {
+#ifdef THREAD_WIN32
+	return TryAcquireSRWLockExclusive(&_handle) != 0;
+#else
+	return pthread_rwlock_trywrlock(&_handle) == 0;
+#endif
+}
+
+void RWMutex::lockRead() {
+	bool contended = false;
+	uint64_t start = 0;
+	if (_site != NULL) {
+		if (tryLockRead()) {
+			LockProfiler::acquired(_site, false, 0);
+			return;
+		}
+		contended = true;
+		start = Thread::getTimeStampNs();
+	}
+#ifdef THREAD_WIN32
+	AcquireSRWLockShared(&_handle);
+#else
+	pthread_rwlock_rdlock(&_handle);
+#endif
+	if (contended)
+		LockProfiler::acquired(_site, true, Thread::getTimeStampNs() - start);
+}
+
+void RWMutex::unlockRead() {
+#ifdef THREAD_WIN32
+	ReleaseSRWLockShared(&_handle);
+#else
+	pthread_rwlock_unlock(&_handle);
+#endif
+}
+
+void RWMutex::lockWrite() {
+	bool contended = false;
+	uint64_t start = 0;
+	if (_site != NULL) {
+		if (tryLockWrite()) {
+			_writeLockedAt = Thread::getTimeStampNs();
+			LockProfiler::acquired(_site, false, 0);
+			return;
+		}
+		contended = true;
+		start = Thread::getTimeStampNs();
+	}
+#ifdef THREAD_WIN32
+	AcquireSRWLockExclusive(&_handle);
+#else
+	pthread_rwlock_wrlock(&_handle);
+#endif
+	if (contended) {
+		_writeLockedAt = Thread::getTimeStampNs();
+		LockProfiler::acquired(_site, true, _writeLockedAt - start);
+	}
+}
+
+void RWMutex::unlockWrite() {
+	if (_site != NULL)
+		LockProfiler::released(_site, Thread::getTimeStampNs() - _writeLockedAt);
+#ifdef THREAD_WIN32
+	ReleaseSRWLockExclusive(&_handle);
+#else
+	pthread_rwlock_unlock(&_handle);
+#endif
 }
 
 #ifdef THREAD_PTHREAD
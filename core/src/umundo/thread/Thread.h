@@ -23,6 +23,8 @@
 #include "umundo/common/Common.h"
 #include "umundo/thread/tinythread.h"
 
+#include <list>
+
 // this is a hack until we get a compiler firewall per Pimpl
 #ifdef _WIN32
 # if !(defined THREAD_PTHREAD || defined THREAD_WIN32)
@@ -117,7 +119,12 @@ public:
 	static void yield();
 	static void sleepMs(uint32_t ms);
 	static int getThreadId(); ///< integer unique to the current thread
-	static uint64_t getTimeStampMs(); ///< timestamp in ms since 01.01.1970
+	static uint64_t getTimeStampMs(); ///< wall clock in ms since 01.01.1970, jumps when the clock is set
+	static uint64_t getTimeStampUs(); ///< monotonic clock in us since an unspecified point, use for timeouts
+	static uint64_t getTimeStampNs(); ///< monotonic clock in ns since an unspecified point, use for latencies
+	static uint64_t getMonotonicMs() {
+		return getTimeStampUs() / 1000;
+	}
 
 private:
 	bool _isStarted;
@@ -127,15 +134,191 @@ private:
 };
 
 /**
- * Platform independent mutual exclusion.
+ * Wait and hold times of all locks created with the same name.
+ */
+class DLLEXPORT LockStats {
+public:
+	LockStats() : acquisitions(0), contentions(0), waitNs(0), maxWaitNs(0), holdNs(0), maxHoldNs(0) {}
+	std::string name;
+	uint64_t acquisitions;
+	uint64_t contentions; ///< acquisitions that had to wait for another thread
+	uint64_t waitNs; ///< accumulated time spent waiting for the lock
+	uint64_t maxWaitNs;
+	uint64_t holdNs; ///< accumulated time the lock was held, not counting monitor waits
+	uint64_t maxHoldNs;
+};
+
+class LockSite;
+class Monitor;
+
+/**
+ * Contention profiler for named locks.
+ *
+ * Locks given a name at construction report into the same site, so every node's mutex shows
+ * up as one entry. Nothing is recorded unless umundo was built with PROFILE_LOCKS.
+ */
+class DLLEXPORT LockProfiler {
+public:
+	static bool isEnabled(); ///< whether we were built with PROFILE_LOCKS
+	static std::list<LockStats> getStats(); ///< one entry per lock name, ordered by name
+	static void reset();
+
+	static LockSite* getSite(const char* name);
+	static void acquired(LockSite* site, bool contended, uint64_t waitNs);
+	static void released(LockSite* site, uint64_t holdNs);
+};
+
+/**
+ * A tinythread mutex with an optional name for the contention profiler.
+ */
+template <class MutexT>
+class ProfiledMutex : public MutexT {
+public:
+	ProfiledMutex(const char* name = NULL) : _site(NULL), _depth(0), _lockedAt(0) {
+#ifdef PROFILE_LOCKS
+		if (name != NULL)
+			_site = LockProfiler::getSite(name);
+#endif
+	}
+
+	inline void lock() {
+#ifdef PROFILE_LOCKS
+		if (_site != NULL) {
+			if (MutexT::try_lock()) {
+				held(false, 0);
+			} else {
+				uint64_t start = Thread::getTimeStampNs();
+				MutexT::lock();
+				held(true, Thread::getTimeStampNs() - start);
+			}
+			return;
+		}
+#endif
+		MutexT::lock();
+	}
+
+	inline bool try_lock() {
+		if (!MutexT::try_lock())
+			return false;
+#ifdef PROFILE_LOCKS
+		if (_site != NULL)
+			held(false, 0);
+#endif
+		return true;
+	}
+
+	inline void unlock() {
+#ifdef PROFILE_LOCKS
+		if (_site != NULL && --_depth == 0)
+			LockProfiler::released(_site, Thread::getTimeStampNs() - _lockedAt);
+#endif
+		MutexT::unlock();
+	}
+
+protected:
+	void held(bool contended, uint64_t waitNs) {
+		// recursive locking only counts once
+		if (_depth++ > 0)
+			return;
+		_lockedAt = Thread::getTimeStampNs();
+		LockProfiler::acquired(_site, contended, waitNs);
+	}
+
+	// a monitor releases the lock while it waits, other threads take it meanwhile
+	int suspend() {
+		int depth = _depth;
+		if (_site != NULL && depth > 0)
+			LockProfiler::released(_site, Thread::getTimeStampNs() - _lockedAt);
+		_depth = 0;
+		return depth;
+	}
+	void resume(int depth) {
+		_depth = depth;
+		if (_site != NULL && depth > 0)
+			_lockedAt = Thread::getTimeStampNs();
+	}
+
+	LockSite* _site;
+	int _depth; ///< only touched by the thread holding the lock
+	uint64_t _lockedAt;
+
+	friend class Monitor;
+};
+
+/**
+ * Platform independent mutual exclusion, the same thread may lock repeatedly.
+ *
+ * Most of umundo still calls back into itself with its locks held, so this remains the
+ * default. Prefer NonRecursiveMutex for new leaf locks, reentrancy hides ordering problems.
  */
-typedef tthread::recursive_mutex Mutex;
+typedef ProfiledMutex<tthread::recursive_mutex> RecursiveMutex;
+typedef RecursiveMutex Mutex;
 
+/**
+ * Mutual exclusion that deadlocks if the holding thread locks again.
+ */
+typedef ProfiledMutex<tthread::mutex> NonRecursiveMutex;
 
 /**
  * Instantiate on stack to give code in scope below exclusive access.
  */
-typedef tthread::lock_guard<tthread::recursive_mutex> ScopeLock;
+typedef tthread::lock_guard<Mutex> ScopeLock;
+typedef tthread::lock_guard<NonRecursiveMutex> NonRecursiveScopeLock;
+
+/**
+ * Many readers or a single writer, neither is reentrant.
+ *
+ * Readers are profiled for their wait times only, they hold the lock concurrently.
+ */
+class DLLEXPORT RWMutex {
+public:
+	RWMutex(const char* name = NULL);
+	RWMutex(const RWMutex& other); ///< a new lock for the same site, lock handles cannot be copied
+	RWMutex& operator=(const RWMutex& other);
+	~RWMutex();
+
+	void lockRead();
+	void unlockRead();
+	void lockWrite();
+	void unlockWrite();
+
+private:
+	void init();
+	bool tryLockRead();
+	bool tryLockWrite();
+
+#ifdef THREAD_WIN32
+	SRWLOCK _handle;
+#else
+	pthread_rwlock_t _handle;
+#endif
+	LockSite* _site;
+	uint64_t _writeLockedAt;
+};
+
+class DLLEXPORT ScopeReadLock {
+public:
+	ScopeReadLock(RWMutex& mutex) : _mutex(mutex) {
+		_mutex.lockRead();
+	}
+	~ScopeReadLock() {
+		_mutex.unlockRead();
+	}
+private:
+	RWMutex& _mutex;
+};
+
+class DLLEXPORT ScopeWriteLock {
+public:
+	ScopeWriteLock(RWMutex& mutex) : _mutex(mutex) {
+		_mutex.lockWrite();
+	}
+	~ScopeWriteLock() {
+		_mutex.unlockWrite();
+	}
+private:
+	RWMutex& _mutex;
+};
 
 /**
  * See comments from Schmidt on condition variables in windows:
@@ -155,6 +338,9 @@ public:
 		return wait(mutex, 0);
 	}
 	void wait(Mutex& mutex, uint32_t ms);
+	void waitUs(Mutex& mutex, uint64_t us);
+	/// Wait at most until the monotonic deadline from getTimeStampUs(), false once it passed
+	bool waitUntilUs(Mutex& mutex, uint64_t deadline);
 
 private:
 	tthread::condition_variable _cond;
@@ -162,6 +348,44 @@ private:
 
 typedef Monitor Condition;
 
+/**
+ * Platform independent lock-free operations on machine words.
+ */
+class DLLEXPORT Atomic {
+public:
+	static size_t add(volatile size_t* value, size_t delta) {
+#ifdef _MSC_VER
+# ifdef _WIN64
+		return InterlockedExchangeAdd64((volatile LONGLONG*)value, delta) + delta;
+# else
+		return InterlockedExchangeAdd((volatile LONG*)value, delta) + delta;
+# endif
+#else
+		return __sync_add_and_fetch(value, delta);
+#endif
+	}
+
+	static size_t load(volatile size_t* value) {
+		size_t result = *value;
+		barrier();
+		return result;
+	}
+
+	static void store(volatile size_t* value, size_t newValue) {
+		barrier();
+		*value = newValue;
+		barrier();
+	}
+
+	static void barrier() { ///< full memory fence
+#ifdef _MSC_VER
+		MemoryBarrier();
+#else
+		__sync_synchronize();
+#endif
+	}
+};
+
 }
 
 #endif /* end of include guard: PTHREAD_H_KU2YWI3W */
@@ -80,12 +80,18 @@ freely, subject to the following restrictions:
 #endif
 #else
 #include <sys/time.h> // gettimeofday
+#include <time.h> // clock_gettime
 #include <pthread.h>
 #include <signal.h>
 #include <sched.h>
 #include <unistd.h>
 #endif
 
+// Timed waits on a monotonic clock, darwin has relative waits instead
+#if defined(_TTHREAD_POSIX_) && defined(CLOCK_MONOTONIC) && !defined(__APPLE__) && !defined(__ANDROID__)
+#define _TTHREAD_MONOTONIC_COND_
+#endif
+
 // Generic includes
 #include <ostream>
 
@@ -388,7 +394,15 @@ public:
 	condition_variable();
 #else
 	condition_variable() {
+#if defined(_TTHREAD_MONOTONIC_COND_)
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&mHandle, &attr);
+		pthread_condattr_destroy(&attr);
+#else
 		pthread_cond_init(&mHandle, NULL);
+#endif
 	}
 #endif
 
@@ -426,6 +440,14 @@ public:
 
 	template <class _mutexT>
 	inline void wait_for(_mutexT &aMutex, unsigned int ms) {
+		wait_for_us(aMutex, (unsigned long long)ms * 1000);
+	}
+
+	/// Wait for the condition at most us microseconds.
+	/// Setting the clock does not shorten or prolong the wait where we have a
+	/// monotonic clock, windows waits at millisecond granularity.
+	template <class _mutexT>
+	inline void wait_for_us(_mutexT &aMutex, unsigned long long us) {
 #if defined(_TTHREAD_WIN32_)
 		// Increment number of waiters
 		EnterCriticalSection(&mWaitersCountLock);
@@ -435,16 +457,30 @@ public:
 		// Release the mutex while waiting for the condition (will decrease
 		// the number of waiters when done)...
 		aMutex.unlock();
-		_wait(ms);
+		_wait((unsigned int)((us + 999) / 1000));
 		aMutex.lock();
+#elif defined(__APPLE__)
+		struct timespec ts;
+		ts.tv_sec = us / 1000000;
+		ts.tv_nsec = (us % 1000000) * 1000;
+		pthread_cond_timedwait_relative_np(&mHandle, &aMutex.mHandle, &ts);
+#else
+		struct timespec ts;
+#if defined(_TTHREAD_MONOTONIC_COND_)
+		clock_gettime(CLOCK_MONOTONIC, &ts);
 #else
 		struct timeval tv;
 		gettimeofday(&tv, NULL);
-
-		struct timespec ts;
-		ts.tv_sec = tv.tv_sec + (ms / 1000);
-		ts.tv_nsec = (tv.tv_usec * 1000); // convert tv microseconds to nanoseconds
-		ts.tv_nsec += (ms % 1000) * 1000000; // add millisecond part of wait time
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000;
+#endif
+		ts.tv_sec += us / 1000000;
+		ts.tv_nsec += (us % 1000000) * 1000;
+		if (ts.tv_nsec >= 1000000000) {
+			// pthread_cond_timedwait rejects more than a second of nanoseconds
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
 		pthread_cond_timedwait(&mHandle, &aMutex.mHandle, &ts);
 #endif
 	}
@@ -0,0 +1,33 @@
+#ifndef LOSSYRTPPUBLISHER_H_Q4N8ZKWD
+#define LOSSYRTPPUBLISHER_H_Q4N8ZKWD
+
+#include "umundo/connection/rtp/RTPPublisher.h"
+
+namespace umundo {
+
+/**
+ * Drops a fixed share of the datagrams, retransmissions and parity included.
+ *
+ * It has its own generator, so publishers sending the same stream lose alike.
+ */
+class LossyRTPPublisher : public RTPPublisher {
+public:
+	LossyRTPPublisher(uint32_t lossPercent) : _lossPercent(lossPercent), _random(4711), _dropped(0) {}
+
+	void transmit(const char* buffer, size_t size, const Destination& dest) {
+		_random = _random * 1103515245 + 12345;
+		if ((_random >> 16) % 100 < _lossPercent) {
+			_dropped++;
+			return;
+		}
+		RTPPublisher::transmit(buffer, size, dest);
+	}
+
+	uint32_t _lossPercent;
+	uint32_t _random;
+	size_t _dropped;
+};
+
+}
+
+#endif /* end of include guard: LOSSYRTPPUBLISHER_H_Q4N8ZKWD */
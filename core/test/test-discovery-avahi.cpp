@@ -0,0 +1,301 @@
+#include "umundo/core.h"
+#include "umundo/common/Factory.h"
+#include "umundo/discovery/MDNSDiscovery.h"
+
+#include <avahi-client/client.h>
+#include <avahi-client/publish.h>
+#include <avahi-client/lookup.h>
+#include <avahi-common/timeval.h>
+#include <arpa/inet.h>
+#include <iostream>
+
+#define NR_ADS 20
+
+using namespace umundo;
+
+/**
+ * A stand-in for the avahi client library without a daemon, all events are delivered
+ * through the poll loop of the client as soon as it gets to them. Our definitions take
+ * precedence over the ones from libavahi-client.
+ */
+struct AvahiClient {
+	const AvahiPoll* poll;
+};
+
+struct AvahiEntryGroup {
+	AvahiClient* client;
+	std::string name;
+	std::string type;
+	std::string domain;
+	uint16_t port;
+	bool committed;
+};
+
+struct AvahiServiceBrowser {
+	AvahiClient* client;
+	std::string type;
+	AvahiServiceBrowserCallback callback;
+	void* userdata;
+};
+
+struct AvahiServiceResolver {
+	AvahiClient* client;
+	AvahiServiceResolverCallback callback;
+	void* userdata;
+};
+
+struct StubEvent {
+	const AvahiPoll* poll;
+	AvahiServiceBrowser* browser;
+	AvahiServiceResolver* resolver;
+	AvahiBrowserEvent browserEvent;
+	AvahiIfIndex interface;
+	std::string name;
+	std::string type;
+	std::string domain;
+};
+
+static std::set<AvahiEntryGroup*> groups;
+static std::set<AvahiServiceBrowser*> browsers;
+static std::set<AvahiServiceResolver*> resolvers;
+
+static void fireEvent(AvahiTimeout* timeout, void* userdata) {
+	StubEvent* event = (StubEvent*)userdata;
+	event->poll->timeout_free(timeout);
+
+	if (event->browser != NULL && browsers.find(event->browser) != browsers.end()) {
+		event->browser->callback(event->browser, event->interface, AVAHI_PROTO_INET, event->browserEvent,
+		                         event->name.c_str(), event->type.c_str(), event->domain.c_str(),
+		                         (AvahiLookupResultFlags)0, event->browser->userdata);
+	}
+
+	if (event->resolver != NULL && resolvers.find(event->resolver) != resolvers.end()) {
+		AvahiEntryGroup* group = NULL;
+		for (std::set<AvahiEntryGroup*>::iterator groupIter = groups.begin(); groupIter != groups.end(); groupIter++) {
+			if ((*groupIter)->name == event->name && (*groupIter)->committed)
+				group = *groupIter;
+		}
+
+		AvahiAddress address;
+		address.proto = AVAHI_PROTO_INET;
+		address.data.ipv4.address = htonl(INADDR_LOOPBACK);
+		event->resolver->callback(event->resolver, event->interface, AVAHI_PROTO_INET,
+		                          (group != NULL ? AVAHI_RESOLVER_FOUND : AVAHI_RESOLVER_FAILURE),
+		                          event->name.c_str(), event->type.c_str(), event->domain.c_str(),
+		                          "localhost", &address, (group != NULL ? group->port : 0), NULL,
+		                          (AvahiLookupResultFlags)0, event->resolver->userdata);
+	}
+	delete event;
+}
+
+static void schedule(AvahiClient* client, StubEvent* event) {
+	struct timeval now;
+	avahi_elapse_time(&now, 0, 0);
+	event->poll = client->poll;
+	client->poll->timeout_new(client->poll, &now, fireEvent, event);
+}
+
+static void announce(AvahiEntryGroup* group, AvahiBrowserEvent browserEvent) {
+	for (std::set<AvahiServiceBrowser*>::iterator browserIter = browsers.begin(); browserIter != browsers.end(); browserIter++) {
+		if ((*browserIter)->type != group->type)
+			continue;
+		StubEvent* event = new StubEvent();
+		event->browser = *browserIter;
+		event->resolver = NULL;
+		event->browserEvent = browserEvent;
+		event->interface = 1;
+		event->name = group->name;
+		event->type = group->type;
+		event->domain = group->domain;
+		schedule(group->client, event);
+	}
+}
+
+AvahiClient* avahi_client_new(const AvahiPoll *poll_api, AvahiClientFlags flags, AvahiClientCallback callback, void *userdata, int *error) {
+	AvahiClient* client = new AvahiClient();
+	client->poll = poll_api;
+	callback(client, AVAHI_CLIENT_S_RUNNING, userdata);
+	return client;
+}
+
+void avahi_client_free(AvahiClient *client) {
+	delete client;
+}
+
+int avahi_client_errno(AvahiClient*) {
+	return 0;
+}
+
+AvahiEntryGroup* avahi_entry_group_new(AvahiClient* client, AvahiEntryGroupCallback callback, void *userdata) {
+	AvahiEntryGroup* group = new AvahiEntryGroup();
+	group->client = client;
+	group->port = 0;
+	group->committed = false;
+	groups.insert(group);
+	return group;
+}
+
+int avahi_entry_group_add_service_strlst(AvahiEntryGroup *group, AvahiIfIndex interface, AvahiProtocol protocol, AvahiPublishFlags flags,
+        const char *name, const char *type, const char *domain, const char *host, uint16_t port, AvahiStringList *txt) {
+	group->name = name;
+	group->type = type;
+	group->domain = (domain != NULL ? domain : "local");
+	group->port = port;
+	return 0;
+}
+
+int avahi_entry_group_commit(AvahiEntryGroup* group) {
+	group->committed = true;
+	announce(group, AVAHI_BROWSER_NEW);
+	return 0;
+}
+
+int avahi_entry_group_free(AvahiEntryGroup* group) {
+	if (group->committed)
+		announce(group, AVAHI_BROWSER_REMOVE);
+	groups.erase(group);
+	delete group;
+	return 0;
+}
+
+AvahiClient* avahi_entry_group_get_client(AvahiEntryGroup* group) {
+	return group->client;
+}
+
+AvahiServiceBrowser* avahi_service_browser_new(AvahiClient *client, AvahiIfIndex interface, AvahiProtocol protocol, const char *type,
+        const char *domain, AvahiLookupFlags flags, AvahiServiceBrowserCallback callback, void *userdata) {
+	AvahiServiceBrowser* browser = new AvahiServiceBrowser();
+	browser->client = client;
+	browser->type = type;
+	browser->callback = callback;
+	browser->userdata = userdata;
+	browsers.insert(browser);
+
+	for (std::set<AvahiEntryGroup*>::iterator groupIter = groups.begin(); groupIter != groups.end(); groupIter++) {
+		if ((*groupIter)->committed && (*groupIter)->type == browser->type) {
+			StubEvent* event = new StubEvent();
+			event->browser = browser;
+			event->resolver = NULL;
+			event->browserEvent = AVAHI_BROWSER_NEW;
+			event->interface = 1;
+			event->name = (*groupIter)->name;
+			event->type = (*groupIter)->type;
+			event->domain = (*groupIter)->domain;
+			schedule(client, event);
+		}
+	}
+	return browser;
+}
+
+AvahiClient* avahi_service_browser_get_client(AvahiServiceBrowser* browser) {
+	return browser->client;
+}
+
+int avahi_service_browser_free(AvahiServiceBrowser* browser) {
+	browsers.erase(browser);
+	delete browser;
+	return 0;
+}
+
+AvahiServiceResolver* avahi_service_resolver_new(AvahiClient *client, AvahiIfIndex interface, AvahiProtocol protocol, const char *name,
+        const char *type, const char *domain, AvahiProtocol aprotocol, AvahiLookupFlags flags, AvahiServiceResolverCallback callback, void *userdata) {
+	AvahiServiceResolver* resolver = new AvahiServiceResolver();
+	resolver->client = client;
+	resolver->callback = callback;
+	resolver->userdata = userdata;
+	resolvers.insert(resolver);
+
+	StubEvent* event = new StubEvent();
+	event->browser = NULL;
+	event->resolver = resolver;
+	event->interface = interface;
+	event->name = name;
+	event->type = type;
+	event->domain = domain;
+	schedule(client, event);
+	return resolver;
+}
+
+AvahiClient* avahi_service_resolver_get_client(AvahiServiceResolver* resolver) {
+	return resolver->client;
+}
+
+int avahi_service_resolver_free(AvahiServiceResolver* resolver) {
+	resolvers.erase(resolver);
+	delete resolver;
+	return 0;
+}
+
+class AdCounter : public ResultSet<MDNSAd*> {
+public:
+	void added(MDNSAd* ad) {
+		ScopeLock lock(_mutex);
+		assert(ad->ipv4.begin()->second == "127.0.0.1");
+		_names.insert(ad->name);
+	}
+	void removed(MDNSAd* ad) {
+		ScopeLock lock(_mutex);
+		_names.erase(ad->name);
+	}
+	void changed(MDNSAd* ad) {}
+
+	size_t size() {
+		ScopeLock lock(_mutex);
+		return _names.size();
+	}
+
+	Mutex _mutex;
+	std::set<std::string> _names;
+};
+
+/**
+ * Operations used to be at least 300ms apart and every report waited for the next poll.
+ */
+bool testLatency() {
+	boost::shared_ptr<MDNSDiscoveryImpl> avahi = boost::static_pointer_cast<MDNSDiscoveryImpl>(Factory::create("discovery.mdns.impl"));
+
+	AdCounter counter;
+	MDNSQuery query;
+	query.domain = "local.";
+	query.regType = "_umundo._tcp.";
+	query.rs = &counter;
+	avahi->browse(&query);
+
+	MDNSAd ads[NR_ADS];
+	uint64_t start = Thread::getTimeStampMs();
+	for (int i = 0; i < NR_ADS; i++) {
+		ads[i].name = "avahi" + toStr(i);
+		ads[i].domain = "local.";
+		ads[i].regType = "_umundo._tcp.";
+		ads[i].port = 42000 + i;
+		avahi->advertise(&ads[i]);
+	}
+
+	while(counter.size() < NR_ADS && Thread::getTimeStampMs() - start < 5000)
+		Thread::sleepMs(1);
+	uint64_t elapsed = Thread::getTimeStampMs() - start;
+	std::cout << NR_ADS << " ads reported after " << elapsed << "ms" << std::endl;
+	assert(counter.size() == NR_ADS);
+	assert(elapsed < 500);
+
+	start = Thread::getTimeStampMs();
+	for (int i = 0; i < NR_ADS; i++) {
+		avahi->unadvertise(&ads[i]);
+	}
+
+	while(counter.size() > 0 && Thread::getTimeStampMs() - start < 5000)
+		Thread::sleepMs(1);
+	elapsed = Thread::getTimeStampMs() - start;
+	std::cout << NR_ADS << " ads removed after " << elapsed << "ms" << std::endl;
+	assert(counter.size() == 0);
+	assert(elapsed < 500);
+
+	avahi->unbrowse(&query);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (!testLatency())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
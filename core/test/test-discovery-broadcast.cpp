@@ -0,0 +1,166 @@
+#include "umundo/core.h"
+#include "umundo/discovery/BroadcastDiscovery.h"
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define BEACON_PORT 42161
+#define BEACON_ADDRESS "127.255.255.255" // loopback only
+#define INTERVAL_MS 100
+#define MISSED_BEACONS 4
+#define MAX_JOIN_MS 500
+
+using namespace umundo;
+
+class EndPointResultSet : public ResultSet<EndPoint> {
+public:
+	void added(EndPoint endPoint) {
+		ScopeLock lock(_mutex);
+		_endPoints.insert(endPoint.getAddress());
+	}
+	void removed(EndPoint endPoint) {
+		ScopeLock lock(_mutex);
+		_endPoints.erase(endPoint.getAddress());
+	}
+	void changed(EndPoint endPoint) {
+	}
+	bool has(const std::string& address) {
+		ScopeLock lock(_mutex);
+		return _endPoints.find(address) != _endPoints.end();
+	}
+
+	Mutex _mutex;
+	std::set<std::string> _endPoints;
+};
+
+BroadcastDiscoveryOptions loopbackOptions() {
+	BroadcastDiscoveryOptions options;
+	options.setAddress(BEACON_ADDRESS);
+	options.setPort(BEACON_PORT);
+	options.setInterval(INTERVAL_MS, MISSED_BEACONS);
+	return options;
+}
+
+bool waitForConnection(Node& node, const std::string& uuid, uint64_t timeoutMs) {
+	uint64_t start = Thread::getTimeStampMs();
+	while(Thread::getTimeStampMs() - start < timeoutMs) {
+		std::map<std::string, NodeStub> peers = node.connectedTo();
+		if (peers.find(uuid) != peers.end())
+			return true;
+		Thread::sleepMs(1);
+	}
+	return false;
+}
+
+/**
+ * Two discoveries, as if in two processes, find each other's nodes.
+ */
+bool testJoinLatency() {
+	BroadcastDiscoveryOptions options = loopbackOptions();
+	for (int i = 0; i < 5; i++) {
+		Discovery disc1(Discovery::BROADCAST, &options);
+		Discovery disc2(Discovery::BROADCAST, &options);
+
+		Node node1;
+		Node node2;
+		disc1.add(node1);
+
+		uint64_t start = Thread::getTimeStampMs();
+		disc2.add(node2);
+		assert(waitForConnection(node1, node2.getUUID(), 5000));
+		assert(waitForConnection(node2, node1.getUUID(), 5000));
+		uint64_t joinMs = Thread::getTimeStampMs() - start;
+
+		std::cout << "join latency: " << joinMs << "ms" << std::endl;
+		assert(joinMs < MAX_JOIN_MS);
+
+		// leaving is announced and does not wait for the expiry
+		disc2.remove(node2);
+		start = Thread::getTimeStampMs();
+		while(disc1.list().size() != 1 && Thread::getTimeStampMs() - start < 5000)
+			Thread::sleepMs(1);
+		std::cout << "leave latency: " << Thread::getTimeStampMs() - start << "ms" << std::endl;
+		assert(disc1.list().size() == 1);
+		assert(Thread::getTimeStampMs() - start < INTERVAL_MS);
+
+		disc1.remove(node1);
+	}
+	return true;
+}
+
+/**
+ * Send hand-crafted beacons with gaps and see when the endpoint expires.
+ */
+bool testExpiry() {
+	BroadcastDiscoveryOptions options = loopbackOptions();
+	Discovery disc(Discovery::BROADCAST, &options);
+	EndPointResultSet* query = new EndPointResultSet();
+	disc.browse(query);
+
+	int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(BEACON_PORT);
+	addr.sin_addr.s_addr = inet_addr(BEACON_ADDRESS);
+
+	const char domain[] = "local.";
+	char beacon[25 + sizeof(domain) - 1];
+	uint16_t port = htons(4242);
+	uint16_t interval = htons(INTERVAL_MS);
+	beacon[0] = 'u';
+	beacon[1] = 'm';
+	beacon[2] = 1;
+	beacon[3] = 0;
+	memcpy(beacon + 4, &port, 2);
+	memcpy(beacon + 6, &interval, 2);
+	for (int i = 0; i < 16; i++)
+		beacon[8 + i] = i;
+	beacon[24] = sizeof(domain) - 1;
+	memcpy(beacon + 25, domain, sizeof(domain) - 1);
+
+	std::string address = "tcp://127.0.0.1:4242";
+
+	// a few lost beacons are fine
+	for (int i = 0; i < 20; i++) {
+		if (i % MISSED_BEACONS != 0)
+			sendto(fd, beacon, sizeof(beacon), 0, (struct sockaddr*)&addr, sizeof(addr));
+		Thread::sleepMs(INTERVAL_MS);
+		if (i > 1)
+			assert(query->has(address));
+	}
+
+	// but no beacons for long enough is not
+	uint64_t start = Thread::getTimeStampMs();
+	while(query->has(address) && Thread::getTimeStampMs() - start < 10 * INTERVAL_MS * MISSED_BEACONS)
+		Thread::sleepMs(10);
+	uint64_t expiryMs = Thread::getTimeStampMs() - start;
+	std::cout << "expired after: " << expiryMs << "ms" << std::endl;
+	assert(!query->has(address));
+	assert(expiryMs <= INTERVAL_MS * (MISSED_BEACONS + 1));
+
+	// beacons for other domains are ignored
+	beacon[25] = 'L';
+	sendto(fd, beacon, sizeof(beacon), 0, (struct sockaddr*)&addr, sizeof(addr));
+	Thread::sleepMs(INTERVAL_MS);
+	assert(!query->has(address));
+
+	close(fd);
+	disc.unbrowse(query);
+	delete query;
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (!testJoinLatency())
+		return EXIT_FAILURE;
+	if (!testExpiry())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
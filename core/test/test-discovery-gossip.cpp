@@ -0,0 +1,161 @@
+#include "umundo/core.h"
+#include "umundo/discovery/GossipDiscovery.h"
+#include <iostream>
+#include <unistd.h>
+
+#define NR_MEMBERS 200
+#define NR_CRASHES 5
+#define INTERVAL_MS 100
+#define MAX_CONVERGE_MS 30000
+#define MAX_LEAVE_PERIODS 10 ///< a leave is pushed to some members and piggybacked from there, no suspicion
+
+using namespace umundo;
+
+class EndPointResultSet : public ResultSet<EndPoint> {
+public:
+	void added(EndPoint endPoint) {
+		ScopeLock lock(_mutex);
+		_endPoints.insert(endPoint.getAddress());
+	}
+	void removed(EndPoint endPoint) {
+		ScopeLock lock(_mutex);
+		_endPoints.erase(endPoint.getAddress());
+	}
+	void changed(EndPoint endPoint) {
+	}
+	size_t size() {
+		ScopeLock lock(_mutex);
+		return _endPoints.size();
+	}
+	bool has(const std::string& address) {
+		ScopeLock lock(_mutex);
+		return _endPoints.find(address) != _endPoints.end();
+	}
+
+	Mutex _mutex;
+	std::set<std::string> _endPoints;
+};
+
+/**
+ * A member that disappears without saying goodbye.
+ */
+class CrashingGossipDiscovery : public GossipDiscovery {
+public:
+	void crash() {
+		stop();
+		join();
+		close(_socket);
+		_socket = -1;
+	}
+};
+
+static CrashingGossipDiscovery* members[NR_MEMBERS];
+static EndPointResultSet* queries[NR_MEMBERS];
+
+static std::string endPointAddress(int member) {
+	return "tcp://127.0.0.1:" + toStr(20000 + member);
+}
+
+static bool waitFor(size_t nrEndPoints, int from, int to, uint64_t maxMs) {
+	uint64_t start = Thread::getTimeStampMs();
+	for (;;) {
+		bool converged = true;
+		for (int i = from; i < to; i++) {
+			if (queries[i]->size() != nrEndPoints) {
+				converged = false;
+				break;
+			}
+		}
+		if (converged)
+			return true;
+		if (Thread::getTimeStampMs() - start > maxMs)
+			return false;
+		Thread::sleepMs(50);
+	}
+}
+
+/**
+ * Hundreds of members on loopback join through a single seed, find each other and
+ * detect the ones that crash.
+ */
+bool testMembership() {
+	uint16_t seedPort = 0;
+	for (int i = 0; i < NR_MEMBERS; i++) {
+		GossipDiscoveryOptions options;
+		options.setDomain("gossipTest");
+		options.setBindAddress("127.0.0.1", 0);
+		options.setInterval(INTERVAL_MS);
+		if (i > 0)
+			options.addSeed("127.0.0.1", seedPort);
+
+		members[i] = new CrashingGossipDiscovery();
+		members[i]->init(&options);
+		if (i == 0)
+			seedPort = members[i]->getPort();
+		assert(members[i]->getPort() != 0);
+
+		queries[i] = new EndPointResultSet();
+		members[i]->browse(queries[i]);
+		members[i]->advertise(EndPoint(endPointAddress(i)));
+	}
+
+	uint64_t start = Thread::getTimeStampMs();
+	bool converged = waitFor(NR_MEMBERS - 1, 0, NR_MEMBERS, MAX_CONVERGE_MS);
+	std::cout << NR_MEMBERS << " members converged after " << Thread::getTimeStampMs() - start << "ms" << std::endl;
+	assert(converged);
+	for (int i = 1; i < NR_MEMBERS; i++) {
+		assert(queries[i]->has(endPointAddress(0)));
+		assert(!queries[i]->has(endPointAddress(i)));
+		assert(members[i]->getNrMembers() == NR_MEMBERS - 1);
+	}
+
+	// every member sends a bounded number of datagrams per period, no matter the group size
+	uint64_t bytesBefore[NR_MEMBERS];
+	for (int i = 0; i < NR_MEMBERS; i++)
+		bytesBefore[i] = members[i]->getBytesSent();
+	start = Thread::getTimeStampMs();
+	Thread::sleepMs(20 * INTERVAL_MS);
+	uint64_t periods = (Thread::getTimeStampMs() - start) / INTERVAL_MS + 1;
+	uint64_t maxBytes = 0;
+	for (int i = 0; i < NR_MEMBERS; i++) {
+		uint64_t bytes = members[i]->getBytesSent() - bytesBefore[i];
+		if (bytes > maxBytes)
+			maxBytes = bytes;
+	}
+	std::cout << "at most " << maxBytes / periods << " bytes per member and period" << std::endl;
+	assert(maxBytes / periods < (UMUNDO_GOSSIP_INDIRECT_PROBES + 4) * UMUNDO_GOSSIP_MAX_DATAGRAM);
+
+	// crash some members, everyone else has to notice
+	for (int i = NR_MEMBERS - NR_CRASHES; i < NR_MEMBERS; i++)
+		members[i]->crash();
+
+	start = Thread::getTimeStampMs();
+	converged = waitFor(NR_MEMBERS - NR_CRASHES - 1, 0, NR_MEMBERS - NR_CRASHES, MAX_CONVERGE_MS);
+	std::cout << NR_CRASHES << " crashes detected after " << Thread::getTimeStampMs() - start << "ms" << std::endl;
+	assert(converged);
+	for (int i = 0; i < NR_MEMBERS - NR_CRASHES; i++) {
+		for (int j = NR_MEMBERS - NR_CRASHES; j < NR_MEMBERS; j++)
+			assert(!queries[i]->has(endPointAddress(j)));
+	}
+
+	// a member leaving gracefully is gone right away
+	int leaving = NR_MEMBERS - NR_CRASHES - 1;
+	members[leaving]->suspend();
+	start = Thread::getTimeStampMs();
+	converged = waitFor(NR_MEMBERS - NR_CRASHES - 2, 0, leaving, MAX_LEAVE_PERIODS * INTERVAL_MS);
+	std::cout << "leave known after " << Thread::getTimeStampMs() - start << "ms" << std::endl;
+	assert(converged);
+
+	for (int i = 0; i < NR_MEMBERS; i++) {
+		members[i]->unbrowse(queries[i]);
+		delete members[i];
+		delete queries[i];
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (!testMembership())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+#include "umundo/core.h"
+#include "umundo/discovery/StaticDiscovery.h"
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+
+#define NODE1_PORT 42471
+#define NODE1_PUB_PORT 42472
+#define NODE2_PORT 42473
+#define NODE2_PUB_PORT 42474
+#define POLL_MS 50
+
+using namespace umundo;
+
+static volatile size_t msgsRcvd = 0;
+
+class CountingReceiver : public Receiver {
+	void receive(Message* msg) {
+		Atomic::add(&msgsRcvd, 1);
+	}
+};
+
+void writeEndPoints(const std::string& filename, const std::string& content) {
+	std::ofstream file(filename.c_str());
+	file << "# static peers" << std::endl;
+	file << content << std::endl;
+}
+
+/**
+ * Have two nodes find each other from a file and the options and see how long the first message takes.
+ */
+bool testStaticDiscovery() {
+	std::string filename = "test-discovery-static.peers";
+	writeEndPoints(filename, "tcp://127.0.0.1:" + toStr(NODE2_PORT));
+
+	uint64_t start = Thread::getTimeStampMs();
+
+	Node node1(NODE1_PORT, NODE1_PUB_PORT);
+	Node node2(NODE2_PORT, NODE2_PUB_PORT);
+
+	Publisher pub("static");
+	node1.addPublisher(pub);
+	Subscriber sub("static", new CountingReceiver());
+	node2.addSubscriber(sub);
+
+	StaticDiscoveryOptions opts1;
+	opts1.setFile(filename, POLL_MS);
+	Discovery disc1(Discovery::STATIC, &opts1);
+	assert(disc1.list().size() == 1);
+
+	StaticDiscoveryOptions opts2;
+	opts2.addEndPoint("tcp://127.0.0.1:" + toStr(NODE1_PORT));
+	Discovery disc2(Discovery::STATIC, &opts2);
+	assert(disc2.list().size() == 1);
+
+	disc1.add(node1);
+	disc2.add(node2);
+
+	pub.waitForSubscribers(1);
+	while(Atomic::load(&msgsRcvd) == 0 && Thread::getTimeStampMs() - start < 5000) {
+		pub.send("ping", 4);
+		Thread::sleepMs(1);
+	}
+	assert(Atomic::load(&msgsRcvd) > 0);
+	std::cout << "first message after: " << Thread::getTimeStampMs() - start << "ms" << std::endl;
+
+	// changes to the file are picked up
+	writeEndPoints(filename, "");
+	int retries = 100;
+	while(disc1.list().size() != 0 && retries-- > 0)
+		Thread::sleepMs(POLL_MS);
+	assert(disc1.list().size() == 0);
+
+	writeEndPoints(filename, "tcp://127.0.0.1:" + toStr(NODE2_PORT) + "\n# tcp://127.0.0.1:1\nnot an endpoint");
+	retries = 100;
+	while(disc1.list().size() != 1 && retries-- > 0)
+		Thread::sleepMs(POLL_MS);
+	assert(disc1.list().size() == 1);
+
+	disc1.remove(node1);
+	disc2.remove(node2);
+	node2.removeSubscriber(sub);
+	node1.removePublisher(pub);
+	remove(filename.c_str());
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (!testStaticDiscovery())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -297,6 +297,48 @@ bool testNodeDiscovery() {
 	return true;
 }
 
+bool testInProcessDiscovery() {
+	int nrNodes = 20;
+	Discovery disc1(Discovery::MDNS);
+	Discovery disc2(Discovery::MDNS);
+
+	uint64_t start = Thread::getTimeStampMs();
+	std::vector<Node> nodes;
+	for (int i = 0; i < nrNodes; ++i) {
+		Node node;
+		// half of the nodes with another discovery object
+		if (i % 2 == 0) {
+			disc1.add(node);
+		} else {
+			disc2.add(node);
+		}
+		nodes.push_back(node);
+	}
+
+	// no need to wait for mDNS, the nodes are known right away
+	assert(disc1.list().size() >= nrNodes);
+	assert(disc2.list().size() >= nrNodes);
+
+	for (int i = 0; i < nrNodes; ++i) {
+		int retries = 500;
+		while(nodes[i].connectedTo().size() < nrNodes - 1) {
+			Thread::sleepMs(10);
+			if (retries-- == 0)
+				assert(false);
+		}
+	}
+	std::cout << nrNodes << " nodes in this process connected after " << Thread::getTimeStampMs() - start << "ms" << std::endl;
+
+	for (int i = 0; i < nrNodes; ++i) {
+		if (i % 2 == 0) {
+			disc1.remove(nodes[i]);
+		} else {
+			disc2.remove(nodes[i]);
+		}
+	}
+	return true;
+}
+
 bool testPubSubConnections() {
 	// test node / publisher / subscriber churn
 	for (int i = 0; i < 10; i++) {
@@ -374,6 +416,8 @@ int main(int argc, char** argv, char** envp) {
 //		return EXIT_FAILURE;
 //	if (!testDiscoveryObject())
 //		return EXIT_FAILURE;
+	if (!testInProcessDiscovery())
+		return EXIT_FAILURE;
 	if (!testNodeDiscovery())
 		return EXIT_FAILURE;
 //	if (!testPubSubConnections())
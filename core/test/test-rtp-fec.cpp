@@ -0,0 +1,118 @@
+#include "umundo/core.h"
+#include "umundo/connection/rtp/RTPPublisher.h"
+#include "umundo/connection/rtp/RTPSubscriber.h"
+#include "LossyRTPPublisher.h"
+#include <iostream>
+#include <stdio.h>
+
+#define NR_MESSAGES 600
+#define MESSAGE_SIZE 3800
+#define SEND_INTERVAL_MS 2
+#define LOSS_PERCENT 5
+#define FEC_GROUP_SIZE 5
+#define MAX_WAIT_MS 5000
+
+using namespace umundo;
+
+class LatencyReceiver : public Receiver {
+public:
+	LatencyReceiver() : _received(0), _latencyMs(0) {}
+	void receive(Message* msg) {
+		ScopeLock lock(_mutex);
+		_received++;
+		_latencyMs += Thread::getTimeStampMs() - strTo<uint64_t>(msg->getMeta("sent"));
+	}
+	size_t size() {
+		ScopeLock lock(_mutex);
+		return _received;
+	}
+	double meanLatencyMs() {
+		ScopeLock lock(_mutex);
+		return (_received > 0 ? (double)_latencyMs / _received : 0);
+	}
+
+	Mutex _mutex;
+	size_t _received;
+	uint64_t _latencyMs;
+};
+
+static boost::shared_ptr<LossyRTPPublisher> lossyPublisher(const std::string& channelName, uint8_t fecGroupSize) {
+	boost::shared_ptr<LossyRTPPublisher> pubImpl(new LossyRTPPublisher(LOSS_PERCENT));
+	pubImpl->implType = Publisher::RTP;
+	pubImpl->setChannelName(channelName);
+	pubImpl->init(NULL);
+	pubImpl->setFEC(fecGroupSize);
+	return pubImpl;
+}
+
+/**
+ * The same lossy stream of fragmented messages with and without parity.
+ */
+bool testFEC() {
+	Node pubNode;
+	Node subNode;
+
+	boost::shared_ptr<LossyRTPPublisher> fecImpl = lossyPublisher("fec", FEC_GROUP_SIZE);
+	boost::shared_ptr<LossyRTPPublisher> plainImpl = lossyPublisher("plain", 0);
+	Publisher fecPub(boost::static_pointer_cast<PublisherImpl>(fecImpl));
+	Publisher plainPub(boost::static_pointer_cast<PublisherImpl>(plainImpl));
+
+	LatencyReceiver fecRecv, plainRecv;
+	Subscriber fecSub(Subscriber::RTP, "fec", &fecRecv);
+	Subscriber plainSub(Subscriber::RTP, "plain", &plainRecv);
+
+	pubNode.addPublisher(fecPub);
+	pubNode.addPublisher(plainPub);
+	subNode.addSubscriber(fecSub);
+	subNode.addSubscriber(plainSub);
+	pubNode.added(subNode);
+	subNode.added(pubNode);
+	assert(fecPub.waitForSubscribers(1, MAX_WAIT_MS) == 1);
+	assert(plainPub.waitForSubscribers(1, MAX_WAIT_MS) == 1);
+
+	char* data = (char*)malloc(MESSAGE_SIZE);
+	memset(data, 'x', MESSAGE_SIZE);
+	for (int i = 0; i < NR_MESSAGES; i++) {
+		Message* msg = new Message(data, MESSAGE_SIZE);
+		msg->putMeta("sent", toStr(Thread::getTimeStampMs()));
+		fecPub.send(msg);
+		plainPub.send(msg);
+		delete msg;
+		Thread::sleepMs(SEND_INTERVAL_MS);
+	}
+	free(data);
+
+	uint64_t start = Thread::getTimeStampMs();
+	while(fecRecv.size() < NR_MESSAGES && Thread::getTimeStampMs() - start < MAX_WAIT_MS)
+		Thread::sleepMs(20);
+	Thread::sleepMs(UMUNDO_RTP_REASSEMBLY_MS);
+
+	RTPStats fecStats = boost::static_pointer_cast<RTPSubscriber>(fecSub.getImpl())->getStats();
+	RTPStats plainStats = boost::static_pointer_cast<RTPSubscriber>(plainSub.getImpl())->getStats();
+	double fecRatio = (double)fecRecv.size() / NR_MESSAGES;
+	double plainRatio = (double)plainRecv.size() / NR_MESSAGES;
+
+	std::cout << "fec: " << fecRatio * 100 << "% delivered, " << fecImpl->_dropped << " of " << fecImpl->getPacketsSent()
+	          << " packets dropped, " << fecStats.packetsRecovered << " recovered, latency " << fecRecv.meanLatencyMs() << "ms" << std::endl;
+	std::cout << "plain: " << plainRatio * 100 << "% delivered, " << plainImpl->_dropped << " of " << plainImpl->getPacketsSent()
+	          << " packets dropped, latency " << plainRecv.meanLatencyMs() << "ms" << std::endl;
+
+	assert(fecImpl->_dropped > 0);
+	assert(plainImpl->_dropped > 0);
+	assert(fecStats.packetsRecovered > 0);
+	assert(plainStats.packetsRecovered == 0);
+	assert(fecRatio > plainRatio);
+	assert(fecRatio >= 0.95);
+
+	subNode.removeSubscriber(fecSub);
+	subNode.removeSubscriber(plainSub);
+	pubNode.removePublisher(fecPub);
+	pubNode.removePublisher(plainPub);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (!testFEC())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
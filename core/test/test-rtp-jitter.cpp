@@ -0,0 +1,183 @@
+#include "umundo/core.h"
+#include "umundo/connection/rtp/RTPPublisher.h"
+#include "umundo/connection/rtp/RTPSubscriber.h"
+#include <iostream>
+#include <stdio.h>
+#include <math.h>
+
+#define NR_MESSAGES 200
+#define SEND_INTERVAL_MS 5
+#define MAX_IMPAIRMENT_MS 40
+#define TARGET_DELAY_MS 80
+#define TIGHT_DELAY_MS 5
+#define MAX_WAIT_MS 5000
+
+using namespace umundo;
+
+/**
+ * Holds every datagram back for a random time before it goes out, which reorders them.
+ */
+class ImpairedRTPPublisher : public RTPPublisher, public Thread {
+public:
+	ImpairedRTPPublisher(uint32_t maxDelayMs) : _maxDelayMs(maxDelayMs) {
+		start();
+	}
+	virtual ~ImpairedRTPPublisher() {
+		stop();
+		join();
+	}
+
+	void transmit(const char* buffer, size_t size, const Destination& dest) {
+		uint64_t releaseAt = Thread::getTimeStampMs() + rand() % (_maxDelayMs + 1);
+		_delayed.insert(std::make_pair(releaseAt, std::make_pair(std::string(buffer, size), dest)));
+	}
+
+	void run() {
+		while(isStarted()) {
+			{
+				ScopeLock lock(_mutex);
+				uint64_t now = Thread::getTimeStampMs();
+				while(_delayed.size() > 0 && _delayed.begin()->first <= now) {
+					const std::string& datagram = _delayed.begin()->second.first;
+					RTPPublisher::transmit(datagram.data(), datagram.size(), _delayed.begin()->second.second);
+					_delayed.erase(_delayed.begin());
+				}
+			}
+			Thread::sleepMs(1);
+		}
+	}
+
+	uint32_t _maxDelayMs;
+	std::multimap<uint64_t, std::pair<std::string, Destination> > _delayed;
+};
+
+class OrderReceiver : public Receiver {
+public:
+	void receive(Message* msg) {
+		ScopeLock lock(_mutex);
+		_seqs.push_back(strTo<int>(msg->getMeta("seq")));
+	}
+	size_t size() {
+		ScopeLock lock(_mutex);
+		return _seqs.size();
+	}
+	bool isInOrder() {
+		ScopeLock lock(_mutex);
+		for (size_t i = 1; i < _seqs.size(); i++) {
+			if (_seqs[i] <= _seqs[i - 1])
+				return false;
+		}
+		return true;
+	}
+
+	Mutex _mutex;
+	std::vector<int> _seqs;
+};
+
+static boost::shared_ptr<RTPSubscriber> rtpImpl(Subscriber& sub) {
+	return boost::static_pointer_cast<RTPSubscriber>(sub.getImpl());
+}
+
+/**
+ * Four subscribers receive the same reordered stream, without a jitter buffer, with an
+ * ample playout delay and with one too short for the impairment, fixed and adaptive.
+ */
+bool testJitterBuffer() {
+	Node pubNode;
+	Node subNode;
+
+	boost::shared_ptr<ImpairedRTPPublisher> pubImpl(new ImpairedRTPPublisher(MAX_IMPAIRMENT_MS));
+	pubImpl->implType = Publisher::RTP;
+	pubImpl->setChannelName("jitter");
+	pubImpl->init(NULL);
+	Publisher pub(boost::static_pointer_cast<PublisherImpl>(pubImpl));
+
+	OrderReceiver rawRecv, bufferedRecv, tightRecv, adaptiveRecv;
+	Subscriber rawSub(Subscriber::RTP, "jitter", &rawRecv);
+	Subscriber bufferedSub(Subscriber::RTP, "jitter", &bufferedRecv);
+	Subscriber tightSub(Subscriber::RTP, "jitter", &tightRecv);
+	Subscriber adaptiveSub(Subscriber::RTP, "jitter", &adaptiveRecv);
+	rtpImpl(bufferedSub)->setPlayoutDelay(TARGET_DELAY_MS);
+	rtpImpl(tightSub)->setPlayoutDelay(TIGHT_DELAY_MS, false);
+	rtpImpl(adaptiveSub)->setPlayoutDelay(TIGHT_DELAY_MS);
+
+	pubNode.addPublisher(pub);
+	subNode.addSubscriber(rawSub);
+	subNode.addSubscriber(bufferedSub);
+	subNode.addSubscriber(tightSub);
+	subNode.addSubscriber(adaptiveSub);
+	pubNode.added(subNode);
+	subNode.added(pubNode);
+	assert(pub.waitForSubscribers(4, MAX_WAIT_MS) == 4);
+
+	uint64_t maxBuffered = 0;
+	for (int i = 0; i < NR_MESSAGES; i++) {
+		Message* msg = new Message();
+		msg->putMeta("seq", toStr(i));
+		pub.send(msg);
+		delete msg;
+		Thread::sleepMs(SEND_INTERVAL_MS);
+
+		RTPStats stats = rtpImpl(bufferedSub)->getStats();
+		if (stats.messagesBuffered > maxBuffered)
+			maxBuffered = stats.messagesBuffered;
+	}
+
+	uint64_t start = Thread::getTimeStampMs();
+	while((rawRecv.size() < NR_MESSAGES || bufferedRecv.size() < NR_MESSAGES) && Thread::getTimeStampMs() - start < MAX_WAIT_MS)
+		Thread::sleepMs(20);
+	Thread::sleepMs(TARGET_DELAY_MS + MAX_IMPAIRMENT_MS); // let the last late ones arrive
+
+	RTPStats rawStats = rtpImpl(rawSub)->getStats();
+	RTPStats bufferedStats = rtpImpl(bufferedSub)->getStats();
+	RTPStats tightStats = rtpImpl(tightSub)->getStats();
+	RTPStats adaptiveStats = rtpImpl(adaptiveSub)->getStats();
+
+	std::cout << "raw: " << rawRecv.size() << " delivered " << (rawRecv.isInOrder() ? "in order" : "out of order")
+	          << ", reorder depth " << rawStats.reorderDepth << ", jitter " << rawStats.jitterMs << "ms" << std::endl;
+	std::cout << "buffered: " << bufferedRecv.size() << " delivered, " << bufferedStats.messagesLate << " late, at most "
+	          << maxBuffered << " buffered, playout delay " << bufferedStats.playoutDelayMs << "ms" << std::endl;
+	std::cout << "tight: " << tightRecv.size() << " delivered, " << tightStats.messagesLate << " late" << std::endl;
+	std::cout << "adaptive: " << adaptiveRecv.size() << " delivered, " << adaptiveStats.messagesLate << " late, jitter "
+	          << adaptiveStats.jitterMs << "ms, playout delay " << adaptiveStats.playoutDelayMs << "ms" << std::endl;
+
+	// without a jitter buffer we get everything in arrival order
+	assert(rawRecv.size() == NR_MESSAGES);
+	assert(!rawRecv.isInOrder());
+	assert(rawStats.reorderDepth > 0);
+	assert(rawStats.messagesLate == 0);
+
+	// with an ample delay we get everything in order
+	assert(bufferedRecv.size() == NR_MESSAGES);
+	assert(bufferedRecv.isInOrder());
+	assert(bufferedStats.messagesLate == 0);
+	assert(bufferedStats.messagesBuffered == 0);
+	assert(bufferedStats.playoutDelayMs >= TARGET_DELAY_MS);
+	assert(maxBuffered > 0);
+
+	// with a short delay we get what was in time in order and drop the rest
+	assert(tightRecv.isInOrder());
+	assert(tightStats.messagesLate > 0);
+	assert(tightRecv.size() + tightStats.messagesLate == NR_MESSAGES);
+
+	// an adaptive delay grows past the short target to cover the jitter and drops less
+	assert(adaptiveRecv.isInOrder());
+	assert(adaptiveStats.jitterMs * UMUNDO_RTP_JITTER_MULTIPLIER > TIGHT_DELAY_MS);
+	assert(adaptiveStats.playoutDelayMs > TIGHT_DELAY_MS);
+	assert(fabs(adaptiveStats.playoutDelayMs - adaptiveStats.jitterMs * UMUNDO_RTP_JITTER_MULTIPLIER) <= 1);
+	assert(adaptiveStats.messagesLate < tightStats.messagesLate);
+	assert(adaptiveRecv.size() + adaptiveStats.messagesLate == NR_MESSAGES);
+
+	subNode.removeSubscriber(rawSub);
+	subNode.removeSubscriber(bufferedSub);
+	subNode.removeSubscriber(tightSub);
+	subNode.removeSubscriber(adaptiveSub);
+	pubNode.removePublisher(pub);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (!testJitterBuffer())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,241 @@
+#include "umundo/core.h"
+#include "umundo/connection/rtp/RTPPublisher.h"
+#include "umundo/connection/rtp/RTPSubscriber.h"
+#include "LossyRTPPublisher.h"
+#include <iostream>
+#include <stdio.h>
+
+#define NR_SUBSCRIBERS 8
+#define NR_MESSAGES 50
+#define MESSAGE_SIZE 10000
+#define SEND_INTERVAL_MS 5
+#define LOSS_PERCENT 5
+#define MAX_WAIT_MS 5000
+
+using namespace umundo;
+
+class CountingReceiver : public Receiver {
+public:
+	CountingReceiver() : _received(0), _explicit(0) {}
+	void receive(Message* msg) {
+		ScopeLock lock(_mutex);
+		if (msg->size() == MESSAGE_SIZE)
+			_received++;
+		if (msg->getMeta("explicit").length() > 0)
+			_explicit++;
+	}
+	size_t size() {
+		ScopeLock lock(_mutex);
+		return _received;
+	}
+	size_t nrExplicit() {
+		ScopeLock lock(_mutex);
+		return _explicit;
+	}
+
+	Mutex _mutex;
+	size_t _received;
+	size_t _explicit;
+};
+
+static void sendMessages(Publisher& pub) {
+	char* data = (char*)malloc(MESSAGE_SIZE);
+	memset(data, 'x', MESSAGE_SIZE);
+	for (int i = 0; i < NR_MESSAGES; i++) {
+		pub.send(data, MESSAGE_SIZE);
+		Thread::sleepMs(SEND_INTERVAL_MS);
+	}
+	free(data);
+}
+
+static bool waitFor(CountingReceiver* recvs, size_t nrRecvs, size_t count) {
+	uint64_t start = Thread::getTimeStampMs();
+	while(Thread::getTimeStampMs() - start < MAX_WAIT_MS) {
+		size_t nrDone = 0;
+		for (size_t i = 0; i < nrRecvs; i++) {
+			if (recvs[i].size() >= count)
+				nrDone++;
+		}
+		if (nrDone == nrRecvs)
+			return true;
+		Thread::sleepMs(20);
+	}
+	return false;
+}
+
+static uint64_t bytesSent(Publisher& pub) {
+	return boost::static_pointer_cast<RTPPublisher>(pub.getImpl())->getBytesSent();
+}
+
+/**
+ * A multicast publisher sends the same no matter how many subscribe, a unicast one once per subscriber.
+ */
+bool testFanOut() {
+	Node pubNode;
+	Node subNode;
+
+	Publisher mcastPub(Publisher::RTP_MULTICAST, "mcast");
+	Publisher ucastPub(Publisher::RTP, "ucast");
+
+	CountingReceiver mcastRecvs[NR_SUBSCRIBERS];
+	CountingReceiver ucastRecvs[NR_SUBSCRIBERS];
+	std::vector<Subscriber> subs;
+	for (int i = 0; i < NR_SUBSCRIBERS; i++) {
+		subs.push_back(Subscriber(Subscriber::RTP, "mcast", &mcastRecvs[i]));
+		subs.push_back(Subscriber(Subscriber::RTP, "ucast", &ucastRecvs[i]));
+	}
+
+	pubNode.addPublisher(mcastPub);
+	pubNode.addPublisher(ucastPub);
+	subNode.addSubscriber(subs[0]);
+	subNode.addSubscriber(subs[1]);
+	pubNode.added(subNode);
+	subNode.added(pubNode);
+	assert(mcastPub.waitForSubscribers(1, MAX_WAIT_MS) == 1);
+	assert(ucastPub.waitForSubscribers(1, MAX_WAIT_MS) == 1);
+
+	// one subscriber each
+	sendMessages(mcastPub);
+	sendMessages(ucastPub);
+	assert(waitFor(mcastRecvs, 1, NR_MESSAGES));
+	assert(waitFor(ucastRecvs, 1, NR_MESSAGES));
+	uint64_t mcastSingle = bytesSent(mcastPub);
+	uint64_t ucastSingle = bytesSent(ucastPub);
+
+	// all of them
+	for (size_t i = 2; i < subs.size(); i++)
+		subNode.addSubscriber(subs[i]);
+	assert(mcastPub.waitForSubscribers(NR_SUBSCRIBERS, MAX_WAIT_MS) == NR_SUBSCRIBERS);
+	assert(ucastPub.waitForSubscribers(NR_SUBSCRIBERS, MAX_WAIT_MS) == NR_SUBSCRIBERS);
+
+	sendMessages(mcastPub);
+	sendMessages(ucastPub);
+	assert(waitFor(mcastRecvs + 1, NR_SUBSCRIBERS - 1, NR_MESSAGES));
+	assert(waitFor(ucastRecvs + 1, NR_SUBSCRIBERS - 1, NR_MESSAGES));
+	uint64_t mcastAll = bytesSent(mcastPub) - mcastSingle;
+	uint64_t ucastAll = bytesSent(ucastPub) - ucastSingle;
+
+	std::cout << "multicast: " << mcastSingle << " bytes for 1 subscriber, " << mcastAll << " bytes for " << NR_SUBSCRIBERS << std::endl;
+	std::cout << "unicast: " << ucastSingle << " bytes for 1 subscriber, " << ucastAll << " bytes for " << NR_SUBSCRIBERS << std::endl;
+
+	// the tail might have been sent again in between
+	assert(mcastAll < mcastSingle + 2 * UMUNDO_RTP_MTU && mcastAll + 2 * UMUNDO_RTP_MTU > mcastSingle);
+	assert(ucastAll == NR_SUBSCRIBERS * ucastSingle);
+
+	for (size_t i = 0; i < subs.size(); i++)
+		subNode.removeSubscriber(subs[i]);
+	pubNode.removePublisher(mcastPub);
+	pubNode.removePublisher(ucastPub);
+	return true;
+}
+
+/**
+ * Subscribers ask for what the lossy publisher dropped until they have everything.
+ */
+bool testRepair() {
+	Node pubNode;
+	Node subNode;
+
+	boost::shared_ptr<LossyRTPPublisher> pubImpl(new LossyRTPPublisher(LOSS_PERCENT));
+	pubImpl->implType = Publisher::RTP_MULTICAST;
+	pubImpl->setChannelName("repair");
+	pubImpl->init(NULL);
+	Publisher pub(boost::static_pointer_cast<PublisherImpl>(pubImpl));
+
+	CountingReceiver recvs[3];
+	std::vector<Subscriber> subs;
+	for (int i = 0; i < 3; i++)
+		subs.push_back(Subscriber(Subscriber::RTP, "repair", &recvs[i]));
+
+	pubNode.addPublisher(pub);
+	for (size_t i = 0; i < subs.size(); i++)
+		subNode.addSubscriber(subs[i]);
+	pubNode.added(subNode);
+	subNode.added(pubNode);
+	assert(pub.waitForSubscribers(3, MAX_WAIT_MS) == 3);
+
+	sendMessages(pub);
+	bool isComplete = waitFor(recvs, 3, NR_MESSAGES);
+
+	RTPStats stats = boost::static_pointer_cast<RTPSubscriber>(subs[0].getImpl())->getStats();
+	std::cout << "repair: " << pubImpl->_dropped << " of " << pubImpl->getPacketsSent() << " packets dropped, "
+	          << pubImpl->getPacketsRetransmitted() << " retransmitted, first subscriber sent " << stats.nacksSent << " NACKs for "
+	          << stats.packetsRepaired << " packets and received " << recvs[0].size() << " messages" << std::endl;
+
+	assert(isComplete);
+	assert(pubImpl->_dropped > 0);
+	assert(pubImpl->getPacketsRetransmitted() > 0);
+	assert(stats.nacksSent > 0);
+	assert(stats.packetsRepaired > 0);
+	assert(stats.messagesDropped == 0);
+
+	for (size_t i = 0; i < subs.size(); i++)
+		subNode.removeSubscriber(subs[i]);
+	pubNode.removePublisher(pub);
+	return true;
+}
+
+/**
+ * Messages for a single subscriber go to it alone and leave no gaps for the others to repair.
+ */
+bool testExplicit() {
+	Node pubNode;
+	Node subNode;
+
+	Publisher pub(Publisher::RTP_MULTICAST, "explicit");
+	CountingReceiver recvs[2];
+	std::vector<Subscriber> subs;
+	for (int i = 0; i < 2; i++)
+		subs.push_back(Subscriber(Subscriber::RTP, "explicit", &recvs[i]));
+
+	pubNode.addPublisher(pub);
+	for (size_t i = 0; i < subs.size(); i++)
+		subNode.addSubscriber(subs[i]);
+	pubNode.added(subNode);
+	subNode.added(pubNode);
+	assert(pub.waitForSubscribers(2, MAX_WAIT_MS) == 2);
+
+	char* data = (char*)malloc(MESSAGE_SIZE);
+	memset(data, 'x', MESSAGE_SIZE);
+	for (int i = 0; i < NR_MESSAGES; i++) {
+		pub.send(data, MESSAGE_SIZE);
+		Message msg;
+		msg.putMeta("um.sub", subs[0].getUUID());
+		msg.putMeta("explicit", toStr(i));
+		pub.send(&msg);
+		Thread::sleepMs(SEND_INTERVAL_MS);
+	}
+	free(data);
+
+	assert(waitFor(recvs, 2, NR_MESSAGES));
+	uint64_t start = Thread::getTimeStampMs();
+	while(recvs[0].nrExplicit() < NR_MESSAGES && Thread::getTimeStampMs() - start < MAX_WAIT_MS)
+		Thread::sleepMs(20);
+
+	RTPStats stats = boost::static_pointer_cast<RTPSubscriber>(subs[1].getImpl())->getStats();
+	std::cout << "explicit: first subscriber received " << recvs[0].nrExplicit() << " explicit messages, second one "
+	          << recvs[1].nrExplicit() << ", it lost " << stats.packetsLost << " packets and sent " << stats.nacksSent << " NACKs" << std::endl;
+
+	assert(recvs[0].nrExplicit() == NR_MESSAGES);
+	assert(recvs[1].nrExplicit() == 0);
+	// every explicit message used to be a gap in the sequence of the second subscriber
+	assert(stats.packetsLost < NR_MESSAGES / 5);
+
+	for (size_t i = 0; i < subs.size(); i++)
+		subNode.removeSubscriber(subs[i]);
+	pubNode.removePublisher(pub);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	// loopback is enough to test and always there
+	setenv("UMUNDO_MULTICAST_INTERFACE", "127.0.0.1", 1);
+
+	if (!testFanOut())
+		return EXIT_FAILURE;
+	if (!testRepair())
+		return EXIT_FAILURE;
+	if (!testExplicit())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -1,36 +1,146 @@
-#include "umundo/common/Factory.h"
-#include "umundo/common/Message.h"
-#include "umundo/connection/Node.h"
-#include "umundo/discovery/Discovery.h"
+#include "umundo/core.h"
+#include "umundo/connection/rtp/RTPSubscriber.h"
+#include "umundo/connection/rtp/RTPPublisher.h"
+#include <iostream>
+#include <stdio.h>
+#include <set>
+
+#define NR_MESSAGES 100
+#define LARGE_SIZE 100000
+#define MAX_WAIT_MS 5000
 
 using namespace umundo;
 
-bool testInstantiation() {
-	Node node1;
-	Node node2;
+static Mutex mutex;
+static size_t nrReceived = 0;
+static size_t nrLargeReceived = 0;
+static size_t nrWrongData = 0;
+static std::set<int> smallReceived;
+
+class RTPReceiver : public Receiver {
+	void receive(Message* msg) {
+		ScopeLock lock(mutex);
+		if (msg->getMeta("type") == "large") {
+			if (msg->size() != LARGE_SIZE)
+				nrWrongData++;
+			for (size_t i = 0; i < msg->size(); i++) {
+				if (msg->data()[i] != (char)(i % 251)) {
+					nrWrongData++;
+					break;
+				}
+			}
+			nrLargeReceived++;
+		} else {
+			if (msg->getMeta("um.channel") != "rtp" || msg->size() != 4) {
+				nrWrongData++;
+			} else {
+				smallReceived.insert(*(const int*)msg->data());
+			}
+			nrReceived++;
+		}
+	}
+};
+
+class ZeroMQReceiver : public Receiver {
+	void receive(Message* msg) {
+		ScopeLock lock(mutex);
+		nrWrongData++; // we never publish via 0MQ
+	}
+};
+
+static bool waitFor(size_t& counter, size_t count) {
+	uint64_t start = Thread::getTimeStampMs();
+	while(Thread::getTimeStampMs() - start < MAX_WAIT_MS) {
+		{
+			ScopeLock lock(mutex);
+			if (counter >= count)
+				return true;
+		}
+		Thread::sleepMs(20);
+	}
+	return false;
+}
+
+/**
+ * Two nodes on loopback, the subscriber's port is negotiated with the subscription.
+ */
+bool testRTPOverLoopback() {
+	Node pubNode;
+	Node subNode;
 
-	Discovery disc(Discovery::MDNS);
+	Publisher rtpPub(Publisher::RTP, "rtp");
+	Subscriber rtpSub(Subscriber::RTP, "rtp", new RTPReceiver());
+	Subscriber zmqSub(Subscriber::ZEROMQ, "rtp", new ZeroMQReceiver());
 
-	disc.add(node1);
-	disc.add(node2);
+	pubNode.addPublisher(rtpPub);
+	subNode.addSubscriber(rtpSub);
+	subNode.addSubscriber(zmqSub);
 
-	Publisher rtpPub(Publisher::RTP, "foo");
-	Subscriber rtpSub(Subscriber::RTP, "foo");
+	pubNode.added(subNode);
+	subNode.added(pubNode);
 
-	node1.addSubscriber(rtpSub);
-	node2.addPublisher(rtpPub);
+	assert(rtpPub.waitForSubscribers(1, MAX_WAIT_MS) == 1);
+	assert(rtpPub.getSubscribers().size() == 1);
+	assert(rtpPub.getSubscribers().begin()->first == rtpSub.getUUID());
 
-	rtpPub.waitForSubscribers(1);
+	// small messages fit into a single datagram
+	for (int i = 0; i < NR_MESSAGES; i++) {
+		Message* msg = new Message();
+		msg->setData((const char*)&i, 4);
+		rtpPub.send(msg);
+		delete msg;
+		Thread::sleepMs(1);
+	}
+	assert(waitFor(nrReceived, NR_MESSAGES));
 
-	Thread::sleepMs(30000);
+	// large messages are fragmented and reassembled
+	char* data = (char*)malloc(LARGE_SIZE);
+	for (size_t i = 0; i < LARGE_SIZE; i++)
+		data[i] = (char)(i % 251);
+	for (int i = 0; i < 10; i++) {
+		Message* msg = new Message(data, LARGE_SIZE);
+		msg->putMeta("type", "large");
+		rtpPub.send(msg);
+		delete msg;
+		Thread::sleepMs(10);
+	}
+	free(data);
+	assert(waitFor(nrLargeReceived, 10));
 
+	RTPStats stats = boost::static_pointer_cast<RTPSubscriber>(rtpSub.getImpl())->getStats();
+	uint64_t packetsSent = boost::static_pointer_cast<RTPPublisher>(rtpPub.getImpl())->getPacketsSent();
+	std::cout << "received " << stats.packetsReceived << " of " << packetsSent << " packets, "
+	          << stats.messagesReceived << " messages, jitter " << stats.jitterMs << "ms" << std::endl;
+
+	// every message arrived exactly once
+	{
+		ScopeLock lock(mutex);
+		assert(nrWrongData == 0);
+		assert(nrReceived == NR_MESSAGES);
+		assert(smallReceived.size() == NR_MESSAGES);
+		assert(*smallReceived.begin() == 0 && *smallReceived.rbegin() == NR_MESSAGES - 1);
+		assert(nrLargeReceived == 10);
+	}
+	assert(stats.messagesReceived == NR_MESSAGES + 10);
+	assert(packetsSent > NR_MESSAGES + 10 * (LARGE_SIZE / UMUNDO_RTP_MTU));
+
+	// nothing is sent after the subscriber left
+	subNode.removeSubscriber(rtpSub);
+	uint64_t start = Thread::getTimeStampMs();
+	while(rtpPub.getSubscribers().size() > 0 && Thread::getTimeStampMs() - start < MAX_WAIT_MS)
+		Thread::sleepMs(20);
+	assert(rtpPub.getSubscribers().size() == 0);
+	size_t suppressed = rtpPub.getSuppressedMessages();
+	rtpPub.send("foo", 3);
+	assert(rtpPub.getSuppressedMessages() == suppressed + 1);
+
+	pubNode.removePublisher(rtpPub);
+	subNode.removeSubscriber(zmqSub);
 	return true;
 }
 
 int main(int argc, char** argv) {
-	setenv("UMUNDO_LOGLEVEL", "4", 1);
-	if (!testInstantiation())
+	if (!testRTPOverLoopback())
 		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
-
-}
\ No newline at end of file
+}
@@ -188,6 +188,173 @@ bool testTimedMonitors() {
 	return true;
 }
 
+bool testClocks() {
+	// the monotonic clocks never go backwards and resolve below a millisecond
+	uint64_t lastNs = Thread::getTimeStampNs();
+	uint64_t lastUs = Thread::getTimeStampUs();
+	bool subMs = false;
+	for (int i = 0; i < 1000; i++) {
+		uint64_t ns = Thread::getTimeStampNs();
+		uint64_t us = Thread::getTimeStampUs();
+		assert(ns >= lastNs);
+		assert(us >= lastUs);
+		if (ns - lastNs > 0 && ns - lastNs < 1000000)
+			subMs = true;
+		lastNs = ns;
+		lastUs = us;
+	}
+	assert(subMs);
+
+	// and agree with the wall clock on how long we slept
+	uint64_t wallStart = Thread::getTimeStampMs();
+	uint64_t start = Thread::getTimeStampUs();
+	Thread::sleepMs(100);
+	uint64_t elapsedUs = Thread::getTimeStampUs() - start;
+	uint64_t wallElapsed = Thread::getTimeStampMs() - wallStart;
+	assert(elapsedUs >= 100000);
+	assert(elapsedUs / 1000 + 20 > wallElapsed && wallElapsed + 20 > elapsedUs / 1000);
+	return true;
+}
+
+static Mutex testDeadlineMutex;
+static Monitor testDeadlineMonitor;
+
+bool testDeadlines() {
+	ScopeLock lock(testDeadlineMutex);
+
+	// waiting for some microseconds returns in about as many
+	uint64_t start = Thread::getTimeStampUs();
+	testDeadlineMonitor.waitUs(testDeadlineMutex, 1500);
+	uint64_t elapsed = Thread::getTimeStampUs() - start;
+	assert(elapsed >= 1000 && elapsed < 50000);
+
+	// deadlines across more than a second
+	uint64_t deadline = Thread::getTimeStampUs() + 1200000;
+	while(testDeadlineMonitor.waitUntilUs(testDeadlineMutex, deadline)) {}
+	assert(Thread::getTimeStampUs() >= deadline);
+	assert(Thread::getTimeStampUs() - deadline < 50000);
+
+	// a passed deadline does not wait at all
+	assert(!testDeadlineMonitor.waitUntilUs(testDeadlineMutex, Thread::getTimeStampUs()));
+	return true;
+}
+
+bool testNonRecursiveMutex() {
+	NonRecursiveMutex mutex;
+	mutex.lock();
+	if(mutex.try_lock()) {
+		UM_LOG_ERR("tryLock should fail on a non-recursive mutex we hold");
+		assert(false);
+	}
+	mutex.unlock();
+	{
+		NonRecursiveScopeLock lock(mutex);
+	}
+	assert(mutex.try_lock());
+	mutex.unlock();
+	return true;
+}
+
+static RWMutex testRWLock("test.rw");
+static volatile size_t readersInside = 0;
+static size_t maxReadersInside = 0;
+static size_t writes = 0;
+
+bool testRWMutex() {
+	struct Reader : public Thread {
+		void run() {
+			ScopeReadLock lock(testRWLock);
+			size_t inside = Atomic::add(&readersInside, 1);
+			if (inside > maxReadersInside)
+				maxReadersInside = inside;
+			Thread::sleepMs(50);
+			Atomic::add(&readersInside, (size_t)-1);
+		}
+	};
+	struct Writer : public Thread {
+		void run() {
+			ScopeWriteLock lock(testRWLock);
+			assert(Atomic::load(&readersInside) == 0);
+			writes++;
+		}
+	};
+
+	// readers share the lock
+	Reader reader1, reader2, reader3;
+	reader1.start();
+	reader2.start();
+	reader3.start();
+	Thread::sleepMs(10);
+
+	// a writer waits for all of them
+	Writer writer;
+	writer.start();
+	reader1.join();
+	reader2.join();
+	reader3.join();
+	writer.join();
+
+	assert(maxReadersInside > 1);
+	assert(writes == 1);
+	return true;
+}
+
+bool testLockProfiler() {
+	static Mutex profiledMutex("test.profiled");
+	static Monitor profiledMonitor;
+
+	struct Holder : public Thread {
+		void run() {
+			ScopeLock lock(profiledMutex);
+			Thread::sleepMs(50);
+		}
+	};
+
+	// takes the lock while we wait on the monitor
+	struct Intruder : public Thread {
+		void run() {
+			ScopeLock lock(profiledMutex);
+			Thread::sleepMs(20);
+		}
+	};
+
+	LockProfiler::reset();
+	Holder holder;
+	Intruder intruder;
+	holder.start();
+	Thread::sleepMs(10);
+	{
+		// we wait for the holder, the monitor wait does not count as holding
+		ScopeLock lock(profiledMutex);
+		intruder.start();
+		profiledMonitor.wait(profiledMutex, 100);
+	}
+	holder.join();
+	intruder.join();
+
+	std::list<LockStats> stats = LockProfiler::getStats();
+	std::list<LockStats>::iterator statIter = stats.begin();
+	while(statIter != stats.end() && statIter->name != "test.profiled")
+		statIter++;
+
+	if (!LockProfiler::isEnabled()) {
+		// built without PROFILE_LOCKS, nothing is recorded
+		assert(statIter == stats.end());
+		return true;
+	}
+
+	assert(statIter != stats.end());
+	std::cout << "test.profiled: " << statIter->acquisitions << " acquisitions, " << statIter->contentions << " contended, waited "
+	          << statIter->waitNs / 1000 << "us, held " << statIter->holdNs / 1000 << "us" << std::endl;
+	assert(statIter->acquisitions == 3);
+	assert(statIter->contentions >= 1);
+	assert(statIter->waitNs >= 30 * 1000 * 1000);
+	assert(statIter->maxHoldNs >= 45 * 1000 * 1000);
+	assert(statIter->holdNs >= 65 * 1000 * 1000);
+	assert(statIter->holdNs < 120 * 1000 * 1000);
+	return true;
+}
+
 class FooTracer : public Traceable, public Thread {
 	void run() {
 		while(isStarted()) {
@@ -238,5 +405,15 @@ int main(int argc, char** argv) {
 		return EXIT_FAILURE;
 	if(!testTimedMonitors())
 		return EXIT_FAILURE;
+	if(!testClocks())
+		return EXIT_FAILURE;
+	if(!testDeadlines())
+		return EXIT_FAILURE;
+	if(!testNonRecursiveMutex())
+		return EXIT_FAILURE;
+	if(!testRWMutex())
+		return EXIT_FAILURE;
+	if(!testLockProfiler())
+		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
 }
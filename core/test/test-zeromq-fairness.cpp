@@ -0,0 +1,167 @@
+#include "umundo/core.h"
+#include <iostream>
+#include <algorithm>
+#include <stdio.h>
+
+#define NR_PEERS 100
+#define PUBS_PER_PEER 4
+#define MSGS_PER_PUB 20
+#define MAX_WAIT_MS 5000
+#define MAX_SPREAD 3 ///< slowest peer may take this many times the median peer
+#define SPREAD_SLACK_MS 20 ///< plus this, so a median of ~0ms does not fail on scheduling noise
+
+using namespace umundo;
+
+static Mutex mutex;
+static uint64_t burstStart = 0;
+static std::map<std::string, int> peerOfPub; ///< publisher uuid to peer index
+static std::vector<uint64_t> welcomedAfter; ///< per peer, last publisher greeted since the burst started
+static std::vector<uint64_t> deliveredAfter; ///< per peer, last message delivered since the burst started
+static std::vector<int> receptions; ///< per peer, messages delivered
+
+class FairnessGreeter : public Greeter {
+	void welcome(const Publisher& pub, const SubscriberStub& subStub) {
+		ScopeLock lock(mutex);
+		welcomedAfter[peerOfPub[pub.getUUID()]] = Thread::getTimeStampMs() - burstStart;
+	}
+	void farewell(const Publisher& pub, const SubscriberStub& subStub) {}
+};
+
+class FairnessReceiver : public Receiver {
+	void receive(Message* msg) {
+		ScopeLock lock(mutex);
+		std::map<std::string, int>::iterator peerIter = peerOfPub.find(msg->getMeta("um.pub"));
+		assert(peerIter != peerOfPub.end());
+		receptions[peerIter->second]++;
+		deliveredAfter[peerIter->second] = Thread::getTimeStampMs() - burstStart;
+	}
+};
+
+/**
+ * No peer may be served much later than the typical one.
+ */
+void assertSpread(const std::string& what, std::vector<uint64_t> latencies) {
+	std::sort(latencies.begin(), latencies.end());
+	uint64_t median = latencies[latencies.size() / 2];
+	uint64_t max = latencies.back();
+
+	std::cout << what << " per peer: min " << latencies.front() << "ms, median " << median << "ms, max " << max << "ms" << std::endl;
+	assert(max <= MAX_SPREAD * median + SPREAD_SLACK_MS);
+}
+
+/**
+ * Have many peers announce publishers and then send at the same time and make sure no peer is starved.
+ *
+ * Every PUB_ADDED reaches the hub on its node socket or one of its client sockets and
+ * every SUBSCRIBE goes back the same way, so this is what the hub's poll loop drains.
+ */
+bool testConcurrentPeers() {
+	FairnessGreeter* greeter = new FairnessGreeter();
+	FairnessReceiver* recv = new FairnessReceiver();
+
+	Node hubNode;
+	Subscriber sub("fairness", recv);
+	hubNode.addSubscriber(sub);
+
+	std::vector<Node> peerNodes;
+	std::vector<Publisher> peerPubs;
+
+	welcomedAfter.resize(NR_PEERS);
+	deliveredAfter.resize(NR_PEERS);
+	receptions.resize(NR_PEERS);
+
+	for (int i = 0; i < NR_PEERS; i++) {
+		Node peerNode;
+		hubNode.added(peerNode);
+		peerNode.added(hubNode);
+		peerNodes.push_back(peerNode);
+		for (int j = 0; j < PUBS_PER_PEER; j++) {
+			Publisher pub("fairness", greeter);
+			peerOfPub[pub.getUUID()] = i;
+			peerPubs.push_back(pub);
+		}
+	}
+
+	// time until the hub and every peer are connected both ways
+	uint64_t connectStart = Thread::getTimeStampMs();
+	for (int i = 0; i < NR_PEERS; i++) {
+		while(peerNodes[i].connectedTo().size() == 0 && Thread::getTimeStampMs() - connectStart < MAX_WAIT_MS)
+			Thread::sleepMs(10);
+		assert(peerNodes[i].connectedTo().size() == 1);
+	}
+	while(hubNode.connectedTo().size() < NR_PEERS && Thread::getTimeStampMs() - connectStart < MAX_WAIT_MS)
+		Thread::sleepMs(10);
+	assert(hubNode.connectedTo().size() == NR_PEERS);
+	std::cout << "all " << NR_PEERS << " peers connected after " << Thread::getTimeStampMs() - connectStart << "ms" << std::endl;
+
+	{
+		ScopeLock lock(mutex);
+		burstStart = Thread::getTimeStampMs();
+	}
+
+	// everyone announces at once
+	for (int j = 0; j < PUBS_PER_PEER; j++) {
+		for (int i = 0; i < NR_PEERS; i++) {
+			peerNodes[i].addPublisher(peerPubs[i * PUBS_PER_PEER + j]);
+		}
+	}
+
+	// wait until the hub subscribed to all of them
+	for (size_t i = 0; i < peerPubs.size(); i++) {
+		assert(peerPubs[i].waitForSubscribers(1, MAX_WAIT_MS) == 1);
+	}
+
+	{
+		ScopeLock lock(mutex);
+		assertSpread("subscribed", welcomedAfter);
+		burstStart = Thread::getTimeStampMs();
+	}
+
+	// everyone sends at once
+	for (int k = 0; k < MSGS_PER_PUB; k++) {
+		for (size_t i = 0; i < peerPubs.size(); i++) {
+			Message* msg = new Message();
+			msg->putMeta("seq", toStr(k));
+			peerPubs[i].send(msg);
+			delete msg;
+		}
+	}
+
+	// wait for all messages to arrive
+	uint64_t sendStart = Thread::getTimeStampMs();
+	while(Thread::getTimeStampMs() - sendStart < MAX_WAIT_MS) {
+		Thread::sleepMs(10);
+		ScopeLock lock(mutex);
+		int done = 0;
+		for (int i = 0; i < NR_PEERS; i++) {
+			if (receptions[i] == PUBS_PER_PEER * MSGS_PER_PUB)
+				done++;
+		}
+		if (done == NR_PEERS)
+			break;
+	}
+
+	{
+		ScopeLock lock(mutex);
+		for (int i = 0; i < NR_PEERS; i++) {
+			assert(receptions[i] == PUBS_PER_PEER * MSGS_PER_PUB);
+		}
+		assertSpread("delivered", deliveredAfter);
+	}
+
+	for (int i = 0; i < NR_PEERS; i++) {
+		for (int j = 0; j < PUBS_PER_PEER; j++)
+			peerNodes[i].removePublisher(peerPubs[i * PUBS_PER_PEER + j]);
+		hubNode.removed(peerNodes[i]);
+		peerNodes[i].removed(hubNode);
+	}
+	hubNode.removeSubscriber(sub);
+
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (!testConcurrentPeers())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+#include "umundo/core.h"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NR_SENDERS 4
+#define MSG_SIZE 4096
+#define DURATION_MS 3000
+
+using namespace umundo;
+
+static volatile size_t bytesRcvd = 0;
+static volatile size_t msgsRcvd = 0;
+
+class ThroughputReceiver : public Receiver {
+	void receive(Message* msg) {
+		Atomic::add(&msgsRcvd, 1);
+		Atomic::add(&bytesRcvd, msg->size());
+	}
+};
+
+class Sender : public Thread {
+public:
+	Sender(Publisher pub) : _pub(pub) {}
+	void run() {
+		char* data = (char*)malloc(MSG_SIZE);
+		memset(data, 1, MSG_SIZE);
+		Message* msg = new Message(data, MSG_SIZE);
+		while(isStarted()) {
+			_pub.send(msg);
+		}
+		delete msg;
+		free(data);
+	}
+	Publisher _pub;
+};
+
+/**
+ * Have some nodes publish as fast as they can and measure what arrives.
+ */
+bool benchIOThreads(int ioThreads) {
+	// measure what 0MQ's I/O threads carry, not the shortcuts between nodes on the same host
+	NodeOptions options;
+	options.setIOThreads(ioThreads);
+	options.setSharedMemorySize(0);
+	options.allowIPC(false);
+	Node recvNode(options);
+
+	ThroughputReceiver* recv = new ThroughputReceiver();
+	std::vector<Node> sendNodes;
+	std::vector<Publisher> pubs;
+	std::vector<Subscriber> subs;
+	std::vector<Sender*> senders;
+
+	for (int i = 0; i < NR_SENDERS; i++) {
+		// spread the sending nodes over the I/O threads
+		NodeOptions sendOptions;
+		sendOptions.setIOThreadAffinity(1 << (i % ioThreads));
+		sendOptions.setSharedMemorySize(0);
+		sendOptions.allowIPC(false);
+		Node sendNode(sendOptions);
+
+		Publisher pub("iothreads" + toStr(i));
+		sendNode.addPublisher(pub);
+
+		Subscriber sub("iothreads" + toStr(i), recv);
+		recvNode.addSubscriber(sub);
+
+		sendNode.added(recvNode);
+		recvNode.added(sendNode);
+
+		sendNodes.push_back(sendNode);
+		pubs.push_back(pub);
+		subs.push_back(sub);
+	}
+
+	for (int i = 0; i < NR_SENDERS; i++) {
+		pubs[i].waitForSubscribers(1);
+		senders.push_back(new Sender(pubs[i]));
+	}
+
+	uint64_t start = Thread::getTimeStampMs();
+	for (int i = 0; i < NR_SENDERS; i++) {
+		senders[i]->start();
+	}
+	Thread::sleepMs(DURATION_MS);
+	size_t msgs = Atomic::load(&msgsRcvd);
+	size_t bytes = Atomic::load(&bytesRcvd);
+	uint64_t elapsed = Thread::getTimeStampMs() - start;
+
+	for (int i = 0; i < NR_SENDERS; i++) {
+		senders[i]->stop();
+		senders[i]->join();
+		delete senders[i];
+	}
+
+	printf("%d I/O threads: %.0f msgs/s %.2f MB/s\n",
+	       ioThreads,
+	       msgs / (elapsed / 1000.0),
+	       bytes / (elapsed / 1000.0) / (1024 * 1024));
+
+	for (int i = 0; i < NR_SENDERS; i++) {
+		sendNodes[i].removePublisher(pubs[i]);
+		recvNode.removeSubscriber(subs[i]);
+		sendNodes[i].removed(recvNode);
+		recvNode.removed(sendNodes[i]);
+	}
+
+	return msgs > 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) {
+		// the 0MQ context is process-wide, so every configuration runs in a process of its own
+		if (!benchIOThreads(atoi(argv[1])))
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
+	int ioThreads[] = { 1, 2, 4 };
+	for (int i = 0; i < 3; i++) {
+		std::string cmd = std::string(argv[0]) + " " + toStr(ioThreads[i]);
+		if (system(cmd.c_str()) != 0)
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+#include "umundo/core.h"
+#include "umundo/connection/zeromq/ZeroMQSubscriber.h"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TOTAL_BYTES (256 * 1024 * 1024)
+#define MAX_MSGS 200000
+#define MAX_BYTES_IN_FLIGHT (64 * 1024 * 1024)
+
+using namespace umundo;
+
+static volatile size_t msgsRcvd = 0;
+
+class CountingReceiver : public Receiver {
+	void receive(Message* msg) {
+		Atomic::add(&msgsRcvd, 1);
+	}
+};
+
+/**
+ * Send messages of the given size between two nodes on this host and report the rate.
+ */
+bool benchTransport(bool useIPC, size_t msgSize) {
+	NodeOptions options;
+	options.allowIPC(useIPC);
+	options.setSharedMemorySize(0); // we compare sockets
+	Node pubNode(options);
+	Node subNode(options);
+
+	Publisher pub("bench.ipc");
+	pubNode.addPublisher(pub);
+
+	CountingReceiver* recv = new CountingReceiver();
+	Subscriber sub("bench.ipc", recv);
+	subNode.addSubscriber(sub);
+
+	subNode.added(pubNode);
+	pubNode.added(subNode);
+	pub.waitForSubscribers(1);
+
+	// make sure we measure what we think we measure
+	std::map<std::string, NodeStub> nodes = subNode.connectedTo();
+	assert(nodes.find(pubNode.getUUID()) != nodes.end());
+	PublisherStub pubStub = nodes[pubNode.getUUID()].getPublisher(pub.getUUID());
+	assert(pubStub);
+	assert(!pubStub.isRemote());
+
+	std::string endPoint = boost::static_pointer_cast<ZeroMQSubscriber>(sub.getImpl())->getEndPoint(pubStub);
+	if (useIPC) {
+		assert(pubStub.getIPCEndpoint().compare(0, 6, "ipc://") == 0);
+		assert(endPoint == pubStub.getIPCEndpoint());
+	} else {
+		assert(pubStub.getIPCEndpoint().length() == 0);
+		assert(endPoint.compare(0, 6, "tcp://") == 0);
+	}
+
+	size_t nrMsgs = TOTAL_BYTES / msgSize;
+	if (nrMsgs > MAX_MSGS)
+		nrMsgs = MAX_MSGS;
+	size_t window = MAX_BYTES_IN_FLIGHT / msgSize;
+	if (window > 10000)
+		window = 10000;
+
+	char* data = (char*)malloc(msgSize);
+	memset(data, 1, msgSize);
+	Message* msg = new Message(data, msgSize);
+
+	Atomic::store(&msgsRcvd, 0);
+	uint64_t start = Thread::getTimeStampMs();
+	for (size_t i = 0; i < nrMsgs; i++) {
+		// do not let 0MQ queue more than we can afford
+		while(i - Atomic::load(&msgsRcvd) >= window)
+			Thread::yield();
+		pub.send(msg);
+	}
+
+	uint64_t deadline = Thread::getTimeStampMs() + 10000;
+	while(Atomic::load(&msgsRcvd) < nrMsgs && Thread::getTimeStampMs() < deadline)
+		Thread::yield();
+	uint64_t elapsed = Thread::getTimeStampMs() - start;
+	if (elapsed == 0)
+		elapsed = 1;
+	size_t received = Atomic::load(&msgsRcvd);
+
+	printf("%s %8lu B: %8lu msgs in %5lums %10.0f msgs/s %8.2f MB/s\n",
+	       (useIPC ? "ipc" : "tcp"),
+	       (unsigned long)msgSize,
+	       (unsigned long)received,
+	       (unsigned long)elapsed,
+	       received / (elapsed / 1000.0),
+	       (received * msgSize) / (elapsed / 1000.0) / (1024 * 1024));
+
+	delete msg;
+	free(data);
+
+	subNode.removeSubscriber(sub);
+	pubNode.removePublisher(pub);
+	subNode.removed(pubNode);
+	pubNode.removed(subNode);
+
+	return received == nrMsgs;
+}
+
+int main(int argc, char** argv) {
+	size_t sizes[] = { 64, 64 * 1024, 4 * 1024 * 1024 };
+	for (int i = 0; i < 3; i++) {
+		if (!benchTransport(false, sizes[i]))
+			return EXIT_FAILURE;
+		if (!benchTransport(true, sizes[i]))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
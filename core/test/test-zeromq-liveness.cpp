@@ -0,0 +1,100 @@
+#include "umundo/core.h"
+#include <iostream>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FAILOVER_MS 600
+#define NODE_PORT 42451
+#define PUB_PORT 42452
+
+using namespace umundo;
+
+/**
+ * Run a node with a publisher in another process until it is killed.
+ *
+ * The node waits for a byte on startFd unless it is negative.
+ */
+static pid_t forkNode(int startFd) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		char start;
+		if (startFd >= 0 && read(startFd, &start, 1) != 1)
+			exit(EXIT_FAILURE);
+		NodeOptions options(NODE_PORT, PUB_PORT);
+		options.setFailoverTime(FAILOVER_MS);
+		Node otherNode(options);
+		Publisher pub("liveness");
+		otherNode.addPublisher(pub);
+		while(true)
+			Thread::sleepMs(1000);
+	}
+	return pid;
+}
+
+/**
+ * Run a node in another process, kill it without a shutdown and see how long we keep it.
+ * Then start it again, discovery never removed it so we have to reconnect on our own.
+ */
+bool testStaleNodeEviction() {
+	// fork before we have a 0MQ context, the second node returns after the first was evicted
+	int startPipe[2];
+	if (pipe(startPipe) != 0)
+		return false;
+	pid_t pid = forkNode(-1);
+	pid_t returningPid = forkNode(startPipe[0]);
+
+	NodeOptions options;
+	options.setFailoverTime(FAILOVER_MS);
+	Node node(options);
+	Subscriber sub("liveness");
+	node.addSubscriber(sub);
+
+	node.added(EndPoint("tcp://127.0.0.1:" + toStr(NODE_PORT)));
+
+	int retries = 50;
+	while(node.connectedTo().size() == 0 && retries-- > 0)
+		Thread::sleepMs(100);
+	assert(node.connectedTo().size() == 1);
+
+	// heartbeats keep an idle connection alive
+	Thread::sleepMs(FAILOVER_MS * 3);
+	assert(node.connectedTo().size() == 1);
+	assert(sub.getPublishers().size() == 1);
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	uint64_t killedAt = Thread::getTimeStampMs();
+
+	while(node.connectedTo().size() > 0 && Thread::getTimeStampMs() - killedAt < FAILOVER_MS * 10)
+		Thread::sleepMs(10);
+
+	uint64_t evictedAfter = Thread::getTimeStampMs() - killedAt;
+	std::cout << "stale node removed after " << evictedAfter << "ms" << std::endl;
+
+	assert(node.connectedTo().size() == 0);
+	assert(sub.getPublishers().size() == 0);
+	assert(evictedAfter < FAILOVER_MS * 2);
+
+	// the node comes back at the same endpoint
+	if (write(startPipe[1], "s", 1) != 1)
+		return false;
+	retries = 100;
+	while((node.connectedTo().size() == 0 || sub.getPublishers().size() == 0) && retries-- > 0)
+		Thread::sleepMs(100);
+	std::cout << "returning node reconnected after " << Thread::getTimeStampMs() - killedAt - evictedAfter << "ms" << std::endl;
+	assert(node.connectedTo().size() == 1);
+	assert(sub.getPublishers().size() == 1);
+
+	kill(returningPid, SIGKILL);
+	waitpid(returningPid, NULL, 0);
+
+	node.removeSubscriber(sub);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (!testStaleNodeEviction())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
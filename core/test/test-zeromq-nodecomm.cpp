@@ -1,6 +1,11 @@
 #include "umundo/common/Factory.h"
 #include "umundo/common/Message.h"
 #include "umundo/connection/Node.h"
+#include "umundo/connection/zeromq/ZeroMQNode.h"
+#include "umundo/connection/PubSummary.h"
+#include "umundo/discovery/PeerCache.h"
+
+#include <fstream>
 
 using namespace umundo;
 
@@ -217,12 +222,368 @@ bool testGeneralStuff() {
 	return true;
 }
 
+bool testPublisherDeltas() {
+	Node* node1 = new Node();
+	Node* node2 = new Node();
+
+	std::vector<Publisher> pubs1;
+	for (int i = 0; i < 50; i++) {
+		Publisher pub("delta" + toStr(i));
+		node1->addPublisher(pub);
+		pubs1.push_back(pub);
+	}
+
+	// what node1 sends to introduce all its publishers
+	boost::shared_ptr<ZeroMQNode> impl1 = boost::static_pointer_cast<ZeroMQNode>(node1->getImpl());
+	size_t bytesBefore = impl1->getMetaBytesSent();
+
+	node2->added(*node1);
+	usleep(100000);
+
+	size_t fullBytes = impl1->getMetaBytesSent() - bytesBefore;
+
+	std::map<std::string, NodeStub> peers = node2->connectedTo();
+	assert(peers.size() == 1);
+	std::map<std::string, PublisherStub> pubs = peers.begin()->second.getPublishers();
+	assert(pubs.size() == 50);
+
+	int iterations = 10;
+	while (iterations--) {
+		// change publishers while we are not connected
+		node2->removed(*node1);
+		usleep(10000);
+
+		node1->removePublisher(pubs1.front());
+		pubs1.erase(pubs1.begin());
+		Publisher pub("delta.late" + toStr(iterations));
+		node1->addPublisher(pub);
+		pubs1.push_back(pub);
+
+		// reconnecting will only transfer the changes, but we still need to know every publisher
+		bytesBefore = impl1->getMetaBytesSent();
+		node2->added(*node1);
+		usleep(100000);
+
+		size_t deltaBytes = impl1->getMetaBytesSent() - bytesBefore;
+		assert(deltaBytes < fullBytes / 2);
+
+		peers = node2->connectedTo();
+		assert(peers.size() == 1);
+		pubs = peers.begin()->second.getPublishers();
+		assert(pubs.size() == 50);
+		for (int i = 0; i < 50; i++) {
+			assert(pubs.find(pubs1[i].getUUID()) != pubs.end());
+		}
+	}
+
+	// changes while connected arrive in order
+	for (int i = 0; i < 50; i++) {
+		node1->removePublisher(pubs1[i]);
+	}
+	usleep(100000);
+	peers = node2->connectedTo();
+	pubs = peers.begin()->second.getPublishers();
+	assert(pubs.size() == 0);
+
+	delete node2;
+	delete node1;
+	return true;
+}
+
+bool testConnectionAdmission() {
+	NodeOptions options;
+	options.setMaxPendingConnections(2);
+	Node* node = new Node(options);
+
+	std::vector<Node*> others;
+	for (int i = 0; i < 20; i++) {
+		Node* other = new Node();
+		for (int j = 0; j < 5; j++) {
+			Publisher pub("admission" + toStr(i) + "." + toStr(j));
+			other->addPublisher(pub);
+		}
+		others.push_back(other);
+	}
+
+	// a node we cannot reach must not block the others
+	node->added(EndPoint("tcp://127.0.0.1:1"));
+
+	Subscriber sub("admission");
+	node->addSubscriber(sub);
+	for (int i = 0; i < 20; i++) {
+		node->added(*others[i]);
+	}
+
+	int retries = 100;
+	while(node->connectedTo().size() < 20 && retries-- > 0)
+		usleep(50000);
+	assert(node->connectedTo().size() == 20);
+
+	// and knows about every publisher
+	retries = 50;
+	while(sub.getPublishers().size() < 100 && retries-- > 0)
+		usleep(50000);
+	assert(sub.getPublishers().size() == 100);
+
+	// never more handshakes at once than we allowed
+	boost::shared_ptr<ZeroMQNode> impl = boost::static_pointer_cast<ZeroMQNode>(node->getImpl());
+	assert(impl->getMaxHandshakesInFlight() > 0);
+	assert(impl->getMaxHandshakesInFlight() <= 2);
+
+	// and the subscriptions to a node's publishers went out together
+	assert(impl->getSubscribesSent() == 100);
+	assert(impl->getSubscribeMsgsSent() <= 20);
+
+	node->removed(EndPoint("tcp://127.0.0.1:1"));
+	for (int i = 0; i < 20; i++) {
+		node->removed(*others[i]);
+		delete others[i];
+	}
+	delete node;
+	return true;
+}
+
+static int interestRcvd = 0;
+
+class InterestReceiver : public Receiver {
+	void receive(Message* msg) {
+		interestRcvd++;
+	}
+};
+
+bool testUninterestedPublishers() {
+	Node* node1 = new Node();
+	Node* node2 = new Node();
+
+	Publisher pub("interest");
+	node1->addPublisher(pub);
+	node2->added(*node1);
+	node1->added(*node2);
+	usleep(100000);
+
+	// no one listens, nothing is sent
+	for (int i = 0; i < 10; i++)
+		pub.send("foo", 3);
+	assert(pub.getSuppressedMessages() == 10);
+
+	InterestReceiver* recv = new InterestReceiver();
+	Subscriber sub("interest", recv);
+	node2->addSubscriber(sub);
+	pub.waitForSubscribers(1);
+
+	for (int i = 0; i < 10; i++)
+		pub.send("foo", 3);
+	usleep(100000);
+	assert(pub.getSuppressedMessages() == 10);
+	assert(interestRcvd == 10);
+
+	// and nothing once the subscriber is gone again
+	node2->removeSubscriber(sub);
+	usleep(100000);
+	for (int i = 0; i < 10; i++)
+		pub.send("foo", 3);
+	assert(pub.getSuppressedMessages() == 20);
+
+	delete node2;
+	delete node1;
+	return true;
+}
+
+#define COALESCE_DELAY_US 2000
+#define COALESCE_SLACK_US 5000 ///< rounding the delay to the next ms and the hop to the subscriber
+
+static std::vector<std::string> coalescedRcvd;
+static std::vector<uint64_t> coalescedArrivalUs;
+
+class CoalescedReceiver : public Receiver {
+	void receive(Message* msg) {
+		if (msg->getMeta("um.sub").length() == 0)
+			assert(msg->getMeta("um.channel") == "coalesce");
+		assert(msg->getMeta("seq") == toStr(coalescedRcvd.size()));
+		coalescedRcvd.push_back(std::string(msg->data(), msg->size()));
+		coalescedArrivalUs.push_back(Thread::getTimeStampUs());
+	}
+};
+
+bool testCoalescing() {
+	NodeOptions options;
+	options.setCoalescing(4096, COALESCE_DELAY_US);
+	Node* node1 = new Node(options);
+	Node* node2 = new Node();
+
+	Publisher pub("coalesce");
+	node1->addPublisher(pub);
+
+	CoalescedReceiver* recv = new CoalescedReceiver();
+	Subscriber sub("coalesce", recv);
+	node2->addSubscriber(sub);
+
+	node1->added(*node2);
+	node2->added(*node1);
+	pub.waitForSubscribers(1);
+	boost::shared_ptr<ZeroMQNode> impl1 = boost::static_pointer_cast<ZeroMQNode>(node1->getImpl());
+
+	// small messages are batched, large ones overtake nothing
+	std::string large(8192, 'x');
+	uint64_t firstSentUs = Thread::getTimeStampUs();
+	for (int i = 0; i < 1000; i++) {
+		Message* msg = new Message();
+		msg->putMeta("seq", toStr(i));
+		if (i % 100 == 99) {
+			msg->setData(large.data(), large.size());
+		} else {
+			msg->setData("foo", 3);
+		}
+		pub.send(msg);
+		delete msg;
+	}
+
+	int retries = 50;
+	while(coalescedRcvd.size() < 1000 && retries-- > 0)
+		usleep(10000);
+	assert(coalescedRcvd.size() == 1000);
+	for (int i = 0; i < 1000; i++) {
+		assert(coalescedRcvd[i] == (i % 100 == 99 ? large : "foo"));
+	}
+
+	// every small message went out in a batch, several to a batch
+	assert(impl1->getBatchedMsgsSent() == 990);
+	assert(impl1->getBatchesSent() >= 10);
+	assert(impl1->getBatchesSent() * 4 <= impl1->getBatchedMsgsSent());
+
+	// and the first did not wait for more than the delay
+	assert(coalescedArrivalUs[0] - firstSentUs < COALESCE_DELAY_US + COALESCE_SLACK_US);
+
+	// a lone message waits no longer than the delay
+	Message* msg = new Message("bar", 3);
+	msg->putMeta("seq", "1000");
+	uint64_t loneSentUs = Thread::getTimeStampUs();
+	pub.send(msg);
+	delete msg;
+	usleep(20000);
+	assert(coalescedRcvd.size() == 1001);
+	assert(coalescedArrivalUs[1000] - loneSentUs < COALESCE_DELAY_US + COALESCE_SLACK_US);
+	assert(impl1->getBatchedMsgsSent() == 991);
+
+	// an explicitly addressed message does not overtake what was batched before
+	for (int i = 1001; i < 1005; i++) {
+		Message* msg = new Message("foo", 3);
+		msg->putMeta("seq", toStr(i));
+		pub.send(msg);
+		delete msg;
+	}
+	msg = new Message("baz", 3);
+	msg->putMeta("seq", "1005");
+	msg->putMeta("um.sub", sub.getUUID());
+	pub.send(msg);
+	delete msg;
+
+	retries = 50;
+	while(coalescedRcvd.size() < 1006 && retries-- > 0)
+		usleep(10000);
+	assert(coalescedRcvd.size() == 1006);
+	assert(coalescedRcvd[1005] == "baz");
+
+	delete node2;
+	delete node1;
+	return true;
+}
+
+bool testPubSummaries() {
+	PubSummary summary;
+	summary.addChannel("summary.foo");
+	assert(summary.mayMatch("summary.foo"));
+	assert(summary.mayMatch("summary."));
+	assert(summary.mayMatch(""));
+	assert(PubSummary("").mayMatch("anything"));
+	assert(summary.covers(PubSummary()));
+	assert(!PubSummary().covers(summary));
+
+	Node* node1 = new Node();
+	Node* node2 = new Node();
+
+	Publisher pub("summary.foo");
+	node1->addPublisher(pub);
+
+	// the way discovery reports node1 with a summary
+	EndPoint endPoint(boost::shared_ptr<EndPointImpl>(new EndPointImpl()));
+	endPoint.getImpl()->setTransport(node1->getTransport());
+	endPoint.getImpl()->setIP(node1->getIP());
+	endPoint.getImpl()->setPort(node1->getPort());
+	endPoint.getImpl()->setPubSummary(node1->getImpl()->getPubSummary());
+
+	// nothing we care for, no connection
+	Subscriber otherSub("summary.bar", new InterestReceiver());
+	node2->addSubscriber(otherSub);
+	node2->added(endPoint);
+	usleep(100000);
+	assert(node2->connectedTo().size() == 0);
+
+	// a matching subscriber makes us connect
+	Subscriber sub("summary.", new InterestReceiver());
+	node2->addSubscriber(sub);
+	pub.waitForSubscribers(1);
+	assert(node2->connectedTo().size() == 1);
+
+	delete node2;
+	delete node1;
+	return true;
+}
+
+bool testPeerCache() {
+	Node* node1 = new Node();
+	std::string cacheFile = "/tmp/umundo-test-peers." + toStr(getpid());
+
+	// a peer from the last run and one that is gone
+	{
+		std::ofstream file(cacheFile.c_str());
+		file << node1->getAddress() << " " << node1->getUUID() << " " << Thread::getTimeStampMs() << std::endl;
+		file << "tcp://127.0.0.1:1 " << UUID::getUUID() << " " << Thread::getTimeStampMs() << std::endl;
+		file << "tcp://127.0.0.1:2 " << UUID::getUUID() << " " << Thread::getTimeStampMs() - 2 * UMUNDO_PEER_CACHE_MAX_AGE_MS << std::endl;
+	}
+
+	NodeOptions options;
+	options.setPeerCache(cacheFile);
+	options.setFailoverTime(1000);
+	Node* node2 = new Node(options);
+
+	// connected without any discovery
+	int retries = 50;
+	while(node2->connectedTo().size() < 1 && retries-- > 0)
+		usleep(50000);
+	assert(node2->connectedTo().size() == 1);
+
+	// the unreachable one is forgotten after the failover time
+	Thread::sleepMs(1500);
+	PeerCache cache(cacheFile);
+	assert(cache.load());
+	assert(cache.getEntries().size() == 1);
+	assert(cache.getEntries().begin()->second.uuid == node1->getUUID());
+
+	delete node2;
+	delete node1;
+	unlink(cacheFile.c_str());
+	return true;
+}
+
 int main(int argc, char** argv) {
 	setenv("UMUNDO_LOGLEVEL", "4", 1);
 	if (!testNodeConnections())
 		return EXIT_FAILURE;
 	if (!testGeneralStuff())
 		return EXIT_FAILURE;
+	if (!testPublisherDeltas())
+		return EXIT_FAILURE;
+	if (!testConnectionAdmission())
+		return EXIT_FAILURE;
+	if (!testUninterestedPublishers())
+		return EXIT_FAILURE;
+	if (!testCoalescing())
+		return EXIT_FAILURE;
+	if (!testPubSummaries())
+		return EXIT_FAILURE;
+	if (!testPeerCache())
+		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
 
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include "umundo/core.h"
+#include "umundo/connection/zeromq/ZeroMQNode.h"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define CONVERGENCE_TIMEOUT_MS 120000
+#define THROUGHPUT_MS 1000
+#define LEAVE_FRACTION 10 ///< remove every n-th node for the leave path
+
+using namespace umundo;
+
+static volatile size_t msgsRcvd = 0;
+
+class CountingReceiver : public Receiver {
+	void receive(Message* msg) {
+		Atomic::add(&msgsRcvd, 1);
+	}
+};
+
+struct SimNode {
+	Node* node;
+	std::vector<Publisher> pubs;
+	std::vector<Subscriber> subs;
+	std::vector<int> subscribedNode; ///< index of the node whose publisher the subscriber listens to
+	bool isRemoved;
+};
+
+/**
+ * Resident set size of the process in KB.
+ */
+size_t residentKB() {
+#ifdef __linux__
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm != NULL) {
+		unsigned long size = 0, resident = 0;
+		int nrRead = fscanf(statm, "%lu %lu", &size, &resident);
+		fclose(statm);
+		if (nrRead == 2)
+			return resident * (sysconf(_SC_PAGESIZE) / 1024);
+	}
+#endif
+	// peak only, but better than nothing
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+size_t metaMsgsSent(std::vector<SimNode>& nodes, size_t& bytes) {
+	size_t msgs = 0;
+	bytes = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].isRemoved)
+			continue;
+		boost::shared_ptr<ZeroMQNode> impl = boost::static_pointer_cast<ZeroMQNode>(nodes[i].node->getImpl());
+		msgs += impl->getMetaMsgsSent();
+		bytes += impl->getMetaBytesSent();
+	}
+	return msgs;
+}
+
+/**
+ * Subscriptions all remaining publishers know about.
+ */
+size_t knownSubscriptions(std::vector<SimNode>& nodes) {
+	size_t known = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].isRemoved)
+			continue;
+		for (size_t j = 0; j < nodes[i].pubs.size(); j++) {
+			known += nodes[i].pubs[j].getSubscribers().size();
+		}
+	}
+	return known;
+}
+
+/**
+ * Wait until the publishers know about the expected number of subscriptions, returns the time it took.
+ */
+uint64_t waitForConvergence(std::vector<SimNode>& nodes, size_t expected, uint64_t start) {
+	size_t known = 0;
+	while(Thread::getTimeStampMs() - start < CONVERGENCE_TIMEOUT_MS) {
+		known = knownSubscriptions(nodes);
+		if (known == expected)
+			return Thread::getTimeStampMs() - start;
+		Thread::sleepMs(10);
+	}
+	std::cerr << "no convergence: " << known << " of " << expected << " subscriptions" << std::endl;
+	return 0;
+}
+
+/**
+ * Have nrNodes nodes in a full mesh with nrPubSubs publishers and subscribers each.
+ */
+bool simulate(size_t nrNodes, size_t nrPubSubs, int maxSockets) {
+	std::cerr << "simulating " << nrNodes << " nodes with " << nrPubSubs << " publishers and subscribers each" << std::endl;
+
+	size_t memBefore = residentKB();
+
+	NodeOptions options;
+	options.setMaxSockets(maxSockets); // only effective with the first node
+	options.setSharedMemorySize(0); // we measure sockets
+	options.allowIPC(false);
+
+	std::vector<SimNode> nodes(nrNodes);
+	for (size_t i = 0; i < nrNodes; i++) {
+		nodes[i].node = new Node(options);
+		nodes[i].isRemoved = false;
+		for (size_t j = 0; j < nrPubSubs; j++) {
+			Publisher pub("scale." + toStr(i) + "." + toStr(j));
+			nodes[i].node->addPublisher(pub);
+			nodes[i].pubs.push_back(pub);
+
+			// every publisher gets a subscriber on another node
+			int other = (i + 1 + j) % nrNodes;
+			Subscriber sub("scale." + toStr(other) + "." + toStr(j), new CountingReceiver());
+			nodes[i].node->addSubscriber(sub);
+			nodes[i].subs.push_back(sub);
+			nodes[i].subscribedNode.push_back(other);
+		}
+	}
+
+	// join path
+	size_t bytesBefore;
+	size_t msgsBefore = metaMsgsSent(nodes, bytesBefore);
+	uint64_t start = Thread::getTimeStampMs();
+	for (size_t i = 0; i < nrNodes; i++) {
+		for (size_t j = 0; j < nrNodes; j++) {
+			if (i != j)
+				nodes[i].node->added(*nodes[j].node);
+		}
+	}
+	uint64_t joinMs = waitForConvergence(nodes, nrNodes * nrPubSubs, start);
+	size_t joinBytes;
+	size_t joinMsgs = metaMsgsSent(nodes, joinBytes) - msgsBefore;
+	joinBytes -= bytesBefore;
+
+	size_t memAfter = residentKB();
+	size_t memPerNode = (memAfter > memBefore ? (memAfter - memBefore) / nrNodes : 0);
+
+	// steady state
+	Atomic::store(&msgsRcvd, 0);
+	uint64_t sendStart = Thread::getTimeStampMs();
+	while(Thread::getTimeStampMs() - sendStart < THROUGHPUT_MS) {
+		for (size_t i = 0; i < nrNodes; i++) {
+			for (size_t j = 0; j < nrPubSubs; j++) {
+				nodes[i].pubs[j].send("scalability", 11);
+			}
+		}
+	}
+	Thread::sleepMs(200); // let the queues drain
+	uint64_t elapsed = Thread::getTimeStampMs() - sendStart;
+	double msgsPerSec = Atomic::load(&msgsRcvd) / (elapsed / 1000.0);
+
+	// leave path
+	size_t remaining = 0;
+	for (size_t i = 0; i < nrNodes; i++) {
+		if (i % LEAVE_FRACTION == 0)
+			nodes[i].isRemoved = true;
+	}
+	for (size_t i = 0; i < nrNodes; i++) {
+		for (size_t j = 0; j < nrPubSubs; j++) {
+			if (!nodes[i].isRemoved && !nodes[nodes[i].subscribedNode[j]].isRemoved)
+				remaining++;
+		}
+	}
+	msgsBefore = metaMsgsSent(nodes, bytesBefore);
+	start = Thread::getTimeStampMs();
+	for (size_t i = 0; i < nrNodes; i++) {
+		if (!nodes[i].isRemoved)
+			continue;
+		for (size_t j = 0; j < nrNodes; j++) {
+			if (i == j)
+				continue;
+			nodes[i].node->removed(*nodes[j].node);
+			nodes[j].node->removed(*nodes[i].node);
+		}
+	}
+	uint64_t leaveMs = waitForConvergence(nodes, remaining, start);
+	size_t leaveBytes;
+	size_t leaveMsgs = metaMsgsSent(nodes, leaveBytes) - msgsBefore;
+	leaveBytes -= bytesBefore;
+
+	printf("%lu,%lu,%lu,%lu,%lu,%lu,%.0f,%lu,%lu,%lu\n",
+	       (unsigned long)nrNodes,
+	       (unsigned long)nrPubSubs,
+	       (unsigned long)joinMs,
+	       (unsigned long)joinMsgs,
+	       (unsigned long)joinBytes,
+	       (unsigned long)memPerNode,
+	       msgsPerSec,
+	       (unsigned long)leaveMs,
+	       (unsigned long)leaveMsgs,
+	       (unsigned long)leaveBytes);
+	fflush(stdout);
+
+	for (size_t i = 0; i < nrNodes; i++) {
+		for (size_t j = 0; j < nrPubSubs; j++) {
+			nodes[i].node->removeSubscriber(nodes[i].subs[j]);
+			nodes[i].node->removePublisher(nodes[i].pubs[j]);
+		}
+		delete nodes[i].node;
+	}
+
+	return joinMs > 0 && leaveMs > 0;
+}
+
+int main(int argc, char** argv) {
+	size_t nrPubSubs = 2;
+	std::vector<size_t> nrNodes;
+
+	// test-zeromq-scalability [-m pubsubs] [nodes ...]
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			nrPubSubs = strTo<size_t>(argv[++i]);
+		} else {
+			nrNodes.push_back(strTo<size_t>(argv[i]));
+		}
+	}
+	if (nrNodes.size() == 0) {
+		// larger meshes need a lot of file descriptors, pass them explicitly
+		size_t defaults[] = { 10, 25, 50, 100 };
+		nrNodes.assign(defaults, defaults + 4);
+	}
+
+	// a full mesh of n nodes has n * (n - 1) connections
+	size_t maxNodes = 0;
+	for (size_t i = 0; i < nrNodes.size(); i++) {
+		if (nrNodes[i] > maxNodes)
+			maxNodes = nrNodes[i];
+	}
+	int maxSockets = maxNodes * (maxNodes + 2 * nrPubSubs + 8);
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	printf("nodes,pubsubs,join_ms,join_msgs,join_bytes,mem_kb_per_node,msgs_per_s,leave_ms,leave_msgs,leave_bytes\n");
+	for (size_t i = 0; i < nrNodes.size(); i++) {
+		if (!simulate(nrNodes[i], nrPubSubs, maxSockets))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,312 @@
+#include "umundo/core.h"
+#include "umundo/connection/shm/ShmRing.h"
+#include <iostream>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define NODE_PORT 42461
+#define PUB_PORT 42462
+#define MSG_SIZE (4 * 1024 * 1024)
+#define NR_MSGS 20
+#define NR_MIXED_MSGS 300
+
+using namespace umundo;
+
+static volatile size_t msgsRcvd = 0;
+static volatile size_t msgsCorrupt = 0;
+
+class PointCloudReceiver : public Receiver {
+	void receive(Message* msg) {
+		if (msg->size() != MSG_SIZE || msg->data()[0] != msg->data()[MSG_SIZE - 1])
+			Atomic::add(&msgsCorrupt, 1);
+		Atomic::add(&msgsRcvd, 1);
+	}
+};
+
+/**
+ * Write and read messages around the end of a ring and get lapped.
+ */
+bool testRing() {
+	ShmRing* writer = ShmRing::create(ShmRing::nameFor(UUID::getUUID()), 100000);
+	assert(writer != NULL);
+	assert(writer->getCapacity() >= 100000);
+	assert(!writer->hasReaders());
+
+	ShmRing* reader = ShmRing::attach(writer->getName());
+	assert(reader != NULL);
+	assert(writer->hasReaders());
+
+	char data[40000];
+	for (int i = 0; i < 100; i++) {
+		memset(data, i, sizeof(data));
+		size_t size = 1000 + i * 300;
+		writer->beginWrite();
+		writer->writeFrame("channel", 8);
+		writer->writeFrame(data, size);
+		writer->commit();
+
+		assert(reader->read());
+		assert(reader->getNrFrames() == 2);
+
+		const char* frame;
+		size_t frameSize;
+		const char* readPtr = reader->getData();
+		const char* end = readPtr + reader->getSize();
+		readPtr = ShmRing::nextFrame(readPtr, end, frame, frameSize);
+		assert(frameSize == 8 && strcmp(frame, "channel") == 0);
+		readPtr = ShmRing::nextFrame(readPtr, end, frame, frameSize);
+		assert(frameSize == size);
+		assert(frame[0] == (char)i && frame[size - 1] == (char)i);
+		assert(ShmRing::nextFrame(readPtr, end, frame, frameSize) == NULL);
+		assert(!reader->read());
+	}
+	assert(writer->getMessagesWritten() == 100);
+	assert(writer->getFramesWritten() == 200);
+	assert(reader->getFramesWritten() == 200);
+	assert(reader->getMessagesRead() == 100);
+
+	// a reader that falls behind loses messages but never sees garbage
+	for (int i = 0; i < 10; i++) {
+		writer->beginWrite();
+		writer->writeFrame(data, sizeof(data));
+		writer->commit();
+	}
+	while(reader->read()) {}
+	assert(reader->getOverruns() == 1);
+
+	// messages larger than the ring are dropped
+	char* tooLarge = (char*)malloc(writer->getCapacity());
+	writer->beginWrite();
+	assert(!writer->writeFrame(tooLarge, writer->getCapacity()));
+	writer->commit();
+	assert(!reader->read());
+	free(tooLarge);
+
+	delete reader;
+	assert(!writer->hasReaders());
+
+	// a reader that crashes gives up its slot eventually
+	pid_t pid = fork();
+	if (pid == 0) {
+		ShmRing::attach(writer->getName());
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+	assert(writer->hasReaders());
+	uint64_t start = Thread::getMonotonicMs();
+	while(writer->hasReaders() && Thread::getMonotonicMs() - start < 2 * UMUNDO_SHM_RING_READER_TIMEOUT_MS)
+		Thread::sleepMs(50);
+	assert(!writer->hasReaders());
+	assert(Thread::getMonotonicMs() - start >= UMUNDO_SHM_RING_READER_TIMEOUT_MS - 100);
+
+	std::string name = writer->getName();
+	delete writer;
+	assert(ShmRing::attach(name) == NULL);
+	return true;
+}
+
+/**
+ * Rings of writers that crashed are removed by the next one to start.
+ */
+bool testStaleRing() {
+	std::string name = ShmRing::nameFor(UUID::getUUID());
+	pid_t pid = fork();
+	if (pid == 0) {
+		ShmRing::create(name, 4096);
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+
+	ShmRing* reader = ShmRing::attach(name);
+	assert(reader != NULL);
+	delete reader;
+
+	ShmRing* other = ShmRing::create(ShmRing::nameFor(UUID::getUUID()), 4096);
+	ShmRing::removeStale();
+#ifdef __linux__
+	assert(ShmRing::attach(name) == NULL);
+	assert((reader = ShmRing::attach(other->getName())) != NULL);
+	delete reader;
+#endif
+	shm_unlink(name.c_str()); // elsewhere we cannot find them
+	delete other;
+	return true;
+}
+
+/**
+ * Have a node in another process publish large messages to us.
+ */
+bool testSameHostNodes() {
+	// fork before we have a 0MQ context
+	pid_t pid = fork();
+	if (pid == 0) {
+		Node otherNode(NODE_PORT, PUB_PORT);
+		Publisher pub("pointclouds");
+		otherNode.addPublisher(pub);
+		pub.waitForSubscribers(1);
+
+		char* data = (char*)malloc(MSG_SIZE);
+		for (int i = 0; i < NR_MSGS; i++) {
+			memset(data, i, MSG_SIZE);
+			Message* msg = new Message(data, MSG_SIZE);
+			pub.send(msg);
+			delete msg;
+			Thread::sleepMs(20);
+		}
+		free(data);
+		while(true)
+			Thread::sleepMs(1000);
+	}
+
+	Node node;
+	PointCloudReceiver* recv = new PointCloudReceiver();
+	Subscriber sub("pointclouds", recv);
+	node.addSubscriber(sub);
+
+	node.added(EndPoint("tcp://127.0.0.1:" + toStr(NODE_PORT)));
+
+	int retries = 50;
+	while(node.connectedTo().size() == 0 && retries-- > 0)
+		Thread::sleepMs(100);
+	assert(node.connectedTo().size() == 1);
+
+	// the other node offers its publications in shared memory
+	std::string ringName = ShmRing::nameFor(node.connectedTo().begin()->first);
+	ShmRing* ring = ShmRing::attach(ringName);
+	assert(ring != NULL);
+	delete ring;
+
+	retries = 100;
+	while(Atomic::load(&msgsRcvd) < NR_MSGS && retries-- > 0)
+		Thread::sleepMs(100);
+
+	// and we received them from there
+	ring = ShmRing::attach(ringName);
+	assert(ring != NULL);
+	size_t messagesWritten = ring->getMessagesWritten();
+	size_t framesWritten = ring->getFramesWritten();
+	delete ring;
+
+	std::cout << "received " << msgsRcvd << " of " << NR_MSGS << " messages with " << msgsCorrupt << " corrupt, "
+	          << messagesWritten << " messages with " << framesWritten << " frames in shared memory" << std::endl;
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	// the killed node could not unlink its ring
+	ShmRing::removeStale();
+#ifdef __linux__
+	assert(ShmRing::attach(ringName) == NULL);
+#endif
+	shm_unlink(ringName.c_str());
+
+	assert(msgsRcvd == NR_MSGS);
+	assert(msgsCorrupt == 0);
+	assert(messagesWritten >= NR_MSGS);
+	assert(framesWritten >= 2 * NR_MSGS);
+
+	node.removeSubscriber(sub);
+	return true;
+}
+
+static Mutex mixedMutex;
+static std::vector<std::string> mixedRcvd; ///< seq of every message in the order we received them
+
+class MixedReceiver : public Receiver {
+	void receive(Message* msg) {
+		ScopeLock lock(mixedMutex);
+		mixedRcvd.push_back(msg->getMeta("seq"));
+	}
+};
+
+class MixedGreeter : public Greeter {
+public:
+	std::string subUUID;
+	void welcome(const Publisher& pub, const SubscriberStub& subStub) {
+		subUUID = subStub.getUUID();
+	}
+	void farewell(const Publisher& pub, const SubscriberStub& subStub) {}
+};
+
+/**
+ * Have a node in another process interleave publications with explicitly addressed messages.
+ */
+bool testExplicitOrder() {
+	pid_t pid = fork();
+	if (pid == 0) {
+		Node otherNode(NODE_PORT + 2, PUB_PORT + 2);
+		MixedGreeter* greeter = new MixedGreeter();
+		Publisher pub("mixed", greeter);
+		otherNode.addPublisher(pub);
+		pub.waitForSubscribers(1);
+
+		for (int i = 0; i < NR_MIXED_MSGS; i++) {
+			Message* msg = new Message("foo", 3);
+			msg->putMeta("seq", toStr(i));
+			if (i % 3 == 2)
+				msg->putMeta("um.sub", greeter->subUUID);
+			pub.send(msg);
+			delete msg;
+		}
+		while(true)
+			Thread::sleepMs(1000);
+	}
+
+	Node node;
+	MixedReceiver* recv = new MixedReceiver();
+	Subscriber sub("mixed", recv);
+	node.addSubscriber(sub);
+
+	node.added(EndPoint("tcp://127.0.0.1:" + toStr(NODE_PORT + 2)));
+
+	int retries = 50;
+	while(node.connectedTo().size() == 0 && retries-- > 0)
+		Thread::sleepMs(100);
+	assert(node.connectedTo().size() == 1);
+	std::string ringName = ShmRing::nameFor(node.connectedTo().begin()->first);
+
+	retries = 100;
+	while(retries-- > 0) {
+		Thread::sleepMs(50);
+		ScopeLock lock(mixedMutex);
+		if (mixedRcvd.size() >= NR_MIXED_MSGS)
+			break;
+	}
+
+	ShmRing* ring = ShmRing::attach(ringName);
+	assert(ring != NULL);
+	size_t messagesWritten = ring->getMessagesWritten();
+	delete ring;
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	ShmRing::removeStale();
+	shm_unlink(ringName.c_str());
+
+	// explicitly addressed messages went through the ring as well and overtook nothing
+	ScopeLock lock(mixedMutex);
+	std::cout << "received " << mixedRcvd.size() << " of " << NR_MIXED_MSGS << " mixed messages, "
+	          << messagesWritten << " messages in shared memory" << std::endl;
+	assert(mixedRcvd.size() == NR_MIXED_MSGS);
+	for (int i = 0; i < NR_MIXED_MSGS; i++) {
+		assert(mixedRcvd[i] == toStr(i));
+	}
+	assert(messagesWritten >= NR_MIXED_MSGS);
+
+	node.removeSubscriber(sub);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (!testRing())
+		return EXIT_FAILURE;
+	if (!testStaleRing())
+		return EXIT_FAILURE;
+	if (!testSameHostNodes())
+		return EXIT_FAILURE;
+	if (!testExplicitOrder())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}